@@ -11,6 +11,8 @@ import Foundation
 /// For managing code paths that are under development. These development featues are turned off by default because they can affect performance.
 public struct AKCapabilities {
     public static let ImageBasedLighting = false
+    public static let CameraEnvironmentCapture = false
+    public static let CameraExposure = false
     public static let SubsurfaceMap = false
     public static let AmbientOcclusionMap = true
     public static let EmissionMap = true
@@ -26,4 +28,6 @@ public struct AKCapabilities {
     public static let ClearcoatGlossMap = false
     public static let EnvironmentMap = true
     public static let LevelOfDetail = true
+    public static let OcclusionCulling = true
+    public static let FilteredShadows = true
 }
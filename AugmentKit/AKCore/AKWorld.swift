@@ -316,6 +316,13 @@ open class AKWorld: NSObject {
         
     }
     
+    /**
+    The virtual content the user is looking at, the closest rendered geometry that a vector from the center of the device intersects. Unlike `currentGazeLocation`, which only considers detected surfaces, the triangles of every augmented anchor, tracker, target and path are tested. Gaze targets are ignored.
+    */
+    public var currentGazeVirtualContentHit: VirtualContentHit? {
+        return renderer.currentGazeVirtualContentHit
+    }
+    
     /**
     The lowest horizontal surface anchor which is assumed to be ground. If no horizontal surfaces have been detected, this returns a horizontal surface 3m below the current device position.
     */
@@ -457,8 +464,19 @@ open class AKWorld: NSObject {
         NotificationCenter.default.removeObserver(self)
     }
     
+    // MARK: Updating entities
+
+    /**
+     Runs `updates` while holding the lock that the renderer captures entity state under. Use this when changing the location, heading or effects of entities that have already been added to the AR world from a thread other than the main thread.
+     - Parameters:
+        - updates: Changes to the entities being rendered
+     */
+    public func performEntityUpdates(_ updates: () -> Void) {
+        renderer.performEntityUpdates(updates)
+    }
+
     // MARK: Adding and removing anchors
-    
+
     /**
      Add a new `AKAugmentedAnchor` to the AR world. The `AKSesstionType` must be set to `.worldTracking` or `.worldTrackingWithFaceDetection`
      - Parameters:
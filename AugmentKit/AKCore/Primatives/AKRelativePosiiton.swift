@@ -85,8 +85,38 @@ open class AKRelativePosition {
             if parentPosition.transformHasChanged  {
                 parentPosition.updateTransforms()
             }
-            referenceTransform = parentPosition.referenceTransform * matrix_identity_float4x4.translate(x: parentPosition.transform.columns.3.x, y: parentPosition.transform.columns.3.y, z: parentPosition.transform.columns.3.z)
+            referenceTransform = AKRelativePosition.referenceTransform(forParentReferenceTransform: parentPosition.referenceTransform, parentTransform: parentPosition.transform)
         }
+        updateHeading()
+        _transformHasChanged = false
+        _headingHasChanged = false
+    }
+    
+    // MARK: Internal
+    
+    /// The reference transform of a child of a parent with the provided transforms. Only the translation of the parent is inherited so this is a translation, not a full matrix multiply.
+    static func referenceTransform(forParentReferenceTransform parentReferenceTransform: matrix_float4x4, parentTransform: matrix_float4x4) -> matrix_float4x4 {
+        var referenceTransform = parentReferenceTransform
+        referenceTransform.columns.3 += parentReferenceTransform.columns.0 * parentTransform.columns.3.x + parentReferenceTransform.columns.1 * parentTransform.columns.3.y + parentReferenceTransform.columns.2 * parentTransform.columns.3.z
+        return referenceTransform
+    }
+    
+    /// Used by `AKRelativePositionHierarchy` to store a reference transform that has already been resolved and mark this object as current.
+    func applyResolvedReferenceTransform(_ resolvedReferenceTransform: matrix_float4x4?) {
+        if let resolvedReferenceTransform = resolvedReferenceTransform {
+            referenceTransform = resolvedReferenceTransform
+        }
+        updateHeading()
+        _transformHasChanged = false
+        _headingHasChanged = false
+    }
+    
+    // MARK: Private
+    
+    private var _transformHasChanged = false
+    private var _headingHasChanged = false
+    
+    private func updateHeading() {
         
         if let heading = heading {
             
@@ -97,36 +127,12 @@ open class AKRelativePosition {
                 self.heading = mutableHeading
             }
             
-            // Removing because this work is being done in the Precalculation Shader
-//            if (_transformHasChanged || _headingHasChanged) {
-//
-//                // Heading
-//                var newTransform = mutableHeading.offsetRotation.quaternion.toMatrix4()
-//
-//                if mutableHeading.type == .absolute {
-//                    // FIXME: This transform calculation is incorrect when headingType = .absolute. It is naive to assume that transform.columns.0.x, transform.columns.1.y, and transform.columns.2.z have no rotational components
-//                    newTransform = newTransform * float4x4(
-//                        SIMD4<Float>(transform.columns.0.x, 0, 0, 0),
-//                        SIMD4<Float>(0, transform.columns.1.y, 0, 0),
-//                        SIMD4<Float>(0, 0, transform.columns.2.z, 0),
-//                        SIMD4<Float>(transform.columns.3.x, transform.columns.3.y, transform.columns.3.z, 1)
-//                    )
-//                    transform = newTransform
-//                } else if mutableHeading.type == .relative {
-//                    transform = transform * newTransform
-//                }
-//            }
+            // The heading is combined with the transform in the Precalculation Shader (see `composeLocationAndHeading`). Absolute headings replace only the rotational part of the transform's polar decomposition (see `AffineDecomposition`) so scale is preserved even when the transform carries rotation.
             
         }
-        _transformHasChanged = false
-        _headingHasChanged = false
+        
     }
     
-    // MARK: Private
-    
-    private var _transformHasChanged = false
-    private var _headingHasChanged = false
-    
 }
 
 extension AKRelativePosition: CustomStringConvertible, CustomDebugStringConvertible {
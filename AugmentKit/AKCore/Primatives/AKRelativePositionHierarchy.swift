@@ -0,0 +1,162 @@
+//
+//  AKRelativePositionHierarchy.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - AKRelativePositionHierarchy
+
+/**
+ Updates a set of `AKRelativePosition` objects and all of their ancestors in a single linear pass.
+ 
+ Calling `updateTransforms()` on each position walks up the `parentPosition` chain for every position, so positions that share ancestors re-resolve the shared part of the chain once per descendant. This object instead flattens all of the positions into a contiguous array sorted so that every parent comes before its children, with the parent of each node stored as an index. Reference transforms are then resolved in one sweep over the array, making the cost O(N) in the number of distinct positions regardless of how deep the chains are.
+ 
+ The flattened order is cached and only rebuilt when the set of positions or any `parentPosition` link changes.
+ */
+final class AKRelativePositionHierarchy {
+    
+    /// The number of distinct positions, including ancestors, in the flattened hierarchy
+    var count: Int {
+        return nodes.count
+    }
+    
+    /**
+     Brings every position in `positions`, and all of their ancestors, up to date.
+     - Parameters:
+        - positions: The positions to update. Ancestors do not need to be included.
+     */
+    func update(_ positions: [AKRelativePosition]) {
+        
+        if needsRebuild(for: positions) {
+            rebuild(with: positions)
+        }
+        
+        // Resolve every reference transform. Because parents always come before their children, every parent has been resolved by the time its children are visited. Every node is resolved, not only the ones flagged as changed, because a parent's transform may have been changed through another path (another hierarchy or a direct call to `updateTransforms()`) that has already cleared its flags. Resolving a node costs one translation so this stays cheap.
+        for index in 0..<nodes.count {
+            let node = nodes[index]
+            let parentIndex = parentIndices[index]
+            if parentIndex != AKRelativePositionHierarchy.noParent {
+                let parent = nodes[parentIndex]
+                node.applyResolvedReferenceTransform(AKRelativePosition.referenceTransform(forParentReferenceTransform: parent.referenceTransform, parentTransform: parent.transform))
+            } else {
+                node.applyResolvedReferenceTransform(nil)
+            }
+        }
+    
+    }
+    
+    // MARK: - Private
+    
+    fileprivate static let noParent = -1
+    
+    // The positions that were passed in to the last `update(_:)` call
+    fileprivate var leaves = [AKRelativePosition]()
+    // All positions sorted parents first
+    fileprivate var nodes = [AKRelativePosition]()
+    // The index in `nodes` of the parent of each node or `noParent`
+    fileprivate var parentIndices = [Int]()
+    // Nodes whose `parentPosition` link was dropped to break a cycle. Their link is expected to differ from `parentIndices`.
+    fileprivate var brokenLinks = Set<Int>()
+    // `true` once the current cycle has been reported so that it is not reported again every time the hierarchy is rebuilt
+    fileprivate var hasReportedCycle = false
+    
+    fileprivate func needsRebuild(for positions: [AKRelativePosition]) -> Bool {
+        
+        guard positions.count == leaves.count else {
+            return true
+        }
+        for index in 0..<positions.count where positions[index] !== leaves[index] {
+            return true
+        }
+        for index in 0..<nodes.count {
+            let parentIndex = parentIndices[index]
+            let parent = nodes[index].parentPosition
+            if parentIndex == AKRelativePositionHierarchy.noParent {
+                if parent != nil && !brokenLinks.contains(index) {
+                    return true
+                }
+            } else if parent !== nodes[parentIndex] {
+                return true
+            }
+        }
+        return false
+    
+    }
+    
+    fileprivate func rebuild(with positions: [AKRelativePosition]) {
+        
+        leaves = positions
+        nodes.removeAll(keepingCapacity: true)
+        parentIndices.removeAll(keepingCapacity: true)
+        brokenLinks.removeAll(keepingCapacity: true)
+        
+        var indexByObject = [ObjectIdentifier: Int]()
+        var chain = [AKRelativePosition]()
+        var foundCycle = false
+        
+        for position in positions {
+            
+            // Walk up until reaching a position that is already indexed (or the root)
+            chain.removeAll(keepingCapacity: true)
+            var chainObjects = Set<ObjectIdentifier>()
+            var current: AKRelativePosition? = position
+            while let aPosition = current, indexByObject[ObjectIdentifier(aPosition)] == nil {
+                guard chainObjects.insert(ObjectIdentifier(aPosition)).inserted else {
+                    foundCycle = true
+                    break
+                }
+                chain.append(aPosition)
+                current = aPosition.parentPosition
+            }
+            
+            // Append root first so parents precede children
+            for aPosition in chain.reversed() {
+                let parentIndex: Int = {
+                    if let parent = aPosition.parentPosition, let index = indexByObject[ObjectIdentifier(parent)] {
+                        return index
+                    } else {
+                        return AKRelativePositionHierarchy.noParent
+                    }
+                }()
+                if parentIndex == AKRelativePositionHierarchy.noParent && aPosition.parentPosition != nil {
+                    brokenLinks.insert(nodes.count)
+                }
+                indexByObject[ObjectIdentifier(aPosition)] = nodes.count
+                nodes.append(aPosition)
+                parentIndices.append(parentIndex)
+            }
+        
+        }
+        
+        if foundCycle && !hasReportedCycle {
+            print("Warning (AKRelativePositionHierarchy) - Found a cycle in the parentPosition chain. The cycle will be broken.")
+        }
+        hasReportedCycle = foundCycle
+    
+    }
+
+}
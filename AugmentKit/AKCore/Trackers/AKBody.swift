@@ -35,4 +35,10 @@ public protocol AKBody: AKTracker {
     
     /// The transform of each joint relative to the transform of the the hip joint. The hip joint is the root of the skeleton and is located at the model origin.
     var jointTransforms: [matrix_float4x4] { get }
+    
+    /// The index of each joint's parent in `jointNames` or `nil` for the root joint
+    var jointParentIndices: [Int?] { get }
+    
+    /// The transform of each joint, relative to the hip joint, when the body is in its neutral pose. `jointTransforms` is compared against this pose when retargeting the body on to a model's skeleton. Empty if the neutral pose is not known.
+    var referenceJointTransforms: [matrix_float4x4] { get }
 }
@@ -76,6 +76,12 @@ open class RealBody: AKBody {
     /// The transform of each joint relative to the transform of the the hip joint. The hip joint is the root of the skeleton and is located at the model origin.
     public var jointTransforms: [matrix_float4x4] = []
     
+    /// The index of each joint's parent in `jointNames` or `nil` for the root joint
+    public var jointParentIndices: [Int?] = []
+    
+    /// The transform of each joint, relative to the hip joint, when the body is in its neutral pose
+    public var referenceJointTransforms: [matrix_float4x4] = []
+    
     /// When `true` this object has a parent `ARBodyAnchor`. If this is `false` it will not be rendered.
     public var isAnchored: Bool {
         position.parentPosition != nil
@@ -92,7 +98,7 @@ open class RealBody: AKBody {
         self.position = myPosition
     }
     
-    /// Updates the transform of the parent transform as well as updating the joint transforms. The `jointTransforms`, `localJointTransforms`, and `jointNames` will be overwritten provided by the `ARBodyAnchor`'s `skeleton` property.
+    /// Updates the transform of the parent transform as well as updating the joint transforms. The `jointNames`, `jointParentIndices` and `referenceJointTransforms` are only replaced when the skeleton definition of the `ARBodyAnchor` changes. `jointTransforms` is updated in place every frame.
     /// - Parameter bodyAnchor: An `ARBodyAnchor` that was detected by ARKit.
     public func update(with bodyAnchor: ARBodyAnchor?) {
         
@@ -101,28 +107,41 @@ open class RealBody: AKBody {
             return
         }
         identifier = bodyAnchor.identifier
-        jointNames = bodyAnchor.skeleton.definition.jointNames
+        let skeleton = bodyAnchor.skeleton
+        if skeleton.definition !== skeletonDefinition {
+            updateJointTable(from: skeleton.definition)
+        }
         if position.parentPosition == nil {
             position.parentPosition = AKRelativePosition(withTransform: bodyAnchor.transform)
         } else {
             position.parentPosition?.transform = bodyAnchor.transform
         }
-        jointTransforms = generateJointTransforms(from: bodyAnchor.skeleton)
+        updateJointTransforms(from: skeleton)
     }
     
     // MARK: - Private
     
-    /// Generates an array of joint transforms where the indexes of the transfors of the join are guaranteed to be the same index as the name of the join in `joinNames`
-    private func generateJointTransforms(from skeleton: ARSkeleton3D) -> [matrix_float4x4] {
-        let returnTransforms: [matrix_float4x4] = skeleton.definition.jointNames.compactMap {
-            let aJoint = ARSkeleton.JointName(rawValue: $0)
-            if let aTransform = skeleton.modelTransform(for: aJoint) {
-                return aTransform
-            } else {
-                return nil
+    /// The skeleton definition that `jointNames`, `jointParentIndices` and `referenceJointTransforms` were built from
+    private var skeletonDefinition: ARSkeletonDefinition?
+    
+    /// Rebuilds the joint table. The indexes of the joints match the indexes of `ARSkeleton3D.jointModelTransforms` so the transforms can be copied without looking up joints by name.
+    private func updateJointTable(from definition: ARSkeletonDefinition) {
+        skeletonDefinition = definition
+        jointNames = definition.jointNames
+        jointParentIndices = definition.parentIndices.map { $0 < 0 ? nil : $0 }
+        referenceJointTransforms = definition.neutralBodySkeleton3D?.jointModelTransforms ?? []
+        jointTransforms = Array(repeating: matrix_identity_float4x4, count: jointNames.count)
+    }
+    
+    /// Copies the joint transforms of `skeleton` into `jointTransforms`. Joints that are not tracked directly are inferred by ARKit so every index has a transform and the indexes always line up with `jointNames`.
+    private func updateJointTransforms(from skeleton: ARSkeleton3D) {
+        let modelTransforms = skeleton.jointModelTransforms
+        let count = min(modelTransforms.count, jointTransforms.count)
+        jointTransforms.withUnsafeMutableBufferPointer { destination in
+            for index in 0..<count {
+                destination[index] = modelTransforms[index]
             }
         }
-        return returnTransforms
     }
 }
 
@@ -134,7 +153,7 @@ extension RealBody: CustomStringConvertible, CustomDebugStringConvertible {
     }
     /// :nodoc:
     public var debugDescription: String {
-        let myDescription = "<RealBody: \(Unmanaged.passUnretained(self).toOpaque())> type: \(RealBody.type), identifier: \(identifier?.debugDescription ?? "None"), position: \(position), asset: \(asset), effects: \(effects.debugDescription), shaderPreference: \(shaderPreference), generatesShadows: \(generatesShadows), needsColorTextureUpdate: \(needsColorTextureUpdate), needsMeshUpdate: \(needsMeshUpdate), jointNames: \(jointNames), jointTransforms: \(jointTransforms), isAnchored: \(isAnchored)"
+        let myDescription = "<RealBody: \(Unmanaged.passUnretained(self).toOpaque())> type: \(RealBody.type), identifier: \(identifier?.debugDescription ?? "None"), position: \(position), asset: \(asset), effects: \(effects.debugDescription), shaderPreference: \(shaderPreference), generatesShadows: \(generatesShadows), needsColorTextureUpdate: \(needsColorTextureUpdate), needsMeshUpdate: \(needsMeshUpdate), jointNames: \(jointNames), jointParentIndices: \(jointParentIndices), jointTransforms: \(jointTransforms), isAnchored: \(isAnchored)"
         return myDescription
     }
     
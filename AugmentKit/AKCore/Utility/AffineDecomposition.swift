@@ -0,0 +1,191 @@
+//
+//  AffineDecomposition.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - AffineDecomposition
+
+/**
+ Splits an affine transform into translation, rotation and stretch using a polar decomposition, `M = T * R * S`, where `R` is a proper rotation and `S` is symmetric. The diagonal of `S` is the scale and any off diagonal terms are shear.
+ 
+ Unlike reading the scale from `columns.0.x`, `columns.1.y` and `columns.2.z`, this is correct for transforms that carry rotation. Mirrored transforms (negative determinant) keep a proper rotation in `R` and carry the reflection in `S`. Near degenerate transforms, where a polar decomposition is ill conditioned, fall back to orthonormalizing the columns.
+ 
+ The same algorithm is implemented for shaders as `polarDecomposition` in Common.metal.
+ */
+public struct AffineDecomposition {
+    
+    /// The translation component
+    public var translation: SIMD3<Float>
+    /// The rotation component. Always a proper rotation (determinant of +1).
+    public var rotationMatrix: float3x3
+    /// The symmetric stretch component. Contains scale on the diagonal and shear off the diagonal. Negative when the transform is mirrored.
+    public var stretch: float3x3
+    /// `true` when the transform has a negative determinant
+    public var isMirrored: Bool
+    /// `true` when the transform is too close to singular to decompose reliably. `rotationMatrix` is then built from the orthonormalized columns.
+    public var isDegenerate: Bool
+    
+    /// The rotation component as a quaternion
+    public var rotation: simd_quatf {
+        return simd_quatf(rotationMatrix)
+    }
+    
+    /// The per axis scale. This is the diagonal of `stretch`.
+    public var scale: SIMD3<Float> {
+        return SIMD3<Float>(stretch.columns.0.x, stretch.columns.1.y, stretch.columns.2.z)
+    }
+    
+    /// `true` when `stretch` has off diagonal terms larger than `AffineDecomposition.shearTolerance` relative to the scale
+    public var hasShear: Bool {
+        let offDiagonal = SIMD3<Float>(stretch.columns.1.x, stretch.columns.2.x, stretch.columns.2.y)
+        let largestScale = max(abs(scale.x), max(abs(scale.y), abs(scale.z)))
+        return simd_reduce_max(abs(offDiagonal)) > AffineDecomposition.shearTolerance * max(largestScale, Float.leastNormalMagnitude)
+    }
+    
+    /// Relative tolerance used by `hasShear`
+    public static let shearTolerance: Float = 1.0e-4
+    /// Transforms whose determinant has a magnitude below this fraction of the cube of their Frobenius norm are treated as degenerate. Being relative, the test does not depend on the overall scale of the transform.
+    public static let degenerateDeterminantRatio: Float = 1.0e-6
+    
+    /**
+     Decomposes an affine transform. The bottom row of `transform` is ignored.
+     - Parameters:
+        - transform: The transform to decompose
+     */
+    public init(_ transform: float4x4) {
+        
+        translation = SIMD3<Float>(transform.columns.3.x, transform.columns.3.y, transform.columns.3.z)
+        let upperLeft = float3x3(SIMD3<Float>(transform.columns.0.x, transform.columns.0.y, transform.columns.0.z), SIMD3<Float>(transform.columns.1.x, transform.columns.1.y, transform.columns.1.z), SIMD3<Float>(transform.columns.2.x, transform.columns.2.y, transform.columns.2.z))
+        let determinant = upperLeft.determinant
+        isMirrored = determinant < 0
+        isDegenerate = AffineDecomposition.isDegenerate(upperLeft)
+        
+        let sign: Float = isMirrored ? -1 : 1
+        if isDegenerate {
+            rotationMatrix = AffineDecomposition.orthonormalized(upperLeft * sign)
+        } else {
+            rotationMatrix = AffineDecomposition.polarRotation(upperLeft * sign)
+        }
+        stretch = rotationMatrix.transpose * upperLeft
+    
+    }
+    
+    /// Rebuilds the transform, `T * R * S`
+    public func recomposed() -> float4x4 {
+        return recomposed(withRotation: rotationMatrix)
+    }
+    
+    /// Rebuilds the transform with a different rotation, keeping the translation and stretch. Used to apply an absolute heading without disturbing the scale, shear or reflection of a transform.
+    public func recomposed(withRotation rotation: float3x3) -> float4x4 {
+        let upperLeft = rotation * stretch
+        return float4x4(
+            SIMD4<Float>(upperLeft.columns.0, 0),
+            SIMD4<Float>(upperLeft.columns.1, 0),
+            SIMD4<Float>(upperLeft.columns.2, 0),
+            SIMD4<Float>(translation, 1)
+        )
+    }
+    
+    /// `true` when `matrix` is too close to singular to decompose reliably. See `degenerateDeterminantRatio`.
+    public static func isDegenerate(_ matrix: float3x3) -> Bool {
+        let norm = frobeniusNorm(matrix)
+        return abs(matrix.determinant) < degenerateDeterminantRatio * norm * norm * norm
+    }
+    
+    // MARK: Reference
+    
+    /// A double precision polar decomposition of a 3x3 matrix. Intended as a reference when measuring the error of the single precision paths.
+    public static func polarDecompositionReference(_ matrix: double3x3) -> (rotation: double3x3, stretch: double3x3) {
+        let sign: Double = matrix.determinant < 0 ? -1 : 1
+        var rotation = matrix * sign
+        for _ in 0..<64 {
+            let inverseTranspose = rotation.inverse.transpose
+            let gamma = (frobeniusNorm(inverseTranspose) / frobeniusNorm(rotation)).squareRoot()
+            let next = (rotation * gamma + inverseTranspose * (1 / gamma)) * 0.5
+            let difference = frobeniusNorm(next - rotation)
+            rotation = next
+            if difference < 1.0e-15 {
+                break
+            }
+        }
+        return (rotation: rotation, stretch: rotation.transpose * matrix)
+    }
+    
+    // MARK: - Private
+    
+    fileprivate static let maxIterations = 10
+    fileprivate static let convergenceTolerance: Float = 1.0e-6
+    
+    // Scaled Newton iteration, R = (γR + R⁻ᵀ/γ) / 2, which converges quadratically to the orthogonal polar factor. Expects a positive determinant.
+    fileprivate static func polarRotation(_ matrix: float3x3) -> float3x3 {
+        var rotation = matrix
+        for _ in 0..<maxIterations {
+            let inverseTranspose = rotation.inverse.transpose
+            let gamma = (frobeniusNorm(inverseTranspose) / frobeniusNorm(rotation)).squareRoot()
+            let next = (rotation * gamma + inverseTranspose * (1 / gamma)) * 0.5
+            let difference = frobeniusNorm(next - rotation)
+            rotation = next
+            if difference < convergenceTolerance {
+                break
+            }
+        }
+        return rotation
+    }
+    
+    // Gram-Schmidt with fallbacks for columns that have collapsed to zero or become parallel
+    fileprivate static func orthonormalized(_ matrix: float3x3) -> float3x3 {
+        
+        let epsilon: Float = 1.0e-12
+        var x = matrix.columns.0
+        if length_squared(x) < epsilon {
+            x = SIMD3<Float>(1, 0, 0)
+        }
+        x = normalize(x)
+        
+        var y = matrix.columns.1 - dot(matrix.columns.1, x) * x
+        if length_squared(y) < epsilon {
+            // Pick the world axis least aligned with x
+            let axis = abs(x.y) < 0.9 ? SIMD3<Float>(0, 1, 0) : SIMD3<Float>(0, 0, 1)
+            y = axis - dot(axis, x) * x
+        }
+        y = normalize(y)
+        
+        let z = cross(x, y)
+        return float3x3(x, y, z)
+    
+    }
+    
+    fileprivate static func frobeniusNorm(_ matrix: float3x3) -> Float {
+        return (length_squared(matrix.columns.0) + length_squared(matrix.columns.1) + length_squared(matrix.columns.2)).squareRoot()
+    }
+    
+    fileprivate static func frobeniusNorm(_ matrix: double3x3) -> Double {
+        return (length_squared(matrix.columns.0) + length_squared(matrix.columns.1) + length_squared(matrix.columns.2)).squareRoot()
+    }
+
+}
@@ -55,6 +55,8 @@ public struct DrawSubData {
      */
     var indexType = MTLIndexType.uint16
     var indexBuffer: MTLBuffer?
+    /// The offset, in bytes, into `indexBuffer` where the submesh’s indices begin
+    var indexBufferOffset = 0
     var baseColorTexture: MTLTexture?
     var normalTexture: MTLTexture?
     var ambientOcclusionTexture: MTLTexture?
@@ -72,6 +74,8 @@ public struct DrawSubData {
     
     var materialUniforms = MaterialUniforms()
     var materialBuffer: MTLBuffer?
+    /// The interned material the textures and uniforms were read from. Submeshes with the same material content share the same instance, and holding it keeps the material alive in `MaterialTable`. `material?.identifier` can be used to sort draws by material.
+    var material: MaterialProperties?
     
     public mutating func updateMaterialTextures(from mdlMaterial: MDLMaterial, textureBundle: Bundle? = nil, textureLoader: MTKTextureLoader? = nil) {
         
@@ -79,6 +83,7 @@ public struct DrawSubData {
         
         let myMaterialProperties = ModelIOTools.materialProperties(from: mdlMaterial, textureLoader: textureLoader, bundle: textureBundle)
         let allProperties = myMaterialProperties.properties
+        self.material = myMaterialProperties
         
         // Encode the texture indexes corresponding to the texture maps. If a property has no texture map this value will be nil
         baseColorTexture = allProperties[.baseColor]?.texture
@@ -156,40 +161,19 @@ public struct DrawSubData {
         
     }
     
-    public func markTexturesAsVolitile() {
-        
-        baseColorTexture?.setPurgeableState(.volatile)
-        normalTexture?.setPurgeableState(.volatile)
-        ambientOcclusionTexture?.setPurgeableState(.volatile)
-        metallicTexture?.setPurgeableState(.volatile)
-        roughnessTexture?.setPurgeableState(.volatile)
-        emissionTexture?.setPurgeableState(.volatile)
-        subsurfaceTexture?.setPurgeableState(.volatile)
-        specularTexture?.setPurgeableState(.volatile)
-        specularTintTexture?.setPurgeableState(.volatile)
-        anisotropicTexture?.setPurgeableState(.volatile)
-        sheenTexture?.setPurgeableState(.volatile)
-        sheenTintTexture?.setPurgeableState(.volatile)
-        clearcoatTexture?.setPurgeableState(.volatile)
-        clearcoatGlossTexture?.setPurgeableState(.volatile)
+    /// The textures the submesh samples
+    var textures: [MTLTexture] {
+        let slotTextures: [MTLTexture?] = [baseColorTexture, normalTexture, ambientOcclusionTexture, metallicTexture, roughnessTexture, emissionTexture, subsurfaceTexture, specularTexture, specularTintTexture, anisotropicTexture, sheenTexture, sheenTintTexture, clearcoatTexture, clearcoatGlossTexture]
+        return slotTextures.compactMap { $0 }
+    }
+    
+    /// Marks the textures as volatile so the system can reclaim their memory. Textures interned by `MaterialTable` are shared between submeshes, so any texture in `texturesInUse` is left alone.
+    public func markTexturesAsVolitile(keeping texturesInUse: Set<ObjectIdentifier> = []) {
+        textures.filter { !texturesInUse.contains(ObjectIdentifier($0)) }.forEach { $0.setPurgeableState(.volatile) }
     }
     
     public func markTexturesAsNonVolitile() {
-        
-        baseColorTexture?.setPurgeableState(.nonVolatile)
-        normalTexture?.setPurgeableState(.nonVolatile)
-        ambientOcclusionTexture?.setPurgeableState(.nonVolatile)
-        metallicTexture?.setPurgeableState(.nonVolatile)
-        roughnessTexture?.setPurgeableState(.nonVolatile)
-        emissionTexture?.setPurgeableState(.nonVolatile)
-        subsurfaceTexture?.setPurgeableState(.nonVolatile)
-        specularTexture?.setPurgeableState(.nonVolatile)
-        specularTintTexture?.setPurgeableState(.nonVolatile)
-        anisotropicTexture?.setPurgeableState(.nonVolatile)
-        sheenTexture?.setPurgeableState(.nonVolatile)
-        sheenTintTexture?.setPurgeableState(.nonVolatile)
-        clearcoatTexture?.setPurgeableState(.nonVolatile)
-        clearcoatGlossTexture?.setPurgeableState(.nonVolatile)
+        textures.forEach { $0.setPurgeableState(.nonVolatile) }
     }
 
     static func mapTextureBindPoint(to textureIndex: TextureIndices) -> FunctionConstantIndices {
@@ -238,11 +222,17 @@ public struct DrawData {
     var vertexBuffers = [MTLBuffer]()
     /// A buffer contining `RawVertexBuffer` uniforms. If this buffer is populated, it will be used instead of `vertexBuffers`
     var rawVertexBuffers = [MTLBuffer]()
+    /// The offset, in bytes, into the first buffer in `rawVertexBuffers` where the vertex data begins
+    var rawVertexBufferOffset = 0
     /// Used in the render pipeline to store the number of instances of this type to render
     var instanceCount = 0
     var subData = [DrawSubData]()
     var worldTransform: matrix_float4x4 = matrix_identity_float4x4
     var worldTransformAnimations: [matrix_float4x4] = []
+    /// A sphere, in model space, that encloses every vertex. The center is in `xyz` and the radius in `w`. A radius of 0 means the bounds are unknown.
+    var boundingSphere = SIMD4<Float>(0, 0, 0, 0)
+    /// A hierarchy over the triangles of the mesh, in model space, used for ray, sphere and frustum queries against virtual content. Skinned meshes are indexed in their bind pose. `nil` for raw geometry.
+    var triangleBVH: TriangleBVH?
     var skeleton: SkeletonData?
     var hasBaseColorMap = false
     var hasNormalMap = false
@@ -265,8 +255,13 @@ public struct DrawData {
         return rawVertexBuffers.count > 0
     }
     
-    public func markTexturesAsVolitile() {
-        subData.forEach{ $0.markTexturesAsVolitile() }
+    /// The textures of every submesh
+    var textures: [MTLTexture] {
+        return subData.flatMap { $0.textures }
+    }
+    
+    public func markTexturesAsVolitile(keeping texturesInUse: Set<ObjectIdentifier> = []) {
+        subData.forEach{ $0.markTexturesAsVolitile(keeping: texturesInUse) }
     }
     
     public func markTexturesAsNonVolitile() {
@@ -284,8 +279,8 @@ public struct MeshGPUData {
     var vertexDescriptor: MTLVertexDescriptor?
     var shaderPreference: ShaderPreference = .pbr
     
-    public func markTexturesAsVolitile() {
-        drawData.forEach{ $0.markTexturesAsVolitile() }
+    public func markTexturesAsVolitile(keeping texturesInUse: Set<ObjectIdentifier> = []) {
+        drawData.forEach{ $0.markTexturesAsVolitile(keeping: texturesInUse) }
     }
     
     public func markTexturesAsNonVolitile() {
@@ -233,7 +233,9 @@ class ModelIOTools {
     // MARK: Encoding Mesh Data
     
     /// Encodes an MDLAsset from ModelIO into a MeshGPUData object which is used internally to set up the render pipeline. Because the work done in this method is CPU intensive, it is offloaded to a background queue and the result is provided in a completion handler. THE COMPLETION HANDLER IS CALLED ON THE BACKGROUND THREAD so callers may need to dispatch back to the appropriate thread in the completion handler.
-    static func meshGPUData(from asset: MDLAsset, device: MTLDevice, vertexDescriptor: MDLVertexDescriptor?, frameRate: Double = 60, shaderPreference: ShaderPreference = .pbr, loadTextures: Bool = true, textureBundle: Bundle? = nil, completion: ((MeshGPUData) -> Void)?) {
+    ///
+    /// When `mergeStaticMeshes` is `true`, meshes that are neither animated nor skinned have their world transforms baked into their vertices and are merged into as few `DrawData` objects as possible, with one submesh per material. See `StaticMeshMerger`. Instances of master meshes are left as they are because they already share their buffers.
+    static func meshGPUData(from asset: MDLAsset, device: MTLDevice, vertexDescriptor: MDLVertexDescriptor?, frameRate: Double = 60, shaderPreference: ShaderPreference = .pbr, loadTextures: Bool = true, textureBundle: Bundle? = nil, mergeStaticMeshes: Bool = true, completion: ((MeshGPUData) -> Void)?) {
         
         // see: https://github.com/metal-by-example/modelio-materials
         
@@ -315,6 +317,8 @@ class ModelIOTools {
             
             let baseSkeleton: SkeletonData? = createSkeleton(from: asset)
             
+            let staticMeshMerger = StaticMeshMerger()
+            
             walkSceneGraph(in: asset) { object, currentIndex, parentIndex in
                 
                 //
@@ -392,11 +396,28 @@ class ModelIOTools {
                     // Set the Vertex Descriptor
                     mesh.vertexDescriptor = concreteVertexDescriptor
                     
+                    let skeleton = skeletonDataAnimation(from: baseSkeleton, for: object, keyTimes: sampleTimes)
+                    
+                    // Meshes that don't move and aren't skinned are baked into world space and merged
+                    if mergeStaticMeshes, skeleton == nil {
+                        let staticWorldTransform: matrix_float4x4? = {
+                            if hasAnimation {
+                                let worldTransformAnimations = parentWorldAnimationTransformsByIndex[currentIndex] ?? []
+                                return StaticMeshMerger.isStatic(worldTransformAnimations) ? (worldTransformAnimations.first ?? matrix_identity_float4x4) : nil
+                            } else {
+                                return parentWorldTransformsByIndex[currentIndex] ?? matrix_identity_float4x4
+                            }
+                        }()
+                        if let worldTransform = staticWorldTransform, staticMeshMerger.add(mesh, worldTransform: worldTransform) {
+                            return
+                        }
+                    }
+                    
                     // Create a new DrawData object from the mesh
                     var drawData = store(mesh, device: device, textureBundle: textureBundle, textureLoader: textureLoader, vertexDescriptor: vertexDescriptor, baseURL: asset.url?.deletingLastPathComponent())
                     
                     // Update the skeleton property with any animation
-                    drawData.skeleton = skeletonDataAnimation(from: baseSkeleton, for: object, keyTimes: sampleTimes)
+                    drawData.skeleton = skeleton
                     
                     // Update the World Transforms (calculated previously)
                     if hasAnimation {
@@ -431,6 +452,12 @@ class ModelIOTools {
                 
             }
             
+            // Store the merged static meshes. Their vertices are already in world space so the world transform is left as the identity.
+            for mergedMesh in staticMeshMerger.mergedMeshes() {
+                let drawData = store(mergedMesh, device: device, textureBundle: textureBundle, textureLoader: textureLoader, vertexDescriptor: vertexDescriptor, baseURL: asset.url?.deletingLastPathComponent())
+                meshGPUData.drawData.append(drawData)
+            }
+            
             // Update the Vertex Descriptor
             if let vertexDescriptor = vertexDescriptor, let mtlVertexDescriptor = MTKMetalVertexDescriptorFromModelIO(vertexDescriptor) {
                 meshGPUData.vertexDescriptor = mtlVertexDescriptor
@@ -466,6 +493,50 @@ class ModelIOTools {
         return vertexBuffer
     }
     
+    /// Returns a sphere that encloses all of the `vertices`. The center is in `xyz` and the radius in `w`. The radius is 0 when there are no vertices.
+    /// - Parameter vertices: An array of verticies
+    static func boundingSphere(enclosing vertices: [SIMD3<Float>]) -> SIMD4<Float> {
+        guard var minBounds = vertices.first else {
+            return SIMD4<Float>(0, 0, 0, 0)
+        }
+        var maxBounds = minBounds
+        for vertex in vertices {
+            minBounds = simd_min(minBounds, vertex)
+            maxBounds = simd_max(maxBounds, vertex)
+        }
+        let center = (minBounds + maxBounds) / 2
+        let radius = vertices.reduce(Float(0)) { max($0, distance($1, center)) }
+        return SIMD4<Float>(center, radius)
+    }
+    
+    /// Returns the vertex positions of `mesh` and the indices of the triangles of every submesh as one triangle list. Submeshes that are not made of triangles are skipped.
+    /// - Parameter mesh: The mesh
+    static func triangles(in mesh: MDLMesh) -> (positions: [SIMD3<Float>], indices: [UInt32]) {
+        
+        guard let positionData = mesh.vertexAttributeData(forAttributeNamed: MDLVertexAttributePosition, as: .float3) else {
+            return (positions: [], indices: [])
+        }
+        
+        var positions = [SIMD3<Float>]()
+        positions.reserveCapacity(mesh.vertexCount)
+        for vertex in 0..<mesh.vertexCount {
+            let components = positionData.dataStart.advanced(by: vertex * positionData.stride).assumingMemoryBound(to: Float.self)
+            positions.append(SIMD3<Float>(components[0], components[1], components[2]))
+        }
+        
+        var indices = [UInt32]()
+        if let submeshes = mesh.submeshes {
+            for case let submesh as MDLSubmesh in submeshes where submesh.geometryType == .triangles {
+                let indexBuffer = submesh.indexBuffer(asIndexType: .uInt32)
+                let indexData = indexBuffer.map().bytes.assumingMemoryBound(to: UInt32.self)
+                indices.append(contentsOf: UnsafeBufferPointer(start: indexData, count: submesh.indexCount))
+            }
+        }
+        
+        return (positions: positions, indices: indices)
+        
+    }
+    
     /// Generated index buffer data from a raw array of indexes.
     /// - Parameter indices: An array of vertex indices
     /// - Parameter device: The Metal device
@@ -508,6 +579,7 @@ class ModelIOTools {
             drawData.rawVertexBuffers = []
         }
         drawData.subData = [submesh]
+        drawData.boundingSphere = boundingSphere(enclosing: vertices)
         
         if submesh.baseColorTexture != nil {
             drawData.hasBaseColorMap = true
@@ -560,19 +632,12 @@ class ModelIOTools {
         
     }
     
-    /// Takes an `MDLMaterial` object and returns a `MaterialProperties` object. The object may come from cache.
+    /// Takes an `MDLMaterial` object and returns a `MaterialProperties` object. The result is interned by `MaterialTable`, so materials with the same content share one `MaterialProperties` instance and one set of textures, even across assets.
     /// - Parameter material: The `MDLMaterial` objet to parse
     /// - Parameter textureLoader: Used to load textures when found. if nil, uniform values will be used instead of textures.
     /// - Parameter bundle: If a relatice URL to an asset is encountered, it is assumed to be an asset within this bundle.
     /// - Parameter baseURL: If provided, all texture asset path will be assumed to be relative to this base url. This may be used id the material is part of an `MDLAsset` within an bundle. Generally the texture asset patch will be relative to the asset but in order to find the asset, we need to know where the asset is. In this case the `baseURL` would be the `URL` of the folder that contains the `MDLAsset`
-    static func materialProperties(from material: MDLMaterial, textureLoader: MTKTextureLoader? = nil, bundle: Bundle? = nil, baseURL: URL? = nil, meshIdentifier: String = "") -> MaterialProperties {
-        
-        let meshCacheKey = meshIdentifier + material.name
-        
-        if let cachedProperties = MaterialCache.shared.cachedMaterial(with: meshCacheKey), textureLoader != nil, bundle != nil {
-            // Only attempt to load from cache materials with textures.
-            return cachedProperties
-        }
+    static func materialProperties(from material: MDLMaterial, textureLoader: MTKTextureLoader? = nil, bundle: Bundle? = nil, baseURL: URL? = nil) -> MaterialProperties {
         
         var allProperties = [MDLMaterialSemantic: (uniform: Any?, texture: MTLTexture?)]()
         
@@ -709,12 +774,7 @@ class ModelIOTools {
             }
         }
         
-        let materialProperties = MaterialProperties(name: material.name, properties: allProperties)
-        if textureLoader != nil, bundle != nil {
-            // Only cace materials with textures
-            MaterialCache.shared.cacheMaterial(materialProperties, for: meshCacheKey)
-        }
-        return materialProperties
+        return MaterialTable.shared.intern(MaterialProperties(name: material.name, properties: allProperties))
     }
     
     // MARK: - Private
@@ -739,6 +799,14 @@ class ModelIOTools {
             mesh.vertexDescriptor = vertexDescriptor
         }
         
+        let boundingBox = mesh.boundingBox
+        if all(boundingBox.minBounds .<= boundingBox.maxBounds) {
+            drawData.boundingSphere = SIMD4<Float>((boundingBox.minBounds + boundingBox.maxBounds) / 2, length(boundingBox.maxBounds - boundingBox.minBounds) / 2)
+        }
+        
+        let meshTriangles = triangles(in: mesh)
+        drawData.triangleBVH = TriangleBVH(positions: meshTriangles.positions, indices: meshTriangles.indices)
+        
         var vertexBuffers = [Data]()
         
         vertexBuffers = mesh.vertexBuffers.map { vertexBuffer in
@@ -768,8 +836,9 @@ class ModelIOTools {
                     
                     var material = MaterialUniforms()
                     
-                    let myMaterialProperties = materialProperties(from: mdlMaterial, textureLoader: textureLoader, bundle: textureBundle, baseURL: baseURL, meshIdentifier: mesh.name)
+                    let myMaterialProperties = materialProperties(from: mdlMaterial, textureLoader: textureLoader, bundle: textureBundle, baseURL: baseURL)
                     let allProperties = myMaterialProperties.properties
+                    subData.material = myMaterialProperties
                     
                     // Encode the texture indexes corresponding to the texture maps. If a property has no texture map this value will be nil
                     subData.baseColorTexture = allProperties[.baseColor]?.texture
@@ -891,12 +960,7 @@ class ModelIOTools {
         var result: (uniform: Any?, texture: MTLTexture?) = (nil, nil)
         
         if let textureLoader = textureLoader, let sourceTexture = property.textureSamplerValue?.texture {
-            let options: [MTKTextureLoader.Option : Any] = [ .generateMipmaps : property.semantic != .tangentSpaceNormal, .allocateMipmaps: property.semantic != .tangentSpaceNormal ]
-            do {
-                result.texture = try textureLoader.newTexture(texture: sourceTexture, options: options)
-            } catch {
-                print(error)
-            }
+            result.texture = newTexture(from: sourceTexture, options: textureLoaderOptions(for: property), textureLoader: textureLoader)
         } else {
             switch property.type {
             case .none:
@@ -911,8 +975,7 @@ class ModelIOTools {
                 }
             case .texture:
                 if let textureLoader = textureLoader, let sourceTexture = property.textureSamplerValue?.texture {
-                    let options: [MTKTextureLoader.Option : Any] = [ .generateMipmaps : property.semantic != .tangentSpaceNormal, .allocateMipmaps: property.semantic != .tangentSpaceNormal ]
-                    result.texture = try? textureLoader.newTexture(texture: sourceTexture, options: options)
+                    result.texture = newTexture(from: sourceTexture, options: textureLoaderOptions(for: property), textureLoader: textureLoader)
                 } else {
                     return nil
                 }
@@ -932,26 +995,62 @@ class ModelIOTools {
                 return nil
             }
         }
+        if let texture = result.texture, isColorSemantic(property.semantic) {
+            result.texture = srgbView(of: texture)
+        }
         return result
     }
     
+    // Color maps are stored as sRGB and decoded by the texture sampler so the shaders never convert them. Data maps such as normals and roughness are loaded as linear values.
+    private static func isColorSemantic(_ semantic: MDLMaterialSemantic) -> Bool {
+        return semantic == .baseColor || semantic == .emission
+    }
+    
+    private static func textureLoaderOptions(for property: MDLMaterialProperty) -> [MTKTextureLoader.Option : Any] {
+        return [ .generateMipmaps : property.semantic != .tangentSpaceNormal, .allocateMipmaps: property.semantic != .tangentSpaceNormal, .SRGB: isColorSemantic(property.semantic) ]
+    }
+    
+    // Some containers ignore the `.SRGB` loader option. Reinterpreting the texels through an sRGB view still moves the decode into the sampler. Views of interned textures are interned too so every material sharing the texture shares the view.
+    private static func srgbView(of texture: MTLTexture) -> MTLTexture {
+        guard let srgbFormat = texture.pixelFormat.srgbVariant, srgbFormat != texture.pixelFormat else {
+            return texture
+        }
+        let viewKey = MaterialTable.shared.key(of: texture).map { "\($0)|view:\(srgbFormat.rawValue)" }
+        return MaterialTable.shared.texture(withKey: viewKey) {
+            return texture.makeTextureView(pixelFormat: srgbFormat)
+        } ?? texture
+    }
+    
+    // Loads a ModelIO texture, reusing an existing texture with the same source or content
+    private static func newTexture(from sourceTexture: MDLTexture, options: [MTKTextureLoader.Option : Any], textureLoader: MTKTextureLoader) -> MTLTexture? {
+        let identity = MaterialTable.identity(of: sourceTexture, options: options)
+        return MaterialTable.shared.texture(withIdentity: identity.identity, fingerprint: identity.fingerprint, contentHash: { MaterialTable.contentHash(of: sourceTexture, options: options) }) {
+            do {
+                return try textureLoader.newTexture(texture: sourceTexture, options: options)
+            } catch {
+                print(error)
+                return nil
+            }
+        }
+    }
+    
     private static func createMTLTexture(fromMaterialProperty property: MDLMaterialProperty, inBundle bundle: Bundle, withTextureLoader textureLoader: MTKTextureLoader, baseURL: URL? = nil) -> MTLTexture? {
             
         if let textureSampler = property.textureSamplerValue, let texture = textureSampler.texture {
-            return try? textureLoader.newTexture(texture: texture)
+            return newTexture(from: texture, options: textureLoaderOptions(for: property), textureLoader: textureLoader)
         } else if let path = property.urlValue?.absoluteString {
             let fixedPath = fullPath(with: path, baseURL: baseURL)
-            return createMTLTexture(inBundle: bundle, fromAssetPath: fixedPath, withTextureLoader: textureLoader)
+            return createMTLTexture(inBundle: bundle, fromAssetPath: fixedPath, withTextureLoader: textureLoader, options: textureLoaderOptions(for: property))
         } else if let path = property.stringValue {
             let fixedPath = fullPath(with: path, baseURL: baseURL)
-            return createMTLTexture(inBundle: bundle, fromAssetPath: fixedPath, withTextureLoader: textureLoader)
+            return createMTLTexture(inBundle: bundle, fromAssetPath: fixedPath, withTextureLoader: textureLoader, options: textureLoaderOptions(for: property))
         } else {
             return nil
         }
         
     }
     
-    private static func createMTLTexture(inBundle bundle: Bundle, fromAssetPath assetPath: String, withTextureLoader textureLoader: MTKTextureLoader) -> MTLTexture? {
+    private static func createMTLTexture(inBundle bundle: Bundle, fromAssetPath assetPath: String, withTextureLoader textureLoader: MTKTextureLoader, options: [MTKTextureLoader.Option : Any]? = nil) -> MTLTexture? {
         
         let textureURL: URL? = {
             guard let aURL = URL(string: assetPath) else {
@@ -976,15 +1075,18 @@ class ModelIOTools {
             return nil
         }
         
-        do {
-            return try textureLoader.newTexture(URL: aURL, options: nil)
-        } catch {
-            print("Unable to loader texture with assetPath \(assetPath) with error \(error)")
-            //                let newError = AKError.recoverableError(.modelError(.unableToLoadTexture(AssetErrorInfo(path: assetPath, underlyingError: error))))
-            //                recordNewError(newError)
+        // Reuse an existing texture when the file, or a file with the same content, has already been loaded
+        let identity = MaterialTable.identity(ofFileAt: aURL, options: options)
+        return MaterialTable.shared.texture(withIdentity: identity?.identity, fingerprint: identity?.fingerprint ?? "", contentHash: { MaterialTable.contentHash(ofFileAt: aURL, options: options) }) {
+            do {
+                return try textureLoader.newTexture(URL: aURL, options: options)
+            } catch {
+                print("Unable to loader texture with assetPath \(assetPath) with error \(error)")
+                //                let newError = AKError.recoverableError(.modelError(.unableToLoadTexture(AssetErrorInfo(path: assetPath, underlyingError: error))))
+                //                recordNewError(newError)
+                return nil
+            }
         }
-        
-        return nil
     }
     
     /// Construct a `SkeletonData`. This generates a base object with no animation.
@@ -1225,26 +1327,332 @@ class ModelIOTools {
 // MARK: - MaterialProperties
 
 /// Stores a material name along with a properties dictionary where the keys are each `MDLMaterialSemantic` that's contained in the material and the values are tupels that either contain a uniform value or a `MTLTexture`. Since `MDLMaterial` objects parsed from various file formats can contain multiple values for the same semantic, generally, a texture is preferred over a uniform and the last value found is the value used.
+///
+/// Instances returned by `ModelIOTools.materialProperties(from:textureLoader:bundle:baseURL:)` are interned by `MaterialTable`, so every submesh whose material has the same content shares one instance.
 class MaterialProperties {
     var materialName: String
     var properties = [MDLMaterialSemantic: (uniform: Any?, texture: MTLTexture?)]()
+    /// A hash of the uniform values and of the content of the textures. Empty until the instance has been interned.
+    fileprivate(set) var contentHash = ""
+    /// A small integer that is unique to each interned material for the life of the process. Can be used as a sort key when grouping draws by material. `-1` until the instance has been interned.
+    fileprivate(set) var identifier = -1
     init(name: String, properties: [MDLMaterialSemantic: (uniform: Any?, texture: MTLTexture?)] = [:]) {
         self.materialName = name
         self.properties = properties
     }
 }
 
-// MARK: - MaterialCache
+// MARK: - MaterialTable
 
-class MaterialCache: NSCache<AnyObject, MaterialProperties> {
-    static let shared = MaterialCache()
+/**
+ Interns materials and material textures by their content so that identical materials, whether they come from different submeshes or from different assets, are parsed into a single `MaterialProperties` and their textures are uploaded once.
+ 
+ - Textures are first looked up by the identity of their source, which is the file's path, size and modification date or the `MDLTexture` instance, combined with the texture loader options. Hashing the content means reading all of it, so a SHA-256 of the source data is only computed when a new texture has the same fingerprint (file size or texel layout) as a live one. Textures with the same content hash share one `MTLTexture`.
+ - Materials are keyed by a SHA-256 of their uniform values and the keys of their textures. The material name is not part of the key.
+ - Textures handed out by the table are shared, so the renderer only marks the textures of a removed draw call group volatile when no remaining group uses them. A texture found in the table is marked non-volatile again, and is loaded again if its contents were purged.
+ 
+ The table only holds weak references. `DrawSubData.material` holds a strong reference, so an entry lives as long as some submesh draws with it and is dropped when the last one is released.
+ */
+final class MaterialTable {
+    
+    static let shared = MaterialTable()
+    
+    /// Counts of the live entries and of the requests that were satisfied by an existing entry
+    struct Statistics {
+        /// The number of distinct materials that are alive
+        var materialCount = 0
+        /// The number of distinct textures that are alive
+        var textureCount = 0
+        /// The number of materials that resolved to an existing entry
+        var materialHits = 0
+        /// The number of textures that resolved to an existing entry instead of being loaded again
+        var textureHits = 0
+        /// The number of content hashes that were computed because a new texture had the same fingerprint as a live one
+        var textureContentHashes = 0
+    }
+    
+    var statistics: Statistics {
+        lock.lock()
+        defer { lock.unlock() }
+        pruneReleasedEntries()
+        var result = Statistics()
+        result.materialCount = materials.count
+        result.textureCount = textureKeys.count
+        result.materialHits = materialHits
+        result.textureHits = textureHits
+        result.textureContentHashes = textureContentHashes
+        return result
+    }
+    
+    /**
+     Returns the live texture loaded from the same source, or from a source with the same content. If there isn't one, `load` is called and its result is added to the table.
+     - Parameters:
+        - identity: Identifies the source and the loader options. Equal identities are assumed to have equal content. When `nil`, `load` is called and the result is not interned.
+        - fingerprint: A value that is cheap to compute and that is equal for any two sources with equal content, such as the file size. Sources with different fingerprints are never hashed.
+        - contentHash: Computes the hash of the source's content. Only called when another live texture has the same fingerprint.
+        - load: Creates the texture
+     */
+    func texture(withIdentity identity: String?, fingerprint: String, contentHash: @escaping () -> String?, load: () -> MTLTexture?) -> MTLTexture? {
+        
+        guard let identity = identity else {
+            return load()
+        }
+        
+        lock.lock()
+        if let existing = liveTexture(forKey: identity) {
+            lock.unlock()
+            return existing
+        }
+        pruneReleasedEntries()
+        let candidates = fingerprints[fingerprint] ?? []
+        lock.unlock()
+        
+        // Hashing reads the whole source so it happens outside of the lock, and only when there is something to compare against
+        if !candidates.isEmpty, let newContentHash = contentHash() {
+            let candidateHashes = candidates.map { $0.contentHash ?? $0.computeHash() }
+            lock.lock()
+            textureContentHashes += 1
+            for (candidate, candidateHash) in zip(candidates, candidateHashes) {
+                if let index = fingerprints[fingerprint]?.firstIndex(where: { $0.key == candidate.key }) {
+                    fingerprints[fingerprint]?[index].contentHash = candidateHash
+                }
+            }
+            if let match = zip(candidates, candidateHashes).first(where: { $0.1 == newContentHash }), let existing = liveTexture(forKey: match.0.key) {
+                textures[identity] = TextureEntry(texture: existing)
+                lock.unlock()
+                return existing
+            }
+            lock.unlock()
+        }
+        
+        // Loading can take a while so it happens outside of the lock. If another thread interned the same source in the meantime, its texture wins.
+        guard let loaded = load() else {
+            return nil
+        }
+        
+        lock.lock()
+        defer { lock.unlock() }
+        if let existing = liveTexture(forKey: identity) {
+            return existing
+        }
+        register(loaded, forKey: identity)
+        fingerprints[fingerprint, default: []].append(FingerprintCandidate(key: identity, texture: loaded, computeHash: contentHash))
+        return loaded
+        
+    }
     
-    func cachedMaterial(with name: String) -> MaterialProperties? {
-        return object(forKey: name as AnyObject)
+    /**
+     Returns the live texture with the provided key. If there isn't one, `load` is called and its result is added to the table.
+     - Parameters:
+        - key: Identifies the texture. When `nil`, `load` is called and the result is not interned.
+        - load: Creates the texture
+     */
+    func texture(withKey key: String?, load: () -> MTLTexture?) -> MTLTexture? {
+        
+        guard let key = key else {
+            return load()
+        }
+        
+        lock.lock()
+        if let existing = liveTexture(forKey: key) {
+            lock.unlock()
+            return existing
+        }
+        lock.unlock()
+        
+        guard let loaded = load() else {
+            return nil
+        }
+        
+        lock.lock()
+        defer { lock.unlock() }
+        if let existing = liveTexture(forKey: key) {
+            return existing
+        }
+        register(loaded, forKey: key)
+        return loaded
+        
     }
     
-    func cacheMaterial(_ materialProperties: MaterialProperties, for name: String) {
-        setObject(materialProperties, forKey: name as AnyObject)
+    /// Returns the key of a texture that was added to the table
+    func key(of texture: MTLTexture) -> String? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let entry = textureKeys[ObjectIdentifier(texture)], entry.texture === texture else {
+            return nil
+        }
+        return entry.key
+    }
+    
+    /// Returns the live material with the same content as `materialProperties`, or interns and returns `materialProperties` if there isn't one
+    func intern(_ materialProperties: MaterialProperties) -> MaterialProperties {
+        
+        let contentHash = materialContentHash(of: materialProperties)
+        
+        lock.lock()
+        defer { lock.unlock() }
+        pruneReleasedEntries()
+        if let existing = materials[contentHash]?.material {
+            materialHits += 1
+            return existing
+        }
+        materialProperties.contentHash = contentHash
+        materialProperties.identifier = nextIdentifier
+        nextIdentifier += 1
+        materials[contentHash] = MaterialEntry(material: materialProperties)
+        return materialProperties
+        
+    }
+    
+    /// The identity of a texture file loaded with the provided loader options. Returns `nil` if the file's attributes can't be read.
+    static func identity(ofFileAt url: URL, options: [MTKTextureLoader.Option: Any]?) -> (identity: String, fingerprint: String)? {
+        guard url.isFileURL, let attributes = try? FileManager.default.attributesOfItem(atPath: url.path), let size = attributes[.size] as? NSNumber else {
+            return nil
+        }
+        let modificationDate = (attributes[.modificationDate] as? Date)?.timeIntervalSinceReferenceDate ?? 0
+        let signature = optionsSignature(options)
+        return (identity: "file:\(url.standardizedFileURL.path)|\(size)|\(modificationDate)|\(signature)", fingerprint: "file:\(size)|\(signature)")
+    }
+    
+    /// The content hash of a texture loaded from a file with the provided loader options. Returns `nil` if the file can't be read.
+    static func contentHash(ofFileAt url: URL, options: [MTKTextureLoader.Option: Any]?) -> String? {
+        guard let data = try? Data(contentsOf: url) else {
+            return nil
+        }
+        return SHA256([UInt8](data) + [UInt8](optionsSignature(options).utf8)).digestString()
+    }
+    
+    /// The identity of a ModelIO texture loaded with the provided loader options
+    static func identity(of texture: MDLTexture, options: [MTKTextureLoader.Option: Any]?) -> (identity: String, fingerprint: String) {
+        if let urlTexture = texture as? MDLURLTexture, let fileIdentity = identity(ofFileAt: urlTexture.url, options: options) {
+            return fileIdentity
+        }
+        let signature = optionsSignature(options)
+        let layout = "\(texture.dimensions.x)x\(texture.dimensions.y):\(texture.channelCount):\(texture.channelEncoding.rawValue)"
+        return (identity: "texture:\(ObjectIdentifier(texture).hashValue)|\(texture.name)|\(signature)", fingerprint: "texels:\(layout)|\(signature)")
+    }
+    
+    /// The content hash of a ModelIO texture with the provided loader options. Returns `nil` if the texture's data can't be read.
+    static func contentHash(of texture: MDLTexture, options: [MTKTextureLoader.Option: Any]?) -> String? {
+        if let urlTexture = texture as? MDLURLTexture, let fileHash = contentHash(ofFileAt: urlTexture.url, options: options) {
+            return fileHash
+        }
+        guard let texelData = texture.texelDataWithTopLeftOrigin() else {
+            return nil
+        }
+        let layout = "\(texture.dimensions.x)x\(texture.dimensions.y):\(texture.channelCount):\(texture.channelEncoding.rawValue)"
+        return SHA256([UInt8](texelData) + [UInt8](layout.utf8) + [UInt8](optionsSignature(options).utf8)).digestString()
+    }
+    
+    // MARK: - Private
+    
+    fileprivate struct TextureEntry {
+        weak var texture: MTLTexture?
+    }
+    
+    fileprivate struct TextureKeyEntry {
+        weak var texture: MTLTexture?
+        var key: String
+    }
+    
+    fileprivate struct FingerprintCandidate {
+        var key: String
+        weak var texture: MTLTexture?
+        var computeHash: () -> String?
+        // Filled in the first time the candidate is compared so it is hashed at most once
+        var contentHash: String?
+        init(key: String, texture: MTLTexture, computeHash: @escaping () -> String?) {
+            self.key = key
+            self.texture = texture
+            self.computeHash = computeHash
+        }
+    }
+    
+    fileprivate struct MaterialEntry {
+        weak var material: MaterialProperties?
+    }
+    
+    fileprivate let lock = NSLock()
+    fileprivate var textures = [String: TextureEntry]()
+    fileprivate var textureKeys = [ObjectIdentifier: TextureKeyEntry]()
+    fileprivate var fingerprints = [String: [FingerprintCandidate]]()
+    fileprivate var materials = [String: MaterialEntry]()
+    fileprivate var materialHits = 0
+    fileprivate var textureHits = 0
+    fileprivate var textureContentHashes = 0
+    fileprivate var nextIdentifier = 0
+    
+    // Must be called while holding `lock`. A texture that was marked volatile when the last draw call group using it was removed is made non-volatile again. If its contents were purged in the meantime it is dropped so it gets loaded again.
+    fileprivate func liveTexture(forKey key: String) -> MTLTexture? {
+        guard let existing = textures[key]?.texture else {
+            return nil
+        }
+        if existing.setPurgeableState(.nonVolatile) == .empty {
+            textures = textures.filter { $0.value.texture !== existing }
+            textureKeys[ObjectIdentifier(existing)] = nil
+            return nil
+        }
+        textureHits += 1
+        return existing
+    }
+    
+    // Must be called while holding `lock`
+    fileprivate func register(_ texture: MTLTexture, forKey key: String) {
+        textures[key] = TextureEntry(texture: texture)
+        textureKeys[ObjectIdentifier(texture)] = TextureKeyEntry(texture: texture, key: key)
+    }
+    
+    // Must be called while holding `lock`
+    fileprivate func pruneReleasedEntries() {
+        textures = textures.filter { $0.value.texture != nil }
+        textureKeys = textureKeys.filter { $0.value.texture != nil }
+        fingerprints = fingerprints.mapValues { $0.filter { $0.texture != nil } }.filter { !$0.value.isEmpty }
+        materials = materials.filter { $0.value.material != nil }
+    }
+    
+    // Uniform values are written as bit patterns so equal values always produce the same key. Textures are written as their key in the table, which is shared by every source with the same content, or as their identity when they weren't loaded through the table.
+    fileprivate func materialContentHash(of materialProperties: MaterialProperties) -> String {
+        
+        var components = [String]()
+        for (semantic, value) in materialProperties.properties.sorted(by: { $0.key.rawValue < $1.key.rawValue }) {
+            let uniform: String = {
+                guard let uniformValue = value.uniform else {
+                    return ""
+                }
+                switch uniformValue {
+                case let float as Float:
+                    return String(float.bitPattern, radix: 16)
+                case let vector as SIMD2<Float>:
+                    return [vector.x, vector.y].map { String($0.bitPattern, radix: 16) }.joined(separator: ",")
+                case let vector as SIMD3<Float>:
+                    return [vector.x, vector.y, vector.z].map { String($0.bitPattern, radix: 16) }.joined(separator: ",")
+                case let vector as SIMD4<Float>:
+                    return [vector.x, vector.y, vector.z, vector.w].map { String($0.bitPattern, radix: 16) }.joined(separator: ",")
+                case let matrix as matrix_float4x4:
+                    return [matrix.columns.0, matrix.columns.1, matrix.columns.2, matrix.columns.3].map { column in
+                        return [column.x, column.y, column.z, column.w].map { String($0.bitPattern, radix: 16) }.joined(separator: ",")
+                    }.joined(separator: ";")
+                default:
+                    return "\(uniformValue)"
+                }
+            }()
+            let texture: String = {
+                guard let texture = value.texture else {
+                    return ""
+                }
+                return key(of: texture) ?? "object:\(ObjectIdentifier(texture).hashValue)"
+            }()
+            components.append("\(semantic.rawValue)=\(uniform)|\(texture)")
+        }
+        return SHA256(components.joined(separator: "\n")).digestString()
+        
+    }
+    
+    fileprivate static func optionsSignature(_ options: [MTKTextureLoader.Option: Any]?) -> String {
+        guard let options = options else {
+            return ""
+        }
+        return options.map { "\($0.key.rawValue)=\($0.value)" }.sorted().joined(separator: ",")
     }
     
 }
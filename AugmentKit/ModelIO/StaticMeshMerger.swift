@@ -0,0 +1,353 @@
+//
+//  StaticMeshMerger.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import ModelIO
+import simd
+
+// MARK: - StaticMeshMerger
+
+/**
+ Flattens the static part of a scene graph when an asset is imported. Authoring tools often export a model as many small nodes, each of which would otherwise become its own `DrawData` and its own draw call.
+ 
+ Each mesh that is added has its world transform baked into its positions, normals and tangents and is appended to a shared set of vertex buffers. Submeshes that share a material are combined into a single index range, so a merged mesh has one submesh per distinct material. Merged meshes are returned as ordinary `MDLMesh` objects in world space and are stored the same way as any other mesh, with an identity world transform.
+ 
+ Only meshes with triangle submeshes and a position attribute that is `.float3` or `.float4` can be merged. `add(_:worldTransform:)` returns `false` for any other mesh, which should then be stored individually. It is up to the caller to only add meshes that are neither animated nor skinned.
+ */
+final class StaticMeshMerger {
+    
+    /// A merged mesh is closed once adding another mesh would take it past this many vertices. Keeps the bounds of each merged mesh, which are used for culling, from growing without limit.
+    static let maximumVertexCount = 1 << 18
+    /// World transform samples that differ by less than this are considered to be the same transform
+    static let staticTolerance: Float = 1.0e-6
+    
+    /// The number of meshes that have been added
+    private(set) var sourceMeshCount = 0
+    
+    init(allocator: MDLMeshBufferAllocator = MDLMeshBufferDataAllocator()) {
+        self.allocator = allocator
+    }
+    
+    /**
+     Returns `true` if every sample of an animated world transform is the same, meaning the node does not actually move.
+     - Parameters:
+        - worldTransformAnimations: The sampled world transforms of a node
+     */
+    static func isStatic(_ worldTransformAnimations: [matrix_float4x4]) -> Bool {
+        guard let first = worldTransformAnimations.first else {
+            return true
+        }
+        for transform in worldTransformAnimations.dropFirst() {
+            for column in 0..<4 {
+                if simd_reduce_max(abs(transform[column] - first[column])) > staticTolerance {
+                    return false
+                }
+            }
+        }
+        return true
+    }
+    
+    /**
+     Bakes `worldTransform` into a copy of the mesh's vertices and appends them to the current merged mesh.
+     - Parameters:
+        - mesh: The mesh to add. Its `vertexDescriptor` should already be set to the descriptor used by the render pipeline.
+        - worldTransform: The world transform of the node the mesh belongs to
+     - Returns: `false` if the mesh cannot be merged, in which case nothing was added
+     */
+    func add(_ mesh: MDLMesh, worldTransform: matrix_float4x4) -> Bool {
+        
+        let vertexCount = mesh.vertexCount
+        guard vertexCount > 0, vertexCount <= StaticMeshMerger.maximumVertexCount, let submeshes = mesh.submeshes as? [MDLSubmesh], !submeshes.isEmpty else {
+            return false
+        }
+        
+        // Only triangles with indices that can be read are supported
+        for submesh in submeshes {
+            guard submesh.geometryType == .triangles, StaticMeshMerger.indexSize(of: submesh.indexType) > 0 else {
+                return false
+            }
+        }
+        
+        let vertexDescriptor = mesh.vertexDescriptor
+        let strides: [Int] = vertexDescriptor.layouts.map { layout in
+            return (layout as? MDLVertexBufferLayout)?.stride ?? 0
+        }
+        let attributes = vertexDescriptor.attributes.compactMap { $0 as? MDLVertexAttribute }.filter { $0.format != .invalid }
+        
+        guard let positionAttribute = attributes.first(where: { $0.name == MDLVertexAttributePosition }), StaticMeshMerger.isFloatVector(positionAttribute.format) else {
+            return false
+        }
+        
+        // Normals and tangents are transformed as well, so they need to be in a format that can be written
+        let directionAttributes = attributes.filter { StaticMeshMerger.directionAttributeNames.contains($0.name) }
+        guard directionAttributes.allSatisfy({ StaticMeshMerger.isFloatVector($0.format) }) else {
+            return false
+        }
+        
+        let layoutSignature = StaticMeshMerger.layoutSignature(attributes: attributes, strides: strides)
+        for attribute in attributes {
+            guard attribute.bufferIndex < strides.count, attribute.bufferIndex < mesh.vertexBuffers.count, strides[attribute.bufferIndex] * vertexCount <= mesh.vertexBuffers[attribute.bufferIndex].length else {
+                return false
+            }
+        }
+        
+        // Start a new merged mesh when the layout changes or the current one is full
+        if let batch = currentBatch, batch.layoutSignature != layoutSignature || batch.vertexCount + vertexCount > StaticMeshMerger.maximumVertexCount {
+            closeCurrentBatch()
+        }
+        if currentBatch == nil {
+            currentBatch = Batch(layoutSignature: layoutSignature, vertexDescriptor: MDLVertexDescriptor(vertexDescriptor: vertexDescriptor), vertexData: strides.map { _ in Data() })
+        }
+        // Take the batch out while it is modified so its buffers are not copied
+        guard var batch = currentBatch else {
+            return false
+        }
+        currentBatch = nil
+        
+        let upperLeft = float3x3(SIMD3<Float>(worldTransform.columns.0.x, worldTransform.columns.0.y, worldTransform.columns.0.z), SIMD3<Float>(worldTransform.columns.1.x, worldTransform.columns.1.y, worldTransform.columns.1.z), SIMD3<Float>(worldTransform.columns.2.x, worldTransform.columns.2.y, worldTransform.columns.2.z))
+        let isMirrored = upperLeft.determinant < 0
+        let normalMatrix = AffineDecomposition.isDegenerate(upperLeft) ? upperLeft : upperLeft.inverse.transpose
+        
+        // Copy and transform the vertices of each buffer
+        for (bufferIndex, stride) in strides.enumerated() where stride > 0 && bufferIndex < mesh.vertexBuffers.count {
+            
+            let vertexMap = mesh.vertexBuffers[bufferIndex].map()
+            var bytes = Data(bytes: vertexMap.bytes, count: stride * vertexCount)
+            bytes.withUnsafeMutableBytes { (buffer: UnsafeMutableRawBufferPointer) in
+                guard let baseAddress = buffer.baseAddress else {
+                    return
+                }
+                for attribute in attributes where attribute.bufferIndex == bufferIndex {
+                    let isPosition = attribute.name == MDLVertexAttributePosition
+                    guard isPosition || StaticMeshMerger.directionAttributeNames.contains(attribute.name) else {
+                        continue
+                    }
+                    let isTangent = attribute.name != MDLVertexAttributeNormal && !isPosition
+                    for vertexIndex in 0..<vertexCount {
+                        let pointer = (baseAddress + vertexIndex * stride + attribute.offset).assumingMemoryBound(to: Float.self)
+                        let value = SIMD3<Float>(pointer[0], pointer[1], pointer[2])
+                        let transformed: SIMD3<Float> = {
+                            if isPosition {
+                                let position = worldTransform * SIMD4<Float>(value, 1)
+                                return SIMD3<Float>(position.x, position.y, position.z) / (position.w != 0 ? position.w : 1)
+                            } else if isTangent {
+                                return simd_normalize(upperLeft * value)
+                            } else {
+                                return simd_normalize(normalMatrix * value)
+                            }
+                        }()
+                        pointer[0] = transformed.x.isFinite ? transformed.x : 0
+                        pointer[1] = transformed.y.isFinite ? transformed.y : 0
+                        pointer[2] = transformed.z.isFinite ? transformed.z : 0
+                        // The handedness of the tangent frame flips with the transform
+                        if isTangent, isMirrored, attribute.format == .float4 {
+                            pointer[3] = -pointer[3]
+                        }
+                    }
+                }
+            }
+            batch.vertexData[bufferIndex].append(bytes)
+            
+        }
+        
+        // Rebase the indices onto the merged vertices and group them by material. A mirrored transform reverses the winding of every triangle so it is swapped back.
+        let baseVertex = UInt32(batch.vertexCount)
+        for submesh in submeshes {
+            
+            let indexSize = StaticMeshMerger.indexSize(of: submesh.indexType)
+            let indexMap = submesh.indexBuffer.map()
+            let indexBytes = indexMap.bytes
+            let indexCount = min(submesh.indexCount, submesh.indexBuffer.length / indexSize)
+            var indices = [UInt32]()
+            indices.reserveCapacity(indexCount)
+            for index in 0..<indexCount {
+                let value: UInt32 = {
+                    switch indexSize {
+                    case 1:
+                        return UInt32(indexBytes.load(fromByteOffset: index, as: UInt8.self))
+                    case 2:
+                        return UInt32(indexBytes.load(fromByteOffset: index * 2, as: UInt16.self))
+                    default:
+                        return indexBytes.load(fromByteOffset: index * 4, as: UInt32.self)
+                    }
+                }()
+                indices.append(value + baseVertex)
+            }
+            if isMirrored {
+                var triangle = 0
+                while triangle + 2 < indices.count {
+                    indices.swapAt(triangle + 1, triangle + 2)
+                    triangle += 3
+                }
+            }
+            
+            let materialKey = StaticMeshMerger.materialKey(for: submesh.material)
+            if let groupIndex = batch.materialGroupIndices[materialKey] {
+                batch.materialGroups[groupIndex].indices.append(contentsOf: indices)
+            } else {
+                batch.materialGroupIndices[materialKey] = batch.materialGroups.count
+                batch.materialGroups.append(MaterialGroup(material: submesh.material, indices: indices))
+            }
+            
+        }
+        
+        batch.vertexCount += vertexCount
+        currentBatch = batch
+        sourceMeshCount += 1
+        return true
+        
+    }
+    
+    /// Closes the current merged mesh and returns every merged mesh. The merger is empty afterwards.
+    func mergedMeshes() -> [MDLMesh] {
+        closeCurrentBatch()
+        let meshes = closedMeshes
+        closedMeshes = []
+        sourceMeshCount = 0
+        return meshes
+    }
+    
+    // MARK: - Private
+    
+    private struct MaterialGroup {
+        var material: MDLMaterial?
+        var indices: [UInt32]
+    }
+    
+    private struct Batch {
+        var layoutSignature: String
+        var vertexDescriptor: MDLVertexDescriptor
+        var vertexData: [Data]
+        var vertexCount = 0
+        var materialGroups = [MaterialGroup]()
+        var materialGroupIndices = [String: Int]()
+        
+        init(layoutSignature: String, vertexDescriptor: MDLVertexDescriptor, vertexData: [Data]) {
+            self.layoutSignature = layoutSignature
+            self.vertexDescriptor = vertexDescriptor
+            self.vertexData = vertexData
+        }
+    }
+    
+    private static let directionAttributeNames: Set<String> = [MDLVertexAttributeNormal, MDLVertexAttributeTangent, MDLVertexAttributeBitangent]
+    
+    private var allocator: MDLMeshBufferAllocator
+    private var currentBatch: Batch?
+    private var closedMeshes = [MDLMesh]()
+    
+    private func closeCurrentBatch() {
+        
+        guard let batch = currentBatch else {
+            return
+        }
+        currentBatch = nil
+        
+        guard batch.vertexCount > 0 else {
+            return
+        }
+        
+        let vertexBuffers = batch.vertexData.map { allocator.newBuffer(with: $0, type: .vertex) }
+        let submeshes: [MDLSubmesh] = batch.materialGroups.enumerated().map { (groupIndex, group) in
+            let indexData = group.indices.withUnsafeBufferPointer { Data(buffer: $0) }
+            let indexBuffer = allocator.newBuffer(with: indexData, type: .index)
+            return MDLSubmesh(name: "Merged Submesh \(groupIndex)", indexBuffer: indexBuffer, indexCount: group.indices.count, indexType: .uint32, geometryType: .triangles, material: group.material)
+        }
+        let mesh = MDLMesh(vertexBuffers: vertexBuffers, vertexCount: batch.vertexCount, descriptor: batch.vertexDescriptor, submeshes: submeshes)
+        mesh.name = "Merged Static Mesh \(closedMeshes.count)"
+        closedMeshes.append(mesh)
+        
+    }
+    
+    private static func isFloatVector(_ format: MDLVertexFormat) -> Bool {
+        return format == .float3 || format == .float4
+    }
+    
+    private static func indexSize(of indexType: MDLIndexBitDepth) -> Int {
+        switch indexType {
+        case .uInt8:
+            return 1
+        case .uInt16:
+            return 2
+        case .uInt32:
+            return 4
+        default:
+            return 0
+        }
+    }
+    
+    private static func layoutSignature(attributes: [MDLVertexAttribute], strides: [Int]) -> String {
+        let attributeSignatures = attributes.map { "\($0.name):\($0.format.rawValue):\($0.offset):\($0.bufferIndex)" }
+        return attributeSignatures.joined(separator: ",") + "|" + strides.map { "\($0)" }.joined(separator: ",")
+    }
+    
+    // Materials are often duplicated by importers, so two materials are considered the same when their names and all of their property values match. Textures are compared by name, or by identity when they don't have one.
+    private static func materialKey(for material: MDLMaterial?) -> String {
+        
+        guard let material = material else {
+            return ""
+        }
+        
+        var components = [material.name]
+        for propertyIndex in 0..<material.count {
+            guard let property = material[propertyIndex] else {
+                continue
+            }
+            let value: String = {
+                switch property.type {
+                case .string:
+                    return property.stringValue ?? ""
+                case .URL:
+                    return property.urlValue?.absoluteString ?? ""
+                case .texture:
+                    guard let texture = property.textureSamplerValue?.texture else {
+                        return ""
+                    }
+                    return texture.name.isEmpty ? "\(ObjectIdentifier(texture).hashValue)" : texture.name
+                case .float:
+                    return "\(property.floatValue)"
+                case .float2:
+                    return "\(property.float2Value)"
+                case .float3:
+                    return "\(property.float3Value)"
+                case .float4:
+                    return "\(property.float4Value)"
+                case .matrix44:
+                    return "\(property.matrix4x4)"
+                case .color:
+                    return property.color?.components.map { "\($0)" } ?? ""
+                default:
+                    return ""
+                }
+            }()
+            components.append("\(property.semantic.rawValue):\(property.type.rawValue):\(value)")
+        }
+        return components.joined(separator: "|")
+        
+    }
+    
+}
@@ -64,4 +64,169 @@ float iorToF0(float transmittedIor, float incidentIor);
 float f0ToIor(float f0);
 vector_float3 f0ClearCoatToSurface(vector_float3 f0);
 
+#ifdef __METAL_VERSION__
+
+#include <metal_stdlib>
+
+// MARK: - Templated BRDF
+
+// The BRDF terms templated on the scalar type so one implementation serves both the `float` and the `half` shading tiers. The `float` functions above are wrappers around the `float` instantiations.
+namespace brdf {
+
+using namespace metal;
+
+/// The largest value a BRDF term is clamped to
+template <typename T> T maxValue();
+template <> inline float maxValue<float>() { return MAXFLOAT; }
+template <> inline half maxValue<half>() { return HALF_MAX; }
+
+/// The smallest roughness (perceptual roughness squared) the tier can shade without `D_GGX` losing its shape. The `half` limit corresponds to a perceptual roughness of 0.089.
+template <typename T> T minRoughness();
+template <> inline float minRoughness<float>() { return 0.002025; }
+template <> inline half minRoughness<half>() { return 0.007921h; }
+
+template <typename T>
+inline T pow5(T x) {
+    T x2 = x * x;
+    return x2 * x2 * x;
+}
+
+// MARK: Specular BRDF implementations
+
+/// Walter et al. 2007, "Microfacet Models for Refraction through Rough Surfaces"
+/// `oneMinusNDotHSquared` should be computed at full precision. At `half` precision 1 - nDoth² has almost no significant bits left near the peak of the highlight.
+template <typename T>
+inline T D_GGX(T roughness, T nDoth, T oneMinusNDotHSquared) {
+    T a = nDoth * roughness;
+    T k = roughness / (oneMinusNDotHSquared + a * a);
+    T d = k * k * T(M_1_PI_F);
+    return min(d, maxValue<T>());
+}
+
+/// Burley 2012, "Physically-Based Shading at Disney"
+template <typename T>
+inline T D_GGX_Anisotropic(T at, T ab, T tDoth, T bDoth, T nDoth) {
+    T a2 = at * ab;
+    vec<T, 3> d = vec<T, 3>(ab * tDoth, at * bDoth, a2 * nDoth);
+    T w = a2 / dot(d, d);
+    return min(a2 * w * w * T(M_1_PI_F), maxValue<T>());
+}
+
+/// Estevez and Kulla 2017, "Production Friendly Microfacet Sheen BRDF"
+template <typename T>
+inline T D_Charlie(T roughness, T nDoth) {
+    T invAlpha = T(1.0) / roughness;
+    T cos2h = nDoth * nDoth;
+    T sin2h = max(T(1.0) - cos2h, T(0.0078125)); // 2^(-14/2), so sin2h^2 > 0 in fp16
+    return (T(2.0) + invAlpha) * pow(sin2h, invAlpha * T(0.5)) * T(0.5 * M_1_PI_F);
+}
+
+/// Heitz 2014, "Understanding the Masking-Shadowing Function in Microfacet-Based BRDFs"
+template <typename T>
+inline T V_SmithG_GGX(T roughness, T nDotv, T nDotl) {
+    T a2 = roughness * roughness;
+    T GsL = T(1.0) / (nDotl + sqrt(a2 + (T(1.0) - a2) * nDotl * nDotl));
+    T GsV = T(1.0) / (nDotv + sqrt(a2 + (T(1.0) - a2) * nDotv * nDotv));
+    return min(GsL * GsV, maxValue<T>());
+}
+
+/// Heitz 2014, "Understanding the Masking-Shadowing Function in Microfacet-Based BRDFs"
+template <typename T>
+inline T V_SmithGGXCorrelated(T roughness, T nDotv, T nDotl) {
+    T a2 = roughness * roughness;
+    T lambdaV = nDotl * sqrt(nDotv * nDotv * (T(1.0) - a2) + a2);
+    T lambdaL = nDotv * sqrt(nDotl * nDotl * (T(1.0) - a2) + a2);
+    return min(T(0.5) / (lambdaV + lambdaL), maxValue<T>());
+}
+
+template <typename T>
+inline T V_SmithGGXCorrelated_Fast(T roughness, T nDotv, T nDotl) {
+    return min(T(0.5) / mix(T(2.0) * nDotl * nDotv, nDotl + nDotv, roughness), maxValue<T>());
+}
+
+template <typename T>
+inline T V_SmithGGXCorrelated_Anisotropic(T at, T ab, T tDotv, T bDotv, T tDotl, T bDotl, T nDotv, T nDotl) {
+    T lambdaV = nDotl * length(vec<T, 3>(at * tDotv, ab * bDotv, nDotv));
+    T lambdaL = nDotv * length(vec<T, 3>(at * tDotl, ab * bDotl, nDotl));
+    return min(T(0.5) / (lambdaV + lambdaL), maxValue<T>());
+}
+
+/// Kelemen 2001, "A Microfacet Based Coupled Specular-Matte BRDF Model with Importance Sampling"
+template <typename T>
+inline T V_Kelemen(T lDoth) {
+    return min(T(0.25) / (lDoth * lDoth), maxValue<T>());
+}
+
+/// Neubelt and Pettineo 2013, "Crafting a Next-gen Material Pipeline for The Order: 1886"
+template <typename T>
+inline T V_Neubelt(T nDotv, T nDotl) {
+    return min(T(1.0) / (T(4.0) * (nDotl + nDotv - nDotl * nDotv)), maxValue<T>());
+}
+
+/// Schlick 1994, "An Inexpensive BRDF Model for Physically-Based Rendering"
+template <typename T>
+inline vec<T, 3> F_Schlick3(vec<T, 3> f0, T f90, T vDoth) {
+    return f0 + (f90 - f0) * pow5(saturate(T(1.0) - vDoth));
+}
+
+template <typename T>
+inline T F_Schlick(T f0, T f90, T vDoth) {
+    return f0 + (f90 - f0) * pow5(saturate(T(1.0) - vDoth));
+}
+
+// MARK: Specular BRDF dispatch
+
+template <typename T>
+inline vec<T, 3> fresnel(vec<T, 3> f0, T vDoth) {
+    T f90 = saturate(dot(f0, vec<T, 3>(T(50.0 * 0.33))));
+    return F_Schlick3(f0, f90, vDoth);
+}
+
+template <typename T>
+inline T distribution(T roughness, T nDoth, T oneMinusNDotHSquared) {
+    return D_GGX(roughness, nDoth, oneMinusNDotHSquared);
+}
+
+template <typename T>
+inline T visibility(T roughness, T nDotv, T nDotl) {
+    // Full Smith-GGX. See `visibility` in BRDFFunctions.metal
+    return V_SmithG_GGX(roughness, nDotv, nDotl);
+}
+
+// MARK: Diffuse BRDF implementations
+
+template <typename T>
+inline T Fd_Lambert() {
+    return T(M_1_PI_F);
+}
+
+/// Burley 2012, "Physically-Based Shading at Disney"
+template <typename T>
+inline T Fd_Burley(T roughness, T nDotv, T nDotl, T lDoth) {
+    T f90 = T(0.5) + T(2.0) * roughness * lDoth * lDoth;
+    T lightScatter = F_Schlick(T(1.0), f90, nDotl);
+    T viewScatter = F_Schlick(T(1.0), f90, nDotv);
+    return lightScatter * viewScatter * T(M_1_PI_F);
+}
+
+/// Energy conserving wrap diffuse term, does *not* include the divide by pi
+template <typename T>
+inline T Fd_Wrap(T nDotl, T w) {
+    return saturate((nDotl + w) / ((T(1.0) + w) * (T(1.0) + w)));
+}
+
+// MARK: Diffuse BRDF dispatch
+
+template <typename T>
+inline T diffuse(T roughness, T nDotv, T nDotl, T lDoth) {
+    // LAMBERT
+    return Fd_Lambert<T>();
+    // BURLEY
+//    return Fd_Burley(roughness, nDotv, nDotl, lDoth);
+}
+
+} // namespace brdf
+
+#endif /* __METAL_VERSION__ */
+
 #endif /* BRDFFunctions_h */
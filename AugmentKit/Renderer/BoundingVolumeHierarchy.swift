@@ -0,0 +1,708 @@
+//
+//  BoundingVolumeHierarchy.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - BoundingBox
+
+/// An axis aligned bounding box. A box is empty when `min` is greater than `max` on any axis.
+struct BoundingBox {
+    
+    var min = SIMD3<Float>(repeating: Float.greatestFiniteMagnitude)
+    var max = SIMD3<Float>(repeating: -Float.greatestFiniteMagnitude)
+    
+    /// `true` when the box does not contain any points
+    var isEmpty: Bool {
+        return any(min .> max)
+    }
+    
+    var center: SIMD3<Float> {
+        return (min + max) * 0.5
+    }
+    
+    /// The surface area of the box. Used as the cost metric when building a hierarchy.
+    var surfaceArea: Float {
+        guard !isEmpty else {
+            return 0
+        }
+        let extent = max - min
+        return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x)
+    }
+    
+    mutating func formUnion(_ point: SIMD3<Float>) {
+        min = simd_min(min, point)
+        max = simd_max(max, point)
+    }
+    
+    mutating func formUnion(_ box: BoundingBox) {
+        min = simd_min(min, box.min)
+        max = simd_max(max, box.max)
+    }
+    
+    /// Returns the box that encloses this box after it has been transformed by the affine `transform`
+    func transformed(by transform: float4x4) -> BoundingBox {
+        guard !isEmpty else {
+            return self
+        }
+        let halfExtent = (max - min) * 0.5
+        let transformedCenter = (transform * SIMD4<Float>(center, 1)).xyz
+        let transformedHalfExtent = abs(transform.columns.0.xyz) * halfExtent.x + abs(transform.columns.1.xyz) * halfExtent.y + abs(transform.columns.2.xyz) * halfExtent.z
+        return BoundingBox(min: transformedCenter - transformedHalfExtent, max: transformedCenter + transformedHalfExtent)
+    }
+    
+    /// The squared distance from `point` to the closest point in the box. 0 when the point is inside the box.
+    func distanceSquared(to point: SIMD3<Float>) -> Float {
+        let zero = SIMD3<Float>(repeating: 0)
+        return length_squared(simd_max(min - point, zero) + simd_max(point - max, zero))
+    }
+    
+    /// Returns the distance along `ray` at which it enters the box, or `Float.infinity` when the ray misses the box or only reaches it beyond `maxDistance`. The three slabs are tested together.
+    @inline(__always)
+    func entryDistance(of ray: BVHRay, maxDistance: Float) -> Float {
+        let t0 = (min - ray.origin) * ray.inverseDirection
+        let t1 = (max - ray.origin) * ray.inverseDirection
+        let near = simd_reduce_max(simd_min(t0, t1))
+        let far = simd_reduce_min(simd_max(t0, t1))
+        guard near <= far, far >= 0, near <= maxDistance else {
+            return Float.infinity
+        }
+        return Swift.max(near, 0)
+    }
+
+}
+
+// MARK: - BVHRay
+
+/// A ray used to query a bounding volume hierarchy. `direction` does not need to be normalized. Distances reported by the queries are in multiples of the length of `direction`, which means they stay the same when the ray is transformed into the model space of an instance.
+struct BVHRay {
+    
+    var origin: SIMD3<Float>
+    var direction: SIMD3<Float>
+    /// `1 / direction`, precomputed for the slab tests. Components are infinite for axis aligned rays, which the slab test handles.
+    var inverseDirection: SIMD3<Float>
+    
+    init(origin: SIMD3<Float>, direction: SIMD3<Float>) {
+        self.origin = origin
+        self.direction = direction
+        self.inverseDirection = SIMD3<Float>(repeating: 1) / direction
+    }
+    
+    func transformed(by transform: float4x4) -> BVHRay {
+        return BVHRay(origin: (transform * SIMD4<Float>(origin, 1)).xyz, direction: (transform * SIMD4<Float>(direction, 0)).xyz)
+    }
+
+}
+
+// MARK: - ViewFrustum
+
+/// The six planes of a view frustum extracted from a view projection matrix with a clip space depth range of 0 to 1, as used by Metal. The plane normals point into the frustum.
+struct ViewFrustum {
+    
+    var planes: [SIMD4<Float>]
+    
+    init(viewProjectionMatrix: float4x4) {
+        let transposed = viewProjectionMatrix.transpose
+        let row0 = transposed.columns.0
+        let row1 = transposed.columns.1
+        let row2 = transposed.columns.2
+        let row3 = transposed.columns.3
+        // Left, right, bottom, top, near, far
+        planes = [row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2]
+    }
+    
+    /// Returns `false` when `box` lies completely outside of one of the planes. Boxes near the corners of the frustum may be reported as intersecting when they are not.
+    func intersects(_ box: BoundingBox) -> Bool {
+        for plane in planes {
+            let normal = plane.xyz
+            // The corner of the box furthest along the plane normal
+            let positiveVertex = box.min.replacing(with: box.max, where: normal .>= 0)
+            if dot(normal, positiveVertex) + plane.w < 0 {
+                return false
+            }
+        }
+        return true
+    }
+
+}
+
+// MARK: - BVHNode
+
+/// A node of a flattened hierarchy. Nodes are stored depth first, so the left child of an interior node immediately follows it and every child has a larger index than its parent.
+struct BVHNode {
+    
+    var bounds: BoundingBox
+    /// For an interior node, the index of the right child. For a leaf, the index of its first primitive in the hierarchy's primitive order.
+    var offset: Int
+    /// The number of primitives in a leaf. 0 for interior nodes.
+    var count: Int
+    
+    var isLeaf: Bool {
+        return count > 0
+    }
+
+}
+
+// MARK: - BoundingVolumeHierarchy
+
+/// Builds, refits and traverses flattened bounding volume hierarchies. The hierarchy only knows the bounds of its primitives; `TriangleBVH` and `InstanceBVH` supply the primitive tests.
+///
+/// Hierarchies are built top down with the surface area heuristic evaluated over `binCount` bins along the axis with the largest spread of primitive centers.
+enum BoundingVolumeHierarchy {
+    
+    /// The number of bins the surface area heuristic is evaluated over
+    static let binCount = 12
+    /// Leaves never contain more primitives than this
+    static let maxLeafSize = 4
+    
+    /// Returns the nodes of a hierarchy over `primitiveBounds` and the order the primitives must be stored in so every leaf refers to a contiguous range of them
+    static func build(primitiveBounds: [BoundingBox]) -> (nodes: [BVHNode], order: [Int]) {
+        var order = Array(0..<primitiveBounds.count)
+        var nodes = [BVHNode]()
+        guard !primitiveBounds.isEmpty else {
+            return (nodes: nodes, order: order)
+        }
+        nodes.reserveCapacity(2 * primitiveBounds.count)
+        let centers = primitiveBounds.map { $0.center }
+        buildNode(start: 0, end: order.count, primitiveBounds: primitiveBounds, centers: centers, order: &order, nodes: &nodes)
+        return (nodes: nodes, order: order)
+    }
+    
+    /// Recomputes the bounds of every node from `primitiveBounds` without changing the structure of the hierarchy. Children always follow their parent so a single reverse pass updates every child before its parent.
+    static func refit(nodes: inout [BVHNode], primitiveBounds: [BoundingBox], order: [Int]) {
+        for nodeIndex in stride(from: nodes.count - 1, through: 0, by: -1) {
+            let node = nodes[nodeIndex]
+            var bounds = BoundingBox()
+            if node.isLeaf {
+                for index in node.offset..<(node.offset + node.count) {
+                    bounds.formUnion(primitiveBounds[order[index]])
+                }
+            } else {
+                bounds = nodes[nodeIndex + 1].bounds
+                bounds.formUnion(nodes[node.offset].bounds)
+            }
+            nodes[nodeIndex].bounds = bounds
+        }
+    }
+    
+    /// The sum of the surface areas of every node. This grows as refitting loosens a hierarchy and is used to decide when to rebuild it.
+    static func totalSurfaceArea(of nodes: [BVHNode]) -> Float {
+        return nodes.reduce(Float(0)) { $0 + $1.bounds.surfaceArea }
+    }
+    
+    /// Finds the closest primitive hit by `ray`. `primitiveDistance` is called with the index of a primitive in the hierarchy's order and the closest distance found so far, and returns the distance to the primitive or `nil` when it is missed or further away. Returns the ordered index and distance of the closest hit.
+    ///
+    /// The nearer child is visited first and nodes that start beyond the closest hit found so far are skipped.
+    static func closestHit(nodes: [BVHNode], ray: BVHRay, maxDistance: Float, primitiveDistance: (_ orderedIndex: Int, _ maxDistance: Float) -> Float?) -> (orderedIndex: Int, distance: Float)? {
+        
+        guard let root = nodes.first, root.bounds.entryDistance(of: ray, maxDistance: maxDistance) < Float.infinity else {
+            return nil
+        }
+        
+        var closest: (orderedIndex: Int, distance: Float)?
+        var closestDistance = maxDistance
+        var stack = [(nodeIndex: Int, distance: Float)]()
+        stack.reserveCapacity(64)
+        var nodeIndex = 0
+        
+        while true {
+            
+            let node = nodes[nodeIndex]
+            if node.isLeaf {
+                for orderedIndex in node.offset..<(node.offset + node.count) {
+                    if let distance = primitiveDistance(orderedIndex, closestDistance), distance <= closestDistance {
+                        closest = (orderedIndex: orderedIndex, distance: distance)
+                        closestDistance = distance
+                    }
+                }
+            } else {
+                let leftIndex = nodeIndex + 1
+                let rightIndex = node.offset
+                let leftDistance = nodes[leftIndex].bounds.entryDistance(of: ray, maxDistance: closestDistance)
+                let rightDistance = nodes[rightIndex].bounds.entryDistance(of: ray, maxDistance: closestDistance)
+                if leftDistance < Float.infinity, rightDistance < Float.infinity {
+                    if leftDistance <= rightDistance {
+                        stack.append((nodeIndex: rightIndex, distance: rightDistance))
+                        nodeIndex = leftIndex
+                    } else {
+                        stack.append((nodeIndex: leftIndex, distance: leftDistance))
+                        nodeIndex = rightIndex
+                    }
+                    continue
+                } else if leftDistance < Float.infinity {
+                    nodeIndex = leftIndex
+                    continue
+                } else if rightDistance < Float.infinity {
+                    nodeIndex = rightIndex
+                    continue
+                }
+            }
+            
+            // Resume from the most recently deferred node that can still contain a closer hit
+            var next: Int?
+            while let entry = stack.popLast() {
+                if entry.distance <= closestDistance {
+                    next = entry.nodeIndex
+                    break
+                }
+            }
+            guard let nextIndex = next else {
+                break
+            }
+            nodeIndex = nextIndex
+            
+        }
+        
+        return closest
+        
+    }
+    
+    /// Calls `visitPrimitive` with the ordered index of every primitive in a leaf whose bounds satisfy `overlaps`. Stops as soon as `visitPrimitive` returns `false`.
+    static func visitOverlapping(nodes: [BVHNode], overlaps: (BoundingBox) -> Bool, visitPrimitive: (_ orderedIndex: Int) -> Bool) {
+        guard !nodes.isEmpty else {
+            return
+        }
+        var stack = [0]
+        stack.reserveCapacity(64)
+        while let nodeIndex = stack.popLast() {
+            let node = nodes[nodeIndex]
+            guard overlaps(node.bounds) else {
+                continue
+            }
+            if node.isLeaf {
+                for orderedIndex in node.offset..<(node.offset + node.count) {
+                    guard visitPrimitive(orderedIndex) else {
+                        return
+                    }
+                }
+            } else {
+                stack.append(node.offset)
+                stack.append(nodeIndex + 1)
+            }
+        }
+    }
+    
+    // MARK: - Private
+    
+    fileprivate static func buildNode(start: Int, end: Int, primitiveBounds: [BoundingBox], centers: [SIMD3<Float>], order: inout [Int], nodes: inout [BVHNode]) {
+        
+        var bounds = BoundingBox()
+        var centerBounds = BoundingBox()
+        for index in start..<end {
+            bounds.formUnion(primitiveBounds[order[index]])
+            centerBounds.formUnion(centers[order[index]])
+        }
+        
+        let nodeIndex = nodes.count
+        let count = end - start
+        nodes.append(BVHNode(bounds: bounds, offset: start, count: count))
+        
+        guard count > maxLeafSize else {
+            return
+        }
+        
+        // Split along the axis with the largest spread of centers. When every center coincides the range is split in half.
+        let extent = centerBounds.max - centerBounds.min
+        let axis: Int = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2)
+        var middle = start + count / 2
+        
+        if extent[axis] > 0 {
+            
+            let binScale = Float(binCount) / extent[axis]
+            let axisMinimum = centerBounds.min[axis]
+            let binIndex: (Int) -> Int = { primitive in
+                return Swift.min(binCount - 1, Int((centers[primitive][axis] - axisMinimum) * binScale))
+            }
+            
+            var binCounts = [Int](repeating: 0, count: binCount)
+            var binBounds = [BoundingBox](repeating: BoundingBox(), count: binCount)
+            for index in start..<end {
+                let bin = binIndex(order[index])
+                binCounts[bin] += 1
+                binBounds[bin].formUnion(primitiveBounds[order[index]])
+            }
+            
+            // Sweep from the right to accumulate the cost of everything after each split, then from the left to find the cheapest split
+            var rightAreas = [Float](repeating: 0, count: binCount)
+            var rightCounts = [Int](repeating: 0, count: binCount)
+            var accumulatedBounds = BoundingBox()
+            var accumulatedCount = 0
+            for bin in stride(from: binCount - 1, to: 0, by: -1) {
+                accumulatedBounds.formUnion(binBounds[bin])
+                accumulatedCount += binCounts[bin]
+                rightAreas[bin] = accumulatedBounds.surfaceArea
+                rightCounts[bin] = accumulatedCount
+            }
+            
+            var bestCost = Float.greatestFiniteMagnitude
+            var bestSplit = binCount / 2
+            accumulatedBounds = BoundingBox()
+            accumulatedCount = 0
+            for split in 1..<binCount {
+                accumulatedBounds.formUnion(binBounds[split - 1])
+                accumulatedCount += binCounts[split - 1]
+                guard accumulatedCount > 0, rightCounts[split] > 0 else {
+                    continue
+                }
+                let cost = accumulatedBounds.surfaceArea * Float(accumulatedCount) + rightAreas[split] * Float(rightCounts[split])
+                if cost < bestCost {
+                    bestCost = cost
+                    bestSplit = split
+                }
+            }
+            
+            // Partition the range in place around the split
+            var left = start
+            var right = end - 1
+            while left <= right {
+                if binIndex(order[left]) < bestSplit {
+                    left += 1
+                } else {
+                    order.swapAt(left, right)
+                    right -= 1
+                }
+            }
+            if left > start && left < end {
+                middle = left
+            }
+            
+        }
+        
+        buildNode(start: start, end: middle, primitiveBounds: primitiveBounds, centers: centers, order: &order, nodes: &nodes)
+        nodes[nodeIndex].offset = nodes.count
+        nodes[nodeIndex].count = 0
+        buildNode(start: middle, end: end, primitiveBounds: primitiveBounds, centers: centers, order: &order, nodes: &nodes)
+        
+    }
+
+}
+
+// MARK: - TriangleBVH
+
+/// The closest intersection of a ray with a `TriangleBVH`
+struct TriangleHit {
+    /// The distance along the ray in multiples of the length of the ray's direction
+    var distance: Float
+    /// The index of the triangle in the order the indices were provided
+    var triangleIndex: Int
+    /// The unnormalized geometric normal of the triangle in model space. Follows the winding of the triangle.
+    var normal: SIMD3<Float>
+}
+
+/// A bounding volume hierarchy over the triangles of one mesh in model space. It is built once when the mesh is imported and never changes. Moving the mesh only moves the instances that refer to it (see `InstanceBVH`).
+///
+/// Triangles are stored in leaf order as a vertex and two edges so the ray test reads contiguous memory. Triangles are double sided.
+final class TriangleBVH {
+    
+    /// The bounds of the whole mesh
+    var bounds: BoundingBox {
+        return nodes.first?.bounds ?? BoundingBox()
+    }
+    
+    /// The number of triangles in the hierarchy
+    var triangleCount: Int {
+        return triangleIndices.count
+    }
+    
+    /// Builds the hierarchy for a triangle list. Triangles that refer to missing vertices are skipped. Returns `nil` when there are no triangles.
+    init?(positions: [SIMD3<Float>], indices: [UInt32]) {
+        
+        var primitiveBounds = [BoundingBox]()
+        var sourceIndices = [Int]()
+        let triangleCount = indices.count / 3
+        primitiveBounds.reserveCapacity(triangleCount)
+        sourceIndices.reserveCapacity(triangleCount)
+        for triangle in 0..<triangleCount {
+            let index0 = Int(indices[3 * triangle])
+            let index1 = Int(indices[3 * triangle + 1])
+            let index2 = Int(indices[3 * triangle + 2])
+            guard index0 < positions.count, index1 < positions.count, index2 < positions.count else {
+                continue
+            }
+            var triangleBounds = BoundingBox()
+            triangleBounds.formUnion(positions[index0])
+            triangleBounds.formUnion(positions[index1])
+            triangleBounds.formUnion(positions[index2])
+            primitiveBounds.append(triangleBounds)
+            sourceIndices.append(triangle)
+        }
+        
+        guard !primitiveBounds.isEmpty else {
+            return nil
+        }
+        
+        let hierarchy = BoundingVolumeHierarchy.build(primitiveBounds: primitiveBounds)
+        nodes = hierarchy.nodes
+        triangleIndices = hierarchy.order.map { sourceIndices[$0] }
+        vertices = [SIMD3<Float>]()
+        edges1 = [SIMD3<Float>]()
+        edges2 = [SIMD3<Float>]()
+        vertices.reserveCapacity(triangleIndices.count)
+        edges1.reserveCapacity(triangleIndices.count)
+        edges2.reserveCapacity(triangleIndices.count)
+        for triangle in triangleIndices {
+            let vertex0 = positions[Int(indices[3 * triangle])]
+            vertices.append(vertex0)
+            edges1.append(positions[Int(indices[3 * triangle + 1])] - vertex0)
+            edges2.append(positions[Int(indices[3 * triangle + 2])] - vertex0)
+        }
+        
+    }
+    
+    /// Returns the closest triangle hit by `ray` within `maxDistance`
+    func intersect(_ ray: BVHRay, maxDistance: Float = Float.greatestFiniteMagnitude) -> TriangleHit? {
+        let hit = BoundingVolumeHierarchy.closestHit(nodes: nodes, ray: ray, maxDistance: maxDistance) { orderedIndex, closestDistance in
+            return TriangleBVH.intersect(ray, vertex: vertices[orderedIndex], edge1: edges1[orderedIndex], edge2: edges2[orderedIndex], maxDistance: closestDistance)
+        }
+        guard let closest = hit else {
+            return nil
+        }
+        return TriangleHit(distance: closest.distance, triangleIndex: triangleIndices[closest.orderedIndex], normal: cross(edges1[closest.orderedIndex], edges2[closest.orderedIndex]))
+    }
+    
+    /// Returns `true` when any triangle, after being transformed by `transform`, comes within `radius` of `center`. Testing in the space of the sphere keeps the test exact for instances with non uniform scale.
+    func intersects(sphereWithCenter center: SIMD3<Float>, radius: Float, transform: float4x4 = matrix_identity_float4x4) -> Bool {
+        let radiusSquared = radius * radius
+        var isIntersecting = false
+        BoundingVolumeHierarchy.visitOverlapping(nodes: nodes, overlaps: { $0.transformed(by: transform).distanceSquared(to: center) <= radiusSquared }, visitPrimitive: { orderedIndex in
+            let vertex0 = (transform * SIMD4<Float>(vertices[orderedIndex], 1)).xyz
+            let vertex1 = vertex0 + (transform * SIMD4<Float>(edges1[orderedIndex], 0)).xyz
+            let vertex2 = vertex0 + (transform * SIMD4<Float>(edges2[orderedIndex], 0)).xyz
+            let closestPoint = TriangleBVH.closestPoint(to: center, a: vertex0, b: vertex1, c: vertex2)
+            isIntersecting = length_squared(closestPoint - center) <= radiusSquared
+            return !isIntersecting
+        })
+        return isIntersecting
+    }
+    
+    // MARK: Reference
+    
+    /// Tests every triangle without using the hierarchy. Intended as a reference when validating the hierarchy and measuring its speed up.
+    func intersectReference(_ ray: BVHRay, maxDistance: Float = Float.greatestFiniteMagnitude) -> TriangleHit? {
+        var closest: TriangleHit?
+        var closestDistance = maxDistance
+        for orderedIndex in 0..<triangleIndices.count {
+            if let distance = TriangleBVH.intersect(ray, vertex: vertices[orderedIndex], edge1: edges1[orderedIndex], edge2: edges2[orderedIndex], maxDistance: closestDistance) {
+                closestDistance = distance
+                closest = TriangleHit(distance: distance, triangleIndex: triangleIndices[orderedIndex], normal: cross(edges1[orderedIndex], edges2[orderedIndex]))
+            }
+        }
+        return closest
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var nodes: [BVHNode]
+    fileprivate var triangleIndices: [Int]
+    fileprivate var vertices: [SIMD3<Float>]
+    fileprivate var edges1: [SIMD3<Float>]
+    fileprivate var edges2: [SIMD3<Float>]
+    
+    // Möller–Trumbore. Returns the distance to the triangle or `nil` when it is missed or further than `maxDistance`.
+    @inline(__always)
+    fileprivate static func intersect(_ ray: BVHRay, vertex: SIMD3<Float>, edge1: SIMD3<Float>, edge2: SIMD3<Float>, maxDistance: Float) -> Float? {
+        let p = cross(ray.direction, edge2)
+        let determinant = dot(edge1, p)
+        guard abs(determinant) > 1.0e-12 else {
+            return nil
+        }
+        let inverseDeterminant = 1 / determinant
+        let s = ray.origin - vertex
+        let u = dot(s, p) * inverseDeterminant
+        guard u >= 0, u <= 1 else {
+            return nil
+        }
+        let q = cross(s, edge1)
+        let v = dot(ray.direction, q) * inverseDeterminant
+        guard v >= 0, u + v <= 1 else {
+            return nil
+        }
+        let distance = dot(edge2, q) * inverseDeterminant
+        guard distance >= 0, distance <= maxDistance else {
+            return nil
+        }
+        return distance
+    }
+    
+    // The closest point on the triangle abc to p, found by testing which Voronoi region of the triangle contains p
+    fileprivate static func closestPoint(to p: SIMD3<Float>, a: SIMD3<Float>, b: SIMD3<Float>, c: SIMD3<Float>) -> SIMD3<Float> {
+        
+        let ab = b - a
+        let ac = c - a
+        let ap = p - a
+        let d1 = dot(ab, ap)
+        let d2 = dot(ac, ap)
+        if d1 <= 0 && d2 <= 0 {
+            return a
+        }
+        
+        let bp = p - b
+        let d3 = dot(ab, bp)
+        let d4 = dot(ac, bp)
+        if d3 >= 0 && d4 <= d3 {
+            return b
+        }
+        
+        let vc = d1 * d4 - d3 * d2
+        if vc <= 0 && d1 >= 0 && d3 <= 0 {
+            return a + ab * (d1 / (d1 - d3))
+        }
+        
+        let cp = p - c
+        let d5 = dot(ab, cp)
+        let d6 = dot(ac, cp)
+        if d6 >= 0 && d5 <= d6 {
+            return c
+        }
+        
+        let vb = d5 * d2 - d1 * d6
+        if vb <= 0 && d2 >= 0 && d6 <= 0 {
+            return a + ac * (d2 / (d2 - d6))
+        }
+        
+        let va = d3 * d6 - d5 * d4
+        if va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0 {
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))
+        }
+        
+        let denominator = 1 / (va + vb + vc)
+        return a + ab * (vb * denominator) + ac * (vc * denominator)
+        
+    }
+
+}
+
+// MARK: - InstanceBVH
+
+/// One placement of a `TriangleBVH` in world space
+struct BVHInstance {
+    /// The identifier of the entity the mesh belongs to
+    var identifier: UUID
+    var mesh: TriangleBVH
+    /// The model to world transform
+    var transform: float4x4
+}
+
+/// A bounding volume hierarchy over mesh instances in world space. Moving instances only refits the hierarchy. It is rebuilt when instances are added or removed, or when refitting has loosened it past `rebuildThreshold`.
+final class InstanceBVH {
+    
+    /// A refitted hierarchy is rebuilt once the total surface area of its nodes grows past this multiple of the area it had when it was built
+    static let rebuildThreshold: Float = 2
+    
+    /// The instances in the order they were provided
+    fileprivate(set) var instances = [BVHInstance]()
+    
+    /// Replaces every instance and rebuilds the hierarchy
+    func rebuild(with newInstances: [BVHInstance]) {
+        instances = newInstances
+        inverseTransforms = instances.map { $0.transform.inverse }
+        instanceBounds = instances.map { $0.mesh.bounds.transformed(by: $0.transform) }
+        let hierarchy = BoundingVolumeHierarchy.build(primitiveBounds: instanceBounds)
+        nodes = hierarchy.nodes
+        order = hierarchy.order
+        builtSurfaceArea = BoundingVolumeHierarchy.totalSurfaceArea(of: nodes)
+        needsRefit = false
+    }
+    
+    /// Moves the instance at `index`. The hierarchy is refit by the next call to `refit()`.
+    func setTransform(_ transform: float4x4, forInstanceAt index: Int) {
+        instances[index].transform = transform
+        inverseTransforms[index] = transform.inverse
+        instanceBounds[index] = instances[index].mesh.bounds.transformed(by: transform)
+        needsRefit = true
+    }
+    
+    /// Refits the hierarchy to the current instance transforms, rebuilding it instead when it has become too loose
+    func refit() {
+        guard needsRefit else {
+            return
+        }
+        needsRefit = false
+        BoundingVolumeHierarchy.refit(nodes: &nodes, primitiveBounds: instanceBounds, order: order)
+        if BoundingVolumeHierarchy.totalSurfaceArea(of: nodes) > InstanceBVH.rebuildThreshold * builtSurfaceArea {
+            rebuild(with: instances)
+        }
+    }
+    
+    /// Returns the index of the instance with the closest triangle hit by `ray` and the hit in the model space of that instance. Instances for which `isIncluded` returns `false` are ignored.
+    func intersect(_ ray: BVHRay, maxDistance: Float = Float.greatestFiniteMagnitude, where isIncluded: (BVHInstance) -> Bool = { _ in return true }) -> (instanceIndex: Int, hit: TriangleHit)? {
+        var closestHit: TriangleHit?
+        let closest = BoundingVolumeHierarchy.closestHit(nodes: nodes, ray: ray, maxDistance: maxDistance) { orderedIndex, closestDistance in
+            let instanceIndex = order[orderedIndex]
+            guard isIncluded(instances[instanceIndex]) else {
+                return nil
+            }
+            // The ray direction is not normalized after the transform so distances in model space match world space
+            guard let hit = instances[instanceIndex].mesh.intersect(ray.transformed(by: inverseTransforms[instanceIndex]), maxDistance: closestDistance) else {
+                return nil
+            }
+            closestHit = hit
+            return hit.distance
+        }
+        guard let instanceHit = closest, let hit = closestHit else {
+            return nil
+        }
+        return (instanceIndex: order[instanceHit.orderedIndex], hit: hit)
+    }
+    
+    /// Returns the indices of the instances that have a triangle within `radius` of `center`
+    func instances(intersectingSphereWithCenter center: SIMD3<Float>, radius: Float) -> [Int] {
+        let radiusSquared = radius * radius
+        var result = [Int]()
+        BoundingVolumeHierarchy.visitOverlapping(nodes: nodes, overlaps: { $0.distanceSquared(to: center) <= radiusSquared }, visitPrimitive: { orderedIndex in
+            let instanceIndex = order[orderedIndex]
+            if instanceBounds[instanceIndex].distanceSquared(to: center) <= radiusSquared, instances[instanceIndex].mesh.intersects(sphereWithCenter: center, radius: radius, transform: instances[instanceIndex].transform) {
+                result.append(instanceIndex)
+            }
+            return true
+        })
+        return result
+    }
+    
+    /// Returns the indices of the instances whose world space bounds intersect `frustum`
+    func instances(in frustum: ViewFrustum) -> [Int] {
+        var result = [Int]()
+        BoundingVolumeHierarchy.visitOverlapping(nodes: nodes, overlaps: { frustum.intersects($0) }, visitPrimitive: { orderedIndex in
+            let instanceIndex = order[orderedIndex]
+            if frustum.intersects(instanceBounds[instanceIndex]) {
+                result.append(instanceIndex)
+            }
+            return true
+        })
+        return result
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var nodes = [BVHNode]()
+    fileprivate var order = [Int]()
+    fileprivate var inverseTransforms = [float4x4]()
+    fileprivate var instanceBounds = [BoundingBox]()
+    fileprivate var builtSurfaceArea: Float = 0
+    fileprivate var needsRefit = false
+
+}
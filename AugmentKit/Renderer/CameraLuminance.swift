@@ -0,0 +1,432 @@
+//
+//  CameraLuminance.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import Metal
+import simd
+import AugmentKitShader
+
+// MARK: - CameraLuminanceHistogram
+
+/**
+ A log2 luminance histogram and the average linear color of a captured camera frame. Produced on the GPU by `CameraLuminanceReduction` or on the host by `init(yPlane:yBytesPerRow:cbcrPlane:cbcrBytesPerRow:width:height:sampleGridSize:minLogLuminance:logLuminanceRange:)`.
+ 
+ `CameraLuminanceHistogram` does not depend on Metal so it can be created and tested on the host.
+ */
+struct CameraLuminanceHistogram {
+    
+    /// The number of samples in each bin
+    var bins: [UInt32]
+    /// The total number of samples
+    var sampleCount: UInt32
+    /// The sum of the linear color of every sample
+    var colorSum: SIMD3<Float>
+    /// The log2 luminance of the lower edge of the first bin
+    var minLogLuminance: Float
+    /// The log2 luminance range covered by all of the bins
+    var logLuminanceRange: Float
+    
+    /// The log average (geometric mean) luminance
+    var logAverageLuminance: Float {
+        guard sampleCount > 0 else {
+            return 0
+        }
+        var weightedSum: Float = 0
+        for (bin, count) in bins.enumerated() where count > 0 {
+            weightedSum += Float(count) * logLuminance(atBinCenter: bin)
+        }
+        return exp2(weightedSum / Float(sampleCount))
+    }
+    
+    /// The average linear color
+    var averageColor: SIMD3<Float> {
+        guard sampleCount > 0 else {
+            return SIMD3<Float>(repeating: 0)
+        }
+        return colorSum / Float(sampleCount)
+    }
+    
+    /// The color of the light illuminating the scene assuming the scene averages to gray (the gray world assumption). Normalized so the largest channel is 1.
+    var grayWorldIlluminant: SIMD3<Float> {
+        let average = averageColor
+        let largest = max(average.x, max(average.y, average.z))
+        guard largest > 0 else {
+            return SIMD3<Float>(repeating: 1)
+        }
+        return average / largest
+    }
+    
+    /// The per channel gains that neutralize `grayWorldIlluminant`, normalized so that the green gain is 1
+    var grayWorldWhiteBalance: SIMD3<Float> {
+        let illuminant = simd_max(grayWorldIlluminant, SIMD3<Float>(repeating: 1.0e-3))
+        return SIMD3<Float>(repeating: illuminant.y) / illuminant
+    }
+    
+    /// The luminance below which `percentile` (0 to 1) of the samples fall
+    func luminance(atPercentile percentile: Float) -> Float {
+        guard sampleCount > 0 else {
+            return 0
+        }
+        let threshold = UInt32(min(max(percentile, 0), 1) * Float(sampleCount))
+        var cumulative: UInt32 = 0
+        for (bin, count) in bins.enumerated() {
+            cumulative += count
+            if cumulative >= threshold {
+                return exp2(logLuminance(atBinCenter: bin))
+            }
+        }
+        return exp2(minLogLuminance + logLuminanceRange)
+    }
+    
+    fileprivate func logLuminance(atBinCenter bin: Int) -> Float {
+        return minLogLuminance + (Float(bin) + 0.5) / Float(bins.count) * logLuminanceRange
+    }
+    
+}
+
+extension CameraLuminanceHistogram {
+    
+    /// Reads a histogram from the buffer layout written by the `camera_luminance_histogram` kernel. See `CameraLuminanceHistogramLayout`
+    init(contents: UnsafePointer<UInt32>, minLogLuminance: Float, logLuminanceRange: Float) {
+        let binCount = Int(kCameraLuminanceHistogramBinCount.rawValue)
+        bins = Array(UnsafeBufferPointer(start: contents, count: binCount))
+        sampleCount = contents[Int(kCameraLuminanceHistogramSampleCountIndex.rawValue)]
+        let lowWords = SIMD3<Double>(Double(contents[Int(kCameraLuminanceHistogramRedSumIndex.rawValue)]), Double(contents[Int(kCameraLuminanceHistogramGreenSumIndex.rawValue)]), Double(contents[Int(kCameraLuminanceHistogramBlueSumIndex.rawValue)]))
+        let highWords = SIMD3<Double>(Double(contents[Int(kCameraLuminanceHistogramRedSumHighIndex.rawValue)]), Double(contents[Int(kCameraLuminanceHistogramGreenSumHighIndex.rawValue)]), Double(contents[Int(kCameraLuminanceHistogramBlueSumHighIndex.rawValue)]))
+        colorSum = SIMD3<Float>((highWords * Double(kCameraLuminanceColorSumWordSize) + lowWords) / kCameraLuminanceColorSumScale)
+        self.minLogLuminance = minLogLuminance
+        self.logLuminanceRange = logLuminanceRange
+    }
+    
+    /**
+     Host reference for the `camera_luminance_histogram` kernel. Reduces the planes of a bi-planar, full range Y/CbCr image (the format of `ARFrame.capturedImage`) eight samples at a time. Samples are taken at the same grid positions as the kernel but with nearest filtering, so results agree with the GPU up to filtering and rounding.
+     - Parameters:
+        - yPlane: The luma plane
+        - yBytesPerRow: The bytes per row of the luma plane
+        - cbcrPlane: The interleaved chroma plane. Half the width and height of the luma plane.
+        - cbcrBytesPerRow: The bytes per row of the chroma plane
+        - width: The width of the luma plane
+        - height: The height of the luma plane
+        - sampleGridSize: The number of samples in each direction
+        - minLogLuminance: The log2 luminance of the lower edge of the first bin
+        - logLuminanceRange: The log2 luminance range covered by all of the bins
+     */
+    init(yPlane: UnsafePointer<UInt8>, yBytesPerRow: Int, cbcrPlane: UnsafePointer<UInt8>, cbcrBytesPerRow: Int, width: Int, height: Int, sampleGridSize: SIMD2<Int>, minLogLuminance: Float, logLuminanceRange: Float) {
+        
+        let binCount = Int(kCameraLuminanceHistogramBinCount.rawValue)
+        var bins = [UInt32](repeating: 0, count: binCount)
+        var sampleCount: UInt32 = 0
+        var colorSum = SIMD3<UInt64>(repeating: 0)
+        let laneCount = SIMD8<Float>.scalarCount
+        
+        for sampleY in 0..<max(sampleGridSize.y, 0) {
+            
+            let y = min(Int((Float(sampleY) + 0.5) / Float(sampleGridSize.y) * Float(height)), height - 1)
+            var sampleX = 0
+            
+            while sampleX < sampleGridSize.x {
+                
+                // Gather up to eight samples along the row
+                let activeLanes = min(laneCount, sampleGridSize.x - sampleX)
+                var luma = SIMD8<Float>(repeating: 0)
+                var cb = SIMD8<Float>(repeating: 0.5)
+                var cr = SIMD8<Float>(repeating: 0.5)
+                for lane in 0..<activeLanes {
+                    let x = min(Int((Float(sampleX + lane) + 0.5) / Float(sampleGridSize.x) * Float(width)), width - 1)
+                    luma[lane] = Float(yPlane[y * yBytesPerRow + x])
+                    let chromaOffset = (y / 2) * cbcrBytesPerRow + (x / 2) * 2
+                    cb[lane] = Float(cbcrPlane[chromaOffset])
+                    cr[lane] = Float(cbcrPlane[chromaOffset + 1])
+                }
+                
+                let color = CameraLuminanceHistogram.linearColor(y: luma / 255, cb: cb / 255, cr: cr / 255)
+                let luminance = color.red * 0.2126 + color.green * 0.7152 + color.blue * 0.0722
+                
+                for lane in 0..<activeLanes {
+                    let logLuminance = luminance[lane] > 0 ? log2(luminance[lane]) : minLogLuminance
+                    let normalized = min(max((logLuminance - minLogLuminance) / logLuminanceRange, 0), 1)
+                    let bin = min(Int(normalized * Float(binCount)), binCount - 1)
+                    bins[bin] += 1
+                    sampleCount += 1
+                    let scaled = (SIMD3<Float>(color.red[lane], color.green[lane], color.blue[lane]) * Float(kCameraLuminanceColorSumScale)).rounded(.toNearestOrAwayFromZero)
+                    colorSum &+= SIMD3<UInt64>(scaled)
+                }
+                
+                sampleX += activeLanes
+                
+            }
+            
+        }
+        
+        self.bins = bins
+        self.sampleCount = sampleCount
+        self.colorSum = SIMD3<Float>(SIMD3<Double>(colorSum) / kCameraLuminanceColorSumScale)
+        self.minLogLuminance = minLogLuminance
+        self.logLuminanceRange = logLuminanceRange
+        
+    }
+    
+    /// Decodes eight Y/CbCr samples (0 to 1) to linear color. Mirrors `cameraLinearColor` in CompositeShaders.metal
+    static func linearColor(y: SIMD8<Float>, cb: SIMD8<Float>, cr: SIMD8<Float>) -> (red: SIMD8<Float>, green: SIMD8<Float>, blue: SIMD8<Float>) {
+        let zero = SIMD8<Float>(repeating: 0)
+        let one = SIMD8<Float>(repeating: 1)
+        let red = (y + 1.4020 * cr - 0.7010).clamped(lowerBound: zero, upperBound: one)
+        let green = (y - 0.3441 * cb - 0.7141 * cr + 0.5291).clamped(lowerBound: zero, upperBound: one)
+        let blue = (y + 1.7720 * cb - 0.8860).clamped(lowerBound: zero, upperBound: one)
+        return (red: srgbToLinear(red), green: srgbToLinear(green), blue: srgbToLinear(blue))
+    }
+    
+    fileprivate static func srgbToLinear(_ value: SIMD8<Float>) -> SIMD8<Float> {
+        var result = value
+        for lane in 0..<SIMD8<Float>.scalarCount {
+            result[lane] = srgbToLinearExact(result[lane])
+        }
+        return result
+    }
+    
+}
+
+// MARK: - CameraExposureAdaptation
+
+/**
+ Turns per frame camera statistics into exposure and ambient lighting values that change smoothly over time, so virtual content doesn't pop in brightness when the light estimate or the camera's own exposure jumps.
+ 
+ Values adapt in log space at `brighteningRate` and `darkeningRate` (in stops per second), mimicking the way eyes and cameras adapt faster to light than to dark.
+ */
+struct CameraExposureAdaptation {
+    
+    /// The luminance that the log average luminance of the frame is mapped to
+    var key: Float = 0.18
+    /// The percentile treated as the brightest highlight that should not clip
+    var highlightPercentile: Float = 0.95
+    /// The exposure is kept within this range
+    var exposureRange: ClosedRange<Float> = (1.0 / 16.0)...16
+    /// Adaptation speed, in stops per second, when the scene gets brighter
+    var brighteningRate: Float = 3
+    /// Adaptation speed, in stops per second, when the scene gets darker
+    var darkeningRate: Float = 1.5
+    /// Adaptation speed, per second, of the ambient light color
+    var colorRate: Float = 1
+    
+    /// The exposure that maps the scene to display brightness
+    fileprivate(set) var exposure: Float = 1
+    /// The ambient intensity for lighting virtual content. The inverse of `exposure`, so that content appears as bright as the camera image around it.
+    var ambientLightIntensity: Float {
+        return 1 / exposure
+    }
+    /// The color of the ambient light
+    fileprivate(set) var ambientLightColor = SIMD3<Float>(0.5, 0.5, 0.5)
+    
+    /// Adapts toward the statistics of a camera frame
+    mutating func update(with histogram: CameraLuminanceHistogram, timestamp: TimeInterval) {
+        guard histogram.sampleCount > 0 else {
+            return
+        }
+        let averageLuminance = max(histogram.logAverageLuminance, Float.leastNormalMagnitude)
+        let highlight = max(histogram.luminance(atPercentile: highlightPercentile), Float.leastNormalMagnitude)
+        let targetExposure = min(key / averageLuminance, 1 / highlight)
+        adapt(toExposure: targetExposure, ambientLightColor: histogram.grayWorldIlluminant, timestamp: timestamp)
+    }
+    
+    /// Adapts toward ARKit's light estimate. Used when camera statistics are not available.
+    mutating func update(withAmbientIntensity ambientIntensity: Float, ambientLightColor: SIMD3<Float>, timestamp: TimeInterval) {
+        adapt(toExposure: 1 / max(ambientIntensity, Float.leastNormalMagnitude), ambientLightColor: ambientLightColor, timestamp: timestamp)
+    }
+    
+    /// Converts a color temperature in Kelvin to an RGB color
+    static func rgb(fromColorTemperature colorTemperature: Float) -> SIMD3<Float> {
+        
+        let temp = colorTemperature / 100
+        
+        var red: Float = 127
+        var green: Float = 127
+        var blue: Float = 127
+        
+        if temp <= 66 {
+            red = 255
+            green = 99.4708025861 * log(temp) - 161.1195681661
+            if temp <= 19 {
+                blue = 0
+            } else {
+                blue = 138.5177312231 * log(temp - 10) - 305.0447927307
+            }
+        } else {
+            red = 329.698727446 * pow(temp - 60, -0.1332047592)
+            green = 288.1221695283 * pow(temp - 60, -0.0755148492)
+            blue = 255
+        }
+        
+        return clamp(SIMD3<Float>(red, green, blue), min: 0, max: 255) / 255
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var lastTimestamp: TimeInterval?
+    
+    fileprivate mutating func adapt(toExposure targetExposure: Float, ambientLightColor targetColor: SIMD3<Float>, timestamp: TimeInterval) {
+        
+        let clampedTarget = min(max(targetExposure, exposureRange.lowerBound), exposureRange.upperBound)
+        
+        guard let lastTimestamp = lastTimestamp else {
+            // Start at the target rather than fading in from the defaults
+            exposure = clampedTarget
+            ambientLightColor = targetColor
+            self.lastTimestamp = timestamp
+            return
+        }
+        
+        let deltaTime = Float(max(timestamp - lastTimestamp, 0))
+        self.lastTimestamp = timestamp
+        
+        // A lower exposure means the scene got brighter
+        let currentStops = log2(exposure)
+        let targetStops = log2(clampedTarget)
+        let rate = targetStops < currentStops ? brighteningRate : darkeningRate
+        let maxStep = rate * deltaTime
+        exposure = exp2(currentStops + min(max(targetStops - currentStops, -maxStep), maxStep))
+        
+        let colorBlend = 1 - exp(-colorRate * deltaTime)
+        ambientLightColor = simd_mix(ambientLightColor, targetColor, SIMD3<Float>(repeating: colorBlend))
+        
+    }
+    
+}
+
+// MARK: - CameraLuminanceReduction
+
+/**
+ Reduces the captured camera frame to a `CameraLuminanceHistogram` on the GPU using the `camera_luminance_histogram` kernel.
+ 
+ Results are written to a ring of `maxInFlightFrames` buffers. The histogram for a buffer index is read back the next time that index comes around, by which point the frame that wrote it has completed, so reading never stalls.
+ */
+final class CameraLuminanceReduction {
+    
+    /// The number of samples taken in each direction
+    var sampleGridSize = SIMD2<UInt32>(160, 120)
+    /// The log2 luminance of the lower edge of the first bin
+    let minLogLuminance: Float = -12
+    /// The log2 luminance range covered by all of the bins
+    let logLuminanceRange: Float = 12
+    
+    init?(device: MTLDevice, metalLibrary: MTLLibrary, maxInFlightFrames: Int) {
+        
+        regionCount = max(maxInFlightFrames, 1)
+        
+        guard let function = metalLibrary.makeFunction(name: "camera_luminance_histogram") else {
+            print("Warning (CameraLuminanceReduction) - Failed to create the camera_luminance_histogram function.")
+            return nil
+        }
+        
+        do {
+            computePipelineState = try device.makeComputePipelineState(function: function)
+        } catch let error {
+            print("Warning (CameraLuminanceReduction) - Failed to create the compute pipeline state. ERROR: \(error)")
+            return nil
+        }
+        
+        alignedRegionSize = ((MemoryLayout<UInt32>.stride * Int(kCameraLuminanceHistogramLength.rawValue)) & ~0xFF) + 0x100
+        guard let histogramBuffer = device.makeBuffer(length: alignedRegionSize * regionCount, options: .storageModeShared) else {
+            print("Warning (CameraLuminanceReduction) - Failed to create the histogram buffer.")
+            return nil
+        }
+        histogramBuffer.label = "Camera Luminance Histogram"
+        GPUResourceRegistry.shared.register(histogramBuffer, category: .buffer, owner: .renderer)
+        self.histogramBuffer = histogramBuffer
+        hasResults = Array(repeating: false, count: regionCount)
+        
+        // Non-uniform threadgroup sizes require an A11 or later
+        supportsNonUniformThreadgroups = device.supportsFamily(.apple4)
+        
+    }
+    
+    /// Returns the histogram that was last encoded with `bufferIndex`. Must be called after the frame that encoded it has completed, i.e. after waiting on the in flight semaphore.
+    func completedHistogram(forBufferIndex bufferIndex: Int) -> CameraLuminanceHistogram? {
+        let region = bufferIndex % regionCount
+        guard hasResults[region] else {
+            return nil
+        }
+        let contents = histogramBuffer.contents().advanced(by: alignedRegionSize * region).assumingMemoryBound(to: UInt32.self)
+        return CameraLuminanceHistogram(contents: contents, minLogLuminance: minLogLuminance, logLuminanceRange: logLuminanceRange)
+    }
+    
+    /// Encodes the reduction of the captured image into `commandBuffer`
+    func encode(textureY: MTLTexture, textureCbCr: MTLTexture, bufferIndex: Int, commandBuffer: MTLCommandBuffer) {
+        
+        let region = bufferIndex % regionCount
+        let offset = alignedRegionSize * region
+        let length = MemoryLayout<UInt32>.stride * Int(kCameraLuminanceHistogramLength.rawValue)
+        
+        guard let blitEncoder = commandBuffer.makeBlitCommandEncoder() else {
+            return
+        }
+        blitEncoder.label = "Clear Camera Luminance Histogram"
+        blitEncoder.fill(buffer: histogramBuffer, range: offset..<(offset + length), value: 0)
+        blitEncoder.endEncoding()
+        
+        guard let computeEncoder = commandBuffer.makeComputeCommandEncoder() else {
+            return
+        }
+        
+        var uniforms = CameraLuminanceUniforms(sampleGridSize: sampleGridSize, minLogLuminance: minLogLuminance, logLuminanceRange: logLuminanceRange)
+        
+        computeEncoder.label = "Camera Luminance"
+        computeEncoder.pushDebugGroup("Camera Luminance Histogram")
+        computeEncoder.setComputePipelineState(computePipelineState)
+        computeEncoder.setTexture(textureY, index: Int(kTextureIndexY.rawValue))
+        computeEncoder.setTexture(textureCbCr, index: Int(kTextureIndexCbCr.rawValue))
+        computeEncoder.setBuffer(histogramBuffer, offset: offset, index: Int(kBufferIndexCameraLuminanceHistogram.rawValue))
+        computeEncoder.setBytes(&uniforms, length: MemoryLayout<CameraLuminanceUniforms>.stride, index: Int(kBufferIndexCameraLuminanceUniforms.rawValue))
+        
+        let threadgroupWidth = computePipelineState.threadExecutionWidth
+        let threadgroupHeight = max(computePipelineState.maxTotalThreadsPerThreadgroup / threadgroupWidth, 1)
+        let threadsPerThreadgroup = MTLSize(width: threadgroupWidth, height: threadgroupHeight, depth: 1)
+        if supportsNonUniformThreadgroups {
+            computeEncoder.dispatchThreads(MTLSize(width: Int(sampleGridSize.x), height: Int(sampleGridSize.y), depth: 1), threadsPerThreadgroup: threadsPerThreadgroup)
+        } else {
+            // Round up to whole threadgroups. The kernel skips the threads outside of the sample grid.
+            let threadgroupsPerGrid = MTLSize(width: (Int(sampleGridSize.x) + threadgroupWidth - 1) / threadgroupWidth, height: (Int(sampleGridSize.y) + threadgroupHeight - 1) / threadgroupHeight, depth: 1)
+            computeEncoder.dispatchThreadgroups(threadgroupsPerGrid, threadsPerThreadgroup: threadsPerThreadgroup)
+        }
+        computeEncoder.popDebugGroup()
+        computeEncoder.endEncoding()
+        
+        hasResults[region] = true
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let computePipelineState: MTLComputePipelineState
+    fileprivate let histogramBuffer: MTLBuffer
+    fileprivate let alignedRegionSize: Int
+    fileprivate let regionCount: Int
+    fileprivate let supportsNonUniformThreadgroups: Bool
+    fileprivate var hasResults: [Bool]
+    
+}
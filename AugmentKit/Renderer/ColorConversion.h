@@ -0,0 +1,94 @@
+//
+//  ColorConversion.h
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+//
+//  sRGB transfer functions shared between Metal shaders and host code. Every function is `static inline` so the same source compiles into each shader and into Swift through the AugmentKitShader module.
+//
+//  - Exact: the piecewise curves from IEC 61966-2-1
+//  - Fast: the exact linear segment plus a minimax fit of the curved segment. The maximum absolute error over [0, 1] is 9.4e-5 for the decode and 3.1e-5 for the encode, well under half of an 8 bit step (2.0e-3).
+//
+//  Table based 8 bit conversions live with the host code in `SRGBConversion`. Shaders should prefer sampling through an `_srgb` pixel format, which does the decode in hardware.
+//
+
+#ifndef ColorConversion_h
+#define ColorConversion_h
+
+#ifdef __METAL_VERSION__
+#include <metal_stdlib>
+#define AK_COLOR_POW(x, y) metal::pow(x, y)
+#define AK_COLOR_SQRT(x) metal::sqrt(x)
+#else
+#include <math.h>
+#define AK_COLOR_POW(x, y) powf(x, y)
+#define AK_COLOR_SQRT(x) sqrtf(x)
+#endif
+
+/// The encoded value below which the sRGB decode is linear
+#define kSRGBDecodeLinearThreshold 0.04045f
+/// The linear value below which the sRGB encode is linear
+#define kSRGBEncodeLinearThreshold 0.0031308f
+
+static inline float srgbToLinearExact(float value) {
+    if (value <= kSRGBDecodeLinearThreshold) {
+        return value / 12.92f;
+    }
+    return AK_COLOR_POW((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static inline float linearToSrgbExact(float value) {
+    float clamped = value > 0.0f ? value : 0.0f;
+    if (clamped <= kSRGBEncodeLinearThreshold) {
+        return clamped * 12.92f;
+    }
+    return 1.055f * AK_COLOR_POW(clamped, 1.0f / 2.4f) - 0.055f;
+}
+
+static inline float srgbToLinearFast(float value) {
+    if (value <= kSRGBDecodeLinearThreshold) {
+        return value / 12.92f;
+    }
+    // Degree 4 minimax polynomial over [kSRGBDecodeLinearThreshold, 1]
+    return 0.00132445086f + value * (0.0222743545f + value * (0.59176102f + value * (0.473353703f + value * -0.0888075015f)));
+}
+
+static inline float linearToSrgbFast(float value) {
+    float clamped = value > 0.0f ? value : 0.0f;
+    if (clamped <= kSRGBEncodeLinearThreshold) {
+        return clamped * 12.92f;
+    }
+    // Minimax fit over [kSRGBEncodeLinearThreshold, 1] in the basis x^(1/2), x^(1/4), x^(1/8), x, 1. Square roots are much cheaper than pow.
+    float s1 = AK_COLOR_SQRT(clamped);
+    float s2 = AK_COLOR_SQRT(s1);
+    float s3 = AK_COLOR_SQRT(s2);
+    return 0.653983617f * s1 + 0.688715109f * s2 - 0.318475461f * s3 - 0.0201874667f * clamped - 0.00406707171f;
+}
+
+#undef AK_COLOR_POW
+#undef AK_COLOR_SQRT
+
+#endif /* ColorConversion_h */
@@ -40,10 +40,23 @@
 float sqr(float a);
 vector_float4 srgbToLinear(vector_float4 c);
 vector_float4 linearToSrgba(vector_float4 c);
+vector_float4 srgbToLinearApproximate(vector_float4 c);
+vector_float4 linearToSrgbaApproximate(vector_float4 c);
 float invert(float m);
 matrix_float2x2 invert2(matrix_float2x2 m);
 matrix_float3x3 invert3(matrix_float3x3 m);
 matrix_float4x4 invert4(matrix_float4x4 m);
 matrix_float3x3 convert3(matrix_float4x4 m);
+matrix_float3x3 quaternionToMatrix3(vector_float4 q);
+float frobeniusNorm3(matrix_float3x3 m);
+matrix_float4x4 composeLocationAndHeading(matrix_float4x4 locationTransform, vector_float4 headingRotation, int headingType);
+#ifdef __METAL_VERSION__
+matrix_float3x3 polarDecomposition(matrix_float3x3 m, thread matrix_float3x3 &stretch);
+bool isSphereInFrustum(matrix_float4x4 modelViewProjectionMatrix, vector_float4 sphere);
+bool isSphereOccluded(matrix_float4x4 modelViewProjectionMatrix, vector_float4 sphere, metal::texture2d<float, metal::access::sample> depthPyramid, vector_uint2 pyramidSize, uint levelCount);
+vector_float4 quantizeShadowMoments(float depth);
+vector_float4 dequantizeShadowMoments(vector_float4 quantizedMoments);
+float shadowVisibilityFromMoments(vector_float4 quantizedMoments, float fragmentDepth);
+#endif
 
 #endif /* Common_h */
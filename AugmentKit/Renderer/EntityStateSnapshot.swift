@@ -0,0 +1,183 @@
+//
+//  EntityStateSnapshot.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - EntityState
+
+/// The renderable state of a single `AKGeometricEntity` at the moment a frame was built. Contains only plain values so it can be copied freely and compared in tests without any Metal or ARKit objects.
+struct EntityState {
+    /// The identifier of the entity. Matches `DrawCallGroup.uuid`
+    var identifier: UUID
+    /// The absolute location of the entity in world space
+    var locationTransform = matrix_identity_float4x4
+    /// `true` when `headingRotation` and `headingType` should be applied
+    var hasHeading = false
+    /// The heading rotation of the entity
+    var headingRotation = simd_quatf(vector: SIMD4<Float>(0, 0, 0, 1))
+    /// How `headingRotation` should be interpreted
+    var headingType: HeadingType = .absolute
+    /// `true` when `worldTransformOverride` should be used instead of the world transform stored in the model. Set for path segments.
+    var hasWorldTransformOverride = false
+    /// The world transform to use when `hasWorldTransformOverride` is `true`
+    var worldTransformOverride = matrix_identity_float4x4
+    /// The value of the alpha effect at the snapshot time
+    var alpha: Float = 1
+    /// The value of the glow effect at the snapshot time
+    var glow: Float = 0
+    /// The value of the tint effect at the snapshot time
+    var tint = SIMD3<Float>(1, 1, 1)
+    /// The value of the uniform scale effect at the snapshot time
+    var scale: Float = 1
+    
+    init(identifier: UUID) {
+        self.identifier = identifier
+    }
+}
+
+// MARK: - EntityStateSnapshot
+
+/// An immutable copy of the renderable state of every geometric entity for one frame. The snapshot is built once, after headings and positions have been updated, and then every module that prepares data for the frame reads from it instead of the live entity objects, so every module sees the same values for the frame.
+///
+/// The renderer builds the snapshot on the render thread while holding the same lock as `Renderer.performEntityUpdates(_:)`, so entities that are changed on another thread inside that method are captured either before or after the change, never part way through it. Modules copy what they need from the snapshot into their own buffers while the frame is prepared, so one snapshot is reused from frame to frame.
+struct EntityStateSnapshot {
+    
+    /// The frame number this snapshot was built for
+    fileprivate(set) var frameNumber: UInt = 0
+    /// The time, in seconds, used to evaluate effects
+    fileprivate(set) var time: TimeInterval = 0
+    /// The entity states stored contiguously in the order they were recorded
+    fileprivate(set) var states = [EntityState]()
+    
+    /// The number of entities in the snapshot
+    var count: Int {
+        return states.count
+    }
+    
+    /// Returns the index of the state for the entity with the provided identifier or `nil` if the entity is not part of the snapshot
+    func index(forIdentifier identifier: UUID) -> Int? {
+        return indexByIdentifier[identifier]
+    }
+    
+    /// Returns the state for the entity with the provided identifier or `nil` if the entity is not part of the snapshot
+    func state(forIdentifier identifier: UUID) -> EntityState? {
+        guard let index = indexByIdentifier[identifier] else {
+            return nil
+        }
+        return states[index]
+    }
+    
+    /// Empties the snapshot while keeping the allocated storage so it can be refilled without allocating.
+    mutating func removeAll() {
+        states.removeAll(keepingCapacity: true)
+        indexByIdentifier.removeAll(keepingCapacity: true)
+        frameNumber = 0
+        time = 0
+    }
+    
+    /// Appends a state. If a state with the same identifier was already recorded it is replaced.
+    mutating func append(_ state: EntityState) {
+        if let existingIndex = indexByIdentifier[state.identifier] {
+            states[existingIndex] = state
+        } else {
+            indexByIdentifier[state.identifier] = states.count
+            states.append(state)
+        }
+    }
+    
+    /// Replaces the contents of the snapshot with the current state of `geometricEntities`. Effects are evaluated at `time`.
+    mutating func rebuild(from geometricEntities: [AKGeometricEntity], frameNumber: UInt, time: TimeInterval) {
+        removeAll()
+        self.frameNumber = frameNumber
+        self.time = time
+        states.reserveCapacity(geometricEntities.count)
+        for geometricEntity in geometricEntities {
+            append(EntityStateSnapshot.state(of: geometricEntity, atTime: time))
+        }
+    }
+    
+    /// Captures the renderable state of a single entity
+    static func state(of geometricEntity: AKGeometricEntity, atTime time: TimeInterval) -> EntityState {
+        
+        var state = EntityState(identifier: geometricEntity.identifier ?? UUID())
+        
+        if let pathSegment = geometricEntity as? AKPathSegmentAnchor {
+            state.hasWorldTransformOverride = true
+            state.worldTransformOverride = pathSegment.segmentTransform
+        }
+        
+        if let akAnchor = geometricEntity as? AKAnchor {
+            state.hasHeading = true
+            state.headingRotation = akAnchor.heading.offsetRotation.quaternion
+            state.headingType = akAnchor.heading.type
+            state.locationTransform = akAnchor.worldLocation.transform
+        } else if let akTarget = geometricEntity as? AKTarget {
+            // Apply the transform of the target relative to the reference transform
+            state.locationTransform = akTarget.position.referenceTransform * akTarget.position.transform
+        } else if let akTracker = geometricEntity as? AKTracker {
+            if let heading = akTracker.position.heading {
+                state.hasHeading = true
+                state.headingRotation = heading.offsetRotation.quaternion
+                state.headingType = heading.type
+            }
+            // Apply the transform of the tracker relative to the reference transform
+            state.locationTransform = akTracker.position.referenceTransform * akTracker.position.transform
+        }
+        
+        if let effects = geometricEntity.effects {
+            for effect in effects {
+                switch effect.effectType {
+                case .alpha:
+                    if let value = effect.value(forTime: time) as? Float {
+                        state.alpha = value
+                    }
+                case .glow:
+                    if let value = effect.value(forTime: time) as? Float {
+                        state.glow = value
+                    }
+                case .tint:
+                    if let value = effect.value(forTime: time) as? SIMD3<Float> {
+                        state.tint = value
+                    }
+                case .scale:
+                    if let value = effect.value(forTime: time) as? Float {
+                        state.scale = value
+                    }
+                }
+            }
+        }
+        
+        return state
+    
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var indexByIdentifier = [UUID: Int]()
+
+}
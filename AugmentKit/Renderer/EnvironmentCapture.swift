@@ -0,0 +1,397 @@
+//
+//  EnvironmentCapture.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import ARKit
+import Metal
+import simd
+import AugmentKitShader
+
+// MARK: - EnvironmentCaptureProjection
+
+/**
+ Host side implementation of the projection used by the `capture_environment` kernel in IBLShaders.metal. Maps directions in world space to pixels of a captured camera frame using the camera's intrinsics and pose.
+ 
+ The environment is treated as infinitely far away so only the rotation of the camera is used. `EnvironmentCaptureProjection` does not depend on Metal so it can be created and tested with a synthetic camera on the host.
+ */
+struct EnvironmentCaptureProjection {
+    
+    /// The rotation from world space to camera space
+    var worldToCamera: float3x3
+    /// The camera intrinsics in pixels
+    var intrinsics: float3x3
+    /// The size of the captured image in pixels
+    var imageResolution: SIMD2<Float>
+    /// The fraction of the image, measured from each edge, over which the weight of a sample falls to zero
+    var edgeFalloff: Float
+    
+    /**
+     Creates a projection.
+     - Parameters:
+        - cameraTransform: The transform from camera space to world space, i.e. `ARCamera.transform`
+        - intrinsics: The camera intrinsics, i.e. `ARCamera.intrinsics`
+        - imageResolution: The size of the captured image, i.e. `ARCamera.imageResolution`
+        - edgeFalloff: The fraction of the image, measured from each edge, over which the weight of a sample falls to zero
+     */
+    init(cameraTransform: float4x4, intrinsics: float3x3, imageResolution: SIMD2<Float>, edgeFalloff: Float = 0.1) {
+        let rotation = AffineDecomposition(cameraTransform).rotationMatrix
+        self.worldToCamera = rotation.transpose
+        self.intrinsics = intrinsics
+        self.imageResolution = imageResolution
+        self.edgeFalloff = edgeFalloff
+    }
+    
+    /// Returns the normalized image coordinates (0 to 1, y down) that `direction` projects to, or `nil` if `direction` points behind the camera
+    func imageCoordinates(of direction: SIMD3<Float>) -> SIMD2<Float>? {
+        let cameraDirection = worldToCamera * direction
+        guard cameraDirection.z < 0 else {
+            return nil
+        }
+        let projected = intrinsics * SIMD3<Float>(cameraDirection.x, -cameraDirection.y, -cameraDirection.z)
+        return SIMD2<Float>(projected.x, projected.y) / projected.z / imageResolution
+    }
+    
+    /// Returns the weight a sample in `direction` is accumulated with. 0 when `direction` is outside of the image.
+    func weight(of direction: SIMD3<Float>) -> Float {
+        guard let uv = imageCoordinates(of: direction) else {
+            return 0
+        }
+        let edgeDistance = min(min(uv.x, 1 - uv.x), min(uv.y, 1 - uv.y))
+        guard edgeDistance > 0 else {
+            return 0
+        }
+        let t = min(edgeDistance / max(edgeFalloff, Float.leastNormalMagnitude), 1)
+        let facing = min(max(-(worldToCamera * normalize(direction)).z, 0), 1)
+        return t * t * (3 - 2 * t) * facing
+    }
+    
+    /// Returns `true` if `direction` projects inside the image
+    func isVisible(_ direction: SIMD3<Float>) -> Bool {
+        guard let uv = imageCoordinates(of: direction) else {
+            return false
+        }
+        return uv.x >= 0 && uv.x <= 1 && uv.y >= 0 && uv.y <= 1
+    }
+    
+    /// The world space direction through a point on a cube map face using the Metal cube map convention. `uv` is in [-1, 1] with v pointing down the face.
+    static func direction(face: Int, uv: SIMD2<Float>) -> SIMD3<Float> {
+        switch face {
+        case 0: return normalize(SIMD3<Float>(1, -uv.y, -uv.x))
+        case 1: return normalize(SIMD3<Float>(-1, -uv.y, uv.x))
+        case 2: return normalize(SIMD3<Float>(uv.x, 1, uv.y))
+        case 3: return normalize(SIMD3<Float>(uv.x, -1, -uv.y))
+        case 4: return normalize(SIMD3<Float>(uv.x, -uv.y, 1))
+        default: return normalize(SIMD3<Float>(-uv.x, -uv.y, -1))
+        }
+    }
+    
+    /**
+     Returns the tiles of a cube map that are at least partly visible. A tile is visible if any of its corners or its center is visible, or if it contains the point the camera is looking at.
+     - Parameters:
+        - faceSize: The size of a cube map face in texels
+        - tileSize: The size of a tile in texels
+     */
+    func visibleTiles(faceSize: Int, tileSize: Int) -> [EnvironmentCaptureTile] {
+        
+        guard faceSize > 0, tileSize > 0 else {
+            return []
+        }
+        
+        let tilesPerSide = (faceSize + tileSize - 1) / tileSize
+        let forward = worldToCamera.transpose * SIMD3<Float>(0, 0, -1)
+        var visibleTiles = [EnvironmentCaptureTile]()
+        
+        for face in 0..<6 {
+            for tileY in 0..<tilesPerSide {
+                for tileX in 0..<tilesPerSide {
+                    
+                    let minTexel = SIMD2<Float>(Float(tileX * tileSize), Float(tileY * tileSize))
+                    let maxTexel = SIMD2<Float>(Float(min((tileX + 1) * tileSize, faceSize)), Float(min((tileY + 1) * tileSize, faceSize)))
+                    let minUV = minTexel / Float(faceSize) * 2 - 1
+                    let maxUV = maxTexel / Float(faceSize) * 2 - 1
+                    let samples = [
+                        minUV,
+                        SIMD2<Float>(maxUV.x, minUV.y),
+                        SIMD2<Float>(minUV.x, maxUV.y),
+                        maxUV,
+                        (minUV + maxUV) * 0.5,
+                    ]
+                    
+                    let containsForward = EnvironmentCaptureProjection.face(of: forward) == face && {
+                        let uv = EnvironmentCaptureProjection.uv(of: forward, onFace: face)
+                        return uv.x >= minUV.x && uv.x <= maxUV.x && uv.y >= minUV.y && uv.y <= maxUV.y
+                    }()
+                    
+                    if containsForward || samples.contains(where: { isVisible(EnvironmentCaptureProjection.direction(face: face, uv: $0)) }) {
+                        visibleTiles.append(EnvironmentCaptureTile(face: UInt32(face), x: UInt32(tileX * tileSize), y: UInt32(tileY * tileSize)))
+                    }
+                    
+                }
+            }
+        }
+        
+        return visibleTiles
+        
+    }
+    
+    /// The cube map face that `direction` falls on
+    static func face(of direction: SIMD3<Float>) -> Int {
+        let magnitude = abs(direction)
+        if magnitude.x >= magnitude.y && magnitude.x >= magnitude.z {
+            return direction.x >= 0 ? 0 : 1
+        } else if magnitude.y >= magnitude.z {
+            return direction.y >= 0 ? 2 : 3
+        } else {
+            return direction.z >= 0 ? 4 : 5
+        }
+    }
+    
+    /// The inverse of `direction(face:uv:)` for a direction that falls on `face`
+    static func uv(of direction: SIMD3<Float>, onFace face: Int) -> SIMD2<Float> {
+        switch face {
+        case 0: return SIMD2<Float>(-direction.z, -direction.y) / direction.x
+        case 1: return SIMD2<Float>(direction.z, -direction.y) / -direction.x
+        case 2: return SIMD2<Float>(direction.x, direction.z) / direction.y
+        case 3: return SIMD2<Float>(direction.x, -direction.z) / -direction.y
+        case 4: return SIMD2<Float>(direction.x, -direction.y) / direction.z
+        default: return SIMD2<Float>(-direction.x, -direction.y) / -direction.z
+        }
+    }
+    
+}
+
+// MARK: - EnvironmentCapture
+
+/**
+ Builds an HDR environment cube map from the captured camera frames instead of waiting for `AREnvironmentProbeAnchor` updates.
+ 
+ Every frame the tiles of the cube map that the camera can see are found on the CPU and only those are dispatched to the `capture_environment` kernel. The kernel projects each texel into the camera image and blends it into a persistent accumulation buffer with a per texel confidence. Confidence is capped at `maxConfidence` so the capture keeps adapting when the lighting changes.
+ 
+ Recomputing the IBL maps is expensive so `needsLightingRefresh` only becomes `true` when enough new tiles have been captured since the last refresh, and no more often than every `minFramesBetweenRefreshes` frames. `dirtyFaces` tells which faces changed.
+ */
+final class EnvironmentCapture {
+    
+    /// The captured environment cube map. Mipmapped so it can be importance sampled by the IBL passes.
+    fileprivate(set) var environmentTexture: GPUPassTexture?
+    /// The size of each face of the cube map in texels
+    let faceSize: Int
+    /// The size of each tile in texels. Tiles are the unit of work for capture and dirty tracking.
+    let tileSize: Int
+    /// The maximum accumulated weight of a texel
+    var maxConfidence: Float = 8
+    /// The fraction of tiles that must be captured since the last refresh before the IBL maps are refreshed again
+    var refreshCoverage: Float = 0.05
+    /// The minimum number of frames between IBL refreshes
+    var minFramesBetweenRefreshes: UInt = 30
+    
+    /// `true` when the captured environment has changed enough that the IBL maps should be recomputed
+    fileprivate(set) var needsLightingRefresh = false
+    /// A bit mask of the faces that have been captured since the last refresh. Bit `n` is face `n`.
+    fileprivate(set) var dirtyFaces: UInt8 = 0
+    
+    init?(device: MTLDevice, metalLibrary: MTLLibrary, maxInFlightFrames: Int, faceSize: Int = 128, tileSize: Int = 16) {
+        
+        self.faceSize = faceSize
+        self.tileSize = tileSize
+        self.regionCount = max(maxInFlightFrames, 1)
+        let tilesPerSide = (faceSize + tileSize - 1) / tileSize
+        self.tileCount = tilesPerSide * tilesPerSide * 6
+        
+        guard let function = metalLibrary.makeFunction(name: "capture_environment") else {
+            print("Warning (EnvironmentCapture) - Failed to create the capture_environment function.")
+            return nil
+        }
+        
+        do {
+            computePipelineState = try device.makeComputePipelineState(function: function)
+        } catch let error {
+            print("Warning (EnvironmentCapture) - Failed to create the compute pipeline state. ERROR: \(error)")
+            return nil
+        }
+        
+        let textureDescriptor = MTLTextureDescriptor.textureCubeDescriptor(pixelFormat: .rgba16Float, size: faceSize, mipmapped: true)
+        textureDescriptor.resourceOptions = .storageModePrivate
+        textureDescriptor.usage = [.shaderRead, .shaderWrite]
+        guard let cubeTexture = device.makeTexture(descriptor: textureDescriptor) else {
+            print("Warning (EnvironmentCapture) - Failed to create the environment cube map.")
+            return nil
+        }
+        cubeTexture.label = "Captured Environment Cubemap"
+        GPUResourceRegistry.shared.register(cubeTexture, category: .environmentMap, owner: .renderer)
+        environmentTexture = GPUPassTexture(texture: cubeTexture, label: "Captured Environment Cubemap", shaderAttributeIndex: Int(kTextureIndexEnvironmentMap.rawValue))
+        
+        // One `half4` per texel. New buffers are zero filled which is zero radiance with zero confidence.
+        guard let accumulationBuffer = device.makeBuffer(length: faceSize * faceSize * 6 * MemoryLayout<UInt16>.stride * 4, options: .storageModePrivate) else {
+            print("Warning (EnvironmentCapture) - Failed to create the accumulation buffer.")
+            return nil
+        }
+        accumulationBuffer.label = "Environment Capture Accumulation"
+        GPUResourceRegistry.shared.register(accumulationBuffer, category: .environmentMap, owner: .renderer)
+        self.accumulationBuffer = accumulationBuffer
+        
+        tileBufferAlignedSize = ((MemoryLayout<EnvironmentCaptureTile>.stride * tileCount) & ~0xFF) + 0x100
+        guard let tileBuffer = device.makeBuffer(length: tileBufferAlignedSize * regionCount, options: .storageModeShared) else {
+            print("Warning (EnvironmentCapture) - Failed to create the tile buffer.")
+            return nil
+        }
+        tileBuffer.label = "Environment Capture Tiles"
+        GPUResourceRegistry.shared.register(tileBuffer, category: .buffer, owner: .renderer)
+        self.tileBuffer = tileBuffer
+        
+    }
+    
+    /**
+     Encodes the capture of `frame` into `commandBuffer`.
+     - Parameters:
+        - frame: The current `ARFrame`
+        - textureY: The luma plane of `frame.capturedImage`
+        - textureCbCr: The chroma plane of `frame.capturedImage`
+        - bufferIndex: The index of the current in flight frame
+        - frameNumber: The current frame number. Used to throttle refreshes.
+        - commandBuffer: The command buffer to encode into
+     */
+    func capture(from frame: ARFrame, textureY: MTLTexture, textureCbCr: MTLTexture, bufferIndex: Int, frameNumber: UInt, commandBuffer: MTLCommandBuffer) {
+        
+        guard case .normal = frame.camera.trackingState, let cubeTexture = environmentTexture?.texture else {
+            return
+        }
+        
+        let imageResolution = SIMD2<Float>(Float(frame.camera.imageResolution.width), Float(frame.camera.imageResolution.height))
+        let projection = EnvironmentCaptureProjection(cameraTransform: frame.camera.transform, intrinsics: frame.camera.intrinsics, imageResolution: imageResolution)
+        
+        // The first capture writes every tile so that texels that have not been seen yet are black rather than uninitialized
+        let resolveAll = !hasCaptured
+        let tiles: [EnvironmentCaptureTile] = {
+            if resolveAll {
+                return allTiles()
+            } else {
+                return projection.visibleTiles(faceSize: faceSize, tileSize: tileSize)
+            }
+        }()
+        
+        guard !tiles.isEmpty, let computeEncoder = commandBuffer.makeComputeCommandEncoder() else {
+            return
+        }
+        
+        let tileBufferOffset = tileBufferAlignedSize * (bufferIndex % regionCount)
+        let tileAddress = tileBuffer.contents().advanced(by: tileBufferOffset).assumingMemoryBound(to: EnvironmentCaptureTile.self)
+        tiles.withUnsafeBufferPointer { tilePointer in
+            if let baseAddress = tilePointer.baseAddress {
+                tileAddress.assign(from: baseAddress, count: tiles.count)
+            }
+        }
+        
+        let exposureScale: Float = {
+            if let lightEstimate = frame.lightEstimate {
+                return Float(lightEstimate.ambientIntensity) / 1000.0
+            } else {
+                return 1
+            }
+        }()
+        
+        var uniforms = EnvironmentCaptureUniforms(worldToCamera: projection.worldToCamera, intrinsics: projection.intrinsics, imageResolution: imageResolution, exposureScale: exposureScale, maxConfidence: maxConfidence, edgeFalloff: projection.edgeFalloff, faceSize: UInt32(faceSize), tileSize: UInt32(tileSize), resolveAll: resolveAll ? 1 : 0)
+        
+        computeEncoder.label = "Environment Capture"
+        computeEncoder.pushDebugGroup("Capture Environment")
+        computeEncoder.setComputePipelineState(computePipelineState)
+        computeEncoder.setTexture(textureY, index: Int(kTextureIndexY.rawValue))
+        computeEncoder.setTexture(textureCbCr, index: Int(kTextureIndexCbCr.rawValue))
+        computeEncoder.setTexture(cubeTexture, index: Int(kTextureIndexEnvironmentMap.rawValue))
+        computeEncoder.setBuffer(accumulationBuffer, offset: 0, index: Int(kBufferIndexEnvironmentCaptureAccumulation.rawValue))
+        computeEncoder.setBuffer(tileBuffer, offset: tileBufferOffset, index: Int(kBufferIndexEnvironmentCaptureTiles.rawValue))
+        computeEncoder.setBytes(&uniforms, length: MemoryLayout<EnvironmentCaptureUniforms>.stride, index: Int(kBufferIndexEnvironmentCaptureUniforms.rawValue))
+        
+        // One threadgroup per tile. Requires the device supports non-uniform threadgroup sizes
+        let threadgroupWidth = min(tileSize, computePipelineState.threadExecutionWidth)
+        let threadgroupHeight = min(tileSize, max(computePipelineState.maxTotalThreadsPerThreadgroup / threadgroupWidth, 1))
+        computeEncoder.dispatchThreads(MTLSize(width: tileSize, height: tileSize, depth: tiles.count), threadsPerThreadgroup: MTLSize(width: threadgroupWidth, height: threadgroupHeight, depth: 1))
+        computeEncoder.popDebugGroup()
+        computeEncoder.endEncoding()
+        
+        hasCaptured = true
+        
+        //
+        // Dirty Tracking
+        //
+        
+        for tile in tiles {
+            dirtyFaces |= UInt8(1 << tile.face)
+        }
+        capturedTileCount += tiles.count
+        
+        let coverage = Float(capturedTileCount) / Float(max(tileCount, 1))
+        let framesSinceRefresh = frameNumber >= lastRefreshFrame ? frameNumber - lastRefreshFrame : minFramesBetweenRefreshes
+        if resolveAll || (coverage >= refreshCoverage && framesSinceRefresh >= minFramesBetweenRefreshes) {
+            
+            // The IBL passes sample lower levels of the environment so the mip chain has to be current before they run
+            if let blitEncoder = commandBuffer.makeBlitCommandEncoder() {
+                blitEncoder.label = "Environment Capture Mipmaps"
+                blitEncoder.generateMipmaps(for: cubeTexture)
+                blitEncoder.endEncoding()
+            }
+            needsLightingRefresh = true
+            
+        }
+        
+    }
+    
+    /// Call after the IBL maps have been recomputed from `environmentTexture`
+    func didRefreshLighting(atFrame frameNumber: UInt) {
+        needsLightingRefresh = false
+        dirtyFaces = 0
+        capturedTileCount = 0
+        lastRefreshFrame = frameNumber
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let computePipelineState: MTLComputePipelineState
+    fileprivate let accumulationBuffer: MTLBuffer
+    fileprivate let tileBuffer: MTLBuffer
+    fileprivate let tileBufferAlignedSize: Int
+    fileprivate let tileCount: Int
+    fileprivate let regionCount: Int
+    fileprivate var hasCaptured = false
+    fileprivate var capturedTileCount = 0
+    fileprivate var lastRefreshFrame: UInt = 0
+    
+    fileprivate func allTiles() -> [EnvironmentCaptureTile] {
+        let tilesPerSide = (faceSize + tileSize - 1) / tileSize
+        var tiles = [EnvironmentCaptureTile]()
+        tiles.reserveCapacity(tileCount)
+        for face in 0..<6 {
+            for tileY in 0..<tilesPerSide {
+                for tileX in 0..<tilesPerSide {
+                    tiles.append(EnvironmentCaptureTile(face: UInt32(face), x: UInt32(tileX * tileSize), y: UInt32(tileY * tileSize)))
+                }
+            }
+        }
+        return tiles
+    }
+    
+}
@@ -0,0 +1,368 @@
+//
+//  GPUResourceRegistry.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import Metal
+
+// MARK: - GPUResourceCategory
+
+/// The kind of data a GPU allocation holds
+public enum GPUResourceCategory: String, CaseIterable {
+    /// Uniform, argument and instance buffers
+    case buffer
+    /// Vertex and index buffers
+    case mesh
+    /// Textures loaded from material properties
+    case materialTexture
+    /// Environment cube maps and the image based lighting textures derived from them
+    case environmentMap
+    /// Shadow maps
+    case shadowMap
+    /// Offscreen render targets and other textures the renderer draws or computes into
+    case renderTarget
+}
+
+// MARK: - GPUResourceOwner
+
+/// Who an allocation is attributed to
+public enum GPUResourceOwner: Hashable, CustomStringConvertible {
+    /// The renderer itself
+    case renderer
+    /// A render or compute module, identified by its `moduleIdentifier`
+    case module(String)
+    /// A loaded asset, identified by its cache key
+    case asset(String)
+    /// A single entity
+    case entity(UUID)
+    
+    public var description: String {
+        switch self {
+        case .renderer:
+            return "renderer"
+        case .module(let identifier):
+            return "module:\(identifier)"
+        case .asset(let key):
+            return "asset:\(key)"
+        case .entity(let identifier):
+            return "entity:\(identifier.uuidString)"
+        }
+    }
+}
+
+// MARK: - GPUMemoryBudgetViolation
+
+/// Describes a budget that has been exceeded. See `GPUResourceRegistry.budgetExceededHandler`
+public struct GPUMemoryBudgetViolation {
+    /// The category whose budget was exceeded or `nil` for the total budget
+    public var category: GPUResourceCategory?
+    /// The budget in bytes
+    public var budgetBytes: Int
+    /// The live bytes at the time the budget was exceeded
+    public var liveBytes: Int
+    /// The owner of the allocation that exceeded the budget
+    public var owner: GPUResourceOwner
+    /// The label of the allocation that exceeded the budget
+    public var label: String?
+}
+
+// MARK: - GPUMemorySnapshot
+
+/// The state of the GPU allocations tracked by a `GPUResourceRegistry` at a point in time. A snapshot is taken every frame and reported in `RenderStats`.
+public struct GPUMemorySnapshot {
+    /// The frame the snapshot was taken on
+    public var frameNumber: UInt
+    /// The number of live resources
+    public var resourceCount: Int
+    /// The bytes held by every live resource
+    public var liveBytes: Int
+    /// The most bytes that have been live at once
+    public var peakBytes: Int
+    /// The bytes held by live resources in each category
+    public var liveBytesByCategory: [GPUResourceCategory: Int]
+    /// The most bytes that have been live at once in each category
+    public var peakBytesByCategory: [GPUResourceCategory: Int]
+    /// The bytes held by live resources for each owner
+    public var liveBytesByOwner: [GPUResourceOwner: Int]
+    /// The bytes held by the assets each entity uses. Assets shared by several entities are counted for each of them.
+    public var liveBytesByEntity: [UUID: Int]
+    /// The total bytes allocated by the device, including allocations that are not tracked. `0` when there is no device.
+    public var deviceAllocatedBytes: Int
+    
+    /// A representation that can be written with `JSONSerialization`
+    public var dictionaryRepresentation: [String: Any] {
+        return [
+            "frameNumber": frameNumber,
+            "resourceCount": resourceCount,
+            "liveBytes": liveBytes,
+            "peakBytes": peakBytes,
+            "liveBytesByCategory": Dictionary(uniqueKeysWithValues: liveBytesByCategory.map({ ($0.key.rawValue, $0.value) })),
+            "peakBytesByCategory": Dictionary(uniqueKeysWithValues: peakBytesByCategory.map({ ($0.key.rawValue, $0.value) })),
+            "liveBytesByOwner": Dictionary(uniqueKeysWithValues: liveBytesByOwner.map({ ($0.key.description, $0.value) })),
+            "liveBytesByEntity": Dictionary(uniqueKeysWithValues: liveBytesByEntity.map({ ($0.key.uuidString, $0.value) })),
+            "deviceAllocatedBytes": deviceAllocatedBytes,
+        ]
+    }
+}
+
+// MARK: - GPUResourceRegistry
+
+/**
+ Tracks the buffers and textures allocated for rendering so that memory use can be attributed to categories and owners, limited with budgets and reported every frame.
+ 
+ Resources are held weakly and are counted until they are released or explicitly unregistered, so memory that is still referenced by in flight frames or cached draw calls is not lost track of. Registering a resource that is already registered keeps the original registration. All methods may be called from any thread.
+ */
+public final class GPUResourceRegistry {
+    
+    /// The registry used by the renderer
+    public static let shared = GPUResourceRegistry()
+    
+    /// Called when the live bytes of a category, or all categories when `category` is `nil`, first exceeds its budget. Not called again until the live bytes have fallen back under the budget. Called on the thread that registered the resource.
+    public var budgetExceededHandler: ((GPUMemoryBudgetViolation) -> Void)? {
+        get {
+            lock.lock()
+            defer { lock.unlock() }
+            return handler
+        }
+        set {
+            lock.lock()
+            handler = newValue
+            lock.unlock()
+        }
+    }
+    
+    public init() {}
+    
+    /// Sets the budget, in bytes, for a category, or for all categories when `category` is `nil`. Pass a `nil` budget to remove it.
+    public func setBudget(_ bytes: Int?, for category: GPUResourceCategory? = nil) {
+        lock.lock()
+        if let category = category {
+            categoryBudgets[category] = bytes
+            exceededCategories.remove(category)
+        } else {
+            totalBudget = bytes
+            isTotalExceeded = false
+        }
+        lock.unlock()
+    }
+    
+    /// Returns the budget, in bytes, for a category, or for all categories when `category` is `nil`
+    public func budget(for category: GPUResourceCategory? = nil) -> Int? {
+        lock.lock()
+        defer { lock.unlock() }
+        if let category = category {
+            return categoryBudgets[category]
+        } else {
+            return totalBudget
+        }
+    }
+    
+    /// Starts tracking `resource`. Its size is read from `allocatedSize`.
+    func register(_ resource: MTLResource?, category: GPUResourceCategory, owner: GPUResourceOwner) {
+        register([resource], category: category, owner: owner)
+    }
+    
+    /// Starts tracking every resource in `resources`
+    func register(_ resources: [MTLResource?], category: GPUResourceCategory, owner: GPUResourceOwner) {
+        
+        var violations = [GPUMemoryBudgetViolation]()
+        
+        lock.lock()
+        pruneReleasedEntries()
+        for case let resource? in resources {
+            let key = ObjectIdentifier(resource)
+            guard entries[key] == nil else {
+                continue
+            }
+            let bytes = resource.allocatedSize
+            entries[key] = Entry(resource: resource, category: category, owner: owner, bytes: bytes)
+            add(bytes, category: category, owner: owner)
+            violations.append(contentsOf: checkBudgets(category: category, owner: owner, label: resource.label))
+        }
+        let currentHandler = handler
+        lock.unlock()
+        
+        if let currentHandler = currentHandler {
+            violations.forEach { currentHandler($0) }
+        }
+        
+    }
+    
+    /// Starts tracking the vertex buffers, index buffers and material textures of a mesh. Textures shared with a mesh that has already been registered keep their original owner.
+    func register(_ meshGPUData: MeshGPUData, owner: GPUResourceOwner) {
+        
+        var meshResources = [MTLResource?]()
+        var bufferResources = [MTLResource?]()
+        var textureResources = [MTLResource?]()
+        for drawData in meshGPUData.drawData {
+            meshResources.append(contentsOf: drawData.vertexBuffers as [MTLResource?])
+            meshResources.append(contentsOf: drawData.rawVertexBuffers as [MTLResource?])
+            for subData in drawData.subData {
+                meshResources.append(subData.indexBuffer)
+                bufferResources.append(subData.materialBuffer)
+                textureResources.append(contentsOf: [subData.baseColorTexture, subData.normalTexture, subData.ambientOcclusionTexture, subData.metallicTexture, subData.roughnessTexture, subData.emissionTexture, subData.subsurfaceTexture, subData.specularTexture, subData.specularTintTexture, subData.anisotropicTexture, subData.sheenTexture, subData.sheenTintTexture, subData.clearcoatTexture, subData.clearcoatGlossTexture] as [MTLResource?])
+            }
+        }
+        
+        register(meshResources, category: .mesh, owner: owner)
+        register(bufferResources, category: .buffer, owner: owner)
+        register(textureResources, category: .materialTexture, owner: owner)
+        
+    }
+    
+    /// Stops tracking `resource`
+    func unregister(_ resource: MTLResource) {
+        lock.lock()
+        if let entry = entries.removeValue(forKey: ObjectIdentifier(resource)) {
+            remove(entry)
+        }
+        lock.unlock()
+    }
+    
+    /// Stops tracking every resource attributed to `owner`
+    func unregisterAll(ownedBy owner: GPUResourceOwner) {
+        lock.lock()
+        for (key, entry) in entries where entry.owner == owner {
+            entries[key] = nil
+            remove(entry)
+        }
+        lock.unlock()
+    }
+    
+    /// Records that `entity` draws the asset cached under `assetKey` so that the asset's bytes are included in `GPUMemorySnapshot.liveBytesByEntity`
+    func associate(entity: UUID, withAsset assetKey: String) {
+        lock.lock()
+        assetKeysByEntity[entity, default: []].insert(assetKey)
+        lock.unlock()
+    }
+    
+    /// Forgets the assets of entities that have been removed
+    func dissociate(entities: [UUID]) {
+        lock.lock()
+        entities.forEach { assetKeysByEntity[$0] = nil }
+        lock.unlock()
+    }
+    
+    /**
+     Returns the current state of the registry.
+     - Parameters:
+        - frameNumber: The frame the snapshot is taken on
+        - device: When provided, its `currentAllocatedSize` is included for comparison with the tracked bytes
+     */
+    func snapshot(frameNumber: UInt, device: MTLDevice? = nil) -> GPUMemorySnapshot {
+        
+        lock.lock()
+        pruneReleasedEntries()
+        var liveBytesByEntity = [UUID: Int]()
+        for (entity, assetKeys) in assetKeysByEntity {
+            liveBytesByEntity[entity] = assetKeys.reduce(0) { $0 + (liveBytesByOwner[.asset($1)] ?? 0) }
+        }
+        let snapshot = GPUMemorySnapshot(frameNumber: frameNumber, resourceCount: entries.count, liveBytes: liveBytes, peakBytes: peakBytes, liveBytesByCategory: liveBytesByCategory, peakBytesByCategory: peakBytesByCategory, liveBytesByOwner: liveBytesByOwner, liveBytesByEntity: liveBytesByEntity, deviceAllocatedBytes: device?.currentAllocatedSize ?? 0)
+        lock.unlock()
+        
+        return snapshot
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate struct Entry {
+        weak var resource: MTLResource?
+        var category: GPUResourceCategory
+        var owner: GPUResourceOwner
+        var bytes: Int
+    }
+    
+    fileprivate let lock = NSLock()
+    fileprivate var entries = [ObjectIdentifier: Entry]()
+    fileprivate var liveBytes = 0
+    fileprivate var peakBytes = 0
+    fileprivate var liveBytesByCategory = [GPUResourceCategory: Int]()
+    fileprivate var peakBytesByCategory = [GPUResourceCategory: Int]()
+    fileprivate var liveBytesByOwner = [GPUResourceOwner: Int]()
+    fileprivate var assetKeysByEntity = [UUID: Set<String>]()
+    fileprivate var totalBudget: Int?
+    fileprivate var categoryBudgets = [GPUResourceCategory: Int]()
+    fileprivate var isTotalExceeded = false
+    fileprivate var exceededCategories = Set<GPUResourceCategory>()
+    fileprivate var handler: ((GPUMemoryBudgetViolation) -> Void)?
+    
+    // Must be called with `lock` held
+    fileprivate func add(_ bytes: Int, category: GPUResourceCategory, owner: GPUResourceOwner) {
+        liveBytes += bytes
+        peakBytes = max(peakBytes, liveBytes)
+        let categoryBytes = (liveBytesByCategory[category] ?? 0) + bytes
+        liveBytesByCategory[category] = categoryBytes
+        peakBytesByCategory[category] = max(peakBytesByCategory[category] ?? 0, categoryBytes)
+        liveBytesByOwner[owner, default: 0] += bytes
+    }
+    
+    // Must be called with `lock` held
+    fileprivate func remove(_ entry: Entry) {
+        liveBytes -= entry.bytes
+        liveBytesByCategory[entry.category, default: 0] -= entry.bytes
+        let ownerBytes = (liveBytesByOwner[entry.owner] ?? 0) - entry.bytes
+        liveBytesByOwner[entry.owner] = ownerBytes > 0 ? ownerBytes : nil
+        
+        // Budgets are re-armed once the live bytes fall back under them
+        if let budget = categoryBudgets[entry.category], (liveBytesByCategory[entry.category] ?? 0) <= budget {
+            exceededCategories.remove(entry.category)
+        }
+        if let budget = totalBudget, liveBytes <= budget {
+            isTotalExceeded = false
+        }
+    }
+    
+    // Drops the entries of resources that have been released. Must be called with `lock` held.
+    fileprivate func pruneReleasedEntries() {
+        for (key, entry) in entries where entry.resource == nil {
+            entries[key] = nil
+            remove(entry)
+        }
+    }
+    
+    // Returns the budgets that have just been exceeded. Must be called with `lock` held.
+    fileprivate func checkBudgets(category: GPUResourceCategory, owner: GPUResourceOwner, label: String?) -> [GPUMemoryBudgetViolation] {
+        
+        var violations = [GPUMemoryBudgetViolation]()
+        
+        let categoryBytes = liveBytesByCategory[category] ?? 0
+        if let budget = categoryBudgets[category], categoryBytes > budget, !exceededCategories.contains(category) {
+            exceededCategories.insert(category)
+            violations.append(GPUMemoryBudgetViolation(category: category, budgetBytes: budget, liveBytes: categoryBytes, owner: owner, label: label))
+        }
+        
+        if let budget = totalBudget, liveBytes > budget, !isTotalExceeded {
+            isTotalExceeded = true
+            violations.append(GPUMemoryBudgetViolation(category: nil, budgetBytes: budget, liveBytes: liveBytes, owner: owner, label: label))
+        }
+        
+        return violations
+        
+    }
+    
+}
@@ -0,0 +1,228 @@
+//
+//  HeadingResolver.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - LookAtBatch
+
+/// A batch of look at problems stored as a structure of arrays so that they can be solved four at a time with `SIMD4<Float>` lanes.
+///
+/// Each entry rotates an object at `eye` so that its +z axis points at `target` while keeping +y as close to world up as possible. This produces the same rotation as `float4x4.lookAtQuaternion(position:)` without building and decomposing an intermediate matrix for each object.
+struct LookAtBatch {
+    
+    /// The number of entries in the batch
+    var count: Int {
+        return eyeX.count
+    }
+    
+    /// Empties the batch while keeping the allocated storage
+    mutating func removeAll() {
+        eyeX.removeAll(keepingCapacity: true)
+        eyeY.removeAll(keepingCapacity: true)
+        eyeZ.removeAll(keepingCapacity: true)
+        targetX.removeAll(keepingCapacity: true)
+        targetY.removeAll(keepingCapacity: true)
+        targetZ.removeAll(keepingCapacity: true)
+    }
+    
+    /// Adds an entry to the batch and returns its index
+    @discardableResult
+    mutating func append(eye: SIMD3<Float>, target: SIMD3<Float>) -> Int {
+        let index = eyeX.count
+        eyeX.append(eye.x)
+        eyeY.append(eye.y)
+        eyeZ.append(eye.z)
+        targetX.append(target.x)
+        targetY.append(target.y)
+        targetZ.append(target.z)
+        return index
+    }
+    
+    /// Solves every entry in the batch. `rotations` is resized to `count` and its storage is reused between calls. Entries where the eye and target coincide, or where the target is directly above or below the eye, resolve to the identity rotation.
+    func resolve(into rotations: inout [simd_quatf]) {
+        
+        let total = count
+        if rotations.count != total {
+            rotations = Array(repeating: simd_quatf(vector: SIMD4<Float>(0, 0, 0, 1)), count: total)
+        }
+        
+        var index = 0
+        while index < total {
+            
+            let laneCount = min(4, total - index)
+            var ex = SIMD4<Float>(repeating: 0)
+            var ey = SIMD4<Float>(repeating: 0)
+            var ez = SIMD4<Float>(repeating: 0)
+            var tx = SIMD4<Float>(repeating: 0)
+            var ty = SIMD4<Float>(repeating: 0)
+            var tz = SIMD4<Float>(repeating: 0)
+            for lane in 0..<laneCount {
+                ex[lane] = eyeX[index + lane]
+                ey[lane] = eyeY[index + lane]
+                ez[lane] = eyeZ[index + lane]
+                tx[lane] = targetX[index + lane]
+                ty[lane] = targetY[index + lane]
+                tz[lane] = targetZ[index + lane]
+            }
+            
+            let lanes = LookAtBatch.resolve(eyeX: ex, eyeY: ey, eyeZ: ez, targetX: tx, targetY: ty, targetZ: tz)
+            for lane in 0..<laneCount {
+                rotations[index + lane] = simd_quatf(vector: SIMD4<Float>(lanes.x[lane], lanes.y[lane], lanes.z[lane], lanes.w[lane]))
+            }
+            
+            index += 4
+        }
+    
+    }
+    
+    /// Solves four look at problems at once and returns the quaternion components for each lane
+    static func resolve(eyeX: SIMD4<Float>, eyeY: SIMD4<Float>, eyeZ: SIMD4<Float>, targetX: SIMD4<Float>, targetY: SIMD4<Float>, targetZ: SIMD4<Float>) -> (x: SIMD4<Float>, y: SIMD4<Float>, z: SIMD4<Float>, w: SIMD4<Float>) {
+        
+        let zero = SIMD4<Float>(repeating: 0)
+        let one = SIMD4<Float>(repeating: 1)
+        let epsilon = SIMD4<Float>(repeating: 1e-12)
+        
+        // z axis: the normalized direction to the target
+        var zx = targetX - eyeX
+        var zy = targetY - eyeY
+        var zz = targetZ - eyeZ
+        let zLengthSquared = zx * zx + zy * zy + zz * zz
+        let zInverseLength = one / (zLengthSquared.squareRoot() + epsilon)
+        zx *= zInverseLength
+        zy *= zInverseLength
+        zz *= zInverseLength
+        
+        // x axis: cross((0, 1, 0), z) which, because up is fixed, reduces to (z.z, 0, -z.x)
+        let xLengthSquared = zz * zz + zx * zx
+        let xInverseLength = one / (xLengthSquared.squareRoot() + epsilon)
+        let xx = zz * xInverseLength
+        let xz = -zx * xInverseLength
+        
+        // y axis: cross(z, x)
+        let yx = zy * xz
+        let yy = zz * xx - zx * xz
+        let yz = -zy * xx
+        
+        // Rotation matrix (columns x, y, z) to quaternion. Uses the branch free form where the magnitude of each component comes from the diagonal and the sign comes from the difference of the mirrored off diagonal elements.
+        let w = (simd_max(zero, one + xx + yy + zz)).squareRoot() * 0.5
+        var x = (simd_max(zero, one + xx - yy - zz)).squareRoot() * 0.5
+        var y = (simd_max(zero, one - xx + yy - zz)).squareRoot() * 0.5
+        var z = (simd_max(zero, one - xx - yy + zz)).squareRoot() * 0.5
+        x = LookAtBatch.copySign(x, yz - zy)
+        y = LookAtBatch.copySign(y, zx - xz)
+        // x.y is always 0
+        z = LookAtBatch.copySign(z, -yx)
+        
+        // Degenerate lanes (no direction or looking straight up / down) resolve to identity
+        let isDegenerate = (zLengthSquared .< epsilon) .| (xLengthSquared .< SIMD4<Float>(repeating: 1e-8))
+        return (
+            x: zero.replacing(with: x, where: .!isDegenerate),
+            y: zero.replacing(with: y, where: .!isDegenerate),
+            z: zero.replacing(with: z, where: .!isDegenerate),
+            w: one.replacing(with: w, where: .!isDegenerate)
+        )
+    
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var eyeX = [Float]()
+    fileprivate var eyeY = [Float]()
+    fileprivate var eyeZ = [Float]()
+    fileprivate var targetX = [Float]()
+    fileprivate var targetY = [Float]()
+    fileprivate var targetZ = [Float]()
+    
+    fileprivate static func copySign(_ magnitude: SIMD4<Float>, _ sign: SIMD4<Float>) -> SIMD4<Float> {
+        return magnitude.replacing(with: -magnitude, where: sign .< SIMD4<Float>(repeating: 0))
+    }
+
+}
+
+// MARK: - HeadingResolver
+
+/// Updates the headings of all of the anchors once per frame.
+///
+/// Headings that look at a point (`AlwaysFacingMeHeading` and `WorldHeading` with a `.lookAt` type) are gathered into a single `LookAtBatch` and solved together. All other headings are updated by calling `updateHeading(withPosition:)` as before.
+final class HeadingResolver {
+    
+    /// Updates the heading of every anchor in `anchors` for a device located at `position`
+    func updateHeadings(of anchors: [AKAnchor], withPosition position: AKRelativePosition) {
+        
+        batch.removeAll()
+        batchedHeadings.removeAll(keepingCapacity: true)
+        
+        let cameraTransform = position.transform
+        let cameraPosition = SIMD3<Float>(cameraTransform.columns.3.x, cameraTransform.columns.3.y, cameraTransform.columns.3.z)
+        
+        for anchor in anchors {
+            // Subclasses may override `updateHeading(withPosition:)` so only the exact types are batched
+            if let facingMeHeading = anchor.heading as? AlwaysFacingMeHeading, type(of: facingMeHeading) == AlwaysFacingMeHeading.self {
+                let transform = facingMeHeading.worldLocation.transform
+                batch.append(eye: SIMD3<Float>(transform.columns.3.x, transform.columns.3.y, transform.columns.3.z), target: cameraPosition)
+                batchedHeadings.append(.alwaysFacingMe(facingMeHeading))
+            } else if let worldHeading = anchor.heading as? WorldHeading, type(of: worldHeading) == WorldHeading.self, case .lookAt(let thisWorldLocation, let thatWorldLocation) = worldHeading.worldHeadingType {
+                let thisTransform = thisWorldLocation.transform
+                let thatTransform = thatWorldLocation.transform
+                batch.append(eye: SIMD3<Float>(thisTransform.columns.3.x, thisTransform.columns.3.y, thisTransform.columns.3.z), target: SIMD3<Float>(thatTransform.columns.3.x, thatTransform.columns.3.y, thatTransform.columns.3.z))
+                batchedHeadings.append(.world(worldHeading))
+            } else {
+                anchor.heading.updateHeading(withPosition: position)
+            }
+        }
+        
+        guard batch.count > 0 else {
+            return
+        }
+        
+        batch.resolve(into: &rotations)
+        
+        for (index, batchedHeading) in batchedHeadings.enumerated() {
+            let offsetRotation = HeadingRotation(withQuaternion: rotations[index])
+            switch batchedHeading {
+            case .alwaysFacingMe(let heading):
+                heading.offsetRotation = offsetRotation
+            case .world(let heading):
+                heading.offsetRotation = offsetRotation
+            }
+        }
+    
+    }
+    
+    // MARK: - Private
+    
+    fileprivate enum BatchedHeading {
+        case alwaysFacingMe(AlwaysFacingMeHeading)
+        case world(WorldHeading)
+    }
+    
+    fileprivate var batch = LookAtBatch()
+    fileprivate var batchedHeadings = [BatchedHeading]()
+    fileprivate var rotations = [simd_quatf]()
+
+}
@@ -44,5 +44,6 @@ vector_float3 importanceSamplingNdfDggx(float2 u, float3 n, float roughness);
 vector_float3 importanceSamplingVNdfDggx(vector_float2 u, float roughness, vector_float3 v);
 float GDFG(float nDotv, float nDotl, float a);
 float prefilteredImportanceSampling(float ipdf, float2 iblMaxMipLevel);
+float perceptualRoughnessToIBLLod(float perceptualRoughness, float maxLod);
 
 #endif /* IBLFunctions_h */
@@ -0,0 +1,263 @@
+//
+//  LevelOfDetail.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+import AugmentKitShader
+
+// MARK: - LevelOfDetailCost
+
+/// The cost of drawing an object at one quality level. Every quality level draws the same mesh and only changes which textures are sampled, so only texture memory is counted.
+struct LevelOfDetailCost {
+    /// The number of bytes of textures sampled
+    var textureBytes: Int
+    
+    static let zero = LevelOfDetailCost(textureBytes: 0)
+    
+    static func + (lhs: LevelOfDetailCost, rhs: LevelOfDetailCost) -> LevelOfDetailCost {
+        return LevelOfDetailCost(textureBytes: lhs.textureBytes + rhs.textureBytes)
+    }
+    
+    static func - (lhs: LevelOfDetailCost, rhs: LevelOfDetailCost) -> LevelOfDetailCost {
+        return LevelOfDetailCost(textureBytes: lhs.textureBytes - rhs.textureBytes)
+    }
+    
+    /// Returns the cost of each quality level of `drawData`. Textures that `RenderUtilities.hasTexture(for:qualityLevel:)` drops at a level do not count towards that level.
+    static func costs(for drawData: DrawData, numQualityLevels: Int) -> [LevelOfDetailCost] {
+        
+        return (0..<numQualityLevels).map { level in
+            let qualityLevel = QualityLevel(rawValue: UInt32(level))
+            var textureBytes = 0
+            for subData in drawData.subData {
+                let textures: [(TextureIndices, MTLTexture?)] = [
+                    (kTextureIndexColor, subData.baseColorTexture),
+                    (kTextureIndexNormal, subData.normalTexture),
+                    (kTextureIndexAmbientOcclusion, subData.ambientOcclusionTexture),
+                    (kTextureIndexMetallic, subData.metallicTexture),
+                    (kTextureIndexRoughness, subData.roughnessTexture),
+                    (kTextureIndexEmissionMap, subData.emissionTexture),
+                    (kTextureIndexSubsurfaceMap, subData.subsurfaceTexture),
+                    (kTextureIndexSpecularMap, subData.specularTexture),
+                    (kTextureIndexSpecularTintMap, subData.specularTintTexture),
+                    (kTextureIndexAnisotropicMap, subData.anisotropicTexture),
+                    (kTextureIndexSheenMap, subData.sheenTexture),
+                    (kTextureIndexSheenTintMap, subData.sheenTintTexture),
+                    (kTextureIndexClearcoatMap, subData.clearcoatTexture),
+                    (kTextureIndexClearcoatGlossMap, subData.clearcoatGlossTexture),
+                ]
+                for (textureIndex, texture) in textures {
+                    if let texture = texture, RenderUtilities.hasTexture(for: textureIndex, qualityLevel: qualityLevel) {
+                        textureBytes += texture.allocatedSize
+                    }
+                }
+            }
+            return LevelOfDetailCost(textureBytes: textureBytes)
+        }
+        
+    }
+}
+
+// MARK: - LevelOfDetailBudget
+
+/// The most that can be drawn in a frame. When the selected quality levels exceed the budget, the objects that are smallest on screen are lowered first.
+struct LevelOfDetailBudget {
+    var maxTextureBytes: Int
+    
+    static let unlimited = LevelOfDetailBudget(maxTextureBytes: Int.max)
+    
+    func allows(_ cost: LevelOfDetailCost) -> Bool {
+        return cost.textureBytes <= maxTextureBytes
+    }
+}
+
+// MARK: - LevelOfDetailSelector
+
+/**
+ Chooses a `QualityLevel` for every object from its projected screen space error.
+ 
+ Each quality level loses detail that is roughly a fixed fraction of the object's size (`errorFractions`). Projecting the object's bounding sphere with the camera's projection gives its size in pixels, so the error of a level in pixels is `errorFractions[level] * projectedSize`. The coarsest level whose error is within `pixelTolerance` is chosen. This accounts for the size of the object, the field of view and the resolution of the viewport, which fixed distance bands do not.
+ 
+ To keep objects close to a boundary from switching every frame, a coarser level than the previous one is only chosen once its error falls `hysteresis` below the tolerance, and a finer level is only chosen once the error of the previous one rises `hysteresis` above it.
+ 
+ Usage, once per frame:
+ 1. `beginFrame()`
+ 2. `request(_:projectedSize:costs:)` for every visible object
+ 3. `resolve()` to apply the budget
+ 4. `qualityLevel(for:)` to read the results
+ */
+final class LevelOfDetailSelector {
+    
+    /// The fraction of an object's projected size that is lost at each quality level. The first entry is for `kQualityLevelHigh` and must be 0. With a one pixel tolerance these match the previous 15 m and 65 m distance bands for a 1 m object on a typical phone.
+    static let errorFractions: [Float] = [0, 1.0 / 128.0, 1.0 / 32.0]
+    
+    /// The number of quality levels
+    let numQualityLevels: Int
+    /// The largest acceptable error, in pixels
+    var pixelTolerance: Float = 1
+    /// The width of the band around `pixelTolerance` in which the previous level is kept, as a fraction of `pixelTolerance`
+    var hysteresis: Float = 0.2
+    /// The most that can be drawn in a frame
+    var budget = LevelOfDetailBudget.unlimited
+    
+    init(numQualityLevels: Int) {
+        self.numQualityLevels = max(min(numQualityLevels, LevelOfDetailSelector.errorFractions.count), 1)
+    }
+    
+    /**
+     Returns the diameter, in pixels, of a sphere projected on to the viewport.
+     - Parameters:
+        - radius: The radius of the sphere in world units
+        - distance: The distance from the camera to the center of the sphere
+        - projectionMatrix: The camera's projection matrix. Only the vertical scale, `columns.1.y`, is used.
+        - viewportHeight: The height of the viewport in pixels
+     */
+    static func projectedSize(radius: Float, distance: Float, projectionMatrix: float4x4, viewportHeight: Float) -> Float {
+        // Inside the sphere the object covers the screen
+        guard distance > radius else {
+            return viewportHeight
+        }
+        return radius * projectionMatrix.columns.1.y * viewportHeight / distance
+    }
+    
+    /// Returns the quality level for an object with the provided projected size, given the level it was drawn at in the previous frame
+    func qualityLevel(forProjectedSize projectedSize: Float, previousLevel: Int?) -> Int {
+        var level = 0
+        for candidate in 1..<max(numQualityLevels, 1) {
+            let tolerance: Float = {
+                guard let previousLevel = previousLevel else {
+                    return pixelTolerance
+                }
+                // Moving to a coarser level than the previous one needs to clear the lower edge of the band. Staying needs to stay below the upper edge.
+                return candidate <= previousLevel ? pixelTolerance * (1 + hysteresis) : pixelTolerance * (1 - hysteresis)
+            }()
+            guard LevelOfDetailSelector.errorFractions[candidate] * projectedSize <= tolerance else {
+                break
+            }
+            level = candidate
+        }
+        return level
+    }
+    
+    /// Returns a weight between 0 and 1 for the textures that are dropped at the next quality level. The weight fades to 0 over the hysteresis band so that the switch to the next level is not visible. `levelCount` is the number of levels the object can be drawn at and defaults to `numQualityLevels`.
+    func transitionWeight(forProjectedSize projectedSize: Float, qualityLevel: Int, levelCount: Int? = nil) -> Float {
+        let nextLevel = qualityLevel + 1
+        guard nextLevel < min(levelCount ?? numQualityLevels, numQualityLevels) else {
+            return 1
+        }
+        let lowerEdge = pixelTolerance * (1 - hysteresis)
+        let bandWidth = max(pixelTolerance * 2 * hysteresis, Float.leastNormalMagnitude)
+        return simd_clamp((LevelOfDetailSelector.errorFractions[nextLevel] * projectedSize - lowerEdge) / bandWidth, 0, 1)
+    }
+    
+    /// Forgets the requests of the previous frame. The levels chosen in the previous frame are kept for hysteresis.
+    func beginFrame() {
+        requests.removeAll(keepingCapacity: true)
+        requestIndexByIdentifier.removeAll(keepingCapacity: true)
+    }
+    
+    /// Requests a quality level for an object. `costs` has the cost of each quality level that the object can be drawn at and the object is never given a level past the end of it. Calling this again for the same identifier in the same frame merges the requests, keeping the larger projected size, adding the costs and keeping only the levels that both requests can be drawn at.
+    func request(_ identifier: UUID, projectedSize: Float, costs: [LevelOfDetailCost]) {
+        if let index = requestIndexByIdentifier[identifier] {
+            let existingCosts = requests[index].costs
+            requests[index].projectedSize = max(requests[index].projectedSize, projectedSize)
+            requests[index].costs = (0..<min(costs.count, existingCosts.count)).map { existingCosts[$0] + costs[$0] }
+        } else {
+            requestIndexByIdentifier[identifier] = requests.count
+            requests.append(Request(identifier: identifier, projectedSize: projectedSize, costs: costs))
+        }
+    }
+    
+    /// Chooses the quality level of every requested object. When the total cost is over `budget`, objects are lowered one level at a time, smallest on screen first, until it fits or every object is at the lowest level.
+    func resolve() {
+        
+        var total = LevelOfDetailCost.zero
+        var levels = [Int]()
+        levels.reserveCapacity(requests.count)
+        for request in requests {
+            let level = min(qualityLevel(forProjectedSize: request.projectedSize, previousLevel: levelByIdentifier[request.identifier]), levelCount(of: request) - 1)
+            levels.append(level)
+            total = total + request.cost(atLevel: level)
+        }
+        
+        if !budget.allows(total) {
+            let order = requests.indices.sorted { requests[$0].projectedSize < requests[$1].projectedSize }
+            var didLower = true
+            while !budget.allows(total) && didLower {
+                didLower = false
+                for index in order where levels[index] + 1 < levelCount(of: requests[index]) {
+                    let request = requests[index]
+                    total = total - request.cost(atLevel: levels[index]) + request.cost(atLevel: levels[index] + 1)
+                    levels[index] += 1
+                    didLower = true
+                    if budget.allows(total) {
+                        break
+                    }
+                }
+            }
+        }
+        
+        levelByIdentifier.removeAll(keepingCapacity: true)
+        for (index, request) in requests.enumerated() {
+            levelByIdentifier[request.identifier] = levels[index]
+        }
+        totalCost = total
+        
+    }
+    
+    /// The total cost of the levels chosen by the last call to `resolve()`
+    private(set) var totalCost = LevelOfDetailCost.zero
+    
+    /// The quality level chosen for an object by the last call to `resolve()`. Objects that were not requested are drawn at `kQualityLevelHigh`.
+    func qualityLevel(for identifier: UUID) -> QualityLevel {
+        return QualityLevel(rawValue: UInt32(levelByIdentifier[identifier] ?? 0))
+    }
+    
+    // MARK: - Private
+    
+    fileprivate struct Request {
+        var identifier: UUID
+        var projectedSize: Float
+        var costs: [LevelOfDetailCost]
+        
+        func cost(atLevel level: Int) -> LevelOfDetailCost {
+            guard !costs.isEmpty else {
+                return .zero
+            }
+            return costs[min(level, costs.count - 1)]
+        }
+    }
+    
+    fileprivate var requests = [Request]()
+    fileprivate var requestIndexByIdentifier = [UUID: Int]()
+    fileprivate var levelByIdentifier = [UUID: Int]()
+    
+    // The number of levels a request can be drawn at. Requests without costs can still be drawn at `kQualityLevelHigh`.
+    fileprivate func levelCount(of request: Request) -> Int {
+        return min(max(request.costs.count, 1), numQualityLevels)
+    }
+    
+}
@@ -85,6 +85,7 @@ class ModelManager {
                 DispatchQueue.main.async { [weak self] in
                     print("Chaching with key \(key)")
                     self?.backingCache[key] = meshGPUData
+                    GPUResourceRegistry.shared.register(meshGPUData, owner: .asset(key))
                     completion?(meshGPUData, key)
                     self?.workGroup.leave()
                 }
@@ -0,0 +1,352 @@
+//
+//  OcclusionCulling.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import CoreGraphics
+import Foundation
+import Metal
+import simd
+import AugmentKitShader
+
+// MARK: - DepthPyramidLevel
+
+/// One level of a depth pyramid on the host. Depths are in the range of the scene depth buffer, 0 at the near plane and 1 at the far plane, and are stored row by row starting at the top.
+struct DepthPyramidLevel {
+    
+    /// The width of the level in texels
+    var width: Int
+    /// The height of the level in texels
+    var height: Int
+    /// `width * height` depths
+    var depths: [Float]
+    
+    /// Returns the depth of a texel
+    func depth(x: Int, y: Int) -> Float {
+        return depths[y * width + x]
+    }
+    
+}
+
+// MARK: - OcclusionCulling
+
+/**
+ Host side implementation of the hierarchical depth (Hi-Z) occlusion culling performed by `DepthPyramid` and `isSphereOccluded` in Common.metal. Used to validate the shaders.
+ 
+ Every texel of the pyramid holds the farthest depth of the texels it covers in the level above, so an object is only reported as occluded when everything that could be in front of it is nearer than its nearest point. `isSphereOccludedReference(modelViewProjectionMatrix:sphere:sceneDepth:realDepth:)` performs the same test against every texel of the full resolution depth and can be used to check that the pyramid never culls something the reference would not.
+ */
+enum OcclusionCulling {
+    
+    /// Matte values at or above this mean a person completely covers the camera image. See `depth_pyramid_seed` in CompositeShaders.metal.
+    static let matteThreshold: Float = 0.99
+    
+    /// Projects linear real world depth into the depth range of the scene. Returns the far plane where there is no depth. Mirrors `realWorldSceneDepth` in CompositeShaders.metal.
+    static func realWorldSceneDepth(linearDepth: Float, projectionMatrix: float4x4) -> Float {
+        guard linearDepth > 0 else {
+            return 1
+        }
+        let depth = (projectionMatrix[2][2] * -linearDepth + projectionMatrix[3][2]) / (projectionMatrix[2][3] * -linearDepth + projectionMatrix[3][3])
+        return min(max(depth, 0), 1)
+    }
+    
+    /// Reduces a level into the next one, keeping the farthest depth of every 2x2 block. The last row and column also cover the remainder of odd sizes. Mirrors `depth_pyramid_downsample` in CompositeShaders.metal.
+    static func downsample(_ level: DepthPyramidLevel) -> DepthPyramidLevel {
+        
+        let width = MipChain.size(of: level.width, atLod: 1)
+        let height = MipChain.size(of: level.height, atLod: 1)
+        var depths = [Float](repeating: 0, count: width * height)
+        
+        for y in 0..<height {
+            let lastY = y == height - 1 ? level.height - 1 : min(y * 2 + 1, level.height - 1)
+            for x in 0..<width {
+                let lastX = x == width - 1 ? level.width - 1 : min(x * 2 + 1, level.width - 1)
+                var farthestDepth: Float = 0
+                for sourceY in (y * 2)...lastY {
+                    for sourceX in (x * 2)...lastX {
+                        farthestDepth = max(farthestDepth, level.depth(x: sourceX, y: sourceY))
+                    }
+                }
+                depths[y * width + x] = farthestDepth
+            }
+        }
+        
+        return DepthPyramidLevel(width: width, height: height, depths: depths)
+        
+    }
+    
+    /**
+     Builds every level of a pyramid. Mirrors `DepthPyramid.encode(sceneDepthTexture:alphaTexture:dilatedDepthTexture:viewMatrix:projectionMatrix:displayTransform:commandBuffer:)`.
+     - Parameters:
+        - sceneDepth: The depth of the virtual content
+        - realDepth: Optional real world depth the same size as `sceneDepth`, already projected into the depth range of the scene with `realWorldSceneDepth(linearDepth:projectionMatrix:)`. Texels that are not covered by a person should be 1.
+     - Returns: The levels of the pyramid, starting with level 0 which is half the size of `sceneDepth`
+     */
+    static func buildPyramid(sceneDepth: DepthPyramidLevel, realDepth: DepthPyramidLevel? = nil) -> [DepthPyramidLevel] {
+        
+        var pyramid = [downsample(combinedDepth(sceneDepth: sceneDepth, realDepth: realDepth))]
+        let levelCount = MipChain.fullLevelCount(width: pyramid[0].width, height: pyramid[0].height)
+        while pyramid.count < levelCount {
+            pyramid.append(downsample(pyramid[pyramid.count - 1]))
+        }
+        return pyramid
+        
+    }
+    
+    /// Returns `true` when `sphere`, in model space with the radius in `w`, is hidden behind the depth in `pyramid`. Mirrors `isSphereOccluded` in Common.metal.
+    static func isSphereOccluded(modelViewProjectionMatrix: float4x4, sphere: SIMD4<Float>, pyramid: [DepthPyramidLevel]) -> Bool {
+        
+        guard let first = pyramid.first, let bounds = projectedBounds(modelViewProjectionMatrix: modelViewProjectionMatrix, sphere: sphere) else {
+            return false
+        }
+        
+        // Choose the level where the box covers at most two texels in each direction
+        let pyramidSize = SIMD2<Float>(Float(first.width), Float(first.height))
+        let minTexel = bounds.minTexCoord * pyramidSize
+        let maxTexel = simd_min(bounds.maxTexCoord * pyramidSize, pyramidSize - 1)
+        let extent = maxTexel - minTexel
+        let level = Int(min(max(ceil(log2(max(max(extent.x, extent.y), 1))), 0), Float(pyramid.count - 1)))
+        
+        // A texel at `level` covers 2^level texels of level 0
+        let levelDepth = pyramid[level]
+        let firstX = min(Int(minTexel.x) >> level, levelDepth.width - 1)
+        let firstY = min(Int(minTexel.y) >> level, levelDepth.height - 1)
+        let lastX = min(Int(maxTexel.x) >> level, levelDepth.width - 1)
+        let lastY = min(Int(maxTexel.y) >> level, levelDepth.height - 1)
+        
+        var farthestDepth: Float = 0
+        for y in firstY...lastY {
+            for x in firstX...lastX {
+                farthestDepth = max(farthestDepth, levelDepth.depth(x: x, y: y))
+            }
+        }
+        
+        return bounds.nearestDepth > farthestDepth
+        
+    }
+    
+    /// Performs the same test as `isSphereOccluded(modelViewProjectionMatrix:sphere:pyramid:)` against every full resolution texel covered by the sphere. Slow but exact, intended as a reference.
+    static func isSphereOccludedReference(modelViewProjectionMatrix: float4x4, sphere: SIMD4<Float>, sceneDepth: DepthPyramidLevel, realDepth: DepthPyramidLevel? = nil) -> Bool {
+        
+        guard sceneDepth.width > 0, sceneDepth.height > 0, let bounds = projectedBounds(modelViewProjectionMatrix: modelViewProjectionMatrix, sphere: sphere) else {
+            return false
+        }
+        
+        let depth = combinedDepth(sceneDepth: sceneDepth, realDepth: realDepth)
+        let size = SIMD2<Float>(Float(depth.width), Float(depth.height))
+        let minTexel = bounds.minTexCoord * size
+        let maxTexel = simd_min(bounds.maxTexCoord * size, size - 1)
+        
+        var farthestDepth: Float = 0
+        for y in Int(minTexel.y)...Int(maxTexel.y) {
+            for x in Int(minTexel.x)...Int(maxTexel.x) {
+                farthestDepth = max(farthestDepth, depth.depth(x: x, y: y))
+            }
+        }
+        
+        return bounds.nearestDepth > farthestDepth
+        
+    }
+    
+    // MARK: - Private
+    
+    // The nearest of the scene and real world depth
+    fileprivate static func combinedDepth(sceneDepth: DepthPyramidLevel, realDepth: DepthPyramidLevel?) -> DepthPyramidLevel {
+        guard let realDepth = realDepth, realDepth.width == sceneDepth.width, realDepth.height == sceneDepth.height else {
+            return sceneDepth
+        }
+        return DepthPyramidLevel(width: sceneDepth.width, height: sceneDepth.height, depths: zip(sceneDepth.depths, realDepth.depths).map({ min($0, $1) }))
+    }
+    
+    // Projects the corners of the box that encloses the sphere and returns its on screen bounds, clamped to the screen, and its nearest depth. Returns `nil` when the sphere can't be tested because its bounds are unknown, it crosses the near plane or it is completely off screen.
+    fileprivate static func projectedBounds(modelViewProjectionMatrix: float4x4, sphere: SIMD4<Float>) -> (minTexCoord: SIMD2<Float>, maxTexCoord: SIMD2<Float>, nearestDepth: Float)? {
+        
+        guard sphere.w > 0 else {
+            return nil
+        }
+        
+        var minTexCoord = SIMD2<Float>(repeating: 1)
+        var maxTexCoord = SIMD2<Float>(repeating: 0)
+        var nearestDepth: Float = 1
+        for index in 0..<8 {
+            let direction = SIMD3<Float>(index & 1 != 0 ? 1 : -1, index & 2 != 0 ? 1 : -1, index & 4 != 0 ? 1 : -1)
+            let corner = SIMD3<Float>(sphere.x, sphere.y, sphere.z) + sphere.w * direction
+            let clipPosition = modelViewProjectionMatrix * SIMD4<Float>(corner, 1)
+            guard clipPosition.w > 1.0e-5 else {
+                return nil
+            }
+            let ndc = SIMD3<Float>(clipPosition.x, clipPosition.y, clipPosition.z) / clipPosition.w
+            let texCoord = SIMD2<Float>(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5)
+            minTexCoord = simd_min(minTexCoord, texCoord)
+            maxTexCoord = simd_max(maxTexCoord, texCoord)
+            nearestDepth = min(nearestDepth, ndc.z)
+        }
+        
+        guard maxTexCoord.x >= 0, maxTexCoord.y >= 0, minTexCoord.x <= 1, minTexCoord.y <= 1 else {
+            return nil
+        }
+        
+        return (minTexCoord: simd_clamp(minTexCoord, SIMD2<Float>(repeating: 0), SIMD2<Float>(repeating: 1)), maxTexCoord: simd_clamp(maxTexCoord, SIMD2<Float>(repeating: 0), SIMD2<Float>(repeating: 1)), nearestDepth: nearestDepth)
+        
+    }
+    
+}
+
+// MARK: - DepthPyramid
+
+/**
+ Builds a hierarchical depth pyramid from the scene depth of a frame so that the precalculation stage of the next frame can skip virtual content that is hidden behind nearer content. Where person segmentation with depth is available, people that completely cover the camera image also occlude virtual content.
+ 
+ Level 0 is half the size of the scene depth and every level keeps the farthest depth of the texels it covers. Because the pyramid is built after the scene is drawn, culling lags by one frame. The test uses the view projection of the frame the pyramid was built from so that camera motion does not cause visible content to be culled.
+ */
+final class DepthPyramid {
+    
+    /// The pyramid. `nil` until `resize(sceneWidth:sceneHeight:)` is called.
+    fileprivate(set) var texture: MTLTexture?
+    /// Describes the most recently encoded pyramid to the precalculation stage. Culling is disabled until a pyramid has been encoded.
+    fileprivate(set) var cullingUniforms = OcclusionCullingUniforms()
+    
+    init?(device: MTLDevice, metalLibrary: MTLLibrary) {
+        
+        guard let seedFunction = metalLibrary.makeFunction(name: "depth_pyramid_seed"), let downsampleFunction = metalLibrary.makeFunction(name: "depth_pyramid_downsample") else {
+            print("Warning (DepthPyramid) - Failed to create the depth pyramid functions.")
+            return nil
+        }
+        
+        do {
+            seedPipelineState = try device.makeComputePipelineState(function: seedFunction)
+            downsamplePipelineState = try device.makeComputePipelineState(function: downsampleFunction)
+        } catch let error {
+            print("Warning (DepthPyramid) - Failed to create the compute pipeline states. ERROR: \(error)")
+            return nil
+        }
+        
+        self.device = device
+        
+    }
+    
+    /// Recreates the pyramid for scene depth of the given size. Culling is disabled until the next pyramid is encoded.
+    func resize(sceneWidth: Int, sceneHeight: Int) {
+        
+        cullingUniforms = OcclusionCullingUniforms()
+        texture = nil
+        levelTextures = []
+        
+        let width = MipChain.size(of: sceneWidth, atLod: 1)
+        let height = MipChain.size(of: sceneHeight, atLod: 1)
+        let threadExecutionWidth = min(seedPipelineState.threadExecutionWidth, downsamplePipelineState.threadExecutionWidth)
+        let maxTotalThreadsPerThreadgroup = min(seedPipelineState.maxTotalThreadsPerThreadgroup, downsamplePipelineState.maxTotalThreadsPerThreadgroup)
+        mipChain = MipChain(width: width, height: height, levelCount: MipChain.fullLevelCount(width: width, height: height), threadExecutionWidth: threadExecutionWidth, maxTotalThreadsPerThreadgroup: maxTotalThreadsPerThreadgroup)
+        
+        guard sceneWidth > 0, sceneHeight > 0 else {
+            return
+        }
+        
+        let descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .r32Float, width: width, height: height, mipmapped: true)
+        descriptor.usage = [.shaderRead, .shaderWrite]
+        descriptor.storageMode = .private
+        guard let pyramidTexture = device.makeTexture(descriptor: descriptor) else {
+            print("Warning (DepthPyramid) - Failed to create the depth pyramid texture.")
+            return
+        }
+        pyramidTexture.label = "Depth Pyramid"
+        
+        // Each level is written through its own view
+        var views = [MTLTexture]()
+        for level in mipChain.levels {
+            guard let view = pyramidTexture.makeTextureView(pixelFormat: .r32Float, textureType: .type2D, levels: level.lod..<(level.lod + 1), slices: 0..<1) else {
+                print("Warning (DepthPyramid) - Failed to create a view of level \(level.lod) of the depth pyramid.")
+                return
+            }
+            views.append(view)
+        }
+        
+        texture = pyramidTexture
+        levelTextures = views
+        
+    }
+    
+    /**
+     Encodes the pyramid into `commandBuffer`. Must be encoded after the scene has been drawn into `sceneDepthTexture`.
+     - Parameters:
+        - sceneDepthTexture: The depth of the virtual content
+        - alphaTexture: The person segmentation matte. Pass `nil` when person segmentation with depth is not available.
+        - dilatedDepthTexture: The linear real world depth of the people in the matte
+        - viewMatrix: The view matrix the scene was drawn with
+        - projectionMatrix: The projection matrix the scene was drawn with
+        - displayTransform: Transforms camera texture coordinates into scene texture coordinates
+        - commandBuffer: The command buffer to encode into
+     */
+    func encode(sceneDepthTexture: MTLTexture, alphaTexture: MTLTexture?, dilatedDepthTexture: MTLTexture?, viewMatrix: float4x4, projectionMatrix: float4x4, displayTransform: CGAffineTransform, commandBuffer: MTLCommandBuffer) {
+        
+        guard let texture = texture, levelTextures.count == mipChain.count, mipChain.count > 0 else {
+            return
+        }
+        
+        guard let computeEncoder = commandBuffer.makeComputeCommandEncoder() else {
+            return
+        }
+        
+        // The composite pass samples the camera image with the inverse of the display transform
+        let sceneToCamera = displayTransform.inverted()
+        let useRealDepth = alphaTexture != nil && dilatedDepthTexture != nil
+        var uniforms = DepthPyramidUniforms(projectionMatrix: projectionMatrix, cameraTexCoordTransformX: SIMD3<Float>(Float(sceneToCamera.a), Float(sceneToCamera.c), Float(sceneToCamera.tx)), cameraTexCoordTransformY: SIMD3<Float>(Float(sceneToCamera.b), Float(sceneToCamera.d), Float(sceneToCamera.ty)), useRealDepth: useRealDepth ? 1 : 0)
+        
+        computeEncoder.label = "Depth Pyramid"
+        
+        for level in mipChain.levels {
+            
+            computeEncoder.pushDebugGroup("Depth Pyramid Level \(level.lod)")
+            if level.lod == 0 {
+                computeEncoder.setComputePipelineState(seedPipelineState)
+                computeEncoder.setTexture(sceneDepthTexture, index: Int(kTextureIndexSceneDepth.rawValue))
+                computeEncoder.setTexture(alphaTexture, index: Int(kTextureIndexAlpha.rawValue))
+                computeEncoder.setTexture(dilatedDepthTexture, index: Int(kTextureIndexDialatedDepth.rawValue))
+                computeEncoder.setBytes(&uniforms, length: MemoryLayout<DepthPyramidUniforms>.stride, index: Int(kBufferIndexDepthPyramidUniforms.rawValue))
+            } else {
+                computeEncoder.setComputePipelineState(downsamplePipelineState)
+                computeEncoder.setTexture(levelTextures[level.lod - 1], index: Int(kTextureIndexDepthPyramidSource.rawValue))
+            }
+            computeEncoder.setTexture(levelTextures[level.lod], index: Int(kTextureIndexDepthPyramidDestination.rawValue))
+            computeEncoder.dispatchThreadgroups(MTLSize(width: level.threadgroupsPerGrid.width, height: level.threadgroupsPerGrid.height, depth: 1), threadsPerThreadgroup: MTLSize(width: level.threadsPerThreadgroup.width, height: level.threadsPerThreadgroup.height, depth: 1))
+            computeEncoder.popDebugGroup()
+            
+        }
+        
+        computeEncoder.endEncoding()
+        
+        cullingUniforms = OcclusionCullingUniforms(viewProjectionMatrix: projectionMatrix * viewMatrix, pyramidSize: SIMD2<UInt32>(UInt32(texture.width), UInt32(texture.height)), levelCount: UInt32(mipChain.count), isEnabled: 1)
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let device: MTLDevice
+    fileprivate let seedPipelineState: MTLComputePipelineState
+    fileprivate let downsamplePipelineState: MTLComputePipelineState
+    fileprivate var mipChain = MipChain(width: 0, height: 0, levelCount: 0)
+    fileprivate var levelTextures = [MTLTexture]()
+    
+}
@@ -141,10 +141,12 @@ class ComputePass<Out> {
     
     /// Prepares the input and output textures for rendering by generating mipmaps. This should be called once before rendering and every time the input / output textures change.
     func prepareTextures() {
+        let threadExecutionWidth = threadGroup?.computePipelineState.threadExecutionWidth ?? 32
+        let maxTotalThreadsPerThreadgroup = threadGroup?.computePipelineState.maxTotalThreadsPerThreadgroup ?? 1024
         inputTextures.forEach {
-            $0.generateMippedTextures()
+            $0.generateMippedTextures(threadExecutionWidth: threadExecutionWidth, maxTotalThreadsPerThreadgroup: maxTotalThreadsPerThreadgroup)
         }
-        outputTexture?.generateMippedTextures()
+        outputTexture?.generateMippedTextures(threadExecutionWidth: threadExecutionWidth, maxTotalThreadsPerThreadgroup: maxTotalThreadsPerThreadgroup)
     }
     
     // MARK: - Lifecycle
@@ -230,6 +232,7 @@ class ComputePass<Out> {
         
     }
     
+    /// Dispatches a single level of the output texture and ends encoding
     func dispatch(lod: Int = 0) {
         
         defer {
@@ -240,6 +243,32 @@ class ComputePass<Out> {
             return
         }
         
+        encodeDispatch(lod: lod, with: computeEncoder)
+    
+    }
+    
+    /// Dispatches every level of the output texture's mip chain into the same encoder and ends encoding. Each level is sized exactly from `GPUPassTexture.mipChain`.
+    func dispatchMipChain() {
+        
+        defer {
+            computeCommandEncoder?.endEncoding()
+        }
+        
+        guard let computeEncoder = computeCommandEncoder else {
+            return
+        }
+        
+        let levelCount = max(outputTexture?.mipChain.count ?? 1, 1)
+        for lod in 0..<levelCount {
+            encodeDispatch(lod: lod, with: computeEncoder)
+        }
+    
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func encodeDispatch(lod: Int, with computeEncoder: MTLComputeCommandEncoder) {
+        
         guard let threadGroup = threadGroup else {
             return
         }
@@ -321,13 +350,17 @@ class ComputePass<Out> {
         
         prepareThreadGroup()
         
-        // Requires the device supports non-uniform threadgroup sizes
-        computeEncoder.dispatchThreads(MTLSize(width: threadGroup.size.width, height: threadGroup.size.height, depth: threadGroup.size.depth), threadsPerThreadgroup: MTLSize(width: threadGroup.threadsPerGroup.width, height: threadGroup.threadsPerGroup.height, depth: 1))
+        if let level = outputTexture?.mipChain.level(at: lod) {
+            // Size the grid to the level being written rather than to level 0
+            // Requires the device supports non-uniform threadgroup sizes
+            computeEncoder.dispatchThreads(MTLSize(width: level.threadsPerGrid.width, height: level.threadsPerGrid.height, depth: level.threadsPerGrid.depth), threadsPerThreadgroup: MTLSize(width: level.threadsPerThreadgroup.width, height: level.threadsPerThreadgroup.height, depth: level.threadsPerThreadgroup.depth))
+        } else {
+            // Requires the device supports non-uniform threadgroup sizes
+            computeEncoder.dispatchThreads(MTLSize(width: threadGroup.size.width, height: threadGroup.size.height, depth: threadGroup.size.depth), threadsPerThreadgroup: MTLSize(width: threadGroup.threadsPerGroup.width, height: threadGroup.threadsPerGroup.height, depth: 1))
+        }
         
         computeEncoder.popDebugGroup()
-        
-    }
     
-    // MARK: - Private
+    }
     
 }
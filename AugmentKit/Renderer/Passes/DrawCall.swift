@@ -280,8 +280,13 @@ struct DrawCall {
         return qualityRenderPipelineStates[qualityLevel]
     }
     
-    func markTexturesAsVolitile() {
-        drawData?.markTexturesAsVolitile()
+    /// The textures of the draw data
+    var textures: [MTLTexture] {
+        return drawData?.textures ?? []
+    }
+    
+    func markTexturesAsVolitile(keeping texturesInUse: Set<ObjectIdentifier> = []) {
+        drawData?.markTexturesAsVolitile(keeping: texturesInUse)
     }
     
     func markTexturesAsNonVolitile() {
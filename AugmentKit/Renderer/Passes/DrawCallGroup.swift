@@ -26,6 +26,7 @@
 //
 
 import Foundation
+import AugmentKitShader
 
 // MARK: - DrawCallGroup
 
@@ -42,6 +43,14 @@ class DrawCallGroup {
     var useSkeleton = false
     /// If `false` the renderer will not generate a shadow for this `DrawCallGroup`
     var generatesShadows: Bool
+    /// The quality level at which the draw calls are rendered. Chosen every frame by the precalculation module when level of detail is enabled. See `LevelOfDetailSelector`
+    var qualityLevel: QualityLevel = kQualityLevelHigh
+    /// The number of quality levels that every draw call in the group has a render pipeline state for. `qualityLevel` is always less than this.
+    var numQualityLevels: Int {
+        return max(drawCalls.map({ $0.qualityRenderPipelineStates.count }).min() ?? 1, 1)
+    }
+    /// The cost of each quality level of each draw call. Calculated by the precalculation module the first time the group is drawn and released along with the group.
+    var levelOfDetailCosts: [[LevelOfDetailCost]]?
     
     /// The order of `drawCalls` is usually taken directly from the order in which the meshes are parsed from the MDLAsset.
     /// see: `ModelIOTools.meshGPUData(from:,device:,vertexDescriptor:,frameRate:,shaderPreference:,loadTextures:,textureBundle:,completion:)`
@@ -56,8 +65,13 @@ class DrawCallGroup {
         }
     }
     
-    func markTexturesAsVolitile() {
-        drawCalls.forEach{ $0.markTexturesAsVolitile() }
+    /// The textures of every draw call
+    var textures: [MTLTexture] {
+        return drawCalls.flatMap { $0.textures }
+    }
+    
+    func markTexturesAsVolitile(keeping texturesInUse: Set<ObjectIdentifier> = []) {
+        drawCalls.forEach{ $0.markTexturesAsVolitile(keeping: texturesInUse) }
     }
     
     func markTexturesAsNonVolitile() {
@@ -65,6 +79,43 @@ class DrawCallGroup {
     }
 }
 
+// MARK: - Merging
+
+extension DrawCallGroup {
+    
+    /**
+     Merges groups that were loaded incrementally into the groups of a render pass.
+     
+     A full load lays out each module's groups as one run sorted by UUID and the argument buffer layout depends on that order, so every new group is merged into its position in its module's run. Groups of a module that has no run yet start a new one at the end. A group that replaces an existing group with the same `uuid` takes its place in the run.
+     - Parameters:
+        - newDrawCallGroups: The groups that finished loading
+        - drawCallGroups: The groups currently in the render pass
+        - currentIdentifiers: The identifiers of the entities that are still being rendered. New groups for any other entity were removed while they were loading and are dropped.
+     - Returns: The merged groups
+     */
+    static func merge(_ newDrawCallGroups: [DrawCallGroup], into drawCallGroups: [DrawCallGroup], currentIdentifiers: Set<UUID>) -> [DrawCallGroup] {
+        
+        let addedDrawCallGroups = newDrawCallGroups.filter({currentIdentifiers.contains($0.uuid)})
+        let addedIDs = Set(addedDrawCallGroups.map({$0.uuid}))
+        var mergedDrawCallGroups = drawCallGroups
+        mergedDrawCallGroups.removeAll(where: {addedIDs.contains($0.uuid)})
+        
+        for drawCallGroup in addedDrawCallGroups.sorted(by: {$0.uuid.uuidString < $1.uuid.uuidString}) {
+            let moduleIndices = mergedDrawCallGroups.indices.filter({mergedDrawCallGroups[$0].moduleIdentifier == drawCallGroup.moduleIdentifier})
+            guard let lastModuleIndex = moduleIndices.last else {
+                mergedDrawCallGroups.append(drawCallGroup)
+                continue
+            }
+            let insertionIndex = moduleIndices.first(where: {mergedDrawCallGroups[$0].uuid.uuidString > drawCallGroup.uuid.uuidString}) ?? lastModuleIndex + 1
+            mergedDrawCallGroups.insert(drawCallGroup, at: insertionIndex)
+        }
+        
+        return mergedDrawCallGroups
+        
+    }
+    
+}
+
 extension DrawCallGroup: CustomDebugStringConvertible, CustomStringConvertible {
     
     /// :nodoc:
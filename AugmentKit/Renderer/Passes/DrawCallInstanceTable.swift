@@ -0,0 +1,110 @@
+//
+//  DrawCallInstanceTable.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import AugmentKitShader
+
+// MARK: - DrawCallInstanceTable
+
+/**
+ A per frame table that maps the instances of an instanced draw to their draw calls in the precalculated arguments buffer.
+ 
+ Draw calls that share a mesh are drawn together with a single `drawIndexedPrimitives`. The vertex function reads the argument buffer index for each instance from the table at `[[instance_id]]`. The table holds one region per in flight frame so that a region is never written while a pending frame reads it.
+ */
+final class DrawCallInstanceTable {
+    
+    /// The buffer containing one table per in flight frame
+    let instanceBuffer: MTLBuffer
+    /// The offset of the current frame's table in `instanceBuffer`
+    private(set) var instanceBufferOffset = 0
+    /// The number of instances in the current frame's table
+    private(set) var instanceCount = 0
+    /// The maximum number of instances in a table
+    let maxInstanceCount: Int
+    
+    init?(device: MTLDevice, regionCount: Int, maxInstanceCount: Int) {
+        self.maxInstanceCount = maxInstanceCount
+        alignedTableSize = ((MemoryLayout<UInt32>.stride * maxInstanceCount) & ~0xFF) + 0x100
+        guard let aBuffer = device.makeBuffer(length: alignedTableSize * max(regionCount, 1), options: .storageModeShared) else {
+            return nil
+        }
+        aBuffer.label = "DrawCallInstanceTable"
+        GPUResourceRegistry.shared.register(aBuffer, category: .buffer, owner: .renderer)
+        instanceBuffer = aBuffer
+    }
+    
+    /// Empties the table and moves to the region for `bufferIndex`
+    func reset(forBufferIndex bufferIndex: Int) {
+        instanceBufferOffset = alignedTableSize * bufferIndex
+        instanceCount = 0
+    }
+    
+    /// Adds the argument buffer indices of one instanced draw to the current frame's table and returns the index of the first one, which is the base instance of the draw. Returns `nil` if the table does not have room for all of them.
+    func append(argumentBufferIndices: [Int]) -> Int? {
+        guard instanceCount + argumentBufferIndices.count <= maxInstanceCount else {
+            return nil
+        }
+        let baseInstance = instanceCount
+        let instances = instanceBuffer.contents().advanced(by: instanceBufferOffset).assumingMemoryBound(to: UInt32.self)
+        for argumentBufferIndex in argumentBufferIndices {
+            instances[instanceCount] = UInt32(argumentBufferIndex)
+            instanceCount += 1
+        }
+        return baseInstance
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let alignedTableSize: Int
+    
+}
+
+// MARK: - MeshIdentity
+
+/// Identifies the GPU geometry of a `DrawData`. Draw calls with the same identity read the same vertex and index data and can be drawn with one instanced draw. `ModelManager` shares the buffers of every entity that uses the same asset.
+struct MeshIdentity: Hashable {
+    
+    init(drawData: DrawData) {
+        vertexBuffers = (drawData.rawVertexBuffers.isEmpty ? drawData.vertexBuffers : drawData.rawVertexBuffers).map { ObjectIdentifier($0) }
+        rawVertexBufferOffset = drawData.rawVertexBufferOffset
+        indexBuffers = drawData.subData.map { subData in
+            guard let indexBuffer = subData.indexBuffer else {
+                return nil
+            }
+            return ObjectIdentifier(indexBuffer)
+        }
+        indexBufferOffsets = drawData.subData.map { $0.indexBufferOffset }
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var vertexBuffers: [ObjectIdentifier]
+    fileprivate var rawVertexBufferOffset: Int
+    fileprivate var indexBuffers: [ObjectIdentifier?]
+    fileprivate var indexBufferOffsets: [Int]
+    
+}
@@ -80,6 +80,7 @@ class GPUPassBuffer<T> {
         if let label = label {
             buffer?.label = label
         }
+        GPUResourceRegistry.shared.register(buffer, category: .buffer, owner: .renderer)
         
     }
     
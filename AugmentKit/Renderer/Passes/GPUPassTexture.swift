@@ -14,8 +14,12 @@ class GPUPassTexture {
     var label: String?
     var shaderAttributeIndex: Int = 0
     var mipLevels: Int = 1
+    /// How the levels of `texture` map to roughness when it holds a prefiltered specular chain
+    var roughnessMapping: RoughnessMapping = .filament
     fileprivate(set) var mippedTextures = [MTLTexture]()
     fileprivate(set) var mippedSizes = [Int]()
+    /// Exact sizes, dispatch grids and roughness for every level. Rebuilt by `generateMippedTextures(threadExecutionWidth:maxTotalThreadsPerThreadgroup:)`
+    fileprivate(set) var mipChain = MipChain(width: 0, height: 0, levelCount: 0)
     
     init(texture: MTLTexture? = nil, label: String?, shaderAttributeIndex: Int = 0, mipLevels: Int = 1) {
         self.texture = texture
@@ -24,55 +28,45 @@ class GPUPassTexture {
         self.mipLevels = mipLevels
     }
     
+    /// The GGX alpha that level `lod` is prefiltered for
     func roughness(for lod: Int) -> Float {
-        guard mipLevels > 1 else {
-            return 0
-        }
-        let roughness = Float(lod) / Float(mipLevels - 1)
-        return roughness
+        return mipChain.level(at: lod)?.roughness ?? 0
     }
     
+    /// The largest dimension of level `lod`
     func mipSize(for lod: Int) -> Int {
-        guard let texture = texture else {
+        guard let level = mipChain.level(at: lod) else {
             return 0
         }
-        let textureSize = max(texture.width, texture.height)
-        guard mipLevels > 1 else {
-            return textureSize
-        }
-        guard lod > 0 else {
-            return textureSize
-        }
-        return textureSize / lod * 2
+        return max(level.width, level.height)
     }
     
-    func generateMippedTextures() {
+    func generateMippedTextures(threadExecutionWidth: Int = 32, maxTotalThreadsPerThreadgroup: Int = 1024) {
+        
+        mippedTextures = []
+        mippedSizes = []
         
         guard let texture = texture else {
-            mippedTextures = []
-//            mippedThreadgroups = []
-            mippedSizes = []
+            mipChain = MipChain(width: 0, height: 0, levelCount: 0)
             return
         }
         
-        var mipSize = max(texture.width, texture.height)
+        let isCube = texture.textureType == .typeCube || texture.textureType == .typeCubeArray
+        let sliceCount = isCube ? texture.arrayLength * 6 : texture.arrayLength
+        let levelCount = min(max(mipLevels, 1), texture.mipmapLevelCount)
+        mipChain = MipChain(width: texture.width, height: texture.height, depth: sliceCount, levelCount: levelCount, roughnessMapping: roughnessMapping, threadExecutionWidth: threadExecutionWidth, maxTotalThreadsPerThreadgroup: maxTotalThreadsPerThreadgroup)
         
-        guard mipLevels > 1 else {
+        guard mipChain.count > 1 else {
             mippedTextures.append(texture)
-//            let aThreadgroup = ThreadGroup(computePipelineState: threadGroup.computePipelineState, size: (width: mipSize, height: mipSize, depth: threadGroup.size.depth))
-//            mippedThreadgroups.append(aThreadgroup)
-            mippedSizes.append(mipSize)
+            mippedSizes.append(mipSize(for: 0))
             return
         }
         
-        for lod in 0..<mipLevels {
-            if let mippedTexture = texture.makeTextureView(pixelFormat: texture.pixelFormat, textureType: .typeCube, levels: lod..<(lod + 1), slices: 0..<6) {
+        for level in mipChain.levels {
+            if let mippedTexture = texture.makeTextureView(pixelFormat: texture.pixelFormat, textureType: texture.textureType, levels: level.lod..<(level.lod + 1), slices: 0..<sliceCount) {
                 mippedTextures.append(mippedTexture)
-//                let aThreadgroup = ThreadGroup(computePipelineState: threadGroup.computePipelineState, size: (width: mipSize, height: mipSize, depth: threadGroup.size.depth))
-//                mippedThreadgroups.append(aThreadgroup)
-                mippedSizes.append(mipSize)
+                mippedSizes.append(max(level.width, level.height))
             }
-            mipSize = mipSize / 2
         }
     }
     
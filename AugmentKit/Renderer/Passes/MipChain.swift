@@ -0,0 +1,176 @@
+//
+//  MipChain.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+
+// MARK: - RoughnessMapping
+
+/// How the levels of a prefiltered specular mip chain map to roughness. The same mapping must be used when sampling the chain, see `perceptualRoughnessToIBLLod` in IBLFunctions.metal.
+enum RoughnessMapping {
+    /// Perceptual roughness increases linearly with the level. Spends as many levels on rough surfaces as smooth ones.
+    case linear
+    /// The mapping used by Filament, `lod = r * (2 - r)`, which spends more of the chain on low roughness where reflections change the most
+    case filament
+    
+    /// Returns the perceptual roughness for a level, where `normalizedLod` is the level divided by the index of the last level
+    func perceptualRoughness(forNormalizedLod normalizedLod: Float) -> Float {
+        let lod = min(max(normalizedLod, 0), 1)
+        switch self {
+        case .linear:
+            return lod
+        case .filament:
+            return 1 - (1 - lod).squareRoot()
+        }
+    }
+    
+    /// Returns the normalized level to sample for a perceptual roughness. The inverse of `perceptualRoughness(forNormalizedLod:)`
+    func normalizedLod(forPerceptualRoughness perceptualRoughness: Float) -> Float {
+        let roughness = min(max(perceptualRoughness, 0), 1)
+        switch self {
+        case .linear:
+            return roughness
+        case .filament:
+            return roughness * (2 - roughness)
+        }
+    }
+}
+
+// MARK: - MipChain
+
+/// Precomputed metadata for every level of a mipmapped texture that a `ComputePass` writes to one level at a time. Calculated once when the texture changes so that dispatching a level does no math.
+///
+/// `MipChain` does not depend on Metal so it can be created and tested on the host.
+struct MipChain {
+    
+    /// A single level of the chain
+    struct Level {
+        /// The index of the level
+        var lod: Int
+        /// The width of the level in texels
+        var width: Int
+        /// The height of the level in texels
+        var height: Int
+        /// The number of slices. 6 for cube textures.
+        var depth: Int
+        /// The perceptual roughness that this level is prefiltered for
+        var perceptualRoughness: Float
+        /// The GGX alpha (perceptual roughness squared) that this level is prefiltered for. This is the value the IBL kernels expect.
+        var roughness: Float
+        /// The number of threads per threadgroup. Clamped to the size of the level so small levels don't launch idle threads.
+        var threadsPerThreadgroup: (width: Int, height: Int, depth: Int)
+        /// The number of threadgroups needed to cover the level for devices that don't support non-uniform threadgroup sizes
+        var threadgroupsPerGrid: (width: Int, height: Int, depth: Int)
+        
+        /// The number of threads needed to cover the level exactly, one per texel
+        var threadsPerGrid: (width: Int, height: Int, depth: Int) {
+            return (width: width, height: height, depth: depth)
+        }
+    }
+    
+    /// The levels of the chain ordered from largest to smallest
+    fileprivate(set) var levels: [Level]
+    /// The mapping used to calculate the roughness of each level
+    let roughnessMapping: RoughnessMapping
+    
+    /// The number of levels in the chain
+    var count: Int {
+        return levels.count
+    }
+    
+    /**
+     Creates a mip chain.
+     - Parameters:
+        - width: The width of level 0
+        - height: The height of level 0
+        - depth: The number of slices. Pass 6 for cube textures.
+        - levelCount: The requested number of levels. Clamped to the number of levels a full chain for `width` and `height` has.
+        - roughnessMapping: How levels map to roughness
+        - threadExecutionWidth: The `threadExecutionWidth` of the compute pipeline that writes to the chain
+        - maxTotalThreadsPerThreadgroup: The `maxTotalThreadsPerThreadgroup` of the compute pipeline that writes to the chain
+     */
+    init(width: Int, height: Int, depth: Int = 1, levelCount: Int, roughnessMapping: RoughnessMapping = .filament, threadExecutionWidth: Int = 32, maxTotalThreadsPerThreadgroup: Int = 1024) {
+        
+        self.roughnessMapping = roughnessMapping
+        
+        guard width > 0, height > 0, levelCount > 0 else {
+            levels = []
+            return
+        }
+        
+        let count = min(levelCount, MipChain.fullLevelCount(width: width, height: height))
+        let executionWidth = max(threadExecutionWidth, 1)
+        let maxThreads = max(maxTotalThreadsPerThreadgroup, executionWidth)
+        
+        levels = (0..<count).map { lod in
+            
+            let levelWidth = MipChain.size(of: width, atLod: lod)
+            let levelHeight = MipChain.size(of: height, atLod: lod)
+            
+            let normalizedLod: Float = count > 1 ? Float(lod) / Float(count - 1) : 0
+            let perceptualRoughness = roughnessMapping.perceptualRoughness(forNormalizedLod: normalizedLod)
+            
+            let threadgroupWidth = min(executionWidth, levelWidth)
+            let threadgroupHeight = min(maxThreads / threadgroupWidth, levelHeight)
+            let threadsPerThreadgroup = (width: threadgroupWidth, height: threadgroupHeight, depth: 1)
+            let threadgroupsPerGrid = (width: (levelWidth + threadgroupWidth - 1) / threadgroupWidth, height: (levelHeight + threadgroupHeight - 1) / threadgroupHeight, depth: depth)
+            
+            return Level(lod: lod, width: levelWidth, height: levelHeight, depth: depth, perceptualRoughness: perceptualRoughness, roughness: perceptualRoughness * perceptualRoughness, threadsPerThreadgroup: threadsPerThreadgroup, threadgroupsPerGrid: threadgroupsPerGrid)
+        
+        }
+    
+    }
+    
+    /// Returns the level at `lod` or `nil` if the chain doesn't have that level
+    func level(at lod: Int) -> Level? {
+        guard lod >= 0, lod < levels.count else {
+            return nil
+        }
+        return levels[lod]
+    }
+    
+    /// The size of a dimension at a level. Each level is half the size of the previous one, rounded down, and never smaller than 1.
+    static func size(of baseSize: Int, atLod lod: Int) -> Int {
+        guard lod > 0 else {
+            return baseSize
+        }
+        guard lod < Int.bitWidth - 1 else {
+            return 1
+        }
+        return max(baseSize >> lod, 1)
+    }
+    
+    /// The number of levels in a full chain, down to and including the 1x1 level
+    static func fullLevelCount(width: Int, height: Int) -> Int {
+        let largest = max(width, height)
+        guard largest > 0 else {
+            return 0
+        }
+        return Int.bitWidth - largest.leadingZeroBitCount
+    }
+    
+}
@@ -82,6 +82,9 @@ class RenderPass {
     // Allows the render pass to filter out certain draw call groups for rendering. Return `false` in order to skip rendering for the given `DrawCallGroup`
     var drawCallGroupFilterFunction: ((DrawCallGroup?) -> Bool)?
     
+    // When set, render modules draw all of the draw calls that share a mesh with a single instanced draw and record the argument buffer index of each instance in this table. Used by the shadow pass.
+    var shadowCasterInstanceTable: DrawCallInstanceTable?
+    
     // The following are used to create DrawCall objects
     var cullMode: MTLCullMode = .front
     var depthBias: DepthBias?
@@ -30,7 +30,7 @@ import ARKit
 import AugmentKitShader
 import MetalKit
 
-class AnchorsRenderModule: RenderModule, SkinningModule {
+class AnchorsRenderModule: IncrementalRenderModule, SkinningModule {
     
     static var identifier = "AnchorsRenderModule"
     
@@ -87,6 +87,8 @@ class AnchorsRenderModule: RenderModule, SkinningModule {
         environmentUniformBuffer = device?.makeBuffer(length: environmentUniformBufferSize, options: .storageModeShared)
         environmentUniformBuffer?.label = "Environment Uniform Buffer"
         
+        GPUResourceRegistry.shared.register([materialUniformBuffer, jointTransformBuffer, effectsUniformBuffer, environmentUniformBuffer], category: .buffer, owner: .module(moduleIdentifier))
+        
         geometricEntities = []
         
     }
@@ -181,52 +183,46 @@ class AnchorsRenderModule: RenderModule, SkinningModule {
             return
         }
         
-        var drawCallGroups = [DrawCallGroup]()
+        loadDrawCallGroups(for: geometricEntities, metalLibrary: metalLibrary, renderDestination: renderDestination, modelManager: modelManager, renderPass: renderPass, numQualityLevels: numQualityLevels) { [weak self] drawCallGroups in
+            self?.state = .ready
+            completion?(drawCallGroups)
+        }
         
-        // Get a list of uuids
-        let filteredGeometryUUIDs = geometricEntities.compactMap({$0.identifier})
+    }
+    
+    func loadAssets(forAddedGeometricEntities theGeometricEntities: [AKGeometricEntity], fromModelProvider modelProvider: ModelProvider?, textureLoader aTextureLoader: MTKTextureLoader, completion: (() -> Void)) {
         
-        // filter the `modelAssetsByUUID` by the model asses contained in the list of uuids
-        let filteredModelsByUUID = modelAssetsByUUID.filter { (uuid, asset) in
-            filteredGeometryUUIDs.contains(uuid)
+        // Skip anything that has already been loaded
+        let addedGeometricEntities = theGeometricEntities.filter { geometricEntity in
+            !geometricEntities.contains(where: {$0.identifier == geometricEntity.identifier})
         }
+        loadAssets(forGeometricEntities: addedGeometricEntities, fromModelProvider: modelProvider, textureLoader: aTextureLoader, completion: completion)
         
-        let total = filteredModelsByUUID.count
-        var count = 0
+    }
+    
+    func loadPipeline(forGeometricEntityIdentifiers identifiers: [UUID], moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass?, numQualityLevels: Int, completion: (([DrawCallGroup]) -> Void)?) {
         
-        // Create a draw call group for every model asset. Each model asset may have multiple instances.
-        for item in filteredModelsByUUID {
-            
-            guard let geometricEntity = geometricEntities.first(where: {$0.identifier == item.key}) else {
-                continue
+        let addedGeometricEntities = geometricEntities.filter { geometricEntity in
+            guard let identifier = geometricEntity.identifier else {
+                return false
             }
-            
-            let uuid = item.key
-            let mdlAsset = item.value
-            let shaderPreference: ShaderPreference = {
-                if let prefernece = shaderPreferenceByUUID[uuid] {
-                    return prefernece
-                } else {
-                    return .pbr
-                }
-            }()
-            
-            modelManager.meshGPUData(for: mdlAsset, shaderPreference: shaderPreference) { [weak self] (meshGPUData, cacheKey) in
-                    
-                // Create a draw call group that contins all of the individual draw calls for this model
-                if let meshGPUData = meshGPUData, let drawCallGroup = self?.createDrawCallGroup(forUUID: uuid, withMetalLibrary: metalLibrary, renderDestination: renderDestination, renderPass: renderPass, meshGPUData: meshGPUData, geometricEntity: geometricEntity, numQualityLevels: numQualityLevels) {
-                    drawCallGroup.moduleIdentifier = AnchorsRenderModule.identifier
-                    drawCallGroups.append(drawCallGroup)
-                }
-                
-                count += 1
-                if count == total {
-                    // Because there must be a deterministic way to order the draw calls so the draw call groups are sorted by UUID.
-                    drawCallGroups.sort { $0.uuid.uuidString < $1.uuid.uuidString }
-                    self?.state = .ready
-                    completion?(drawCallGroups)
-                }
+            return identifiers.contains(identifier)
+        }
+        loadDrawCallGroups(for: addedGeometricEntities, metalLibrary: metalLibrary, renderDestination: renderDestination, modelManager: modelManager, renderPass: renderPass, numQualityLevels: numQualityLevels, completion: completion)
+        
+    }
+    
+    func removeAssets(forGeometricEntityIdentifiers identifiers: [UUID]) {
+        geometricEntities.removeAll(where: { geometricEntity in
+            guard let identifier = geometricEntity.identifier else {
+                return false
             }
+            return identifiers.contains(identifier)
+        })
+        identifiers.forEach {
+            modelAssetsByUUID[$0] = nil
+            shaderPreferenceByUUID[$0] = nil
+            anchorCountByUUID[$0] = nil
         }
     }
     
@@ -388,25 +384,9 @@ class AnchorsRenderModule: RenderModule, SkinningModule {
                     
                     let environmentUniforms = environmentUniformBufferAddress?.assumingMemoryBound(to: EnvironmentUniforms.self).advanced(by: anchorMeshIndex)
                     
-                    // Set up lighting for the scene using the ambient intensity if provided
-                    let ambientIntensity: Float = {
-                        if let lightEstimate = environmentProperties.lightEstimate {
-                            return Float(lightEstimate.ambientIntensity) / 1000.0
-                        } else {
-                            return 1
-                        }
-                    }()
-                    
-                    let ambientLightColor: SIMD3<Float> = {
-                        if let lightEstimate = environmentProperties.lightEstimate {
-                            return getRGB(from: lightEstimate.ambientColorTemperature)
-                        } else {
-                            return SIMD3<Float>(0.5, 0.5, 0.5)
-                        }
-                    }()
-                    
-                    environmentUniforms?.pointee.ambientLightIntensity = ambientIntensity
-                    environmentUniforms?.pointee.ambientLightColor = ambientLightColor// * ambientIntensity
+                    // Ambient lighting is resolved once per frame by the renderer
+                    environmentUniforms?.pointee.ambientLightIntensity = environmentProperties.ambientLightIntensity
+                    environmentUniforms?.pointee.ambientLightColor = environmentProperties.ambientLightColor
                     
                     var directionalLightDirection : SIMD3<Float> = environmentProperties.directionalLightDirection
                     directionalLightDirection = simd_normalize(directionalLightDirection)
@@ -535,6 +515,13 @@ class AnchorsRenderModule: RenderModule, SkinningModule {
             
         }
         
+        // Shadow casters are instanced by mesh
+        if let instanceTable = renderPass.shadowCasterInstanceTable {
+            drawShadowCasters(withRenderPass: renderPass, instanceTable: instanceTable, renderEncoder: renderEncoder)
+            renderEncoder.popDebugGroup()
+            return
+        }
+        
         var drawCallGroupIndex: Int32 = 0
         var drawCallIndex: Int32 = 0
         var baseIndex = 0
@@ -572,7 +559,7 @@ class AnchorsRenderModule: RenderModule, SkinningModule {
                     continue
                 }
                 
-                drawCall.prepareDrawCall(withRenderPass: renderPass)
+                drawCall.prepareDrawCall(withRenderPass: renderPass, qualityLevel: Int(drawCallGroup.qualityLevel.rawValue))
                 
                 if renderPass.usesGeometry {
                 // Set the offset index of the draw call into the argument buffer
@@ -702,6 +689,65 @@ class AnchorsRenderModule: RenderModule, SkinningModule {
     private var anchorCountByUUID = [UUID: Int]()
     private var environmentTextureByUUID = [UUID: MTLTexture]()
     
+    // Creates a `DrawCallGroup` for each of the `someGeometricEntities` that has a model asset
+    private func loadDrawCallGroups(for someGeometricEntities: [AKGeometricEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass?, numQualityLevels: Int, completion: (([DrawCallGroup]) -> Void)?) {
+        
+        var drawCallGroups = [DrawCallGroup]()
+        
+        // Get a list of uuids
+        let filteredGeometryUUIDs = someGeometricEntities.compactMap({$0.identifier})
+        
+        // filter the `modelAssetsByUUID` by the model asses contained in the list of uuids
+        let filteredModelsByUUID = modelAssetsByUUID.filter { (uuid, asset) in
+            filteredGeometryUUIDs.contains(uuid)
+        }
+        
+        let total = filteredModelsByUUID.count
+        var count = 0
+        
+        guard total > 0 else {
+            completion?([])
+            return
+        }
+        
+        // Create a draw call group for every model asset. Each model asset may have multiple instances.
+        for item in filteredModelsByUUID {
+            
+            guard let geometricEntity = someGeometricEntities.first(where: {$0.identifier == item.key}) else {
+                continue
+            }
+            
+            let uuid = item.key
+            let mdlAsset = item.value
+            let shaderPreference: ShaderPreference = {
+                if let prefernece = shaderPreferenceByUUID[uuid] {
+                    return prefernece
+                } else {
+                    return .pbr
+                }
+            }()
+            
+            modelManager.meshGPUData(for: mdlAsset, shaderPreference: shaderPreference) { [weak self] (meshGPUData, cacheKey) in
+                    
+                // Create a draw call group that contins all of the individual draw calls for this model
+                if let meshGPUData = meshGPUData, let drawCallGroup = self?.createDrawCallGroup(forUUID: uuid, withMetalLibrary: metalLibrary, renderDestination: renderDestination, renderPass: renderPass, meshGPUData: meshGPUData, geometricEntity: geometricEntity, numQualityLevels: numQualityLevels) {
+                    drawCallGroup.moduleIdentifier = AnchorsRenderModule.identifier
+                    drawCallGroups.append(drawCallGroup)
+                    if let cacheKey = cacheKey {
+                        GPUResourceRegistry.shared.associate(entity: uuid, withAsset: cacheKey)
+                    }
+                }
+                
+                count += 1
+                if count == total {
+                    // Because there must be a deterministic way to order the draw calls so the draw call groups are sorted by UUID.
+                    drawCallGroups.sort { $0.uuid.uuidString < $1.uuid.uuidString }
+                    completion?(drawCallGroups)
+                }
+            }
+        }
+    }
+    
     private func createDrawCallGroup(forUUID uuid: UUID, withMetalLibrary metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, renderPass: RenderPass?, meshGPUData: MeshGPUData, geometricEntity: AKGeometricEntity, numQualityLevels: Int) -> DrawCallGroup {
         
         guard let renderPass = renderPass else {
@@ -136,7 +136,8 @@ class CameraPlaneRenderModule: RenderModule {
         capturedImagePipelineStateDescriptor.vertexFunction = capturedImageVertexFunction
         capturedImagePipelineStateDescriptor.fragmentFunction = capturedImageFragmentFunction
         capturedImagePipelineStateDescriptor.vertexDescriptor = imagePlaneVertexDescriptor
-        capturedImagePipelineStateDescriptor.colorAttachments[0].pixelFormat = renderDestination.colorPixelFormat
+        // Match the color target of the render pass, which may differ from the drawable
+        capturedImagePipelineStateDescriptor.colorAttachments[0].pixelFormat = renderPass?.templateRenderPipelineDescriptor?.colorAttachments[0].pixelFormat ?? renderDestination.colorPixelFormat
         capturedImagePipelineStateDescriptor.depthAttachmentPixelFormat = renderDestination.depthStencilPixelFormat
         capturedImagePipelineStateDescriptor.stencilAttachmentPixelFormat = renderDestination.depthStencilPixelFormat
         
@@ -58,8 +58,8 @@ protocol PreRenderComputeModule: ComputeModule where Self.Out == PrecalculatedPa
     // Per Frame Updates
     //
     
-    /// Update the buffer(s) data from information about the render
-    func prepareToDraw(withAllEntities: [AKEntity], cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, computePass: ComputePass<Out>, renderPass: RenderPass?)
+    /// Update the buffer(s) data from information about the render. Entity state should be read from `entityStates` rather than from the live entities so that every module sees the same state for the frame.
+    func prepareToDraw(withEntityStates entityStates: EntityStateSnapshot, cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, computePass: ComputePass<Out>, renderPass: RenderPass?)
     
 }
 
@@ -68,34 +68,7 @@ extension PreRenderComputeModule {
     // MARK: Util
     
     func getRGB(from colorTemperature: CGFloat) -> SIMD3<Float> {
-        
-        let temp = Float(colorTemperature) / 100
-        
-        var red: Float = 127
-        var green: Float = 127
-        var blue: Float = 127
-        
-        if temp <= 66 {
-            red = 255
-            green = temp
-            green = 99.4708025861 * log(green) - 161.1195681661
-            if temp <= 19 {
-                blue = 0
-            } else {
-                blue = temp - 10
-                blue = 138.5177312231 * log(blue) - 305.0447927307
-            }
-        } else {
-            red = temp - 60
-            red = 329.698727446 * pow(red, -0.1332047592)
-            green = temp - 60
-            green = 288.1221695283 * pow(green, -0.0755148492 )
-            blue = 255
-        }
-        
-        let clamped = clamp(SIMD3<Float>(red, green, blue), min: 0, max: 255) / 255
-        return SIMD3<Float>(clamped.x, clamped.y, clamped.z)
-        
+        return CameraExposureAdaptation.rgb(fromColorTemperature: Float(colorTemperature))
     }
 }
 
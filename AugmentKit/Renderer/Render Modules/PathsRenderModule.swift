@@ -81,6 +81,8 @@ class PathsRenderModule: RenderModule {
         effectsUniformBuffer = device?.makeBuffer(length: effectsUniformBufferSize, options: .storageModeShared)
         effectsUniformBuffer?.label = "EffectsUniformBuffer"
         
+        GPUResourceRegistry.shared.register([materialUniformBuffer, effectsUniformBuffer], category: .buffer, owner: .module(moduleIdentifier))
+        
         geometricEntities = []
         
     }
@@ -346,6 +348,13 @@ class PathsRenderModule: RenderModule {
             
         }
         
+        // Shadow casters are instanced by mesh
+        if let instanceTable = renderPass.shadowCasterInstanceTable {
+            drawShadowCasters(withRenderPass: renderPass, instanceTable: instanceTable, renderEncoder: renderEncoder)
+            renderEncoder.popDebugGroup()
+            return
+        }
+        
         var drawCallGroupIndex: Int32 = 0
         var drawCallIndex: Int32 = 0
         
@@ -373,7 +382,7 @@ class PathsRenderModule: RenderModule {
                     continue
                 }
                 
-                drawCall.prepareDrawCall(withRenderPass: renderPass)
+                drawCall.prepareDrawCall(withRenderPass: renderPass, qualityLevel: Int(drawCallGroup.qualityLevel.rawValue))
                 
                 if renderPass.usesGeometry {
                     // Set the offset index of the draw call into the argument buffer
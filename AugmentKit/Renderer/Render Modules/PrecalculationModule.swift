@@ -46,6 +46,17 @@ class PrecalculationModule: PreRenderComputeModule {
     
     var errors = [AKError]()
     var renderDistance: Double = 500
+    /// The most that can be drawn in a frame when level of detail is enabled. Objects that are smallest on screen are drawn at a lower quality level until the scene fits.
+    var levelOfDetailBudget: LevelOfDetailBudget {
+        get {
+            return levelOfDetailSelector.budget
+        }
+        set {
+            levelOfDetailSelector.budget = newValue
+        }
+    }
+    /// The depth pyramid of the previous frame. When set, instances hidden behind it are marked as occluded and skipped by the main pass.
+    var depthPyramid: DepthPyramid?
     var sharedModuleIdentifiers: [String]? = [SharedBuffersRenderModule.identifier]
     
     func initializeBuffers(withDevice device: MTLDevice, maxInFlightFrames: Int, maxInstances: Int) {
@@ -85,6 +96,8 @@ class PrecalculationModule: PreRenderComputeModule {
         environmentUniformBuffer = device.makeBuffer(length: environmentUniformBufferSize, options: .storageModeShared)
         environmentUniformBuffer?.label = "Environment Uniform Buffer"
         
+        GPUResourceRegistry.shared.register([geometryUniformBuffer, jointTransformBuffer, effectsUniformBuffer, environmentUniformBuffer], category: .buffer, owner: .module(moduleIdentifier))
+        
     }
     
     func loadPipeline(withMetalLibrary metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, textureBundle: Bundle, forComputePass computePass: ComputePass<PrecalculatedParameters>?) -> ThreadGroup? {
@@ -123,7 +136,7 @@ class PrecalculationModule: PreRenderComputeModule {
         
     }
     
-    func prepareToDraw(withAllEntities allEntities: [AKEntity], cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, computePass: ComputePass<PrecalculatedParameters>, renderPass: RenderPass?) {
+    func prepareToDraw(withEntityStates entityStates: EntityStateSnapshot, cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, computePass: ComputePass<PrecalculatedParameters>, renderPass: RenderPass?) {
         
         var drawCallGroupOffset = 0
         var drawCallGroupIndex = 0
@@ -132,28 +145,16 @@ class PrecalculationModule: PreRenderComputeModule {
         let environmentUniforms = environmentUniformBufferAddress?.assumingMemoryBound(to: EnvironmentUniforms.self)
         let effectsUniforms = effectsUniformBufferAddress?.assumingMemoryBound(to: AnchorEffectsUniforms.self)
         
-        // Get all of the AKGeometricEntity's
-        var allGeometricEntities: [AKGeometricEntity] = allEntities.compactMap({
-            if let geoEntity = $0 as? AKGeometricEntity {
-                return geoEntity
-            } else {
-                return nil
-            }
-        })
-        let allGeometricEntityGroups: [AKGeometricEntityGroup] = allEntities.compactMap({
-            if let geoEntity = $0 as? AKGeometricEntityGroup {
-                return geoEntity
-            } else {
-                return nil
-            }
-        })
-        let groupGeometries = allGeometricEntityGroups.flatMap({$0.geometries})
-        allGeometricEntities.append(contentsOf: groupGeometries)
+        // Level of detail is chosen once every draw call has been seen so that the budget can be applied across the whole scene
+        levelOfDetailSelector.beginFrame()
+        let projectionMatrix = cameraProperties.arCamera.projectionMatrix(for: cameraProperties.orientation, viewportSize: cameraProperties.viewportSize, zNear: 0.001, zFar: CGFloat(renderDistance))
+        let viewportHeight = Float(cameraProperties.viewportSize.height)
+        var levelOfDetailDraws = [(geometryUniform: UnsafeMutablePointer<AnchorInstanceUniforms>, drawCallGroup: DrawCallGroup, projectedSize: Float)]()
         
         renderPass?.drawCallGroups.forEach { drawCallGroup in
             
             let uuid = drawCallGroup.uuid
-            let geometricEntity = allGeometricEntities.first(where: {$0.identifier == uuid})
+            let entityState = entityStates.state(forIdentifier: uuid)
             var drawCallIndex = 0
             
             for drawCall in drawCallGroup.drawCalls {
@@ -206,25 +207,9 @@ class PrecalculationModule: PreRenderComputeModule {
                         }
                         return myEnvironmentData
                     }()
-                    // Set up lighting for the scene using the ambient intensity if provided
-                    let ambientIntensity: Float = {
-                        if let lightEstimate = environmentProperties.lightEstimate {
-                            return Float(lightEstimate.ambientIntensity) / 1000.0
-                        } else {
-                            return 1
-                        }
-                    }()
-                    let ambientLightColor: SIMD3<Float> = {
-                        if let lightEstimate = environmentProperties.lightEstimate {
-                            // FIXME: Remove
-                            return getRGB(from: lightEstimate.ambientColorTemperature)
-                        } else {
-                            return SIMD3<Float>(0.5, 0.5, 0.5)
-                        }
-                    }()
-                    
-                    environmentUniforms?.pointee.ambientLightIntensity = ambientIntensity
-                    environmentUniform.pointee.ambientLightColor = ambientLightColor// * ambientIntensity
+                    // Ambient lighting is resolved once per frame by the renderer
+                    environmentUniform.pointee.ambientLightIntensity = environmentProperties.ambientLightIntensity
+                    environmentUniform.pointee.ambientLightColor = environmentProperties.ambientLightColor
                     
                     var directionalLightDirection : SIMD3<Float> = environmentProperties.directionalLightDirection
                     directionalLightDirection = simd_normalize(directionalLightDirection)
@@ -250,50 +235,11 @@ class PrecalculationModule: PreRenderComputeModule {
                 
                 if let effectsUniform = effectsUniforms?.advanced(by: drawCallGroupOffset + drawCallIndex), computePass.usesEnvironment {
                     
-                    var hasSetAlpha = false
-                    var hasSetGlow = false
-                    var hasSetTint = false
-                    var hasSetScale = false
-                    if let effects = geometricEntity?.effects {
-                        let currentTime: TimeInterval = Double(cameraProperties.currentFrame) / cameraProperties.frameRate
-                        for effect in effects {
-                            switch effect.effectType {
-                            case .alpha:
-                                if let value = effect.value(forTime: currentTime) as? Float {
-                                    effectsUniform.pointee.alpha = value
-                                    hasSetAlpha = true
-                                }
-                            case .glow:
-                                if let value = effect.value(forTime: currentTime) as? Float {
-                                    effectsUniform.pointee.glow = value
-                                    hasSetGlow = true
-                                }
-                            case .tint:
-                                if let value = effect.value(forTime: currentTime) as? SIMD3<Float> {
-                                    effectsUniform.pointee.tint = value
-                                    hasSetTint = true
-                                }
-                            case .scale:
-                                if let value = effect.value(forTime: currentTime) as? Float {
-                                    let scaleMatrix = matrix_identity_float4x4
-                                    effectsUniform.pointee.scale = scaleMatrix.scale(x: value, y: value, z: value)
-                                    hasSetScale = true
-                                }
-                            }
-                        }
-                    }
-                    if !hasSetAlpha {
-                        effectsUniform.pointee.alpha = 1
-                    }
-                    if !hasSetGlow {
-                        effectsUniform.pointee.glow = 0
-                    }
-                    if !hasSetTint {
-                        effectsUniform.pointee.tint = SIMD3<Float>(1,1,1)
-                    }
-                    if !hasSetScale {
-                        effectsUniform.pointee.scale = matrix_identity_float4x4
-                    }
+                    let state = entityState ?? EntityState(identifier: uuid)
+                    effectsUniform.pointee.alpha = state.alpha
+                    effectsUniform.pointee.glow = state.glow
+                    effectsUniform.pointee.tint = state.tint
+                    effectsUniform.pointee.scale = matrix_identity_float4x4.scale(x: state.scale, y: state.scale, z: state.scale)
                     
                 }
             
@@ -313,9 +259,9 @@ class PrecalculationModule: PreRenderComputeModule {
                     
                     // Apply the world transform (as defined in the imported model) if applicable
                     let worldTransform: matrix_float4x4 = {
-                        if let pathSegment = geometricEntity as? AKPathSegmentAnchor {
+                        if let entityState = entityState, entityState.hasWorldTransformOverride {
                             // For path segments, use the segmentTransform as the worldTransform
-                            return pathSegment.segmentTransform
+                            return entityState.worldTransformOverride
                         } else if drawData.worldTransformAnimations.count > 0 {
                             let index = Int(cameraProperties.currentFrame % UInt(drawData.worldTransformAnimations.count))
                             return drawData.worldTransformAnimations[index]
@@ -324,42 +270,17 @@ class PrecalculationModule: PreRenderComputeModule {
                         }
                     }()
                     
-                    var hasHeading = false
-                    var headingType: HeadingType = .absolute
-                    var headingTransform = matrix_identity_float4x4
-                    var locationTransform = matrix_identity_float4x4
-                    
-                    if let akAnchor = geometricEntity as? AKAnchor {
-                        
-                        // Update Heading
-                        headingTransform = akAnchor.heading.offsetRotation.quaternion.toMatrix4()
-                        hasHeading = true
-                        headingType = akAnchor.heading.type
-                        
-                        // Update postion
-                        locationTransform = akAnchor.worldLocation.transform
-                        
-                    } else if let akTarget = geometricEntity as? AKTarget {
-                        
-                        // Apply the transform of the target relative to the reference transform
-                        let targetAbsoluteTransform = akTarget.position.referenceTransform * akTarget.position.transform
-                        locationTransform = targetAbsoluteTransform
-                        
-                    } else if let akTracker = geometricEntity as? AKTracker {
-                        
-                        if let heading = akTracker.position.heading {
-                            
-                            // Update Heading
-                            headingTransform = heading.offsetRotation.quaternion.toMatrix4()
-                            hasHeading = true
-                            headingType = heading.type
+                    let hasHeading = entityState?.hasHeading ?? false
+                    let headingType: HeadingType = entityState?.headingType ?? .absolute
+                    // The shader expects a unit quaternion
+                    let headingRotation: simd_quatf = {
+                        if hasHeading, let rotation = entityState?.headingRotation {
+                            return rotation.normalized
+                        } else {
+                            return simd_quatf(vector: SIMD4<Float>(0, 0, 0, 1))
                         }
-                        
-                        // Update position
-                        // Apply the transform of the target relative to the reference transform
-                        let trackerAbsoluteTransform = akTracker.position.referenceTransform * akTracker.position.transform
-                        locationTransform = trackerAbsoluteTransform
-                    }
+                    }()
+                    let locationTransform = entityState?.locationTransform ?? matrix_identity_float4x4
                     
                     // Ignore anchors that are beyond the renderDistance
                     let distance = anchorDistance(withTransform: locationTransform, cameraProperties: cameraProperties)
@@ -369,16 +290,31 @@ class PrecalculationModule: PreRenderComputeModule {
                         continue
                     }
                     
-                    // Calculate LOD
-                    let lodMapWeights = computeTextureWeights(for: distance)
+                    // Calculate LOD from the size of the mesh's bounds on screen
+                    if AKCapabilities.LevelOfDetail {
+                        let projectedSize: Float = {
+                            guard drawData.boundingSphere.w > 0 else {
+                                return viewportHeight
+                            }
+                            let transform = locationTransform * worldTransform
+                            let center = transform * SIMD4<Float>(drawData.boundingSphere.x, drawData.boundingSphere.y, drawData.boundingSphere.z, 1)
+                            let scale = max(length(transform.columns.0), max(length(transform.columns.1), length(transform.columns.2)))
+                            return LevelOfDetailSelector.projectedSize(radius: drawData.boundingSphere.w * scale, distance: length(SIMD3<Float>(center.x, center.y, center.z) - cameraProperties.position), projectionMatrix: projectionMatrix, viewportHeight: viewportHeight)
+                        }()
+                        levelOfDetailSelector.request(uuid, projectedSize: projectedSize, costs: levelOfDetailCosts(for: drawCallGroup, drawCallIndex: drawCallIndex))
+                        levelOfDetailDraws.append((geometryUniform: geometryUniform, drawCallGroup: drawCallGroup, projectedSize: projectedSize))
+                    }
                     
                     geometryUniform.pointee.hasGeometry = 1
                     geometryUniform.pointee.hasHeading = hasHeading ? 1 : 0
                     geometryUniform.pointee.headingType = headingType == .absolute ? 0 : 1
-                    geometryUniform.pointee.headingTransform = headingTransform
+                    // The heading is applied to the location as a quaternion in the precalculation shader
+                    geometryUniform.pointee.headingRotation = headingRotation.vector
                     geometryUniform.pointee.worldTransform = worldTransform
                     geometryUniform.pointee.locationTransform = locationTransform
-                    geometryUniform.pointee.mapWeights = lodMapWeights
+                    geometryUniform.pointee.mapWeights = computeTextureWeights(for: kQualityLevelHigh, mapWeight: 1)
+                    // Skinned meshes can move outside of their bind pose bounds so they are never culled
+                    geometryUniform.pointee.boundingSphere = drawData.hasSkeleton ? SIMD4<Float>(0, 0, 0, 0) : drawData.boundingSphere
                 }
                 
                 drawCallIndex += 1
@@ -389,6 +325,27 @@ class PrecalculationModule: PreRenderComputeModule {
             drawCallGroupIndex += 1
             
         }
+        
+        //
+        // Level of Detail
+        //
+        
+        guard AKCapabilities.LevelOfDetail else {
+            return
+        }
+        
+        levelOfDetailSelector.resolve()
+        
+        renderPass?.drawCallGroups.forEach { drawCallGroup in
+            drawCallGroup.qualityLevel = levelOfDetailSelector.qualityLevel(for: drawCallGroup.uuid)
+        }
+        
+        for levelOfDetailDraw in levelOfDetailDraws {
+            let qualityLevel = levelOfDetailDraw.drawCallGroup.qualityLevel
+            let mapWeight = levelOfDetailSelector.transitionWeight(forProjectedSize: levelOfDetailDraw.projectedSize, qualityLevel: Int(qualityLevel.rawValue), levelCount: levelOfDetailDraw.drawCallGroup.numQualityLevels)
+            levelOfDetailDraw.geometryUniform.pointee.mapWeights = computeTextureWeights(for: qualityLevel, mapWeight: mapWeight)
+        }
+        
     }
     
     func dispatch(withComputePass computePass: ComputePass<PrecalculatedParameters>?, sharedModules: [SharedRenderModule]?) {
@@ -444,6 +401,15 @@ class PrecalculationModule: PreRenderComputeModule {
             }
         }
         
+        // Occlusion culling is disabled until a depth pyramid has been built
+        var occlusionCullingUniforms = depthPyramid?.cullingUniforms ?? OcclusionCullingUniforms()
+        computeEncoder.pushDebugGroup("Occlusion Culling")
+        computeEncoder.setBytes(&occlusionCullingUniforms, length: MemoryLayout<OcclusionCullingUniforms>.stride, index: Int(kBufferIndexOcclusionCullingUniforms.rawValue))
+        if let depthPyramidTexture = depthPyramid?.texture {
+            computeEncoder.setTexture(depthPyramidTexture, index: Int(kTextureIndexDepthPyramid.rawValue))
+        }
+        computeEncoder.popDebugGroup()
+        
         // Output Buffer
         if let argumentOutputBuffer = computePass.outputBuffer?.buffer, let argumentOutputBufferOffset = computePass.outputBuffer?.currentBufferFrameOffset {
             computeEncoder.pushDebugGroup("Output Buffer")
@@ -477,6 +443,8 @@ class PrecalculationModule: PreRenderComputeModule {
     
     fileprivate var instanceCount: Int = 0
     
+    fileprivate var levelOfDetailSelector = LevelOfDetailSelector(numQualityLevels: Int(kQualityLevelLow.rawValue) + 1)
+    
     fileprivate var alignedGeometryInstanceUniformsSize: Int = 0
     fileprivate var alignedEffectsUniformSize: Int = 0
     fileprivate var alignedEnvironmentUniformSize: Int = 0
@@ -505,23 +473,38 @@ class PrecalculationModule: PreRenderComputeModule {
     // Addresses to write environment uniforms to each frame
     fileprivate var environmentUniformBufferAddress: UnsafeMutableRawPointer?
     
+    // Returns the cost of each quality level of a draw call, calculating the costs of the whole group the first time. Draw data does not change after it is loaded. Only the levels that the group has render pipeline states for are included so the selector never chooses a level the group cannot be drawn at.
+    fileprivate func levelOfDetailCosts(for drawCallGroup: DrawCallGroup, drawCallIndex: Int) -> [LevelOfDetailCost] {
+        if drawCallGroup.levelOfDetailCosts == nil {
+            let numQualityLevels = min(levelOfDetailSelector.numQualityLevels, drawCallGroup.numQualityLevels)
+            drawCallGroup.levelOfDetailCosts = drawCallGroup.drawCalls.map { drawCall in
+                guard let drawData = drawCall.drawData else {
+                    return []
+                }
+                return LevelOfDetailCost.costs(for: drawData, numQualityLevels: numQualityLevels)
+            }
+        }
+        guard let costs = drawCallGroup.levelOfDetailCosts, drawCallIndex < costs.count else {
+            return []
+        }
+        return costs[drawCallIndex]
+    }
+    
     // FIXME: Remove - put in compute shader
     fileprivate func anchorDistance(withTransform transform: matrix_float4x4, cameraProperties: CameraProperties?) -> Float {
         guard let cameraProperties = cameraProperties else {
             return 0
         }
-        let point = SIMD3<Float>(transform.columns.3.x, transform.columns.3.x, transform.columns.3.z)
+        let point = SIMD3<Float>(transform.columns.3.x, transform.columns.3.y, transform.columns.3.z)
         return length(point - cameraProperties.position)
     }
     
-    fileprivate func computeTextureWeights(for distance: Float) -> (Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float) {
+    fileprivate func computeTextureWeights(for quality: QualityLevel, mapWeight: Float) -> (Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float, Float) {
         
         guard AKCapabilities.LevelOfDetail else {
             return (Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1), Float(1))
         }
         
-        let quality = RenderUtilities.getQualityLevel(for: distance)
-        
         // Escape hatch for performance. If the quality is low, exit with all 0 values
         guard quality.rawValue < 2 else {
             return (Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0), Float(0))
@@ -550,8 +533,6 @@ class PrecalculationModule: PreRenderComputeModule {
             }
         }()
         
-        let mapWeight = getMapWeight(for: quality, distance: distance)
-        
         if !RenderUtilities.hasTexture(for: kTextureIndexColor, qualityLevel: quality) {
             baseMapWeight = 0
         } else if RenderUtilities.hasTexture(for: kTextureIndexColor, qualityLevel: quality) && !RenderUtilities.hasTexture(for: kTextureIndexColor, qualityLevel: nextLevel) {
@@ -639,39 +620,4 @@ class PrecalculationModule: PreRenderComputeModule {
         return (baseMapWeight, normalMapWeight, metallicMapWeight, roughnessMapWeight, ambientOcclusionMapWeight, emissionMapWeight, subsurfaceMapWeight, specularMapWeight, specularTintMapWeight, anisotropicMapWeight, sheenMapWeight, sheenTintMapWeight, clearcoatMapWeight, clearcoatMapWeightGlossMapWeight)
     }
     
-    fileprivate func getMapWeight(for level: QualityLevel, distance: Float) -> Float {
-        
-        guard AKCapabilities.LevelOfDetail else {
-            return 1
-        }
-        
-        guard distance > 0 else {
-            return 1
-        }
-        
-        // In meters
-        let MediumQualityDepth: Float = 15
-        let LowQualityDepth: Float = 65
-        let TransitionDepthAmount: Float = 50
-        
-        if level == kQualityLevelHigh {
-            let TransitionDepth = MediumQualityDepth - TransitionDepthAmount
-            if distance > TransitionDepth {
-                return 1 - ((distance - TransitionDepth) / TransitionDepthAmount)
-            } else {
-                return 1
-            }
-        } else if level == kQualityLevelMedium {
-            let TransitionDepth = LowQualityDepth - TransitionDepthAmount
-            if distance > TransitionDepth {
-                return 1 - ((distance - TransitionDepth) / TransitionDepthAmount)
-            } else {
-                return 1
-            }
-        } else {
-            return 0
-        }
-        
-    }
-    
 }
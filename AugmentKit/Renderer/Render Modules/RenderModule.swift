@@ -63,6 +63,32 @@ protocol RenderModule: ShaderModule {
     
     
     
+}
+
+// MARK: - IncrementalRenderModule
+
+/// A `RenderModule` that can add and remove individual entities after it has been initialized. Only the assets and `DrawCallGroup`s of the entities that changed are loaded or released so the cost of adding or removing an entity does not grow with the number of entities already in the module.
+protocol IncrementalRenderModule: RenderModule {
+    
+    /// Load the data from the Model Provider for entities that were added after the module was initialized. Entities that have already been loaded are ignored.
+    func loadAssets(forAddedGeometricEntities: [AKGeometricEntity], fromModelProvider: ModelProvider?, textureLoader: MTKTextureLoader, completion: (() -> Void))
+    
+    /// Creates `DrawCallGroup`s for only the entities with the provided identifiers. Existing `DrawCallGroup`s are not rebuilt.
+    func loadPipeline(forGeometricEntityIdentifiers: [UUID], moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass?, numQualityLevels: Int, completion: (([DrawCallGroup]) -> Void)?)
+    
+    /// Release everything that was loaded for entities that have been removed.
+    func removeAssets(forGeometricEntityIdentifiers: [UUID])
+    
+}
+
+// MARK: - CullingRenderModule
+
+/// A `RenderModule` that culls its geometry on the GPU before each render pass is encoded
+protocol CullingRenderModule: RenderModule {
+    
+    /// Encode the compute work that culls the module's geometry for `renderPass`. Called after `updateBuffers(withModuleEntities:cameraProperties:environmentProperties:shadowProperties:argumentBufferProperties:forRenderPass:)` and before the render command encoder of `renderPass` is created.
+    func encodeCulling(forRenderPass renderPass: RenderPass, commandBuffer: MTLCommandBuffer)
+    
 }
 
 // MARK: - RenderModule extensions
@@ -79,7 +105,7 @@ extension RenderModule {
             }
             // Set mesh's raw vertex buffer
             if let vertexBuffer = drawData.rawVertexBuffers.first {
-                renderEncoder.setVertexBuffer(vertexBuffer, offset: 0, index: Int(kBufferIndexRawVertexData.rawValue))
+                renderEncoder.setVertexBuffer(vertexBuffer, offset: drawData.rawVertexBufferOffset, index: Int(kBufferIndexRawVertexData.rawValue))
             }
         
             if includeSkeleton {
@@ -113,12 +139,76 @@ extension RenderModule {
             }
             
             if includeGeometry {
-                renderEncoder.drawIndexedPrimitives(type: .triangle, indexCount: indexCount, indexType: indexType, indexBuffer: indexBuffer, indexBufferOffset: 0, instanceCount: drawData.instanceCount, baseVertex: 0, baseInstance: baseIndex)
+                renderEncoder.drawIndexedPrimitives(type: .triangle, indexCount: indexCount, indexType: indexType, indexBuffer: indexBuffer, indexBufferOffset: submeshData.indexBufferOffset, instanceCount: drawData.instanceCount, baseVertex: 0, baseInstance: baseIndex)
             }
         }
         
     }
     
+    /// Draws this module's draw calls in `renderPass` with one instanced draw for each distinct mesh. The argument buffer index of every instance is recorded in `instanceTable` so the vertex function can find its draw call. Instances that do not fit in the table are not drawn. `isIncluded` can be used to skip additional draw call groups.
+    func drawShadowCasters(withRenderPass renderPass: RenderPass, instanceTable: DrawCallInstanceTable, renderEncoder: MTLRenderCommandEncoder, where isIncluded: ((DrawCallGroup) -> Bool)? = nil) {
+        
+        // Group the draw calls by mesh, keeping the order in which each mesh is first seen
+        var meshIdentities = [MeshIdentity]()
+        var drawCallsByMesh = [MeshIdentity: (drawCall: DrawCall, argumentBufferIndices: [Int])]()
+        var drawCallIndex = 0
+        
+        for drawCallGroup in renderPass.drawCallGroups {
+            
+            let firstDrawCallIndex = drawCallIndex
+            drawCallIndex += drawCallGroup.drawCalls.count
+            
+            guard drawCallGroup.moduleIdentifier == moduleIdentifier, isIncluded?(drawCallGroup) ?? true else {
+                continue
+            }
+            
+            // Use the render pass filter function to skip draw call groups on an individual basis
+            if let filterFunction = renderPass.drawCallGroupFilterFunction {
+                guard filterFunction(drawCallGroup) else {
+                    continue
+                }
+            }
+            
+            for (index, drawCall) in drawCallGroup.drawCalls.enumerated() {
+                guard let drawData = drawCall.drawData else {
+                    continue
+                }
+                let meshIdentity = MeshIdentity(drawData: drawData)
+                if drawCallsByMesh[meshIdentity] == nil {
+                    meshIdentities.append(meshIdentity)
+                    drawCallsByMesh[meshIdentity] = (drawCall: drawCall, argumentBufferIndices: [])
+                }
+                drawCallsByMesh[meshIdentity]?.argumentBufferIndices.append(firstDrawCallIndex + index)
+            }
+            
+        }
+        
+        guard meshIdentities.count > 0 else {
+            return
+        }
+        
+        renderEncoder.setVertexBuffer(instanceTable.instanceBuffer, offset: instanceTable.instanceBufferOffset, index: Int(kBufferIndexShadowCasterInstances.rawValue))
+        
+        for meshIdentity in meshIdentities {
+            
+            guard let (drawCall, argumentBufferIndices) = drawCallsByMesh[meshIdentity], var drawData = drawCall.drawData else {
+                continue
+            }
+            
+            guard let baseInstance = instanceTable.append(argumentBufferIndices: argumentBufferIndices) else {
+                print("Warning (RenderModule) - The shadow caster instance table is full. Skipping \(argumentBufferIndices.count) instances.")
+                continue
+            }
+            
+            // All instances share the pipeline state of the first draw call. Instances that are outside of the light's frustum are culled in the vertex function.
+            drawCall.prepareDrawCall(withRenderPass: renderPass)
+            drawData.instanceCount = argumentBufferIndices.count
+            draw(withDrawData: drawData, with: renderEncoder, baseIndex: baseInstance, includeGeometry: true, includeSkeleton: renderPass.hasSkeleton, includeLighting: false)
+            
+        }
+        
+    }
+    
     // MARK: Encoding Textures
     
     func encodeTextures(for renderEncoder: MTLRenderCommandEncoder, subData drawSubData: DrawSubData, environmentData: EnvironmentData? = nil) {
@@ -242,33 +332,7 @@ extension RenderModule {
     // MARK: Util
     
     func getRGB(from colorTemperature: CGFloat) -> SIMD3<Float> {
-        
-        let temp = Float(colorTemperature) / 100
-        
-        var red: Float = 127
-        var green: Float = 127
-        var blue: Float = 127
-        
-        if temp <= 66 {
-            red = 255
-            green = temp
-            green = 99.4708025861 * log(green) - 161.1195681661
-            if temp <= 19 {
-                blue = 0
-            } else {
-                blue = temp - 10
-                blue = 138.5177312231 * log(blue) - 305.0447927307
-            }
-        } else {
-            red = temp - 60
-            red = 329.698727446 * pow(red, -0.1332047592)
-            green = temp - 60
-            green = 288.1221695283 * pow(green, -0.0755148492 )
-            blue = 255
-        }
-        
-        let clamped = clamp(SIMD3<Float>(red, green, blue), min: 0, max: 255) / 255
-        return SIMD3<Float>(clamped.x, clamped.y, clamped.z)
+        return CameraExposureAdaptation.rgb(fromColorTemperature: Float(colorTemperature))
     }
 }
 
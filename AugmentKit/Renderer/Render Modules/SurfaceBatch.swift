@@ -0,0 +1,483 @@
+//
+//  SurfaceBatch.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import Metal
+import simd
+import AugmentKitShader
+
+// MARK: - SurfaceBatch
+
+/**
+ Shared vertex and index storage for every detected surface so that all of them can be drawn from the same buffers with a single pipeline state.
+ 
+ Every surface is assigned a slot. The slot index stays the same for the life of the surface and is also used to index the effects uniforms. Once geometry is written, the slot owns a range of each arena that holds `regionCount` copies of the geometry, one per in flight frame, plus 50% headroom. Updates are written in place into the next copy in the ring, so a copy that a pending frame is reading is never overwritten.
+ 
+ When a surface outgrows its range it moves to a new one. The old range is reused only after every frame that could still be reading it has completed. Released ranges are merged with their free neighbours. When an arena runs out of room it is reallocated at twice the size and its contents are copied over.
+ */
+final class SurfaceBatch {
+    
+    /// The shared `RawVertexBuffer` arena
+    var vertexBuffer: MTLBuffer? {
+        return vertexArena.buffer
+    }
+    /// The shared `UInt16` index arena. Indices are relative to the first vertex of their surface.
+    var indexBuffer: MTLBuffer? {
+        return indexArena.buffer
+    }
+    /// The maximum number of slots
+    let maxSlotCount: Int
+    /// The number of copies of each surface's geometry. Should match the number of in flight frames.
+    let regionCount: Int
+    
+    init(device: MTLDevice, regionCount: Int, maxSlotCount: Int) {
+        self.regionCount = max(regionCount, 1)
+        self.maxSlotCount = maxSlotCount
+        slots = Array(repeating: Slot(), count: maxSlotCount)
+        // Hand out the lowest indices first
+        freeSlotIndices = Array((0..<maxSlotCount).reversed())
+        vertexArena = Arena(device: device, stride: MemoryLayout<RawVertexBuffer>.stride, label: "SurfaceBatch Vertices")
+        indexArena = Arena(device: device, stride: MemoryLayout<UInt16>.stride, label: "SurfaceBatch Indices")
+    }
+    
+    /// Must be called once at the start of every frame. Arena ranges that were released at least `regionCount` frames ago become available again.
+    func beginFrame() {
+        frameNumber += 1
+        vertexArena.reclaim(atFrame: frameNumber, latency: UInt(regionCount))
+        indexArena.reclaim(atFrame: frameNumber, latency: UInt(regionCount))
+    }
+    
+    /// Returns the slot index for the surface or `nil` if the surface does not have a slot
+    func slotIndex(for identifier: UUID) -> Int? {
+        return slotIndexByIdentifier[identifier]
+    }
+    
+    /// Returns the slot index for the surface, assigning a free slot if needed. Returns `nil` when every slot is in use.
+    func reserveSlot(for identifier: UUID) -> Int? {
+        if let slotIndex = slotIndexByIdentifier[identifier] {
+            return slotIndex
+        }
+        guard let slotIndex = freeSlotIndices.popLast() else {
+            return nil
+        }
+        slots[slotIndex] = Slot()
+        slots[slotIndex].identifier = identifier
+        slotIndexByIdentifier[identifier] = slotIndex
+        return slotIndex
+    }
+    
+    /// Releases the slots of every surface for which `isRemoved` returns `true`
+    func releaseSlots(where isRemoved: (UUID) -> Bool) {
+        for (identifier, slotIndex) in slotIndexByIdentifier where isRemoved(identifier) {
+            releaseRanges(ofSlot: slotIndex)
+            slots[slotIndex] = Slot()
+            slotIndexByIdentifier.removeValue(forKey: identifier)
+            freeSlotIndices.append(slotIndex)
+        }
+    }
+    
+    /// Returns `true` if geometry has been written to the slot
+    func hasGeometry(slotIndex: Int) -> Bool {
+        return slots[slotIndex].vertexRange != nil
+    }
+    
+    /**
+     Writes the geometry of a surface into the next copy in its ring, moving the surface to larger ranges if the geometry no longer fits.
+     - Parameters:
+        - vertices: The vertex positions
+        - textureCoordinates: The texture coordinates for each vertex
+        - indices: Triangle indices. Only whole triangles are used.
+        - slotIndex: A slot returned from `reserveSlot(for:)`
+     - Returns: `false` if the arenas could not be grown to fit the geometry
+     */
+    @discardableResult
+    func write(vertices: [SIMD3<Float>], textureCoordinates: [SIMD2<Float>], indices: [Int16], toSlot slotIndex: Int) -> Bool {
+        
+        var slot = slots[slotIndex]
+        guard slot.identifier != nil else {
+            return false
+        }
+        
+        let vertexCount = vertices.count
+        let indexCount = indices.count - indices.count % 3
+        
+        if slot.vertexRange == nil || vertexCount > slot.vertexCapacity || indexCount > slot.indexCapacity {
+            
+            releaseRanges(ofSlot: slotIndex)
+            slot.vertexRange = nil
+            slot.indexRange = nil
+            
+            let vertexCapacity = SurfaceBatch.capacity(for: vertexCount)
+            let indexCapacity = SurfaceBatch.capacity(for: indexCount)
+            guard let vertexRange = vertexArena.allocate(count: vertexCapacity * regionCount) else {
+                slots[slotIndex] = slot
+                return false
+            }
+            guard let indexRange = indexArena.allocate(count: indexCapacity * regionCount) else {
+                vertexArena.release(vertexRange, atFrame: frameNumber)
+                slots[slotIndex] = slot
+                return false
+            }
+            slot.vertexRange = vertexRange
+            slot.indexRange = indexRange
+            slot.vertexCapacity = vertexCapacity
+            slot.indexCapacity = indexCapacity
+            // Start on the last region so the first write lands in region 0
+            slot.region = regionCount - 1
+        
+        }
+        
+        guard let vertexRange = slot.vertexRange, let indexRange = slot.indexRange, let vertexBuffer = vertexArena.buffer, let indexBuffer = indexArena.buffer else {
+            return false
+        }
+        
+        let region = (slot.region + 1) % regionCount
+        
+        var minimum = SIMD3<Float>(repeating: .greatestFiniteMagnitude)
+        var maximum = SIMD3<Float>(repeating: -.greatestFiniteMagnitude)
+        let firstVertex = vertexRange.start + region * slot.vertexCapacity
+        let vertexAddress = vertexBuffer.contents().advanced(by: firstVertex * MemoryLayout<RawVertexBuffer>.stride).bindMemory(to: RawVertexBuffer.self, capacity: vertexCount)
+        for index in 0..<vertexCount {
+            let position = vertices[index]
+            let texCoord = index < textureCoordinates.count ? textureCoordinates[index] : SIMD2<Float>(0, 0)
+            vertexAddress[index] = RawVertexBuffer(position: position, texCoord: texCoord, normal: SIMD3<Float>(0, 0, 0), tangent: SIMD3<Float>(0, 0, 0))
+            minimum = simd_min(minimum, position)
+            maximum = simd_max(maximum, position)
+        }
+        
+        let firstIndex = indexRange.start + region * slot.indexCapacity
+        if indexCount > 0 {
+            indices.withUnsafeBytes { indexBytes in
+                indexBuffer.contents().advanced(by: firstIndex * MemoryLayout<UInt16>.stride).copyMemory(from: indexBytes.baseAddress!, byteCount: indexCount * MemoryLayout<UInt16>.stride)
+            }
+        }
+        
+        // Bounding sphere around the axis aligned bounds
+        if vertexCount > 0 {
+            let center = (minimum + maximum) * 0.5
+            slot.boundingSphere = SIMD4<Float>(center, length(maximum - center))
+        } else {
+            slot.boundingSphere = SIMD4<Float>(0, 0, 0, 0)
+        }
+        slot.indexCount = indexCount
+        slot.region = region
+        slots[slotIndex] = slot
+        
+        return true
+    
+    }
+    
+    /// Returns the instance describing the most recently written geometry of a slot or `nil` if the slot has no geometry
+    func instance(forSlot slotIndex: Int, argumentBufferIndex: Int) -> SurfaceInstance? {
+        let slot = slots[slotIndex]
+        guard let vertexRange = slot.vertexRange, let indexRange = slot.indexRange, slot.indexCount > 0 else {
+            return nil
+        }
+        return SurfaceInstance(
+            vertexStart: UInt32(vertexRange.start + slot.region * slot.vertexCapacity),
+            indexStart: UInt32(indexRange.start + slot.region * slot.indexCapacity),
+            indexCount: UInt32(slot.indexCount),
+            argumentBufferIndex: UInt32(argumentBufferIndex),
+            effectsIndex: UInt32(slotIndex),
+            boundingSphere: slot.boundingSphere,
+            drawArguments: SurfaceDrawArguments()
+        )
+    }
+    
+    // MARK: - Private
+    
+    fileprivate struct Slot {
+        var identifier: UUID?
+        var vertexRange: ArenaRange?
+        var indexRange: ArenaRange?
+        // The number of vertices and indices in each region
+        var vertexCapacity = 0
+        var indexCapacity = 0
+        // The region containing the most recently written geometry
+        var region = 0
+        var indexCount = 0
+        var boundingSphere = SIMD4<Float>(0, 0, 0, 0)
+    }
+    
+    fileprivate var slots: [Slot]
+    fileprivate var slotIndexByIdentifier = [UUID: Int]()
+    fileprivate var freeSlotIndices: [Int]
+    fileprivate var vertexArena: Arena
+    fileprivate var indexArena: Arena
+    fileprivate var frameNumber: UInt = 0
+    
+    fileprivate func releaseRanges(ofSlot slotIndex: Int) {
+        if let vertexRange = slots[slotIndex].vertexRange {
+            vertexArena.release(vertexRange, atFrame: frameNumber)
+        }
+        if let indexRange = slots[slotIndex].indexRange {
+            indexArena.release(indexRange, atFrame: frameNumber)
+        }
+    }
+    
+    // Leaves 50% headroom so that a plane can grow for a while before it has to move
+    fileprivate static func capacity(for count: Int) -> Int {
+        return max(count + count / 2, 64)
+    }
+    
+}
+
+// MARK: - SurfaceInstanceTable
+
+/// The `SurfaceInstance` table for a single render pass. The table is rebuilt every frame into the region of its buffer for that frame. Each entry also holds the indirect draw arguments of its surface, which are written by `SurfaceBatchCulling`.
+final class SurfaceInstanceTable {
+    
+    /// The buffer containing one table per in flight frame
+    let instanceBuffer: MTLBuffer
+    /// The offset of the current frame's table in `instanceBuffer`
+    private(set) var instanceBufferOffset = 0
+    /// The number of instances in the current frame's table
+    private(set) var instanceCount = 0
+    /// The maximum number of instances in a table
+    let maxInstanceCount: Int
+    
+    init?(device: MTLDevice, regionCount: Int, maxInstanceCount: Int) {
+        self.maxInstanceCount = maxInstanceCount
+        alignedTableSize = ((MemoryLayout<SurfaceInstance>.stride * maxInstanceCount) & ~0xFF) + 0x100
+        guard let aBuffer = device.makeBuffer(length: alignedTableSize * max(regionCount, 1), options: .storageModeShared) else {
+            return nil
+        }
+        aBuffer.label = "SurfaceInstanceTable"
+        GPUResourceRegistry.shared.register(aBuffer, category: .buffer, owner: .module(SurfacesRenderModule.identifier))
+        instanceBuffer = aBuffer
+    }
+    
+    /// Empties the table and moves to the region for `bufferIndex`
+    func reset(forBufferIndex bufferIndex: Int) {
+        instanceBufferOffset = alignedTableSize * bufferIndex
+        instanceCount = 0
+    }
+    
+    /// Adds an instance to the current frame's table. Instances past `maxInstanceCount` are dropped.
+    func append(_ instance: SurfaceInstance) {
+        guard instanceCount < maxInstanceCount else {
+            return
+        }
+        let instances = instanceBuffer.contents().advanced(by: instanceBufferOffset).assumingMemoryBound(to: SurfaceInstance.self)
+        instances[instanceCount] = instance
+        instanceCount += 1
+    }
+    
+    /// The offset in `instanceBuffer` of the indirect draw arguments of an instance in the current frame's table
+    func drawArgumentsOffset(forInstanceAt index: Int) -> Int {
+        return instanceBufferOffset + MemoryLayout<SurfaceInstance>.stride * index + SurfaceInstanceTable.drawArgumentsOffset
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let alignedTableSize: Int
+    fileprivate static let drawArgumentsOffset = MemoryLayout<SurfaceInstance>.offset(of: \SurfaceInstance.drawArguments) ?? 0
+    
+}
+
+// MARK: - SurfaceBatchCulling
+
+/**
+ Culls every instance of a `SurfaceInstanceTable` once on the GPU and writes the indirect draw arguments of each instance. Visible surfaces are then drawn with their own index count and culled surfaces draw nothing, so the vertex functions only run for vertices that end up on screen.
+ 
+ Must be encoded after the precalculation pass and before the render pass that draws the table.
+ */
+final class SurfaceBatchCulling {
+    
+    init?(device: MTLDevice, metalLibrary: MTLLibrary) {
+        
+        guard let cullFunction = metalLibrary.makeFunction(name: "surface_batch_cull") else {
+            print("Warning (SurfaceBatchCulling) - Failed to create the surface_batch_cull function.")
+            return nil
+        }
+        
+        do {
+            pipelineState = try device.makeComputePipelineState(function: cullFunction)
+        } catch let error {
+            print("Warning (SurfaceBatchCulling) - Failed to create the compute pipeline state. ERROR: \(error)")
+            return nil
+        }
+        
+    }
+    
+    /**
+     Encodes the culling of the current frame's table into `commandBuffer`
+     - Parameters:
+        - instanceTable: The table to cull
+        - argumentBuffer: The buffer containing the precalculated arguments of the current frame
+        - argumentBufferOffset: The offset of the current frame in `argumentBuffer`
+        - renderDistance: Surfaces farther than this from the camera are culled. Ignored when `cullsAgainstLight` is `true`.
+        - cullsAgainstLight: `true` to cull against the directional light's frustum for the shadow pass instead of the camera's
+        - commandBuffer: The command buffer to encode into
+     */
+    func encode(instanceTable: SurfaceInstanceTable, argumentBuffer: MTLBuffer, argumentBufferOffset: Int, renderDistance: Float, cullsAgainstLight: Bool, commandBuffer: MTLCommandBuffer) {
+        
+        guard instanceTable.instanceCount > 0 else {
+            return
+        }
+        
+        guard let computeEncoder = commandBuffer.makeComputeCommandEncoder() else {
+            return
+        }
+        
+        computeEncoder.label = "Surface Batch Culling"
+        
+        var batchUniforms = SurfaceBatchUniforms(renderDistance: renderDistance, instanceCount: UInt32(instanceTable.instanceCount), cullsAgainstLight: cullsAgainstLight ? 1 : 0)
+        computeEncoder.setComputePipelineState(pipelineState)
+        computeEncoder.setBuffer(instanceTable.instanceBuffer, offset: instanceTable.instanceBufferOffset, index: Int(kBufferIndexSurfaceInstances.rawValue))
+        computeEncoder.setBytes(&batchUniforms, length: MemoryLayout<SurfaceBatchUniforms>.stride, index: Int(kBufferIndexSurfaceBatchUniforms.rawValue))
+        computeEncoder.setBuffer(argumentBuffer, offset: argumentBufferOffset, index: Int(kBufferIndexPrecalculationOutputBuffer.rawValue))
+        
+        // Whole threadgroups are dispatched because non-uniform threadgroup sizes are not supported by every GPU. The kernel skips the threads past the end of the table.
+        let threadsPerThreadgroup = MTLSize(width: pipelineState.threadExecutionWidth, height: 1, depth: 1)
+        let threadgroupsPerGrid = MTLSize(width: (instanceTable.instanceCount + threadsPerThreadgroup.width - 1) / threadsPerThreadgroup.width, height: 1, depth: 1)
+        computeEncoder.dispatchThreadgroups(threadgroupsPerGrid, threadsPerThreadgroup: threadsPerThreadgroup)
+        
+        computeEncoder.endEncoding()
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let pipelineState: MTLComputePipelineState
+    
+}
+
+// MARK: - Arena
+
+fileprivate struct ArenaRange {
+    var start: Int
+    var count: Int
+}
+
+// A growable buffer of fixed size elements with a first fit free list. Released ranges are held back for a number of frames before they are reused. The free list is kept sorted by start so that adjacent free ranges can be merged.
+fileprivate final class Arena {
+    
+    let stride: Int
+    private(set) var buffer: MTLBuffer?
+    
+    init(device: MTLDevice, stride: Int, label: String) {
+        self.device = device
+        self.stride = stride
+        self.label = label
+    }
+    
+    func allocate(count: Int) -> ArenaRange? {
+        
+        if let freeIndex = freeRanges.firstIndex(where: { $0.count >= count }) {
+            let freeRange = freeRanges[freeIndex]
+            if freeRange.count == count {
+                freeRanges.remove(at: freeIndex)
+            } else {
+                freeRanges[freeIndex] = ArenaRange(start: freeRange.start + count, count: freeRange.count - count)
+            }
+            return ArenaRange(start: freeRange.start, count: count)
+        }
+        
+        if highWaterMark + count > capacity {
+            guard grow(toFit: highWaterMark + count) else {
+                return nil
+            }
+        }
+        let range = ArenaRange(start: highWaterMark, count: count)
+        highWaterMark += count
+        return range
+    
+    }
+    
+    func release(_ range: ArenaRange, atFrame frameNumber: UInt) {
+        pendingRanges.append((range: range, frameNumber: frameNumber))
+    }
+    
+    func reclaim(atFrame frameNumber: UInt, latency: UInt) {
+        guard !pendingRanges.isEmpty else {
+            return
+        }
+        var stillPending = [(range: ArenaRange, frameNumber: UInt)]()
+        for pendingRange in pendingRanges {
+            if frameNumber - pendingRange.frameNumber >= latency {
+                insertFreeRange(pendingRange.range)
+            } else {
+                stillPending.append(pendingRange)
+            }
+        }
+        pendingRanges = stillPending
+    }
+    
+    // MARK: - Private
+    
+    private let device: MTLDevice
+    private let label: String
+    private var capacity = 0
+    private var highWaterMark = 0
+    private var freeRanges = [ArenaRange]()
+    private var pendingRanges = [(range: ArenaRange, frameNumber: UInt)]()
+    
+    // Inserts a range into the sorted free list, merging it with the free ranges on either side. A free range that ends at the high water mark is returned to the unallocated tail of the arena instead.
+    private func insertFreeRange(_ range: ArenaRange) {
+        
+        var mergedRange = range
+        var insertionIndex = freeRanges.firstIndex(where: { $0.start > range.start }) ?? freeRanges.count
+        
+        if insertionIndex < freeRanges.count, mergedRange.start + mergedRange.count == freeRanges[insertionIndex].start {
+            mergedRange.count += freeRanges[insertionIndex].count
+            freeRanges.remove(at: insertionIndex)
+        }
+        
+        if insertionIndex > 0, freeRanges[insertionIndex - 1].start + freeRanges[insertionIndex - 1].count == mergedRange.start {
+            insertionIndex -= 1
+            mergedRange.start = freeRanges[insertionIndex].start
+            mergedRange.count += freeRanges[insertionIndex].count
+            freeRanges.remove(at: insertionIndex)
+        }
+        
+        if mergedRange.start + mergedRange.count == highWaterMark {
+            highWaterMark = mergedRange.start
+        } else {
+            freeRanges.insert(mergedRange, at: insertionIndex)
+        }
+        
+    }
+    
+    // Frames that are still in flight keep the old buffer alive, so the contents can simply be copied into a new, larger buffer
+    private func grow(toFit count: Int) -> Bool {
+        let newCapacity = max(count, capacity * 2, 4096)
+        guard let newBuffer = device.makeBuffer(length: newCapacity * stride, options: .storageModeShared) else {
+            print("Warning (SurfaceBatch) - Failed to grow the \(label) arena to \(newCapacity) elements.")
+            return false
+        }
+        newBuffer.label = label
+        GPUResourceRegistry.shared.register(newBuffer, category: .mesh, owner: .module(SurfacesRenderModule.identifier))
+        if let oldBuffer = buffer, highWaterMark > 0 {
+            newBuffer.contents().copyMemory(from: oldBuffer.contents(), byteCount: highWaterMark * stride)
+        }
+        buffer = newBuffer
+        capacity = newCapacity
+        return true
+    }
+    
+}
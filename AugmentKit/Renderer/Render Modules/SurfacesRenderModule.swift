@@ -33,7 +33,7 @@ import MetalKit
 /**
  A module for rendering to Real Surfaces. The most common use is for rendering shadows from Augmented geometries onto real surfaces. It can also be used to visualize the detected real surfaces for debugging and diagnostics
  */
-class SurfacesRenderModule: RenderModule {
+class SurfacesRenderModule: CullingRenderModule {
     
     static var identifier = "SurfacesRenderModule"
     
@@ -55,11 +55,12 @@ class SurfacesRenderModule: RenderModule {
     // The number of surface instances to render
     private(set) var instanceCount: Int = 0
     
-    func initializeBuffers(withDevice aDevice: MTLDevice, maxInFlightFrames: Int, maxInstances: Int) {
+    func initializeBuffers(withDevice aDevice: MTLDevice, maxInFlightFrames theMaxInFlightFrames: Int, maxInstances: Int) {
         
         state = .initializing
         
         device = aDevice
+        maxInFlightFrames = theMaxInFlightFrames
         
         // Calculate our uniform buffer sizes. We allocate `maxInFlightFrames` instances for uniform
         // storage in a single buffer. This allows us to update uniforms in a ring (i.e. triple
@@ -67,9 +68,9 @@ class SurfacesRenderModule: RenderModule {
         // to another. Surface uniforms should be specified with a max instance count for instancing.
         // Also uniform storage must be aligned (to 256 bytes) to meet the requirements to be an
         // argument in the constant address space of our shading functions.
-        let materialUniformBufferSize = RenderModuleConstants.alignedMaterialSize * maxInFlightFrames
-        let effectsUniformBufferSize = Constants.alignedEffectsUniformSize * maxInFlightFrames
-        let environmentUniformBufferSize = Constants.alignedEnvironmentUniformSize * maxInFlightFrames
+        let materialUniformBufferSize = RenderModuleConstants.alignedMaterialSize * theMaxInFlightFrames
+        let effectsUniformBufferSize = Constants.alignedEffectsUniformSize * theMaxInFlightFrames
+        let environmentUniformBufferSize = Constants.alignedEnvironmentUniformSize * theMaxInFlightFrames
         
         // Create and allocate our uniform buffer objects. Indicate shared storage so that both the
         // CPU can access the buffer
@@ -83,6 +84,10 @@ class SurfacesRenderModule: RenderModule {
         environmentUniformBuffer = device?.makeBuffer(length: environmentUniformBufferSize, options: .storageModeShared)
         environmentUniformBuffer?.label = "EnvironmentUniformBuffer"
         
+        GPUResourceRegistry.shared.register([materialUniformBuffer, effectsUniformBuffer, environmentUniformBuffer], category: .buffer, owner: .module(moduleIdentifier))
+        
+        surfaceBatch = SurfaceBatch(device: aDevice, regionCount: theMaxInFlightFrames, maxSlotCount: Constants.maxSurfaceInstanceCount)
+    
     }
     
     func loadAssets(forGeometricEntities geometricEntities: [AKGeometricEntity], fromModelProvider modelProvider: ModelProvider?, textureLoader aTextureLoader: MTKTextureLoader, completion: (() -> Void)) {
@@ -110,7 +115,7 @@ class SurfacesRenderModule: RenderModule {
             // Check for Plane Anchors that have raw geometry data instead of assets
             if let identifier = geometricEntity.identifier {
                 modelProvider.loadAsset(forObjectType:  "AnySurface", identifier: identifier) { asset in
-                    
+                
                 }
             }
             
@@ -118,9 +123,9 @@ class SurfacesRenderModule: RenderModule {
             if numModels <= 0 {
                 completion()
             }
-            
-        }
         
+        }
+    
     }
     
     func loadPipeline(withModuleEntities moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass? = nil, numQualityLevels: Int = 1, completion: (([DrawCallGroup]) -> Void)? = nil) {
@@ -149,13 +154,17 @@ class SurfacesRenderModule: RenderModule {
             
             if let surfaceEntity = moduleEntity as? AKRealSurfaceAnchor {
                 
-                guard let uuid = surfaceEntity.identifier, let planeGeometry = surfaceEntity.geometry else {
+                guard let uuid = surfaceEntity.identifier, surfaceEntity.geometry != nil else {
                     continue
                 }
                 
-                let meshGPUData = ModelIOTools.meshGPUData(from: planeGeometry.vertices, indices: planeGeometry.triangleIndices, textureCoordinates: planeGeometry.textureCoordinates, device: modelManager.device, material: material, textureBundle: modelManager.textureBundle)
+                guard let batchDrawCall = batchDrawCall(for: renderPass, withMetalLibrary: metalLibrary, material: material, textureBundle: modelManager.textureBundle, numQualityLevels: numQualityLevels) else {
+                    continue
+                }
                 
-                let drawCallGroup = createDrawCallGroup(forUUID: uuid, withMetalLibrary: metalLibrary, renderDestination: renderDestination, renderPass: renderPass, meshGPUData: meshGPUData, geometricEntity: surfaceEntity, numQualityLevels: numQualityLevels)
+                // The geometry of the surface is uploaded to the `SurfaceBatch` and drawn by the batch draw call. The group still has a draw call, sharing the batch pipeline state, so that the precalculation pass produces a transform for the surface.
+                let drawCall = DrawCall(renderPipelineState: batchDrawCall.renderPipelineState, depthStencilState: batchDrawCall.depthStencilState, cullMode: batchDrawCall.cullMode, drawData: batchDrawCall.drawData)
+                let drawCallGroup = DrawCallGroup(drawCalls: [drawCall], uuid: uuid, generatesShadows: surfaceEntity.generatesShadows)
                 drawCallGroup.moduleIdentifier = SurfacesRenderModule.identifier
                 drawCallGroups.append(drawCallGroup)
                 
@@ -171,7 +180,7 @@ class SurfacesRenderModule: RenderModule {
                     state = .ready
                     completion?(drawCallGroups)
                 }
-                
+            
             } else if let geometricEntity = moduleEntity as? AKGeometricEntity {
                 
                 guard let uuid = geometricEntity.identifier else {
@@ -182,10 +191,13 @@ class SurfacesRenderModule: RenderModule {
                 let shaderPreference = geometricEntity.shaderPreference
                 
                 modelManager.meshGPUData(for: mdlAsset, shaderPreference: shaderPreference) { [weak self] (meshGPUData, cacheKey) in
-                        
+                    
                     if let meshGPUData = meshGPUData, let drawCallGroup = self?.createDrawCallGroup(forUUID: uuid, withMetalLibrary: metalLibrary, renderDestination: renderDestination, renderPass: renderPass, meshGPUData: meshGPUData, geometricEntity: geometricEntity, numQualityLevels: numQualityLevels) {
                         drawCallGroup.moduleIdentifier = SurfacesRenderModule.identifier
                         drawCallGroups.append(drawCallGroup)
+                        if let cacheKey = cacheKey {
+                            GPUResourceRegistry.shared.associate(entity: uuid, withAsset: cacheKey)
+                        }
                     }
                     
                     count += 1
@@ -221,6 +233,8 @@ class SurfacesRenderModule: RenderModule {
         effectsUniformBufferAddress = effectsUniformBuffer?.contents().advanced(by: effectsUniformBufferOffset)
         environmentUniformBufferAddress = environmentUniformBuffer?.contents().advanced(by: environmentUniformBufferOffset)
         
+        surfaceBatch?.beginFrame()
+    
     }
     
     func updateBuffers(withModuleEntities moduleEntities: [AKEntity], cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, argumentBufferProperties theArgumentBufferProperties: ArgumentBufferProperties, forRenderPass renderPass: RenderPass) {
@@ -230,229 +244,147 @@ class SurfacesRenderModule: RenderModule {
         // Update the anchor uniform buffer with transforms of the current frame's anchors
         instanceCount = 0
         
+        guard let surfaceBatch = surfaceBatch else {
+            return
+        }
+        
+        // Index the entities once instead of searching `moduleEntities` for every draw call group
+        entitiesByIdentifier.removeAll(keepingCapacity: true)
+        for moduleEntity in moduleEntities {
+            if let identifier = moduleEntity.identifier {
+                entitiesByIdentifier[identifier] = moduleEntity
+            }
+        }
+        
+        // Release the slots of entities that have been removed
+        surfaceBatch.releaseSlots(where: { identifier in
+            guard entitiesByIdentifier[identifier] == nil else {
+                return false
+            }
+            batchedIdentifiers.remove(identifier)
+            culledIdentifiers.remove(identifier)
+            return true
+        })
+        
         //
-        // Update Geometry
+        // Update Environment
         //
         
-        for drawCallGroup in renderPass.drawCallGroups {
-            
-            guard drawCallGroup.moduleIdentifier == moduleIdentifier else {
+        // Every surface shares the environment of the smallest environment probe related to any of them. The smallest volume is assumed to be the most localized.
+        var environmentTexture: MTLTexture?
+        var smallestVolume = Float.greatestFiniteMagnitude
+        for (environmentProbeAnchor, relatedIdentifiers) in environmentProperties.environmentAnchorsWithReatedAnchors {
+            guard let texture = environmentProbeAnchor.environmentTexture, relatedIdentifiers.contains(where: { entitiesByIdentifier[$0] != nil }) else {
                 continue
             }
-            
-            let identifier = drawCallGroup.uuid
-            
-            guard let realSurfaceAnchor = moduleEntities.first(where: {$0.identifier == identifier}) as? AKRealSurfaceAnchor else {
-                continue
-            }
-            
-            if let planeGeometry = realSurfaceAnchor.geometry, let device = device, realSurfaceAnchor.needsMeshUpdate {
-                guard let rawVertexBuffer = ModelIOTools.rawVertexBuffer(from: planeGeometry.vertices, textureCoordinates: planeGeometry.textureCoordinates, device: device) else {
-                    continue
-                }
-                let indexBuffer = ModelIOTools.indexBuffer(from: planeGeometry.triangleIndices, device: device)
-                
-                var mutableDrawCallGroups = [DrawCallGroup]()
-                for drawCallGroup in renderPass.drawCallGroups {
-                    if let drawCall = drawCallGroup.drawCalls.first, let drawData = drawCall.drawData, drawCallGroup.uuid == identifier {
-                        var mutableDrawCall = drawCall
-                        var mutableDrawData = drawData
-                        mutableDrawData.rawVertexBuffers = [rawVertexBuffer]
-                        mutableDrawData.subData[0].indexBuffer = indexBuffer
-                        mutableDrawCall.drawData = mutableDrawData
-                        drawCallGroup.drawCalls = [mutableDrawCall]
-                    }
-                    mutableDrawCallGroups.append(drawCallGroup)
-                }
-                renderPass.drawCallGroups = mutableDrawCallGroups
-                var mutableAKAnchor = realSurfaceAnchor
-                mutableAKAnchor.needsMeshUpdate = false
+            let volume = environmentProbeAnchor.extent.x * environmentProbeAnchor.extent.y * environmentProbeAnchor.extent.z
+            if volume < smallestVolume {
+                smallestVolume = volume
+                environmentTexture = texture
             }
         }
         
+        environmentData = {
+            var myEnvironmentData = EnvironmentData()
+            if let texture = environmentTexture {
+                myEnvironmentData.environmentTexture = texture
+                myEnvironmentData.hasEnvironmentMap = true
+                return myEnvironmentData
+            } else {
+                myEnvironmentData.hasEnvironmentMap = false
+            }
+            return myEnvironmentData
+        }()
+        
+        updateEnvironmentUniforms(environmentProperties: environmentProperties, shadowProperties: shadowProperties)
+        
         //
-        // Update the Buffers
+        // Update Geometry, Effects and the Instance Table
         //
         
-        var anchorMeshIndex = 0
+        let instanceTable = surfaceInstanceTables[ObjectIdentifier(renderPass)]
+        instanceTable?.reset(forBufferIndex: bufferIndex)
+        
+        let currentTime: TimeInterval = Double(cameraProperties.currentFrame) / cameraProperties.frameRate
+        var drawCallIndex = 0
         
         for drawCallGroup in renderPass.drawCallGroups {
             
+            // The index of this group's first draw call into the precalculated arguments buffer
+            let argumentBufferIndex = drawCallIndex
+            drawCallIndex += drawCallGroup.drawCalls.count
+            
             guard drawCallGroup.moduleIdentifier == moduleIdentifier else {
                 continue
             }
             
             let identifier = drawCallGroup.uuid
             
-            guard let realSurfaceAnchor = moduleEntities.first(where: {$0.identifier == identifier}) as? AKRealSurfaceAnchor else {
+            guard let entity = entitiesByIdentifier[identifier] else {
                 continue
             }
             
-            guard let arAnchor = realSurfaceAnchor.arAnchor else {
+            // Every group gets a slot, which is also its index into the effects uniforms. Groups past `maxSurfaceInstanceCount` are not rendered.
+            guard let slotIndex = surfaceBatch.reserveSlot(for: identifier) else {
                 continue
             }
             
-            // Ignore anchors that are beyond the renderDistance
-            let distance = anchorDistance(withTransform: arAnchor.transform, cameraProperties: cameraProperties)
-            guard Double(distance) < renderDistance else {
-                print("Info: AKRealSurfaceAnchor \(identifier) is too far away. Skipping render")
-                continue
-            }
+            instanceCount += 1
             
-            // See if this anchor is associated with an environment anchor. An environment anchor applies to a region of space which may contain several anchors. The environment anchor that has the smallest volume is assumed to be more localized and therefore be the best for for this anchor
-            var environmentTexture: MTLTexture?
-            let environmentProbes: [AREnvironmentProbeAnchor] = environmentProperties.environmentAnchorsWithReatedAnchors.compactMap{
-                if $0.value.contains(identifier) {
-                    return $0.key
+            updateEffectsUniforms(atIndex: slotIndex, for: entity as? AKGeometricEntity, time: currentTime)
+            
+            guard let realSurfaceAnchor = entity as? AKRealSurfaceAnchor, let planeGeometry = realSurfaceAnchor.geometry else {
+                
+                // Groups that are not batched are drawn individually and culled on the CPU
+                batchedIdentifiers.remove(identifier)
+                if let arAnchor = (entity as? AKRealAnchor)?.arAnchor, Double(anchorDistance(withTransform: arAnchor.transform, cameraProperties: cameraProperties)) >= renderDistance {
+                    culledIdentifiers.insert(identifier)
                 } else {
-                    return nil
+                    culledIdentifiers.remove(identifier)
                 }
+                continue
+            
             }
-            if environmentProbes.count > 1 {
-                var bestEnvironmentProbe: AREnvironmentProbeAnchor?
-                environmentProbes.forEach {
-                    if let theBestEnvironmentProbe = bestEnvironmentProbe {
-                        let existingVolume = AKCube(position: AKVector(x: theBestEnvironmentProbe.transform.columns.3.x, y: theBestEnvironmentProbe.transform.columns.3.y, z: theBestEnvironmentProbe.transform.columns.3.z), extent: AKVector(theBestEnvironmentProbe.extent)).volume()
-                        let newVolume = AKCube(position: AKVector(x: $0.transform.columns.3.x, y: $0.transform.columns.3.y, z: $0.transform.columns.3.z), extent: AKVector($0.extent)).volume()
-                        if newVolume < existingVolume {
-                            bestEnvironmentProbe = $0
-                        }
-                    } else {
-                        bestEnvironmentProbe = $0
-                    }
-                }
-                if let environmentProbeAnchor = bestEnvironmentProbe, let texture = environmentProbeAnchor.environmentTexture {
-                    environmentTexture = texture
-                }
-            } else {
-                if let environmentProbeAnchor = environmentProbes.first, let texture = environmentProbeAnchor.environmentTexture {
-                    environmentTexture = texture
+            
+            batchedIdentifiers.insert(identifier)
+            
+            // Upload the geometry the first time the surface is seen and whenever ARKit refines the plane
+            if realSurfaceAnchor.needsMeshUpdate || !surfaceBatch.hasGeometry(slotIndex: slotIndex) {
+                if surfaceBatch.write(vertices: planeGeometry.vertices, textureCoordinates: planeGeometry.textureCoordinates, indices: planeGeometry.triangleIndices, toSlot: slotIndex) {
+                    var mutableAKAnchor = realSurfaceAnchor
+                    mutableAKAnchor.needsMeshUpdate = false
                 }
             }
             
-            drawCallGroup.drawCalls.forEach { drawCall in
-                
-                instanceCount += 1
-                
-                if instanceCount > Constants.maxSurfaceInstanceCount {
-                    instanceCount = Constants.maxSurfaceInstanceCount
-                    return
-                }
-                
-                //
-                // Update Environment
-                //
-                
-                environmentData = {
-                    var myEnvironmentData = EnvironmentData()
-                    if let texture = environmentTexture {
-                        myEnvironmentData.environmentTexture = texture
-                        myEnvironmentData.hasEnvironmentMap = true
-                        return myEnvironmentData
-                    } else {
-                        myEnvironmentData.hasEnvironmentMap = false
-                    }
-                    return myEnvironmentData
-                }()
-                
-                let environmentUniforms = environmentUniformBufferAddress?.assumingMemoryBound(to: EnvironmentUniforms.self).advanced(by: anchorMeshIndex)
-                
-                // Set up lighting for the scene using the ambient intensity if provided
-                let ambientIntensity: Float = {
-                    if let lightEstimate = environmentProperties.lightEstimate {
-                        return Float(lightEstimate.ambientIntensity) / 1000.0
-                    } else {
-                        return 1
-                    }
-                }()
-                
-                let ambientLightColor: SIMD3<Float> = {
-                    if let lightEstimate = environmentProperties.lightEstimate {
-                        return getRGB(from: lightEstimate.ambientColorTemperature)
-                    } else {
-                        return SIMD3<Float>(0.5, 0.5, 0.5)
-                    }
-                }()
-                
-                environmentUniforms?.pointee.ambientLightIntensity = ambientIntensity
-                environmentUniforms?.pointee.ambientLightColor = ambientLightColor// * ambientIntensity
-                
-                var directionalLightDirection : SIMD3<Float> = environmentProperties.directionalLightDirection
-                directionalLightDirection = simd_normalize(directionalLightDirection)
-                environmentUniforms?.pointee.directionalLightDirection = directionalLightDirection
-                
-                let directionalLightColor: SIMD3<Float> = SIMD3<Float>(0.6, 0.6, 0.6)
-                environmentUniforms?.pointee.directionalLightColor = directionalLightColor// * ambientIntensity
-                
-                environmentUniforms?.pointee.directionalLightMVP = environmentProperties.directionalLightMVP
-                environmentUniforms?.pointee.shadowMVPTransformMatrix = shadowProperties.shadowMVPTransformMatrix
-                
-                if environmentData?.hasEnvironmentMap == true {
-                    environmentUniforms?.pointee.hasEnvironmentMap = 1
-                } else {
-                    environmentUniforms?.pointee.hasEnvironmentMap = 0
-                }
-                
-                //
-                // Update Effects uniform
-                //
-                
-                let effectsUniforms = effectsUniformBufferAddress?.assumingMemoryBound(to: AnchorEffectsUniforms.self).advanced(by: anchorMeshIndex)
-                var hasSetAlpha = false
-                var hasSetGlow = false
-                var hasSetTint = false
-                var hasSetScale = false
-                if let effects = realSurfaceAnchor.effects {
-                    let currentTime: TimeInterval = Double(cameraProperties.currentFrame) / cameraProperties.frameRate
-                    for effect in effects {
-                        switch effect.effectType {
-                        case .alpha:
-                            if let value = effect.value(forTime: currentTime) as? Float {
-                                effectsUniforms?.pointee.alpha = value
-                                hasSetAlpha = true
-                            }
-                        case .glow:
-                            if let value = effect.value(forTime: currentTime) as? Float {
-                                effectsUniforms?.pointee.glow = value
-                                hasSetGlow = true
-                            }
-                        case .tint:
-                            if let value = effect.value(forTime: currentTime) as? SIMD3<Float> {
-                                effectsUniforms?.pointee.tint = value
-                                hasSetTint = true
-                            }
-                        case .scale:
-                            if let value = effect.value(forTime: currentTime) as? Float {
-                                let scaleMatrix = matrix_identity_float4x4
-                                effectsUniforms?.pointee.scale = scaleMatrix.scale(x: value, y: value, z: value)
-                                hasSetScale = true
-                            }
-                        }
-                    }
-                }
-                if !hasSetAlpha {
-                    effectsUniforms?.pointee.alpha = 1
-                }
-                if !hasSetGlow {
-                    effectsUniforms?.pointee.glow = 0
-                }
-                if !hasSetTint {
-                    effectsUniforms?.pointee.tint = SIMD3<Float>(1,1,1)
-                }
-                if !hasSetScale {
-                    effectsUniforms?.pointee.scale = matrix_identity_float4x4
+            // Use the render pass filter function to skip surfaces on an individual basis. Frustum and distance culling happen on the GPU.
+            if let filterFunction = renderPass.drawCallGroupFilterFunction {
+                guard filterFunction(drawCallGroup) else {
+                    continue
                 }
-                
-                anchorMeshIndex += 1
-                
             }
+            
+            if let instance = surfaceBatch.instance(forSlot: slotIndex, argumentBufferIndex: argumentBufferIndex) {
+                instanceTable?.append(instance)
+            }
+        
         }
         
         //
         // Update the shadow map
         //
         shadowMap = shadowProperties.shadowMap
+        shadowMoments = shadowProperties.shadowMoments
+    
+    }
+    
+    func encodeCulling(forRenderPass renderPass: RenderPass, commandBuffer: MTLCommandBuffer) {
+        
+        guard let surfaceBatchCulling = surfaceBatchCulling, let instanceTable = surfaceInstanceTables[ObjectIdentifier(renderPass)], let argumentBufferProperties = argumentBufferProperties, let vertexArgumentBuffer = argumentBufferProperties.vertexArgumentBuffer else {
+            return
+        }
         
+        surfaceBatchCulling.encode(instanceTable: instanceTable, argumentBuffer: vertexArgumentBuffer, argumentBufferOffset: argumentBufferProperties.vertexArgumentBufferOffset(forFrame: bufferIndex), renderDistance: Float(renderDistance), cullsAgainstLight: renderPass.shadowCasterInstanceTable != nil, commandBuffer: commandBuffer)
+    
     }
     
     func draw(withRenderPass renderPass: RenderPass, sharedModules: [SharedRenderModule]?) {
@@ -482,7 +414,7 @@ class SurfacesRenderModule: RenderModule {
             }
             renderEncoder.setFragmentBuffer(environmentUniformBuffer, offset: environmentUniformBufferOffset, index: Int(kBufferIndexEnvironmentUniforms.rawValue))
             renderEncoder.popDebugGroup()
-            
+        
         }
         
         if let effectsBuffer = effectsUniformBuffer, renderPass.usesEffects {
@@ -490,24 +422,67 @@ class SurfacesRenderModule: RenderModule {
             renderEncoder.pushDebugGroup("Draw Effects Uniforms")
             renderEncoder.setFragmentBuffer(effectsBuffer, offset: effectsUniformBufferOffset, index: Int(kBufferIndexAnchorEffectsUniforms.rawValue))
             renderEncoder.popDebugGroup()
-            
+        
         }
         
         if let shadowMap = shadowMap, renderPass.usesShadows {
             
             renderEncoder.pushDebugGroup("Attach Shadow Buffer")
             renderEncoder.setFragmentTexture(shadowMap, index: Int(kTextureIndexShadowMap.rawValue))
+            // When the prefiltered moments are bound the shader uses them for soft shadows instead of comparing against the shadow map
+            renderEncoder.setFragmentTexture(shadowMoments, index: Int(kTextureIndexShadowMoments.rawValue))
             renderEncoder.popDebugGroup()
+        
+        }
+        
+        //
+        // Batched Surfaces
+        //
+        
+        // Every batched surface shares one pipeline state and one set of buffers. Each surface is drawn indirectly with the arguments written by `SurfaceBatchCulling` in `encodeCulling(forRenderPass:commandBuffer:)`, so culled surfaces draw nothing and visible surfaces draw exactly their own indices.
+        if renderPass.usesGeometry, let surfaceBatch = surfaceBatch, let instanceTable = surfaceInstanceTables[ObjectIdentifier(renderPass)], instanceTable.instanceCount > 0, let batchDrawCall = batchDrawCalls[ObjectIdentifier(renderPass)], let vertexBuffer = surfaceBatch.vertexBuffer, let indexBuffer = surfaceBatch.indexBuffer {
+            
+            renderEncoder.pushDebugGroup("Surface Batch")
+            
+            batchDrawCall.prepareDrawCall(withRenderPass: renderPass)
             
+            renderEncoder.setVertexBuffer(vertexBuffer, offset: 0, index: Int(kBufferIndexRawVertexData.rawValue))
+            renderEncoder.setVertexBuffer(indexBuffer, offset: 0, index: Int(kBufferIndexSurfaceIndices.rawValue))
+            renderEncoder.setVertexBuffer(instanceTable.instanceBuffer, offset: instanceTable.instanceBufferOffset, index: Int(kBufferIndexSurfaceInstances.rawValue))
+            
+            if renderPass.usesLighting, let submeshData = batchDrawCall.drawData?.subData.first {
+                encodeTextures(for: renderEncoder, subData: submeshData, environmentData: environmentData)
+                var materialUniforms = submeshData.materialUniforms
+                renderEncoder.setFragmentBytes(&materialUniforms, length: MemoryLayout<MaterialUniforms>.stride, index: Int(kBufferIndexMaterialUniforms.rawValue))
+            }
+            
+            for instanceIndex in 0..<instanceTable.instanceCount {
+                renderEncoder.drawPrimitives(type: .triangle, indirectBuffer: instanceTable.instanceBuffer, indirectBufferOffset: instanceTable.drawArgumentsOffset(forInstanceAt: instanceIndex))
+            }
+            
+            renderEncoder.popDebugGroup()
+        
+        }
+        
+        //
+        // Individual Draw Calls
+        //
+        
+        // Shadow casters are instanced by mesh. Surfaces culled on the CPU are skipped.
+        if let instanceTable = renderPass.shadowCasterInstanceTable {
+            drawShadowCasters(withRenderPass: renderPass, instanceTable: instanceTable, renderEncoder: renderEncoder, where: { [batchedIdentifiers, culledIdentifiers] drawCallGroup in
+                return !batchedIdentifiers.contains(drawCallGroup.uuid) && !culledIdentifiers.contains(drawCallGroup.uuid)
+            })
+            renderEncoder.popDebugGroup()
+            return
         }
         
         var drawCallGroupIndex: Int32 = 0
         var drawCallIndex: Int32 = 0
-        var baseIndex = 0
         
         for drawCallGroup in renderPass.drawCallGroups {
             
-            guard drawCallGroup.moduleIdentifier == moduleIdentifier else {
+            guard drawCallGroup.moduleIdentifier == moduleIdentifier, !batchedIdentifiers.contains(drawCallGroup.uuid), !culledIdentifiers.contains(drawCallGroup.uuid), let slotIndex = surfaceBatch?.slotIndex(for: drawCallGroup.uuid) else {
                 drawCallIndex += Int32(drawCallGroup.drawCalls.count)
                 drawCallGroupIndex += 1
                 continue
@@ -530,7 +505,7 @@ class SurfacesRenderModule: RenderModule {
                     continue
                 }
                 
-                drawCall.prepareDrawCall(withRenderPass: renderPass)
+                drawCall.prepareDrawCall(withRenderPass: renderPass, qualityLevel: Int(drawCallGroup.qualityLevel.rawValue))
                 
                 if renderPass.usesGeometry {
                     // Set the offset index of the draw call into the argument buffer
@@ -542,20 +517,19 @@ class SurfacesRenderModule: RenderModule {
                 var mutableDrawData = drawData
                 mutableDrawData.instanceCount = 1
                 
-                // Set the mesh's vertex data buffers and draw
-                draw(withDrawData: mutableDrawData, with: renderEncoder, baseIndex: baseIndex, includeGeometry: renderPass.usesGeometry, includeSkeleton: renderPass.hasSkeleton, includeLighting: renderPass.usesLighting)
+                // Set the mesh's vertex data buffers and draw. The slot index selects the effects uniforms.
+                draw(withDrawData: mutableDrawData, with: renderEncoder, baseIndex: slotIndex, includeGeometry: renderPass.usesGeometry, includeSkeleton: renderPass.hasSkeleton, includeLighting: renderPass.usesLighting)
                 
-                baseIndex += 1
                 drawCallIndex += 1
-                
+            
             }
             
             drawCallGroupIndex += 1
-            
+        
         }
         
         renderEncoder.popDebugGroup()
-        
+    
     }
     
     func frameEncodingComplete(renderPasses: [RenderPass]) {
@@ -573,12 +547,13 @@ class SurfacesRenderModule: RenderModule {
     // MARK: - Private
     
     private enum Constants {
-        static let maxSurfaceInstanceCount = 64
+        static let maxSurfaceInstanceCount = 512
         static let alignedEffectsUniformSize = ((MemoryLayout<AnchorEffectsUniforms>.stride * Constants.maxSurfaceInstanceCount) & ~0xFF) + 0x100
         static let alignedEnvironmentUniformSize = ((MemoryLayout<EnvironmentUniforms>.stride * Constants.maxSurfaceInstanceCount) & ~0xFF) + 0x100
     }
     
     private var bufferIndex: Int = 0
+    private var maxInFlightFrames: Int = 3
     private var device: MTLDevice?
     private var textureLoader: MTKTextureLoader?
     private var materialUniformBuffer: MTLBuffer?
@@ -586,6 +561,7 @@ class SurfacesRenderModule: RenderModule {
     private var environmentUniformBuffer: MTLBuffer?
     private var environmentData: EnvironmentData?
     private var shadowMap: MTLTexture?
+    private var shadowMoments: MTLTexture?
     private var argumentBufferProperties: ArgumentBufferProperties?
     
     // Offset within materialUniformBuffer to set for the current frame
@@ -606,6 +582,157 @@ class SurfacesRenderModule: RenderModule {
     // Addresses to write environment uniforms to each frame
     private var environmentUniformBufferAddress: UnsafeMutableRawPointer?
     
+    // Shared vertex and index storage for every surface
+    private var surfaceBatch: SurfaceBatch?
+    
+    // The batch draw call and instance table for each render pass
+    private var batchDrawCalls = [ObjectIdentifier: DrawCall]()
+    private var surfaceInstanceTables = [ObjectIdentifier: SurfaceInstanceTable]()
+    
+    // Culls the instance tables on the GPU
+    private var surfaceBatchCulling: SurfaceBatchCulling?
+    
+    // The identifiers of groups that are drawn by the batch draw call
+    private var batchedIdentifiers = Set<UUID>()
+    
+    // The identifiers of groups that are not batched and are beyond the `renderDistance`
+    private var culledIdentifiers = Set<UUID>()
+    
+    // The module entities for the current frame, keyed by identifier
+    private var entitiesByIdentifier = [UUID: AKEntity]()
+    
+    // Returns the draw call used to draw every batched surface in `renderPass`, creating it and the render pass's instance table the first time
+    private func batchDrawCall(for renderPass: RenderPass?, withMetalLibrary metalLibrary: MTLLibrary, material: MDLMaterial, textureBundle: Bundle?, numQualityLevels: Int) -> DrawCall? {
+        
+        guard let renderPass = renderPass else {
+            print("Warning - Skipping all draw calls because the render pass is nil.")
+            let underlyingError = NSError(domain: AKErrorDomain, code: AKErrorCodeRenderPassNotFound, userInfo: nil)
+            let newError = AKError.seriousError(.renderPipelineError(.failedToInitialize(PipelineErrorInfo(moduleIdentifier: moduleIdentifier, underlyingError: underlyingError))))
+            recordNewError(newError)
+            return nil
+        }
+        
+        let key = ObjectIdentifier(renderPass)
+        if let existingDrawCall = batchDrawCalls[key] {
+            return existingDrawCall
+        }
+        
+        guard let device = device, let instanceTable = SurfaceInstanceTable(device: device, regionCount: maxInFlightFrames, maxInstanceCount: Constants.maxSurfaceInstanceCount) else {
+            print("Warning (SurfacesRenderModule) - Failed to allocate the surface instance table.")
+            return nil
+        }
+        
+        if surfaceBatchCulling == nil {
+            surfaceBatchCulling = SurfaceBatchCulling(device: device, metalLibrary: metalLibrary)
+        }
+        guard surfaceBatchCulling != nil else {
+            return nil
+        }
+        
+        // All surfaces share one material
+        var submesh = DrawSubData()
+        submesh.updateMaterialTextures(from: material, textureBundle: textureBundle, textureLoader: textureLoader)
+        var drawData = DrawData()
+        drawData.subData = [submesh]
+        drawData.hasBaseColorMap = submesh.baseColorTexture != nil
+        
+        // The cull mode is set to from because the x geometry is flipped in the shader. The vertex function reads from the arenas directly so no vertex descriptor is needed.
+        let drawCall: DrawCall
+        if renderPass.shadowCasterInstanceTable != nil {
+            // The shadow pass replaces every vertex function with its template's, which reads its vertices through a vertex descriptor. The batch has none so it gets its own depth only pipeline state.
+            guard let shadowVertexFunction = metalLibrary.makeFunction(name: "surfaceBatchShadowVertexShader"), let renderPipelineDescriptor = renderPass.renderPipelineDescriptor(withVertexDescriptor: nil, vertexFunction: shadowVertexFunction, fragmentFunction: nil) else {
+                print("Warning (SurfacesRenderModule) - Failed to create the surface batch shadow pipeline descriptor.")
+                return nil
+            }
+            renderPipelineDescriptor.vertexFunction = shadowVertexFunction
+            renderPipelineDescriptor.vertexDescriptor = nil
+            drawCall = DrawCall(withDevice: device, renderPipelineDescriptor: renderPipelineDescriptor, depthStencilDescriptor: renderPass.depthStencilDescriptor(withDepthComareFunction: .less, isDepthWriteEnabled: true), cullMode: .front, drawData: drawData)
+        } else {
+            drawCall = DrawCall(metalLibrary: metalLibrary, renderPass: renderPass, vertexFunctionName: "rawSurfaceBatchVertexTransform", fragmentFunctionName: "surfaceFragmentLightingSimple", vertexDescriptor: nil, cullMode: .front, drawData: drawData, numQualityLevels: numQualityLevels)
+        }
+        batchDrawCalls[key] = drawCall
+        surfaceInstanceTables[key] = instanceTable
+        return drawCall
+    
+    }
+    
+    // Writes the environment uniforms. All surfaces share the first entry.
+    private func updateEnvironmentUniforms(environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties) {
+        
+        let environmentUniforms = environmentUniformBufferAddress?.assumingMemoryBound(to: EnvironmentUniforms.self)
+        
+        // Ambient lighting is resolved once per frame by the renderer
+        environmentUniforms?.pointee.ambientLightIntensity = environmentProperties.ambientLightIntensity
+        environmentUniforms?.pointee.ambientLightColor = environmentProperties.ambientLightColor
+        
+        var directionalLightDirection : SIMD3<Float> = environmentProperties.directionalLightDirection
+        directionalLightDirection = simd_normalize(directionalLightDirection)
+        environmentUniforms?.pointee.directionalLightDirection = directionalLightDirection
+        
+        let directionalLightColor: SIMD3<Float> = SIMD3<Float>(0.6, 0.6, 0.6)
+        environmentUniforms?.pointee.directionalLightColor = directionalLightColor// * ambientIntensity
+        
+        environmentUniforms?.pointee.directionalLightMVP = environmentProperties.directionalLightMVP
+        environmentUniforms?.pointee.shadowMVPTransformMatrix = shadowProperties.shadowMVPTransformMatrix
+        
+        if environmentData?.hasEnvironmentMap == true {
+            environmentUniforms?.pointee.hasEnvironmentMap = 1
+        } else {
+            environmentUniforms?.pointee.hasEnvironmentMap = 0
+        }
+    
+    }
+    
+    // Writes the effects uniforms for a single surface
+    private func updateEffectsUniforms(atIndex index: Int, for geometricEntity: AKGeometricEntity?, time: TimeInterval) {
+        
+        let effectsUniforms = effectsUniformBufferAddress?.assumingMemoryBound(to: AnchorEffectsUniforms.self).advanced(by: index)
+        var hasSetAlpha = false
+        var hasSetGlow = false
+        var hasSetTint = false
+        var hasSetScale = false
+        if let effects = geometricEntity?.effects {
+            for effect in effects {
+                switch effect.effectType {
+                case .alpha:
+                    if let value = effect.value(forTime: time) as? Float {
+                        effectsUniforms?.pointee.alpha = value
+                        hasSetAlpha = true
+                    }
+                case .glow:
+                    if let value = effect.value(forTime: time) as? Float {
+                        effectsUniforms?.pointee.glow = value
+                        hasSetGlow = true
+                    }
+                case .tint:
+                    if let value = effect.value(forTime: time) as? SIMD3<Float> {
+                        effectsUniforms?.pointee.tint = value
+                        hasSetTint = true
+                    }
+                case .scale:
+                    if let value = effect.value(forTime: time) as? Float {
+                        let scaleMatrix = matrix_identity_float4x4
+                        effectsUniforms?.pointee.scale = scaleMatrix.scale(x: value, y: value, z: value)
+                        hasSetScale = true
+                    }
+                }
+            }
+        }
+        if !hasSetAlpha {
+            effectsUniforms?.pointee.alpha = 1
+        }
+        if !hasSetGlow {
+            effectsUniforms?.pointee.glow = 0
+        }
+        if !hasSetTint {
+            effectsUniforms?.pointee.tint = SIMD3<Float>(1,1,1)
+        }
+        if !hasSetScale {
+            effectsUniforms?.pointee.scale = matrix_identity_float4x4
+        }
+    
+    }
+    
     private func createDrawCallGroup(forUUID uuid: UUID, withMetalLibrary metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, renderPass: RenderPass?, meshGPUData: MeshGPUData, geometricEntity: AKGeometricEntity, numQualityLevels: Int) -> DrawCallGroup {
         
         guard let renderPass = renderPass else {
@@ -642,12 +769,12 @@ class SurfacesRenderModule: RenderModule {
             // The cull mode is set to from because the x geometry is flipped in the shader
             let drawCall = DrawCall(metalLibrary: metalLibrary, renderPass: renderPass, vertexFunctionName: vertexShaderName, fragmentFunctionName: fragmentShaderName, vertexDescriptor: meshGPUData.vertexDescriptor, cullMode: .front, drawData: drawData, numQualityLevels: numQualityLevels)
             drawCalls.append(drawCall)
-            
+        
         }
         
         let drawCallGroup = DrawCallGroup(drawCalls: drawCalls, uuid: uuid, generatesShadows: geometricEntity.generatesShadows)
         return drawCallGroup
-        
+    
     }
     
 }
@@ -69,6 +69,8 @@ class TrackingPointsRenderModule: RenderModule {
         trackingPointDataBuffer = device?.makeBuffer(length: trackingPointDataBufferSize, options: .storageModeShared)
         trackingPointDataBuffer?.label = "TrackingPointDataBuffer"
         
+        GPUResourceRegistry.shared.register([trackingPointDataBuffer], category: .buffer, owner: .module(moduleIdentifier))
+        
     }
     
     // Load the data from the Model Provider.
@@ -123,7 +125,8 @@ class TrackingPointsRenderModule: RenderModule {
             trackingPointPipelineStateDescriptor.vertexFunction = pointVertexShader
             trackingPointPipelineStateDescriptor.fragmentFunction = pointFragmentShader
             trackingPointPipelineStateDescriptor.vertexDescriptor = trackingPointVertexDescriptor
-            trackingPointPipelineStateDescriptor.colorAttachments[0].pixelFormat = renderDestination.colorPixelFormat
+            // Match the color target of the render pass, which may differ from the drawable
+            trackingPointPipelineStateDescriptor.colorAttachments[0].pixelFormat = renderPass?.templateRenderPipelineDescriptor?.colorAttachments[0].pixelFormat ?? renderDestination.colorPixelFormat
             trackingPointPipelineStateDescriptor.colorAttachments[0].isBlendingEnabled = true
             trackingPointPipelineStateDescriptor.colorAttachments[0].destinationRGBBlendFactor = .one
             trackingPointPipelineStateDescriptor.colorAttachments[0].destinationAlphaBlendFactor = .one
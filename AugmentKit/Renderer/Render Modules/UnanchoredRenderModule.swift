@@ -30,7 +30,7 @@ import ARKit
 import AugmentKitShader
 import MetalKit
 
-class UnanchoredRenderModule: RenderModule, SkinningModule {
+class UnanchoredRenderModule: IncrementalRenderModule, SkinningModule {
     
     static var identifier = "UnanchoredRenderModule"
     
@@ -86,6 +86,8 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
         jointTransformBuffer = device?.makeBuffer(length: jointTransformBufferSize, options: [])
         jointTransformBuffer?.label = "Joint Transform Buffer"
         
+        GPUResourceRegistry.shared.register([materialUniformBuffer, effectsUniformBuffer, environmentUniformBuffer, jointTransformBuffer], category: .buffer, owner: .module(moduleIdentifier))
+        
         geometricEntities = []
         
     }
@@ -158,99 +160,74 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
         }
         
         // Load the per-geometry models
-        for geometricEntity in theGeometricEntities {
-            
-            if let identifier = geometricEntity.identifier {
-                modelProvider.loadAsset(forObjectType:  type(of: geometricEntity).type, identifier: identifier) { [weak self] asset in
-                    
-                    guard let asset = asset else {
-                        print("Warning (UnanchoredRenderModule) - Failed to get a MDLAsset for type \"\(type(of: geometricEntity).type)\") with identifier \(identifier) from the modelProvider. Aborting the render phase.")
-                        let newError = AKError.warning(.modelError(.modelNotFound(ModelErrorInfo(type:  type(of: geometricEntity).type, identifier: identifier))))
-                        recordNewError(newError)
-                        completion()
-                        return
-                    }
-                    
-                    self?.modelAssetsByUUID[identifier] = asset
-                    self?.shaderPreferenceByUUID[identifier] = geometricEntity.shaderPreference
-                }
-            }
-            
+        loadModelAssets(for: theGeometricEntities, fromModelProvider: modelProvider, completion: completion) {
             numModels -= 1
-            if hasLoadedTrackerAsset && hasLoadedTargetAsset && numModels <= 0 {
-                completion()
-            }
-            
+            return hasLoadedTrackerAsset && hasLoadedTargetAsset && numModels <= 0
         }
         
     }
     
-    func loadPipeline(withModuleEntities moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass? = nil, numQualityLevels: Int = 1, completion: (([DrawCallGroup]) -> Void)? = nil) {
+    func loadAssets(forAddedGeometricEntities theGeometricEntities: [AKGeometricEntity], fromModelProvider modelProvider: ModelProvider?, textureLoader aTextureLoader: MTKTextureLoader, completion: (() -> Void)) {
         
-        var drawCallGroups = [DrawCallGroup]()
+        guard let modelProvider = modelProvider else {
+            print("Serious Error - Model Provider not found.")
+            let underlyingError = NSError(domain: AKErrorDomain, code: AKErrorCodeModelProviderNotFound, userInfo: nil)
+            let newError = AKError.seriousError(.renderPipelineError(.failedToInitialize(PipelineErrorInfo(moduleIdentifier: moduleIdentifier, underlyingError: underlyingError))))
+            recordNewError(newError)
+            completion()
+            return
+        }
         
-        let filteredGeometryUUIDs = geometricEntities.compactMap({$0.identifier})
-        let filteredModelsByUUID = modelAssetsByUUID.filter { (uuid, asset) in
-            filteredGeometryUUIDs.contains(uuid)
+        // Skip anything that has already been loaded. The general tracker and target models were loaded when the module was initialized.
+        let addedGeometricEntities = theGeometricEntities.filter { geometricEntity in
+            !geometricEntities.contains(where: {$0.identifier == geometricEntity.identifier})
         }
+        geometricEntities.append(contentsOf: addedGeometricEntities)
         
-        let realBodies: [RealBody] = moduleEntities.compactMap { entity in
-            if let aBody = entity as? RealBody {
-                return aBody
-            } else {
-                return nil
-            }
+        guard !addedGeometricEntities.isEmpty else {
+            completion()
+            return
         }
         
-        let total = filteredModelsByUUID.count
-        var count = 0
+        var numModels = addedGeometricEntities.count
+        loadModelAssets(for: addedGeometricEntities, fromModelProvider: modelProvider, completion: completion) {
+            numModels -= 1
+            return numModels <= 0
+        }
         
-        for item in filteredModelsByUUID {
-            
-            guard let geometricEntity = geometricEntities.first(where: {$0.identifier == item.key}) else {
-                continue
-            }
-            
-            let uuid = item.key
-            
-            let realBody = realBodies.first(where: { entity in
-                entity.identifier == uuid
-            })
-            
-            // Ignore any RealBody entities that aren't anchored to ARBodyAnchors
-            if realBody?.isAnchored == false {
-                continue
+    }
+    
+    func loadPipeline(withModuleEntities moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass? = nil, numQualityLevels: Int = 1, completion: (([DrawCallGroup]) -> Void)? = nil) {
+        loadDrawCallGroups(for: geometricEntities, moduleEntities: moduleEntities, metalLibrary: metalLibrary, renderDestination: renderDestination, modelManager: modelManager, renderPass: renderPass, numQualityLevels: numQualityLevels) { [weak self] drawCallGroups in
+            self?.state = .ready
+            completion?(drawCallGroups)
+        }
+    }
+    
+    func loadPipeline(forGeometricEntityIdentifiers identifiers: [UUID], moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass?, numQualityLevels: Int, completion: (([DrawCallGroup]) -> Void)?) {
+        
+        let addedGeometricEntities = geometricEntities.filter { geometricEntity in
+            guard let identifier = geometricEntity.identifier else {
+                return false
             }
-            
-            let mdlAsset = item.value
-            let shaderPreference: ShaderPreference = {
-                if let prefernece = shaderPreferenceByUUID[uuid] {
-                    return prefernece
-                } else {
-                    return .pbr
-                }
-            }()
-            
-            // TODO: Joint Layout - , jointLayout: realBody?.jointNames\
-            modelManager.meshGPUData(for: mdlAsset, shaderPreference: shaderPreference) { [weak self] (meshGPUData, cacheKey) in
-                    
-                if let meshGPUData = meshGPUData, let drawCallGroup = self?.createDrawCallGroup(forUUID: uuid, withMetalLibrary: metalLibrary, renderDestination: renderDestination, renderPass: renderPass, meshGPUData: meshGPUData, geometricEntity: geometricEntity, numQualityLevels: numQualityLevels) {
-                    drawCallGroup.moduleIdentifier = UnanchoredRenderModule.identifier
-                    drawCallGroups.append(drawCallGroup)
-                }
-                
-                count += 1
-                if count == total {
-                    // In the buffer, the anchors are layed out by UUID in sorted order. So if there are
-                    // 5 anchors with UUID = "A..." and 3 UUIDs = "B..." and 1 UUID = "C..." then that's
-                    // how they will layed out in memory. Therefore updating the buffers is a 2 step process.
-                    // First, loop through all of the ARAnchors and gather the UUIDs as well as the counts for each.
-                    // Second, layout and update the buffers in the desired order.
-                    drawCallGroups.sort { $0.uuid.uuidString < $1.uuid.uuidString }
-                    self?.state = .ready
-                    completion?(drawCallGroups)
-                }
+            return identifiers.contains(identifier)
+        }
+        loadDrawCallGroups(for: addedGeometricEntities, moduleEntities: moduleEntities, metalLibrary: metalLibrary, renderDestination: renderDestination, modelManager: modelManager, renderPass: renderPass, numQualityLevels: numQualityLevels, completion: completion)
+        
+    }
+    
+    func removeAssets(forGeometricEntityIdentifiers identifiers: [UUID]) {
+        geometricEntities.removeAll(where: { geometricEntity in
+            guard let identifier = geometricEntity.identifier else {
+                return false
             }
+            return identifiers.contains(identifier)
+        })
+        identifiers.forEach {
+            modelAssetsByUUID[$0] = nil
+            shaderPreferenceByUUID[$0] = nil
+            geometryCountByUUID[$0] = nil
+            skeletonRetargetersByUUID[$0] = nil
         }
     }
     
@@ -300,22 +277,9 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
         var geometriesByUUID = [UUID: [AKGeometricEntity]]()
         environmentTextureByUUID = [:]
         
-        // Set up lighting for the scene using the ambient intensity if provided
-        ambientIntensity = {
-            if let lightEstimate = environmentProperties.lightEstimate {
-                return Float(lightEstimate.ambientIntensity) / 1000.0
-            } else {
-                return 1
-            }
-        }()
-        
-        ambientLightColor = {
-            if let lightEstimate = environmentProperties.lightEstimate {
-                return getRGB(from: lightEstimate.ambientColorTemperature)
-            } else {
-                return SIMD3<Float>(0.5, 0.5, 0.5)
-            }
-        }()
+        // Ambient lighting is resolved once per frame by the renderer
+        ambientIntensity = environmentProperties.ambientLightIntensity
+        ambientLightColor = environmentProperties.ambientLightColor
         
         var index = 0
         var trackerUUIDs = trackers.map({$0.identifier})
@@ -399,18 +363,7 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
                         //
                         
                         if let body = akTracker as? AKBody {
-                            let jointMap: [Int]? = {
-                                if let cachedJointMap = jointMapsByUUID[uuid] {
-                                    return cachedJointMap
-                                } else if let skeleton = drawData.skeleton {
-                                    let aMap = generateJointMap(from: body, to: skeleton)
-                                    jointMapsByUUID[uuid] = aMap
-                                    return aMap
-                                } else {
-                                    return nil
-                                }
-                            }()
-                            updateTrackedSkeleton(from: drawData, body: body, jointMap: jointMap)
+                            updateTrackedSkeleton(from: drawData, body: body, uuid: uuid)
                         } else {
                             updateSkeletonAnimation(from: drawData, frameNumber: cameraProperties.currentFrame, frameRate: cameraProperties.frameRate)
                         }
@@ -737,6 +690,13 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
             
         }
         
+        // Shadow casters are instanced by mesh
+        if let instanceTable = renderPass.shadowCasterInstanceTable {
+            drawShadowCasters(withRenderPass: renderPass, instanceTable: instanceTable, renderEncoder: renderEncoder)
+            renderEncoder.popDebugGroup()
+            return
+        }
+        
         var drawCallGroupIndex: Int32 = 0
         var drawCallIndex: Int32 = 0
         var baseIndex = 0
@@ -770,7 +730,7 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
                     continue
                 }
                 
-                drawCall.prepareDrawCall(withRenderPass: renderPass)
+                drawCall.prepareDrawCall(withRenderPass: renderPass, qualityLevel: Int(drawCallGroup.qualityLevel.rawValue))
                 
                 if renderPass.usesGeometry {
                     // Set the offset index of the draw call into the argument buffer
@@ -835,7 +795,8 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
     private var shaderPreferenceByUUID = [UUID: ShaderPreference]()
     private var environmentTextureByUUID = [UUID: MTLTexture]()
     private var geometryCountByUUID = [UUID: Int]()
-    private var jointMapsByUUID = [UUID: [Int]]()
+    // Resolved once per tracked skeleton definition and model skeleton. See `SkeletonRetargeter`
+    private var skeletonRetargetersByUUID = [UUID: SkeletonRetargeter]()
     private var ambientIntensity: Float?
     private var ambientLightColor: SIMD3<Float>?
     private var unanchoredUniformBuffer: MTLBuffer?
@@ -877,6 +838,112 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
     // number of frames in the target animation by index
     private var targetAnimationFrameCount = [Int]()
     
+    // Loads the model asset for each of the `someGeometricEntities`. `didLoad` is called after each one and should return `true` once everything the caller is waiting on has loaded.
+    private func loadModelAssets(for someGeometricEntities: [AKGeometricEntity], fromModelProvider modelProvider: ModelProvider, completion: (() -> Void), didLoad: (() -> Bool)) {
+        
+        for geometricEntity in someGeometricEntities {
+            
+            if let identifier = geometricEntity.identifier {
+                modelProvider.loadAsset(forObjectType:  type(of: geometricEntity).type, identifier: identifier) { [weak self] asset in
+                    
+                    guard let asset = asset else {
+                        print("Warning (UnanchoredRenderModule) - Failed to get a MDLAsset for type \"\(type(of: geometricEntity).type)\") with identifier \(identifier) from the modelProvider. Aborting the render phase.")
+                        let newError = AKError.warning(.modelError(.modelNotFound(ModelErrorInfo(type:  type(of: geometricEntity).type, identifier: identifier))))
+                        self?.recordNewError(newError)
+                        completion()
+                        return
+                    }
+                    
+                    self?.modelAssetsByUUID[identifier] = asset
+                    self?.shaderPreferenceByUUID[identifier] = geometricEntity.shaderPreference
+                }
+            }
+            
+            if didLoad() {
+                completion()
+            }
+            
+        }
+        
+    }
+    
+    // Creates a `DrawCallGroup` for each of the `someGeometricEntities` that has a model asset
+    private func loadDrawCallGroups(for someGeometricEntities: [AKGeometricEntity], moduleEntities: [AKEntity], metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, modelManager: ModelManager, renderPass: RenderPass?, numQualityLevels: Int, completion: (([DrawCallGroup]) -> Void)?) {
+        
+        var drawCallGroups = [DrawCallGroup]()
+        
+        let filteredGeometryUUIDs = someGeometricEntities.compactMap({$0.identifier})
+        let filteredModelsByUUID = modelAssetsByUUID.filter { (uuid, asset) in
+            filteredGeometryUUIDs.contains(uuid)
+        }
+        
+        let realBodies: [RealBody] = moduleEntities.compactMap { entity in
+            if let aBody = entity as? RealBody {
+                return aBody
+            } else {
+                return nil
+            }
+        }
+        
+        let total = filteredModelsByUUID.count
+        var count = 0
+        
+        guard total > 0 else {
+            completion?([])
+            return
+        }
+        
+        for item in filteredModelsByUUID {
+            
+            guard let geometricEntity = someGeometricEntities.first(where: {$0.identifier == item.key}) else {
+                continue
+            }
+            
+            let uuid = item.key
+            
+            let realBody = realBodies.first(where: { entity in
+                entity.identifier == uuid
+            })
+            
+            // Ignore any RealBody entities that aren't anchored to ARBodyAnchors
+            if realBody?.isAnchored == false {
+                continue
+            }
+            
+            let mdlAsset = item.value
+            let shaderPreference: ShaderPreference = {
+                if let prefernece = shaderPreferenceByUUID[uuid] {
+                    return prefernece
+                } else {
+                    return .pbr
+                }
+            }()
+            
+            // TODO: Joint Layout - , jointLayout: realBody?.jointNames\
+            modelManager.meshGPUData(for: mdlAsset, shaderPreference: shaderPreference) { [weak self] (meshGPUData, cacheKey) in
+                    
+                if let meshGPUData = meshGPUData, let drawCallGroup = self?.createDrawCallGroup(forUUID: uuid, withMetalLibrary: metalLibrary, renderDestination: renderDestination, renderPass: renderPass, meshGPUData: meshGPUData, geometricEntity: geometricEntity, numQualityLevels: numQualityLevels) {
+                    drawCallGroup.moduleIdentifier = UnanchoredRenderModule.identifier
+                    drawCallGroups.append(drawCallGroup)
+                    if let cacheKey = cacheKey {
+                        GPUResourceRegistry.shared.associate(entity: uuid, withAsset: cacheKey)
+                    }
+                }
+                
+                count += 1
+                if count == total {
+                    // In the buffer, the anchors are layed out by UUID in sorted order. So if there are
+                    // 5 anchors with UUID = "A..." and 3 UUIDs = "B..." and 1 UUID = "C..." then that's
+                    // how they will layed out in memory. Therefore updating the buffers is a 2 step process.
+                    // First, loop through all of the ARAnchors and gather the UUIDs as well as the counts for each.
+                    // Second, layout and update the buffers in the desired order.
+                    drawCallGroups.sort { $0.uuid.uuidString < $1.uuid.uuidString }
+                    completion?(drawCallGroups)
+                }
+            }
+        }
+    }
+    
     private func createDrawCallGroup(forUUID uuid: UUID, withMetalLibrary metalLibrary: MTLLibrary, renderDestination: RenderDestinationProvider, renderPass: RenderPass?, meshGPUData: MeshGPUData, geometricEntity: AKGeometricEntity, numQualityLevels: Int) -> DrawCallGroup {
         
         guard let renderPass = renderPass else {
@@ -922,26 +989,6 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
         
     }
     
-    private func generateJointMap(from body: AKBody, to skeleton: SkeletonData) -> [Int]? {
-        let fromJointNames = body.jointNames
-        let toJointName = skeleton.jointNames
-        guard fromJointNames.count >= toJointName.count else {
-            print("WARNING: Cannot map joints from the AKBody to the SkeletonData because the joints in the AKBody are not a superset of the joints in SkeletonData")
-            return nil
-        }
-        var map = [Int]()
-        for name in toJointName {
-            if let fromIndex = fromJointNames.firstIndex(of: name) {
-                map.append(fromIndex)
-            }
-        }
-        guard map.count == toJointName.count else {
-            print("WARNING: Cannot map joints from the AKBody to the SkeletonData because the joints in the AKBody are not a superset of the joints in SkeletonData")
-            return nil
-        }
-        return map
-    }
-    
     private func updateSkeletonAnimation(from drawData: DrawData, frameNumber: UInt, frameRate: Double = 60) {
         
         let capacity = Constants.alignedJointTransform * Constants.maxJointCount
@@ -959,18 +1006,31 @@ class UnanchoredRenderModule: RenderModule, SkinningModule {
         }
     }
     
-    private func updateTrackedSkeleton(from drawData: DrawData, body: AKBody, jointMap: [Int]? = nil) {
+    private func updateTrackedSkeleton(from drawData: DrawData, body: AKBody, uuid: UUID) {
+        
+        guard let skeleton = drawData.skeleton else {
+            return
+        }
         
         let capacity = Constants.alignedJointTransform * Constants.maxJointCount
         let boundJointTransformData = jointTransformBufferAddress?.bindMemory(to: matrix_float4x4.self, capacity: capacity)
         let jointTransformData = UnsafeMutableBufferPointer<matrix_float4x4>(start: boundJointTransformData, count: Constants.maxJointCount)
         
-        if let skeleton = drawData.skeleton {
-            let jointTransforms = evaluateJointTransforms(skeletonData: skeleton, jointModelTransforms: body.jointTransforms, jointMap: jointMap)
-            for k in 0..<jointTransforms.count {
-                jointTransformData[k] = jointTransforms[k]
+        // The joint names of a body are only replaced when its skeleton definition changes, so this comparison is usually between two references to the same array
+        let retargeter: SkeletonRetargeter = {
+            if let existingRetargeter = skeletonRetargetersByUUID[uuid], existingRetargeter.sourceJointNames == body.jointNames, existingRetargeter.jointCount == skeleton.jointCount {
+                return existingRetargeter
             }
-        }
+            let newRetargeter = SkeletonRetargeter(sourceJointNames: body.jointNames, skeleton: skeleton)
+            if newRetargeter.mappedJointCount == 0 {
+                print("Warning (UnanchoredRenderModule) - None of the joints of the model's skeleton match a tracked joint. The model will follow the root of the body only.")
+            }
+            skeletonRetargetersByUUID[uuid] = newRetargeter
+            return newRetargeter
+        }()
+        
+        retargeter.evaluate(jointTransforms: body.jointTransforms, referenceJointTransforms: body.referenceJointTransforms, into: jointTransformData)
+        
     }
     
 }
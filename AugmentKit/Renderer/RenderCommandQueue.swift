@@ -0,0 +1,100 @@
+//
+//  RenderCommandQueue.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import ARKit
+import os
+
+// MARK: - RenderCommand
+
+/// A change to the set of objects being rendered. Commands are recorded by whatever thread calls into the `Renderer` and are applied, in order, on the render thread at the start of the next frame.
+enum RenderCommand {
+    /// Start tracking `entity` in the bucket belonging to the render module with the identifier `moduleIdentifier`
+    case add(entity: AKEntity, moduleIdentifier: String)
+    /// Stop tracking `entity` in the bucket belonging to the render module with the identifier `moduleIdentifier`
+    case remove(entity: AKEntity, moduleIdentifier: String)
+    /// Forwarded from `ARSessionDelegate.session(_:didAdd:)`
+    case sessionDidAdd(anchors: [ARAnchor])
+    /// Forwarded from `ARSessionDelegate.session(_:didUpdate:)`
+    case sessionDidUpdate(anchors: [ARAnchor])
+    /// Forwarded from `ARSessionDelegate.session(_:didRemove:)`
+    case sessionDidRemove(anchors: [ARAnchor])
+    /// The shadow pass `DrawCallGroup`s finished loading for entities that were added incrementally. Starts loading the main pass `DrawCallGroup`s for the same entities.
+    case loadMainPassDrawCallGroups(identifiers: [UUID], moduleIdentifier: String, shadowPass: [DrawCallGroup])
+    /// `DrawCallGroup`s that finished loading for entities that were added incrementally
+    case addDrawCallGroups(shadowPass: [DrawCallGroup], mainPass: [DrawCallGroup])
+}
+
+// MARK: - RenderCommandQueue
+
+/// A multiple producer / single consumer queue.
+///
+/// Any number of threads may call `enqueue(_:)` concurrently. Only one thread (the render thread) may call `drain()`. Commands are appended to an array guarded by an `os_unfair_lock`. The consumer swaps the whole array out under the lock and returns the commands in the order they were enqueued, which lets the renderer apply a whole burst of changes as one batch. The lock is only held for an append or a swap so contention stays negligible at the rate entities and anchors change.
+final class RenderCommandQueue<Command> {
+    
+    init() {
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+    
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+    
+    /// `true` if there are no commands waiting to be drained. Only meaningful as a hint when called from a producer thread.
+    var isEmpty: Bool {
+        os_unfair_lock_lock(lock)
+        defer {
+            os_unfair_lock_unlock(lock)
+        }
+        return pendingCommands.isEmpty
+    }
+    
+    /// Records a command. Safe to call from any thread.
+    func enqueue(_ command: Command) {
+        os_unfair_lock_lock(lock)
+        pendingCommands.append(command)
+        os_unfair_lock_unlock(lock)
+    }
+    
+    /// Removes and returns all of the pending commands in FIFO order. Must only be called from the consumer thread.
+    func drain() -> [Command] {
+        var commands = [Command]()
+        os_unfair_lock_lock(lock)
+        swap(&commands, &pendingCommands)
+        os_unfair_lock_unlock(lock)
+        return commands
+    }
+    
+    // MARK: - Private
+    
+    // The address of an `os_unfair_lock` must not change, so it is allocated rather than stored inline
+    fileprivate let lock: UnsafeMutablePointer<os_unfair_lock>
+    fileprivate var pendingCommands = [Command]()
+
+}
@@ -70,32 +70,6 @@ class RenderUtilities {
         }
     }
     
-    /// Determine the quality level we want given the model's distance from the camera, Also, when close to a the bounds of a quality level, calculate a weight to transition between the two quality levels
-    /// - Parameter distance: Distance in meters from the camera. Can not be negative
-    /// - Returns: A `QualityLevel`
-    static func getQualityLevel(for distance: Float) -> QualityLevel {
-        
-        guard AKCapabilities.LevelOfDetail else {
-            return kQualityLevelHigh
-        }
-        
-        guard distance > 0 else {
-            return kQualityLevelHigh
-        }
-        
-        // In meters
-        let MediumQualityDepth: Float = 15
-        let LowQualityDepth: Float = 65
-        
-        if distance < MediumQualityDepth {
-            return kQualityLevelHigh
-        } else if distance < LowQualityDepth {
-            return kQualityLevelMedium
-        } else {
-            return kQualityLevelLow
-        }
-    }
-    
     static func getFuncConstants(forDrawData drawData: DrawData?, qualityLevel: QualityLevel = kQualityLevelHigh) -> MTLFunctionConstantValues {
         
         var has_base_color_map = false
@@ -112,6 +86,8 @@ class RenderUtilities {
         var has_sheenTint_map = false
         var has_clearcoat_map = false
         var has_clearcoatGloss_map = false
+        // The lower quality levels shade in half precision. See `illuminate` in MainShaders.metal
+        var has_half_precision_shading = qualityLevel != kQualityLevelHigh
         
         if let drawData = drawData {
             has_base_color_map = drawData.hasBaseColorMap && hasTexture(for: kTextureIndexColor, qualityLevel: qualityLevel)
@@ -145,6 +121,7 @@ class RenderUtilities {
         constantValues.setConstantValue(&has_sheenTint_map, type: .bool, index: Int(kFunctionConstantSheenTintMapIndex.rawValue))
         constantValues.setConstantValue(&has_clearcoat_map, type: .bool, index: Int(kFunctionConstantClearcoatMapIndex.rawValue))
         constantValues.setConstantValue(&has_clearcoatGloss_map, type: .bool, index: Int(kFunctionConstantClearcoatGlossMapIndex.rawValue))
+        constantValues.setConstantValue(&has_half_precision_shading, type: .bool, index: Int(kFunctionConstantHalfPrecisionShadingIndex.rawValue))
         
         return constantValues
     }
@@ -118,6 +118,10 @@ public struct RenderStats {
      The total number of `AKPathSegmentAnchor`'s rendered
      */
     public var numPathSegments: Int
+    /**
+     The GPU memory used by buffers and textures at the end of the frame, broken down by category and owner. See `GPUResourceRegistry`
+     */
+    public var gpuMemory: GPUMemorySnapshot
 }
 
 // MARK: - RenderOptions
@@ -281,6 +285,18 @@ public struct EnvironmentProperties {
      The Model View Projection matrix of the primary light
      */
     var directionalLightMVP: float4x4 = matrix_identity_float4x4
+    /**
+     The intensity of the ambient light. Derived from the captured camera frame when `AKCapabilities.CameraExposure` is enabled, otherwise from `lightEstimate`. Smoothed over time.
+     */
+    var ambientLightIntensity: Float = 1
+    /**
+     The color of the ambient light. Derived from the captured camera frame when `AKCapabilities.CameraExposure` is enabled, otherwise from `lightEstimate`. Smoothed over time.
+     */
+    var ambientLightColor: SIMD3<Float> = SIMD3<Float>(0.5, 0.5, 0.5)
+    /**
+     The exposure that maps the scene to display brightness. The inverse of `ambientLightIntensity`.
+     */
+    var exposure: Float = 1
 }
 
 // MARK: - ShadowProperties
@@ -292,6 +308,10 @@ public struct ShadowProperties {
      Texture for the shadow depth map
      */
     var shadowMap: MTLTexture?
+    /**
+     The filtered, quantized depth moments of the shadow map. `nil` when filtered shadows are not available, in which case `shadowMap` should be sampled directly. See `ShadowMomentFilter`
+     */
+    var shadowMoments: MTLTexture?
     /**
      The `directionalLightMVP` with flipped y/t coordinate and converted from the [-1, 1] range of clip coordinates to [0, 1] range. used for texture sampling the shadow map.
      */
@@ -376,6 +396,10 @@ open class Renderer: NSObject {
          Used for Level Of Detail calculations to determaile the number of quality levels to set up. Quality levels requires `AKCapabilities.LevelOfDetail == true`
          */
         static let numQualityLevels = 3
+        /**
+         The pixel format of the offscreen scene color target. Virtual content is rendered as linear HDR color and tone mapped to the display format in the composite pass.
+         */
+        static let sceneColorPixelFormat: MTLPixelFormat = .rgba16Float
     }
     /**
      State of the renderer
@@ -595,6 +619,54 @@ open class Renderer: NSObject {
         }
         
     }
+    /**
+     The closest virtual content intersected by the device's gaze, a ray from the camera along the direction it is facing. Where `currentGazeTransform` only considers detected surfaces, this tests the triangles of every rendered anchor, tracker, target and path. Gaze targets are ignored. Returns `nil` if nothing is hit.
+     */
+    public var currentGazeVirtualContentHit: VirtualContentHit? {
+        
+        guard let cameraTransform = session.currentFrame?.camera.transform else {
+            return nil
+        }
+        
+        // The camera looks along its negative z axis
+        return virtualContentIndex.hitTest(origin: cameraTransform.columns.3.xyz, direction: -cameraTransform.columns.2.xyz)
+        
+    }
+    /**
+     Returns the closest virtual content intersected by a ray. The content is tested as it was placed for the most recently rendered frame.
+     - Parameters:
+        - origin: The origin of the ray in world space
+        - direction: The direction of the ray in world space. Does not need to be normalized.
+        - maxDistance: Hits further than this many meters are ignored
+        - excludesGazeTargets: When `true`, gaze targets are ignored
+     - Returns: The closest hit or `nil` if nothing is hit
+     */
+    public func hitTestVirtualContent(origin: SIMD3<Float>, direction: SIMD3<Float>, maxDistance: Float = Float.greatestFiniteMagnitude, excludesGazeTargets: Bool = true) -> VirtualContentHit? {
+        return virtualContentIndex.hitTest(origin: origin, direction: direction, maxDistance: maxDistance, excludesGazeTargets: excludesGazeTargets)
+    }
+    /**
+     Returns the identifiers of the virtual content that has any triangle within a sphere
+     - Parameters:
+        - center: The center of the sphere in world space
+        - radius: The radius of the sphere in meters
+     */
+    public func virtualContent(intersectingSphereWithCenter center: SIMD3<Float>, radius: Float) -> [UUID] {
+        return virtualContentIndex.identifiers(intersectingSphereWithCenter: center, radius: radius)
+    }
+    /**
+     Returns the identifiers of the virtual content whose bounds intersect a view frustum
+     - Parameters:
+        - viewProjectionMatrix: A view projection matrix with a clip space depth range of 0 to 1
+     */
+    public func virtualContent(inFrustumOf viewProjectionMatrix: matrix_float4x4) -> [UUID] {
+        return virtualContentIndex.identifiers(inFrustumOf: viewProjectionMatrix)
+    }
+    /**
+     Tracks the GPU memory used for rendering. Use it to set memory budgets and to be notified when they are exceeded. A snapshot is reported every frame in `RenderStats.gpuMemory`.
+     */
+    public var gpuResources: GPUResourceRegistry {
+        return GPUResourceRegistry.shared
+    }
     /**
      Initialize the renderer with an `ARSession`, a `MTLDevice`, a `RenderDestinationProvider`, and a `Bundle`
      - Parameters:
@@ -711,6 +783,12 @@ open class Renderer: NSObject {
         
         lastFrameTime = currentFrame.timestamp
         
+        //
+        // Apply changes that were recorded since the last frame
+        //
+        
+        applyPendingCommands()
+        
         hasDetectedSurfaces = hasDetectedSurfaces || (groundPlaneAnchor != nil) || (realAnchors.count > 0)
         
         // Update current camera position and heading
@@ -811,6 +889,9 @@ open class Renderer: NSObject {
         // Update positions
         //
         
+        // Entity state is only written and captured while holding `entityLock` so that changes made with `performEntityUpdates(_:)` on another thread are seen whole or not at all
+        entityLock.lock()
+        
         // Calculate updates to trackers relative position
         let cameraPositionTransform = currentCameraPositionTransform ?? matrix_identity_float4x4
         let cameraRelativePosition = AKRelativePosition(withTransform: cameraPositionTransform)
@@ -822,11 +903,9 @@ open class Renderer: NSObject {
         trackers.forEach {
             if let userTracker = $0 as? AKAugmentedUserTracker {
                 userTracker.userPosition()?.transform = cameraPositionTransform
-                userTracker.position.updateTransforms()
-            } else {
-                $0.position.updateTransforms()
             }
         }
+        positionHierarchy.update(trackers.map({$0.position}))
         
         //
         // Update Gaze Targets
@@ -841,8 +920,8 @@ open class Renderer: NSObject {
             if gazeTransform != matrix_identity_float4x4 {
                 gazeTargets.forEach {
                     $0.position.parentPosition?.transform = gazeTransform
-                    $0.position.updateTransforms()
                 }
+                gazeTargetPositionHierarchy.update(gazeTargets.map({$0.position}))
             }
             
         }
@@ -858,9 +937,19 @@ open class Renderer: NSObject {
                 return nil
             }
         }
-        allAKAnchors.forEach {
-            $0.heading.updateHeading(withPosition: cameraRelativePosition)
+        headingResolver.updateHeadings(of: allAKAnchors, withPosition: cameraRelativePosition)
+        
+        //
+        // Entity State Snapshot
+        //
+        
+        // Capture the state of every entity once, now that headings and positions are up to date. Everything that prepares data for this frame reads from the snapshot instead of the live entities.
+        let allEntities: [AKEntity] = entitiesForRenderModule.flatMap { (key, value) in
+            return value
         }
+        entityStates.rebuild(from: flattenedGeometricEntities(from: allEntities), frameNumber: currentFrameNumber, time: Double(currentFrameNumber) / frameRate)
+        
+        entityLock.unlock()
         
         //
         // Camera Properties
@@ -902,6 +991,7 @@ open class Renderer: NSObject {
         
         var shadowProperties = ShadowProperties()
         shadowProperties.shadowMap = shadowMap
+        shadowProperties.shadowMoments = shadowMomentFilter?.texture
         let shadowScale = matrix_identity_float4x4.scale(x: 0.5, y: -0.5, z: 1)
         let shadowTranslate = matrix_identity_float4x4.translate(x: 0.5, y: 0.5, z: 0)
         let shadowTransform = shadowTranslate * shadowScale
@@ -921,6 +1011,16 @@ open class Renderer: NSObject {
         let _ = inFlightSemaphore.wait(timeout: DispatchTime.distantFuture)
         uniformBufferIndex = (uniformBufferIndex + 1) % Constants.maxInFlightFrames
         
+        // The frame that last used this buffer index has completed so its camera statistics can be read without stalling
+        if let histogram = cameraLuminanceReduction?.completedHistogram(forBufferIndex: uniformBufferIndex) {
+            exposureAdaptation.update(with: histogram, timestamp: currentFrame.timestamp)
+        } else if let lightEstimate = currentFrame.lightEstimate {
+            exposureAdaptation.update(withAmbientIntensity: Float(lightEstimate.ambientIntensity) / 1000.0, ambientLightColor: CameraExposureAdaptation.rgb(fromColorTemperature: Float(lightEstimate.ambientColorTemperature)), timestamp: currentFrame.timestamp)
+        }
+        environmentProperties.ambientLightIntensity = exposureAdaptation.ambientLightIntensity
+        environmentProperties.ambientLightColor = exposureAdaptation.ambientLightColor
+        environmentProperties.exposure = exposureAdaptation.exposure
+        
         // Update Buffer States
         renderModules.forEach { module in
             if module.state == .ready {
@@ -933,6 +1033,11 @@ open class Renderer: NSObject {
             }
         }
         
+        // Move the virtual content that can be hit tested to where it will be drawn this frame
+        if let mainRenderPass = mainRenderPass {
+            virtualContentIndex.update(drawCallGroups: mainRenderPass.drawCallGroups, entityStates: entityStates, frameNumber: currentFrameNumber, gazeTargetIdentifiers: Set(gazeTargets.compactMap({$0.identifier})))
+        }
+        
         captureScope?.begin()
         
         // Create a new command buffer to process the IBL pre-render if necessary
@@ -956,6 +1061,7 @@ open class Renderer: NSObject {
 
                 computeCommandBuffer.commit()
                 hasEnvironmentTextureChanged = false
+                environmentCapture?.didRefreshLighting(atFrame: currentFrameNumber)
 
             }
         }
@@ -982,7 +1088,7 @@ open class Renderer: NSObject {
             // Prepare compute passses that require knowledge of the main render pass (i.e. the precalculation pass that requires knowledge of the objects that will be rendered in the main pass)
             //
             
-            prepareToDraw(forCameraProperties: cameraProperties, environmentProperties: environmentProperties, shadowProperties: shadowProperties, renderPass: mainRenderPass)
+            prepareToDraw(withEntityStates: entityStates, cameraProperties: cameraProperties, environmentProperties: environmentProperties, shadowProperties: shadowProperties, renderPass: mainRenderPass)
             
             //
             // Dispatch Compute Passes
@@ -996,9 +1102,14 @@ open class Renderer: NSObject {
             
             if let shadowRenderPass = shadowRenderPass {
                 
+                shadowRenderPass.shadowCasterInstanceTable?.reset(forBufferIndex: uniformBufferIndex)
+                
                 // Update Buffers
                 updateBuffers(forCameraProperties: cameraProperties, environmentProperties: environmentProperties, shadowProperties: shadowProperties, argumentBufferProperties: argumentBufferProperties, renderPass: shadowRenderPass)
                 
+                // Cull
+                encodeCulling(forRenderPass: shadowRenderPass, commandBuffer: commandBuffer)
+                
                 // Draw
                 shadowRenderPass.prepareCommandEncoder(withCommandBuffer: commandBuffer)
                 if let shadowRenderEncoder = shadowRenderPass.renderCommandEncoder {
@@ -1009,6 +1120,11 @@ open class Renderer: NSObject {
                 
                 renderPasses.append(shadowRenderPass)
                 
+                // Prefilter the shadow map for the passes that sample it
+                if let shadowMap = shadowMap {
+                    shadowMomentFilter?.encode(shadowMap: shadowMap, commandBuffer: commandBuffer)
+                }
+                
             }
             
             //
@@ -1020,6 +1136,9 @@ open class Renderer: NSObject {
                 // Update Buffers
                 updateBuffers(forCameraProperties: cameraProperties, environmentProperties: environmentProperties, shadowProperties: shadowProperties, argumentBufferProperties: argumentBufferProperties, renderPass: mainRenderPass)
                 
+                // Cull
+                encodeCulling(forRenderPass: mainRenderPass, commandBuffer: commandBuffer)
+                
                 // Getting the currentRenderPassDescriptor from the RenderDestinationProvider should be called as
                 // close as possible to presenting it with the command buffer. The currentDrawable is
                 // a scarce resource and holding on to it too long may affect performance
@@ -1063,6 +1182,12 @@ open class Renderer: NSObject {
                         
                     }
 
+                    // Build the depth pyramid from the depth of this frame. It is used to cull the next one.
+                    if let depthPyramid = depthPyramid, let sceneDepthTexture = sceneDepthTexture, let sharedUniforms = sharedUniformsBuffer?.currentBufferInstancePointer()?.pointee {
+                        let usesRealDepth = sharedUniforms.useDepth != 0
+                        depthPyramid.encode(sceneDepthTexture: sceneDepthTexture, alphaTexture: usesRealDepth ? alphaTexture : nil, dilatedDepthTexture: usesRealDepth ? dilatedDepthTexture : nil, viewMatrix: sharedUniforms.viewMatrix, projectionMatrix: sharedUniforms.projectionMatrix, displayTransform: cameraProperties.displayTransform, commandBuffer: commandBuffer)
+                    }
+                    
                     // Schedule a present once the framebuffer is complete using the current drawable
                     commandBuffer.present(currentDrawable)
 
@@ -1071,6 +1196,28 @@ open class Renderer: NSObject {
                 renderPasses.append(mainRenderPass)
             }
             
+            //
+            // Environment Capture
+            //
+            
+            // The camera textures for this frame are available once the render passes have updated their buffers. The IBL maps are refreshed from the capture at the start of a later frame.
+            if AKCapabilities.ImageBasedLighting, let environmentCapture = environmentCapture, let textureY = cameraRenderModule?.capturedImageTextureY, let textureCbCr = cameraRenderModule?.capturedImageTextureCbCr, let metalTextureY = CVMetalTextureGetTexture(textureY), let metalTextureCbCr = CVMetalTextureGetTexture(textureCbCr) {
+                environmentCapture.capture(from: currentFrame, textureY: metalTextureY, textureCbCr: metalTextureCbCr, bufferIndex: uniformBufferIndex, frameNumber: currentFrameNumber, commandBuffer: commandBuffer)
+                if environmentCapture.needsLightingRefresh {
+                    environmentTexture = environmentCapture.environmentTexture
+                    hasEnvironmentTextureChanged = true
+                }
+            }
+            
+            //
+            // Camera Luminance
+            //
+            
+            // The statistics are read back when this buffer index comes around again
+            if let cameraLuminanceReduction = cameraLuminanceReduction, let textureY = cameraRenderModule?.capturedImageTextureY, let textureCbCr = cameraRenderModule?.capturedImageTextureCbCr, let metalTextureY = CVMetalTextureGetTexture(textureY), let metalTextureCbCr = CVMetalTextureGetTexture(textureCbCr) {
+                cameraLuminanceReduction.encode(textureY: metalTextureY, textureCbCr: metalTextureCbCr, bufferIndex: uniformBufferIndex, commandBuffer: commandBuffer)
+            }
+            
             //
             // Setup Bloom Downsample pass
             //
@@ -1116,13 +1263,16 @@ open class Renderer: NSObject {
         }
         monitor?.update(renderErrors: errors)
         
-        let stats = RenderStats(arKitAnchorCount: currentFrame.anchors.count, numAnchors: anchorsRenderModule?.anchorInstanceCount ?? 0, numPlanes: surfacesRenderModule?.instanceCount ?? 0, numTrackingPoints: trackingPointRenderModule?.trackingPointCount ?? 0, numTrackers: unanchoredRenderModule?.trackerInstanceCount ?? 0, numTargets: unanchoredRenderModule?.targetInstanceCount ?? 0, numPathSegments: pathsRenderModule?.pathSegmentInstanceCount ?? 0)
+        let stats = RenderStats(arKitAnchorCount: currentFrame.anchors.count, numAnchors: anchorsRenderModule?.anchorInstanceCount ?? 0, numPlanes: surfacesRenderModule?.instanceCount ?? 0, numTrackingPoints: trackingPointRenderModule?.trackingPointCount ?? 0, numTrackers: unanchoredRenderModule?.trackerInstanceCount ?? 0, numTargets: unanchoredRenderModule?.targetInstanceCount ?? 0, numPathSegments: pathsRenderModule?.pathSegmentInstanceCount ?? 0, gpuMemory: gpuResources.snapshot(frameNumber: currentFrameNumber, device: device))
         monitor?.update(renderStats: stats)
         
     }
     
     // MARK: - Adding objects for render
     
+    // The add and remove methods may be called from any thread. Changes to the objects being
+    // rendered are recorded in `pendingCommands` and applied at the start of the next `update()`
+    
     /**
      Add a new AKAugmentedAnchor to the AR world. Requires a `.worldTracking` or `.worldTrackingWithFaceDetection` `sessionType`.
      - Parameters:
@@ -1146,15 +1296,7 @@ open class Renderer: NSObject {
         
         // Keep track of the anchor bucketed by the RenderModule
         // This will be used to load individual models per anchor.
-        if let existingGeometries = entitiesForRenderModule[AnchorsRenderModule.identifier] {
-            var mutableExistingGeometries = existingGeometries
-            mutableExistingGeometries.append(akAnchor)
-            entitiesForRenderModule[AnchorsRenderModule.identifier] = mutableExistingGeometries
-            anchorsRenderModule?.state = .uninitialized
-            hasUninitializedModules = true
-        } else {
-            entitiesForRenderModule[AnchorsRenderModule.identifier] = [akAnchor]
-        }
+        pendingCommands.enqueue(.add(entity: akAnchor, moduleIdentifier: AnchorsRenderModule.identifier))
         
         // Add a new anchor to the session
         session.add(anchor: arAnchor)
@@ -1184,15 +1326,7 @@ open class Renderer: NSObject {
         
         // Keep track of the tracker bucketed by the RenderModule
         // This will be used to load individual models per anchor.
-        if let existingGeometries = entitiesForRenderModule[UnanchoredRenderModule.identifier] {
-            var mutableExistingGeometries = existingGeometries
-            mutableExistingGeometries.append(akTracker)
-            entitiesForRenderModule[UnanchoredRenderModule.identifier] = mutableExistingGeometries
-            unanchoredRenderModule?.state = .uninitialized
-            hasUninitializedModules = true
-        } else {
-            entitiesForRenderModule[UnanchoredRenderModule.identifier] = [akTracker]
-        }
+        pendingCommands.enqueue(.add(entity: akTracker, moduleIdentifier: UnanchoredRenderModule.identifier))
         
     }
     
@@ -1230,15 +1364,7 @@ open class Renderer: NSObject {
         }
         
         // Keep track of the path bucketed by the RenderModule
-        if let existingGeometries = entitiesForRenderModule[PathsRenderModule.identifier] {
-            var mutableExistingGeometries = existingGeometries
-            mutableExistingGeometries.append(akPath)
-            entitiesForRenderModule[PathsRenderModule.identifier] = mutableExistingGeometries
-        } else {
-            entitiesForRenderModule[PathsRenderModule.identifier] = [akPath]
-        }
-        
-        paths.append(akPath)
+        pendingCommands.enqueue(.add(entity: akPath, moduleIdentifier: PathsRenderModule.identifier))
         
     }
     
@@ -1264,15 +1390,7 @@ open class Renderer: NSObject {
         
         // Keep track of the tracker bucketed by the RenderModule
         // This will be used to load individual models per anchor.
-        if let existingGeometries = entitiesForRenderModule[UnanchoredRenderModule.identifier] {
-            var mutableExistingGeometries = existingGeometries
-            mutableExistingGeometries.append(gazeTarget)
-            entitiesForRenderModule[UnanchoredRenderModule.identifier] = mutableExistingGeometries
-            unanchoredRenderModule?.state = .uninitialized
-            hasUninitializedModules = true
-        } else {
-            entitiesForRenderModule[UnanchoredRenderModule.identifier] = [gazeTarget]
-        }
+        pendingCommands.enqueue(.add(entity: gazeTarget, moduleIdentifier: UnanchoredRenderModule.identifier))
         
     }
     
@@ -1299,18 +1417,25 @@ open class Renderer: NSObject {
         
         // Keep track of the tracker bucketed by the RenderModule
         // This will be used to load individual models per anchor.
-        if let existingGeometries = entitiesForRenderModule[UnanchoredRenderModule.identifier] {
-            var mutableExistingGeometries = existingGeometries
-            mutableExistingGeometries.append(trackedBody)
-            entitiesForRenderModule[UnanchoredRenderModule.identifier] = mutableExistingGeometries
-            unanchoredRenderModule?.state = .uninitialized
-            hasUninitializedModules = true
-        } else {
-            entitiesForRenderModule[UnanchoredRenderModule.identifier] = [trackedBody]
-        }
+        pendingCommands.enqueue(.add(entity: trackedBody, moduleIdentifier: UnanchoredRenderModule.identifier))
         
     }
     
+    // MARK: - Updating objects
+    
+    /**
+     Runs `updates` while holding the lock that the renderer captures entity state under. When changing the location, heading or effects of entities that have already been added from a thread other than the one that calls `update()`, make the changes inside `updates` so that a frame never sees an entity that is only partly updated.
+     - Parameters:
+        - updates: Changes to the entities being rendered
+     */
+    public func performEntityUpdates(_ updates: () -> Void) {
+        entityLock.lock()
+        defer {
+            entityLock.unlock()
+        }
+        updates()
+    }
+    
     // MARK: - Removing objects
     
     /**
@@ -1320,24 +1445,14 @@ open class Renderer: NSObject {
      */
     public func remove(akAnchor: AKAugmentedAnchor) {
         
-        if let uuid = akAnchor.identifier {
-            freeTextureMemory(for: [uuid])
-        }
-        
         let anchorType = type(of: akAnchor).type
         modelProvider?.unregisterAsset(forObjectType: anchorType, identifier: akAnchor.identifier)
-        var existingGeometries = entitiesForRenderModule[AnchorsRenderModule.identifier]
-        if let index = existingGeometries?.firstIndex(where: {$0.identifier == akAnchor.identifier}) {
-            existingGeometries?.remove(at: index)
-        }
-        entitiesForRenderModule[AnchorsRenderModule.identifier] = existingGeometries
+        pendingCommands.enqueue(.remove(entity: akAnchor, moduleIdentifier: AnchorsRenderModule.identifier))
         
         guard let arAnchor = session.currentFrame?.anchors.first(where: {$0.identifier == akAnchor.identifier}) else {
             return
         }
         
-        modelManager.clearCache(asset: akAnchor.asset)
-        
         session.remove(anchor: arAnchor)
     }
     /**
@@ -1347,22 +1462,9 @@ open class Renderer: NSObject {
      */
     public func remove(akTracker: AKAugmentedTracker) {
         
-        if let uuid = akTracker.identifier {
-            freeTextureMemory(for: [uuid])
-        }
-        
         let anchorType = type(of: akTracker).type
         modelProvider?.unregisterAsset(forObjectType: anchorType, identifier: akTracker.identifier)
-        var existingGeometries = entitiesForRenderModule[UnanchoredRenderModule.identifier]
-        if let index = existingGeometries?.firstIndex(where: {$0.identifier == akTracker.identifier}) {
-            existingGeometries?.remove(at: index)
-        }
-        entitiesForRenderModule[UnanchoredRenderModule.identifier] = existingGeometries
-        
-        unanchoredRenderModule?.state = .uninitialized
-        hasUninitializedModules = true
-        
-        modelManager.clearCache(asset: akTracker.asset)
+        pendingCommands.enqueue(.remove(entity: akTracker, moduleIdentifier: UnanchoredRenderModule.identifier))
     }
     /**
      Remove a new path to the AR world
@@ -1371,29 +1473,15 @@ open class Renderer: NSObject {
      */
     public func remove(akPath: AKPath) {
         
-        var uuids = [UUID]()
         akPath.segmentPoints.forEach { segment in
-            if let uuid = segment.identifier {
-                uuids.append(uuid)
-            }
             if let arAnchor = session.currentFrame?.anchors.first(where: {$0.identifier == segment.identifier}) {
                 session.remove(anchor: arAnchor)
             }
-            modelManager.clearCache(asset: segment.asset)
         }
-        if let uuid = akPath.identifier {
-            uuids.append(uuid)
-        }
-        
-        freeTextureMemory(for: uuids)
         
         let anchorType = type(of: akPath).type
         modelProvider?.unregisterAsset(forObjectType: anchorType, identifier: akPath.identifier)
-        var existingGeometries = entitiesForRenderModule[PathsRenderModule.identifier]
-        if let index = existingGeometries?.firstIndex(where: {$0.identifier == akPath.identifier}) {
-            existingGeometries?.remove(at: index)
-        }
-        entitiesForRenderModule[PathsRenderModule.identifier] = existingGeometries
+        pendingCommands.enqueue(.remove(entity: akPath, moduleIdentifier: PathsRenderModule.identifier))
     }
     
     /**
@@ -1403,22 +1491,9 @@ open class Renderer: NSObject {
      */
     public func remove(gazeTarget: GazeTarget) {
         
-        if let uuid = gazeTarget.identifier {
-            freeTextureMemory(for: [uuid])
-        }
-        
         let anchorType = type(of: gazeTarget).type
         modelProvider?.unregisterAsset(forObjectType: anchorType, identifier: gazeTarget.identifier)
-        var existingGeometries = entitiesForRenderModule[UnanchoredRenderModule.identifier]
-        if let index = existingGeometries?.firstIndex(where: {$0.identifier == gazeTarget.identifier}) {
-            existingGeometries?.remove(at: index)
-        }
-        entitiesForRenderModule[UnanchoredRenderModule.identifier] = existingGeometries
-        
-        unanchoredRenderModule?.state = .uninitialized
-        hasUninitializedModules = true
-        
-        modelManager.clearCache(asset: gazeTarget.asset)
+        pendingCommands.enqueue(.remove(entity: gazeTarget, moduleIdentifier: UnanchoredRenderModule.identifier))
     }
     
     /**
@@ -1428,30 +1503,29 @@ open class Renderer: NSObject {
      */
     public func remove(trackedbody: RealBody) {
         
-        if let uuid = trackedbody.identifier {
-            freeTextureMemory(for: [uuid])
-        }
-        
         let anchorType = type(of: trackedbody).type
         modelProvider?.unregisterAsset(forObjectType: anchorType, identifier: trackedbody.identifier)
-        var existingGeometries = entitiesForRenderModule[UnanchoredRenderModule.identifier]
-        if let index = existingGeometries?.firstIndex(where: {$0.identifier == trackedbody.identifier}) {
-            existingGeometries?.remove(at: index)
-        }
-        entitiesForRenderModule[UnanchoredRenderModule.identifier] = existingGeometries
-        
-        unanchoredRenderModule?.state = .uninitialized
-        hasUninitializedModules = true
-        
-        modelManager.clearCache(asset: trackedbody.asset)
+        pendingCommands.enqueue(.remove(entity: trackedbody, moduleIdentifier: UnanchoredRenderModule.identifier))
     }
     
     // MARK: - Private
     
     fileprivate var hasUninitializedModules = false
+    fileprivate let pendingCommands = RenderCommandQueue<RenderCommand>()
     fileprivate var renderDestination: RenderDestinationProvider
     fileprivate var matteGenerator: ARMatteGenerator
     fileprivate let inFlightSemaphore = DispatchSemaphore(value: Constants.maxInFlightFrames)
+    // Flattened position hierarchies used to update trackers and gaze targets in a single pass
+    fileprivate let positionHierarchy = AKRelativePositionHierarchy()
+    fileprivate let gazeTargetPositionHierarchy = AKRelativePositionHierarchy()
+    // Batches the look at headings of all anchors
+    fileprivate let headingResolver = HeadingResolver()
+    // Held while entity state is written by the renderer or by `performEntityUpdates(_:)`, and while it is captured into `entityStates`
+    fileprivate let entityLock = NSLock()
+    // The state of every entity for the frame being prepared. Modules copy what they need into their own buffers while preparing the frame, so a single snapshot is reused from frame to frame.
+    fileprivate var entityStates = EntityStateSnapshot()
+    // Acceleration structure for hit testing virtual content
+    fileprivate let virtualContentIndex = VirtualContentIndex()
     // This is the current frame number modulo `maxInFlightFrames`
     fileprivate var uniformBufferIndex: Int = 0
     fileprivate var worldInitiationTime: Double = 0
@@ -1472,6 +1546,10 @@ open class Renderer: NSObject {
     // Environment
     fileprivate var environmentTexture: GPUPassTexture?
     fileprivate var hasEnvironmentTextureChanged = false
+    fileprivate var environmentCapture: EnvironmentCapture?
+    fileprivate var cameraLuminanceReduction: CameraLuminanceReduction?
+    fileprivate var depthPyramid: DepthPyramid?
+    fileprivate var exposureAdaptation = CameraExposureAdaptation()
     
     // Shared Uniforms Buffer
     fileprivate var sharedUniformsBuffer: GPUPassBuffer<SharedUniforms>?
@@ -1507,6 +1585,7 @@ open class Renderer: NSObject {
     
     // Shadow Render Pass
     fileprivate var shadowMap: MTLTexture?
+    fileprivate var shadowMomentFilter: ShadowMomentFilter?
     fileprivate var shadowRenderPass: RenderPass?
     
     // Matting textures to be filled by ARMattingGenerator
@@ -1547,6 +1626,14 @@ open class Renderer: NSObject {
     
     fileprivate let modelManager: ModelManager
     
+    fileprivate var numQualityLevels: Int {
+        if AKCapabilities.LevelOfDetail {
+            return Constants.numQualityLevels
+        } else {
+            return 1
+        }
+    }
+    
     // MARK: ARKit Session Configuration
     
     fileprivate func createNewConfiguration() -> ARConfiguration {
@@ -1702,6 +1789,7 @@ open class Renderer: NSObject {
             diffuseIBLTextureDesc.usage = [.shaderRead, .shaderWrite]
             let diffuseIBLCube = device.makeTexture(descriptor: diffuseIBLTextureDesc)
             diffuseIBLCube?.label = "Diffuse IBL Cubemap"
+            GPUResourceRegistry.shared.register(diffuseIBLCube, category: .environmentMap, owner: .renderer)
             diffuseIBLCubeTexture = GPUPassTexture(texture: diffuseIBLCube, label: "Diffuse IBL Cubemap", shaderAttributeIndex: Int(kTextureIndexDiffuseIBLMap.rawValue))
             diffuseIBLCubePass?.outputTexture = diffuseIBLCubeTexture
             
@@ -1730,6 +1818,7 @@ open class Renderer: NSObject {
             specularIBLTextureDesc.usage = [.shaderRead, .shaderWrite]
             let specularIBLCube = device.makeTexture(descriptor: specularIBLTextureDesc)
             specularIBLCube?.label = "Specular IBL Cubemap"
+            GPUResourceRegistry.shared.register(specularIBLCube, category: .environmentMap, owner: .renderer)
             specularIBLCubeTexture = GPUPassTexture(texture: specularIBLCube, label: "Specular IBL Cubemap", shaderAttributeIndex: Int(kTextureIndexSpecularIBLMap.rawValue), mipLevels: 9)
             specularIBLCubePass?.outputTexture = specularIBLCubeTexture
             
@@ -1758,6 +1847,7 @@ open class Renderer: NSObject {
             brdfLUTTextureDesc.usage = [.shaderRead, .shaderWrite]
             let brdfLUT = device.makeTexture(descriptor: brdfLUTTextureDesc)
             brdfLUT?.label = "BDRF Lookup"
+            GPUResourceRegistry.shared.register(brdfLUT, category: .environmentMap, owner: .renderer)
             brdfLUTTexture = GPUPassTexture(texture: brdfLUT, label: "BDRF Lookup", shaderAttributeIndex: Int(kTextureIndexBDRFLookupMap.rawValue))
             computeBDRFLookupPass?.outputTexture = brdfLUTTexture
             
@@ -1766,6 +1856,29 @@ open class Renderer: NSObject {
             computeBDRFLookupComputeModule.threadgroupDepth = 1
             computeBDRFLookupComputeModule.computePass = computeBDRFLookupPass
             mutableComputeModules.append(AnyComputeModule(computeBDRFLookupComputeModule))
+            
+            // Environment Capture
+            
+            if AKCapabilities.CameraEnvironmentCapture, let defaultLibrary = defaultLibrary {
+                environmentCapture = EnvironmentCapture(device: device, metalLibrary: defaultLibrary, maxInFlightFrames: Constants.maxInFlightFrames)
+            }
+        }
+        
+        //
+        // Setup Camera Luminance
+        //
+        
+        if AKCapabilities.CameraExposure, let defaultLibrary = defaultLibrary {
+            cameraLuminanceReduction = CameraLuminanceReduction(device: device, metalLibrary: defaultLibrary, maxInFlightFrames: Constants.maxInFlightFrames)
+        }
+        
+        //
+        // Setup Occlusion Culling
+        //
+        
+        if AKCapabilities.OcclusionCulling, let defaultLibrary = defaultLibrary {
+            depthPyramid = DepthPyramid(device: device, metalLibrary: defaultLibrary)
+            precalculationComputeModule?.depthPyramid = depthPyramid
         }
         
         hasUninitializedModules = true
@@ -1781,6 +1894,13 @@ open class Renderer: NSObject {
         shadowTextureDesc.usage = [.renderTarget, .shaderRead]
         shadowMap = device.makeTexture(descriptor: shadowTextureDesc)
         shadowMap?.label = "Shadow Map"
+        GPUResourceRegistry.shared.register(shadowMap, category: .shadowMap, owner: .renderer)
+        
+        // Create the filter that turns the shadow map into moments for soft shadows
+        if AKCapabilities.FilteredShadows, let defaultLibrary = defaultLibrary {
+            shadowMomentFilter = ShadowMomentFilter(device: device, metalLibrary: defaultLibrary, shadowMapWidth: shadowTextureDesc.width, shadowMapHeight: shadowTextureDesc.height)
+            GPUResourceRegistry.shared.register([shadowMomentFilter?.texture, shadowMomentFilter?.intermediateTexture], category: .shadowMap, owner: .renderer)
+        }
         
         // Create shadow render pass descriptor
         let shadowRenderPassDescriptor = MTLRenderPassDescriptor()
@@ -1819,6 +1939,8 @@ open class Renderer: NSObject {
         shadowRenderPass?.drawCallGroupFilterFunction = { drawCallGroup in
             return drawCallGroup?.generatesShadows == true
         }
+        // Shadow casters that share a mesh are drawn with one instanced draw and culled against the light's frustum on the GPU
+        shadowRenderPass?.shadowCasterInstanceTable = DrawCallInstanceTable(device: device, regionCount: Constants.maxInFlightFrames, maxInstanceCount: Constants.maxInstances)
         
         //
         // Setup Main Pass
@@ -1832,7 +1954,7 @@ open class Renderer: NSObject {
         mainRenderPass?.usesLighting = true
         mainRenderPass?.usesEffects = true
         mainRenderPass?.usesEnvironment = true
-        mainRenderPass?.usesCameraOutput = true
+        mainRenderPass?.usesCameraOutput = false // the camera image is composited under the tone mapped scene in the composite pass
         mainRenderPass?.usesSharedBuffer = true
         mainRenderPass?.usesShadows = true
         mainRenderPass?.depthCompareFunction = .less
@@ -1840,10 +1962,13 @@ open class Renderer: NSObject {
         
         // Create render pipeline descriptor for main pass
         let mainRenderPipelineDescriptor = MTLRenderPipelineDescriptor()
-        mainRenderPipelineDescriptor.colorAttachments[0].pixelFormat = renderDestination.colorPixelFormat
+        mainRenderPipelineDescriptor.colorAttachments[0].pixelFormat = Constants.sceneColorPixelFormat
         mainRenderPipelineDescriptor.colorAttachments[0].isBlendingEnabled = true
         mainRenderPipelineDescriptor.colorAttachments[0].sourceRGBBlendFactor = .sourceAlpha
         mainRenderPipelineDescriptor.colorAttachments[0].destinationRGBBlendFactor = .oneMinusSourceAlpha
+        // Accumulate coverage in alpha so the composite pass can blend the scene over the camera image
+        mainRenderPipelineDescriptor.colorAttachments[0].sourceAlphaBlendFactor = .one
+        mainRenderPipelineDescriptor.colorAttachments[0].destinationAlphaBlendFactor = .oneMinusSourceAlpha
         mainRenderPipelineDescriptor.depthAttachmentPixelFormat = renderDestination.depthStencilPixelFormat
         mainRenderPipelineDescriptor.stencilAttachmentPixelFormat = renderDestination.depthStencilPixelFormat
         mainRenderPipelineDescriptor.sampleCount = renderDestination.sampleCount
@@ -1857,7 +1982,7 @@ open class Renderer: NSObject {
         let width = renderDestination.currentDrawable?.texture.width ?? 0
         let height = renderDestination.currentDrawable?.texture.height ?? 0
         
-        let colorDesc = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: renderDestination.colorPixelFormat, width: width, height: height, mipmapped: false)
+        let colorDesc = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: Constants.sceneColorPixelFormat, width: width, height: height, mipmapped: false)
         colorDesc.usage = [.renderTarget, .shaderRead]
         colorDesc.resourceOptions = .storageModePrivate
         sceneColorTexture = device.makeTexture(descriptor: colorDesc)
@@ -1868,6 +1993,8 @@ open class Renderer: NSObject {
         depthDesc.resourceOptions = .storageModePrivate
         sceneDepthTexture = device.makeTexture(descriptor: depthDesc)
         sceneDepthTexture?.label = "Composite Depth"
+        depthPyramid?.resize(sceneWidth: width, sceneHeight: height)
+        GPUResourceRegistry.shared.register([sceneColorTexture, sceneDepthTexture, depthPyramid?.texture], category: .renderTarget, owner: .renderer)
         
         // Create composite pipeline
         let compositeImageVertexFunction = defaultLibrary?.makeFunction(name: "compositeImageVertexTransform")
@@ -2024,22 +2151,7 @@ open class Renderer: NSObject {
                 module.initializeBuffers(withDevice: device, maxInFlightFrames: Constants.maxInFlightFrames, maxInstances: Constants.maxInstances)
                 
                 // Get all of the AKGeometricEntity's associated with this module
-                var geometricEntities: [AKGeometricEntity] = (entitiesForRenderModule[module.moduleIdentifier] ?? []).compactMap({
-                    if let geoEntity = $0 as? AKGeometricEntity {
-                        return geoEntity
-                    } else {
-                        return nil
-                    }
-                })
-                let geometricEntityGroups: [AKGeometricEntityGroup] = (entitiesForRenderModule[module.moduleIdentifier] ?? []).compactMap({
-                    if let geoEntity = $0 as? AKGeometricEntityGroup {
-                        return geoEntity
-                    } else {
-                        return nil
-                    }
-                })
-                let groupGeometries = geometricEntityGroups.flatMap({$0.geometries})
-                geometricEntities.append(contentsOf: groupGeometries)
+                let geometricEntities = flattenedGeometricEntities(from: entitiesForRenderModule[module.moduleIdentifier] ?? [])
                 
                 // Load the assets
                 module.loadAssets(forGeometricEntities: geometricEntities, fromModelProvider: modelProvider, textureLoader: textureLoader, completion: { [weak self] in
@@ -2087,6 +2199,27 @@ open class Renderer: NSObject {
         
     }
     
+    /// All of the `AKGeometricEntity`'s in `entities` including the geometries that belong to any `AKGeometricEntityGroup`'s
+    fileprivate func flattenedGeometricEntities(from entities: [AKEntity]) -> [AKGeometricEntity] {
+        var geometricEntities: [AKGeometricEntity] = entities.compactMap({
+            if let geoEntity = $0 as? AKGeometricEntity {
+                return geoEntity
+            } else {
+                return nil
+            }
+        })
+        let geometricEntityGroups: [AKGeometricEntityGroup] = entities.compactMap({
+            if let geoEntity = $0 as? AKGeometricEntityGroup {
+                return geoEntity
+            } else {
+                return nil
+            }
+        })
+        let groupGeometries = geometricEntityGroups.flatMap({$0.geometries})
+        geometricEntities.append(contentsOf: groupGeometries)
+        return geometricEntities
+    }
+    
     fileprivate func loadPipelines(for moduleIdentifiers: [String]) {
         
         guard !moduleIdentifiers.isEmpty else {
@@ -2099,13 +2232,6 @@ open class Renderer: NSObject {
         
         var mutableShadowPassDrawCallGroups = shadowRenderPass?.drawCallGroups ?? []
         var mutableMainPassDrawCallGroups = mainRenderPass?.drawCallGroups ?? []
-        let numQualityLevels: Int = {
-            if AKCapabilities.LevelOfDetail {
-                return Constants.numQualityLevels
-            } else {
-                return 1
-            }
-        }()
         
         renderModules.filter({moduleIdentifiers.contains($0.moduleIdentifier)}).forEach { module in
             // FIXME: decouple loading thae pipeline with the render pass so there is not so much duplicated effort
@@ -2132,14 +2258,11 @@ open class Renderer: NSObject {
         
     }
     
-    fileprivate func prepareToDraw(forCameraProperties cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, renderPass: RenderPass?) {
+    fileprivate func prepareToDraw(withEntityStates entityStates: EntityStateSnapshot, cameraProperties: CameraProperties, environmentProperties: EnvironmentProperties, shadowProperties: ShadowProperties, renderPass: RenderPass?) {
         
-        let allEntities: [AKEntity] = entitiesForRenderModule.flatMap { (key, value) in
-            return value
-        }
         // Update precalculation module
         if let preRenderComputeModule = precalculationComputeModule, let precalculationPass = precalculationPass, preRenderComputeModule.state == .ready {
-            preRenderComputeModule.prepareToDraw(withAllEntities: allEntities, cameraProperties: cameraProperties, environmentProperties: environmentProperties, shadowProperties: shadowProperties, computePass: precalculationPass, renderPass: renderPass)
+            preRenderComputeModule.prepareToDraw(withEntityStates: entityStates, cameraProperties: cameraProperties, environmentProperties: environmentProperties, shadowProperties: shadowProperties, computePass: precalculationPass, renderPass: renderPass)
         }
     }
     
@@ -2153,6 +2276,208 @@ open class Renderer: NSObject {
         }
     }
     
+    fileprivate func encodeCulling(forRenderPass renderPass: RenderPass, commandBuffer: MTLCommandBuffer) {
+        
+        // Culling runs in its own compute encoders so it has to be encoded before the render pass's command encoder is created
+        renderModules.forEach { module in
+            if let cullingModule = module as? CullingRenderModule, module.state == .ready {
+                cullingModule.encodeCulling(forRenderPass: renderPass, commandBuffer: commandBuffer)
+            }
+        }
+    }
+    
+    // MARK: Pending Commands
+    
+    /// Applies all of the add / remove commands that have been recorded since the last frame as a single batch. Module state is only changed once per module regardless of how many entities were added or removed.
+    fileprivate func applyPendingCommands() {
+        
+        let commands = pendingCommands.drain()
+        guard !commands.isEmpty else {
+            return
+        }
+        
+        var modulesToReinitialize = Set<String>()
+        var modulesToUpdate = Set<String>()
+        var removedEntityIDs = [UUID]()
+        var addedEntitiesForModule = [String: [AKEntity]]()
+        var removedEntityIDsForModule = [String: [UUID]]()
+        
+        for command in commands {
+            switch command {
+            case let .add(entity, moduleIdentifier):
+                if let existingGeometries = entitiesForRenderModule[moduleIdentifier] {
+                    var mutableExistingGeometries = existingGeometries
+                    mutableExistingGeometries.append(entity)
+                    entitiesForRenderModule[moduleIdentifier] = mutableExistingGeometries
+                    if let module = incrementalRenderModule(forModuleIdentifier: moduleIdentifier), module.state == .ready {
+                        addedEntitiesForModule[moduleIdentifier, default: []].append(entity)
+                    } else if moduleIdentifier != PathsRenderModule.identifier {
+                        modulesToReinitialize.insert(moduleIdentifier)
+                    }
+                } else {
+                    entitiesForRenderModule[moduleIdentifier] = [entity]
+                }
+                if let akPath = entity as? AKPath {
+                    paths.append(akPath)
+                }
+            case let .remove(entity, moduleIdentifier):
+                var existingGeometries = entitiesForRenderModule[moduleIdentifier]
+                if let index = existingGeometries?.firstIndex(where: {$0.identifier == entity.identifier}) {
+                    existingGeometries?.remove(at: index)
+                }
+                entitiesForRenderModule[moduleIdentifier] = existingGeometries
+                if let akPath = entity as? AKPath {
+                    paths.removeAll(where: {$0.identifier == akPath.identifier})
+                    akPath.segmentPoints.forEach { segment in
+                        if let uuid = segment.identifier {
+                            removedEntityIDs.append(uuid)
+                        }
+                        modelManager.clearCache(asset: segment.asset)
+                    }
+                } else if let geometricEntity = entity as? AKGeometricEntity {
+                    modelManager.clearCache(asset: geometricEntity.asset)
+                }
+                if let uuid = entity.identifier {
+                    removedEntityIDs.append(uuid)
+                }
+                if let module = incrementalRenderModule(forModuleIdentifier: moduleIdentifier), module.state == .ready {
+                    let uuids = flattenedGeometricEntities(from: [entity]).compactMap({$0.identifier}) + [entity.identifier].compactMap({$0})
+                    removedEntityIDsForModule[moduleIdentifier, default: []].append(contentsOf: uuids)
+                } else if moduleIdentifier == UnanchoredRenderModule.identifier {
+                    modulesToReinitialize.insert(moduleIdentifier)
+                }
+            case let .sessionDidAdd(anchors):
+                modulesToUpdate.formUnion(applySessionDidAdd(anchors: anchors))
+            case let .sessionDidUpdate(anchors):
+                applySessionDidUpdate(anchors: anchors)
+            case let .sessionDidRemove(anchors):
+                modulesToUpdate.formUnion(applySessionDidRemove(anchors: anchors))
+            case let .loadMainPassDrawCallGroups(identifiers, moduleIdentifier, shadowPassDrawCallGroups):
+                loadMainPassDrawCallGroups(forGeometricEntityIdentifiers: identifiers, moduleIdentifier: moduleIdentifier, shadowPassDrawCallGroups: shadowPassDrawCallGroups)
+            case let .addDrawCallGroups(shadowPassDrawCallGroups, mainPassDrawCallGroups):
+                addDrawCallGroups(shadowPassDrawCallGroups, to: shadowRenderPass)
+                addDrawCallGroups(mainPassDrawCallGroups, to: mainRenderPass)
+            }
+        }
+        
+        freeTextureMemory(for: removedEntityIDs)
+        gpuResources.dissociate(entities: removedEntityIDs)
+        
+        // Entities that were removed only need their own `DrawCallGroup`s removed
+        removedEntityIDsForModule.forEach { (moduleIdentifier, uuids) in
+            guard !modulesToReinitialize.contains(moduleIdentifier), let module = incrementalRenderModule(forModuleIdentifier: moduleIdentifier) else {
+                return
+            }
+            module.removeAssets(forGeometricEntityIdentifiers: uuids)
+            shadowRenderPass?.drawCallGroups.removeAll(where: {uuids.contains($0.uuid)})
+            mainRenderPass?.drawCallGroups.removeAll(where: {uuids.contains($0.uuid)})
+        }
+        
+        // Entities that were added only need their own assets and `DrawCallGroup`s loaded
+        addedEntitiesForModule.forEach { (moduleIdentifier, entities) in
+            guard !modulesToReinitialize.contains(moduleIdentifier), let module = incrementalRenderModule(forModuleIdentifier: moduleIdentifier) else {
+                return
+            }
+            let removedIDs = removedEntityIDsForModule[moduleIdentifier] ?? []
+            let addedEntities = entities.filter { entity in
+                guard let identifier = entity.identifier else {
+                    return true
+                }
+                return !removedIDs.contains(identifier)
+            }
+            loadEntitiesIncrementally(addedEntities, for: module)
+        }
+        
+        modulesToReinitialize.forEach {
+            markModuleUninitialized(forModuleIdentifier: $0)
+        }
+        
+        // Modules that are about to be reinitialized will load their pipelines as part of initialization
+        loadPipelines(for: Array(modulesToUpdate.subtracting(modulesToReinitialize)))
+        
+    }
+    
+    /// Loads the assets and creates `DrawCallGroup`s for only the `entities` provided. Existing `DrawCallGroup`s are left untouched. The new `DrawCallGroup`s are added to the render passes at the start of the frame after they finish loading.
+    ///
+    /// Modules are only called from the render thread. `loadAssets` completes before it returns but the `DrawCallGroup`s are built on the `ModelManager`'s queue, so each pass hands its results back through `pendingCommands` and the next step runs from `applyPendingCommands()`.
+    fileprivate func loadEntitiesIncrementally(_ entities: [AKEntity], for module: IncrementalRenderModule) {
+        
+        guard !entities.isEmpty else {
+            return
+        }
+        
+        let geometricEntities = flattenedGeometricEntities(from: entities)
+        let identifiers = geometricEntities.compactMap({$0.identifier})
+        let moduleIdentifier = module.moduleIdentifier
+        
+        module.loadAssets(forAddedGeometricEntities: geometricEntities, fromModelProvider: modelProvider, textureLoader: textureLoader) {
+            
+            // The shadow and main passes are loaded one after the other and added together so both passes see the `DrawCallGroup`s in the same order
+            loadIncrementalPipeline(forGeometricEntityIdentifiers: identifiers, module: module, renderPass: shadowRenderPass) { [weak self] shadowPassDrawCallGroups in
+                self?.pendingCommands.enqueue(.loadMainPassDrawCallGroups(identifiers: identifiers, moduleIdentifier: moduleIdentifier, shadowPass: shadowPassDrawCallGroups))
+            }
+            
+        }
+        
+    }
+    
+    /// Second step of `loadEntitiesIncrementally(_:for:)`. Called from `applyPendingCommands()` once the shadow pass `DrawCallGroup`s have loaded.
+    fileprivate func loadMainPassDrawCallGroups(forGeometricEntityIdentifiers identifiers: [UUID], moduleIdentifier: String, shadowPassDrawCallGroups: [DrawCallGroup]) {
+        
+        // The module was reinitialized while the shadow pass was loading. Initialization reloads every entity.
+        guard let module = incrementalRenderModule(forModuleIdentifier: moduleIdentifier), module.state == .ready else {
+            return
+        }
+        
+        loadIncrementalPipeline(forGeometricEntityIdentifiers: identifiers, module: module, renderPass: mainRenderPass) { [weak self] mainPassDrawCallGroups in
+            self?.pendingCommands.enqueue(.addDrawCallGroups(shadowPass: shadowPassDrawCallGroups, mainPass: mainPassDrawCallGroups))
+        }
+        
+    }
+    
+    fileprivate func loadIncrementalPipeline(forGeometricEntityIdentifiers identifiers: [UUID], module: IncrementalRenderModule, renderPass: RenderPass?, completion: @escaping ([DrawCallGroup]) -> Void) {
+        
+        guard let defaultLibrary = defaultLibrary else {
+            return
+        }
+        
+        let moduleEntities = entitiesForRenderModule[module.moduleIdentifier] ?? []
+        module.loadPipeline(forGeometricEntityIdentifiers: identifiers, moduleEntities: moduleEntities, metalLibrary: defaultLibrary, renderDestination: renderDestination, modelManager: modelManager, renderPass: renderPass, numQualityLevels: numQualityLevels, completion: completion)
+        
+    }
+    
+    fileprivate func addDrawCallGroups(_ drawCallGroups: [DrawCallGroup], to renderPass: RenderPass?) {
+        
+        guard let renderPass = renderPass, !drawCallGroups.isEmpty else {
+            return
+        }
+        
+        // Skip the groups for entities that were removed while they were loading
+        let currentIDs = Set(flattenedGeometricEntities(from: entitiesForRenderModule.flatMap({$0.value})).compactMap({$0.identifier}))
+        renderPass.drawCallGroups = DrawCallGroup.merge(drawCallGroups, into: renderPass.drawCallGroups, currentIdentifiers: currentIDs)
+        
+    }
+    
+    fileprivate func incrementalRenderModule(forModuleIdentifier moduleIdentifier: String) -> IncrementalRenderModule? {
+        return renderModules.first(where: {$0.moduleIdentifier == moduleIdentifier}) as? IncrementalRenderModule
+    }
+    
+    fileprivate func markModuleUninitialized(forModuleIdentifier moduleIdentifier: String) {
+        switch moduleIdentifier {
+        case AnchorsRenderModule.identifier:
+            anchorsRenderModule?.state = .uninitialized
+        case UnanchoredRenderModule.identifier:
+            unanchoredRenderModule?.state = .uninitialized
+        case PathsRenderModule.identifier:
+            pathsRenderModule?.state = .uninitialized
+        case SurfacesRenderModule.identifier:
+            surfacesRenderModule?.state = .uninitialized
+        default:
+            return
+        }
+        hasUninitializedModules = true
+    }
+    
     // MARK: Shared Modules
     
     fileprivate func setupSharedModule(forModuleIdentifier moduleIdentifier: String) -> SharedRenderModule? {
@@ -2184,7 +2509,7 @@ open class Renderer: NSObject {
         diffuseIBLCubePass?.prepareCommandEncoder(withCommandBuffer: commandBuffer)
         diffuseIBLCubePass?.dispatch()
         specularIBLCubePass?.prepareCommandEncoder(withCommandBuffer: commandBuffer)
-        specularIBLCubePass?.dispatch()
+        specularIBLCubePass?.dispatchMipChain()
         computeBDRFLookupPass?.prepareCommandEncoder(withCommandBuffer: commandBuffer)
         computeBDRFLookupPass?.dispatch()
         
@@ -2227,7 +2552,9 @@ open class Renderer: NSObject {
         
         // For the current DrawCallGroup's that have been removed, Mark the textures associated with those draw calls purgable so the system can free up the memory
         let removedMainPassGroups = existingMainPassDrawCallGroups.filter({ enitityIDs.contains($0.uuid) })
-        removedMainPassGroups.forEach{ $0.markTexturesAsVolitile() }
+        // Textures are interned by content, so a texture of a removed group may still be drawn by a remaining one
+        let remainingTextures = Set(existingMainPassDrawCallGroups.filter({ !enitityIDs.contains($0.uuid) }).flatMap({ $0.textures }).map({ ObjectIdentifier($0) }))
+        removedMainPassGroups.forEach{ $0.markTexturesAsVolitile(keeping: remainingTextures) }
     }
     
     // MARK: Precomute pass
@@ -2288,6 +2615,9 @@ open class Renderer: NSObject {
         commandEncoder.setFragmentTexture(alphaTexture, index: Int(kTextureIndexAlpha.rawValue))
         commandEncoder.setFragmentTexture(dilatedDepthTexture, index: Int(kTextureIndexDialatedDepth.rawValue))
         
+        var compositeUniforms = CompositeUniforms(exposure: exposureAdaptation.exposure)
+        commandEncoder.setFragmentBytes(&compositeUniforms, length: MemoryLayout<CompositeUniforms>.stride, index: Int(kBufferIndexCompositeUniforms.rawValue))
+        
         // Draw each submesh of our mesh
         commandEncoder.drawPrimitives(type: .triangleStrip, vertexStart: 0, vertexCount: 4)
         
@@ -2395,6 +2725,29 @@ extension Renderer: ARSessionDelegate {
     
      /// :nodoc:
     public func session(_ session: ARSession, didAdd anchors: [ARAnchor]) {
+        pendingCommands.enqueue(.sessionDidAdd(anchors: anchors))
+    }
+    
+    /// :nodoc:
+    public func session(_ session: ARSession, didUpdate anchors: [ARAnchor]) {
+        pendingCommands.enqueue(.sessionDidUpdate(anchors: anchors))
+    }
+    
+    /// :nodoc:
+    public func session(_ session: ARSession, didRemove anchors: [ARAnchor]) {
+        pendingCommands.enqueue(.sessionDidRemove(anchors: anchors))
+    }
+    
+}
+
+// MARK: - Applying ARSession changes
+
+// The `ARSessionDelegate` callbacks only record the changes. These are called from
+// `applyPendingCommands()` on the render thread.
+extension Renderer {
+    
+    /// Returns the identifiers of the modules that need their pipelines reloaded
+    fileprivate func applySessionDidAdd(anchors: [ARAnchor]) -> Set<String> {
         
         var modulesToUpdate = Set<String>()
         
@@ -2433,7 +2786,7 @@ extension Renderer: ARSessionDelegate {
             } else if let environmentProbeAnchor = anchor as? AREnvironmentProbeAnchor, let environmentCubeMap = environmentProbeAnchor.environmentTexture {
                 environmentProbeAnchors.append(environmentProbeAnchor)
                 remapEnvironmentProbes()
-                if environmentProbeAnchor.extent.x.isInfinite {
+                if environmentProbeAnchor.extent.x.isInfinite, environmentCapture == nil {
                     let aGPUTexture = GPUPassTexture(texture: environmentCubeMap, label: "Global Environment Texture", shaderAttributeIndex: Int(kTextureIndexEnvironmentMap.rawValue))
                     environmentTexture = aGPUTexture
                     hasEnvironmentTextureChanged = true
@@ -2475,17 +2828,17 @@ extension Renderer: ARSessionDelegate {
                 }) {
                     akAnchor.setARAnchor(anchor)
                 }
-                modulesToUpdate.insert(AnchorsRenderModule.identifier)
+                // There is no need to reload the pipeline. The `DrawCallGroup` for this anchor is
+                // created incrementally when the anchor is added.
                 remapEnvironmentProbes()
             }
         }
         
-        loadPipelines(for: Array(modulesToUpdate))
+        return modulesToUpdate
         
     }
     
-    /// :nodoc:
-    public func session(_ session: ARSession, didUpdate anchors: [ARAnchor]) {
+    fileprivate func applySessionDidUpdate(anchors: [ARAnchor]) {
         
         anchors.forEach { anchor in
             if let planeAnchor = anchor as? ARPlaneAnchor {
@@ -2514,7 +2867,7 @@ extension Renderer: ARSessionDelegate {
                     environmentProbeAnchors.append(environmentProbeAnchor)
                 }
                 remapEnvironmentProbes()
-                if environmentProbeAnchor.extent.x.isInfinite {
+                if environmentProbeAnchor.extent.x.isInfinite, environmentCapture == nil {
                     let aGPUTexture = GPUPassTexture(texture: environmentCubeMap, label: "Global Environment Texture", shaderAttributeIndex: Int(kTextureIndexEnvironmentMap.rawValue))
                     environmentTexture = aGPUTexture
                     hasEnvironmentTextureChanged = true
@@ -2544,8 +2897,8 @@ extension Renderer: ARSessionDelegate {
         }
     }
     
-    /// :nodoc:
-    public func session(_ session: ARSession, didRemove anchors: [ARAnchor]) {
+    /// Returns the identifiers of the modules that need their pipelines reloaded
+    fileprivate func applySessionDidRemove(anchors: [ARAnchor]) -> Set<String> {
         
         var modulesToUpdate = Set<String>()
         
@@ -2593,12 +2946,11 @@ extension Renderer: ARSessionDelegate {
                 modulesToUpdate.insert(UnanchoredRenderModule.identifier)
                 
             } else {
-                //
-                modulesToUpdate.insert(AnchorsRenderModule.identifier)
+                // The `DrawCallGroup` for this anchor is removed incrementally when the anchor is removed
             }
-            
-            loadPipelines(for: Array(modulesToUpdate))
         }
+        
+        return modulesToUpdate
     }
     
 }
@@ -0,0 +1,133 @@
+//
+//  SRGBConversion.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import Metal
+import AugmentKitShader
+
+// MARK: - SRGBConversion
+
+/**
+ Host side sRGB conversions. The exact and fast curves are shared with the shaders through ColorConversion.h. This adds table based conversions for 8 bit data, which are exact and are the fastest option when converting whole images on the CPU.
+ 
+ - `toLinear(_:)` for a `UInt8` is a single lookup into a 256 entry table.
+ - `toSRGB8(_:)` does a binary search over the 255 decision thresholds between adjacent 8 bit codes. It always returns the same code as rounding the exact encode.
+ */
+enum SRGBConversion {
+    
+    /// The linear value of every 8 bit sRGB code
+    static let decodeTable: [Float] = (0...255).map { srgbToLinearExact(Float($0) / 255) }
+    
+    /// `encodeThresholds[i]` is the linear value at which the 8 bit encoding changes from code `i` to `i + 1`
+    static let encodeThresholds: [Float] = (0..<255).map { code in
+        // The exact encode is monotonic so the decision point can be found by bisection
+        let target = (Float(code) + 0.5) / 255
+        var low: Float = 0
+        var high: Float = 1
+        for _ in 0..<32 {
+            let middle = (low + high) / 2
+            if linearToSrgbExact(middle) < target {
+                low = middle
+            } else {
+                high = middle
+            }
+        }
+        return high
+    }
+    
+    /// Converts an 8 bit sRGB code to a linear value using `decodeTable`
+    static func toLinear(_ value: UInt8) -> Float {
+        return decodeTable[Int(value)]
+    }
+    
+    /// Converts a linear value to the nearest 8 bit sRGB code using `encodeThresholds`
+    static func toSRGB8(_ value: Float) -> UInt8 {
+        var low = 0
+        var high = encodeThresholds.count
+        while low < high {
+            let middle = (low + high) / 2
+            if value < encodeThresholds[middle] {
+                high = middle
+            } else {
+                low = middle + 1
+            }
+        }
+        return UInt8(low)
+    }
+    
+    /// Converts a buffer of 8 bit sRGB codes to linear values
+    static func toLinear(_ source: UnsafeBufferPointer<UInt8>, into destination: UnsafeMutableBufferPointer<Float>) {
+        let count = min(source.count, destination.count)
+        decodeTable.withUnsafeBufferPointer { table in
+            for index in 0..<count {
+                destination[index] = table[Int(source[index])]
+            }
+        }
+    }
+    
+    /// Converts a buffer of linear values to 8 bit sRGB codes
+    static func toSRGB8(_ source: UnsafeBufferPointer<Float>, into destination: UnsafeMutableBufferPointer<UInt8>) {
+        let count = min(source.count, destination.count)
+        for index in 0..<count {
+            destination[index] = toSRGB8(source[index])
+        }
+    }
+    
+}
+
+// MARK: - MTLPixelFormat
+
+extension MTLPixelFormat {
+    
+    /// The `_srgb` variant of this format, or `nil` if there isn't one. Sampling through an sRGB view decodes the texels in hardware.
+    var srgbVariant: MTLPixelFormat? {
+        switch self {
+        case .rgba8Unorm, .rgba8Unorm_srgb:
+            return .rgba8Unorm_srgb
+        case .bgra8Unorm, .bgra8Unorm_srgb:
+            return .bgra8Unorm_srgb
+        case .r8Unorm, .r8Unorm_srgb:
+            return .r8Unorm_srgb
+        case .rg8Unorm, .rg8Unorm_srgb:
+            return .rg8Unorm_srgb
+        case .astc_4x4_ldr, .astc_4x4_srgb:
+            return .astc_4x4_srgb
+        case .astc_6x6_ldr, .astc_6x6_srgb:
+            return .astc_6x6_srgb
+        case .astc_8x8_ldr, .astc_8x8_srgb:
+            return .astc_8x8_srgb
+        case .etc2_rgb8, .etc2_rgb8_srgb:
+            return .etc2_rgb8_srgb
+        case .eac_rgba8, .eac_rgba8_srgb:
+            return .eac_rgba8_srgb
+        default:
+            return nil
+        }
+    }
+    
+}
@@ -56,6 +56,19 @@ enum BufferIndices {
     kBufferIndexLODRoughness,
     kBufferIndexInstanceCount,
     kBufferIndexCommandBufferContainer,
+    kBufferIndexSurfaceInstances, // The per surface instance table used by the batched surface draw
+    kBufferIndexSurfaceIndices, // The shared index arena used by the batched surface draw
+    kBufferIndexSurfaceBatchUniforms,
+    kBufferIndexEnvironmentCaptureTiles, // The cube map tiles visible in the captured camera frame
+    kBufferIndexEnvironmentCaptureAccumulation, // The persistent radiance and confidence of every cube map texel
+    kBufferIndexEnvironmentCaptureUniforms,
+    kBufferIndexCameraLuminanceHistogram, // The log luminance histogram and color sums of the captured camera frame. See `CameraLuminanceHistogramLayout`
+    kBufferIndexCameraLuminanceUniforms,
+    kBufferIndexCompositeUniforms,
+    kBufferIndexShadowCasterInstances, // The argument buffer index of every instance drawn by the shadow pass. See `DrawCallInstanceTable`
+    kBufferIndexDepthPyramidUniforms,
+    kBufferIndexOcclusionCullingUniforms,
+    kBufferIndexShadowMomentUniforms,
 };
 
 /// Argument buffer ID for the ICB encoded by the compute kernel
@@ -119,6 +132,14 @@ enum TextureIndices {
     kTextureIndexSceneDepth,
     kTextureIndexAlpha,
     kTextureIndexDialatedDepth,
+    // Occlusion Culling
+    kTextureIndexDepthPyramid,
+    kTextureIndexDepthPyramidSource,
+    kTextureIndexDepthPyramidDestination,
+    // Filtered Shadows
+    kTextureIndexShadowMoments,
+    kTextureIndexShadowMomentsSource,
+    kTextureIndexShadowMomentsDestination,
     kNumTextureIndices,
 };
 
@@ -137,6 +158,7 @@ enum FunctionConstantIndices {
     kFunctionConstantSheenTintMapIndex,
     kFunctionConstantClearcoatMapIndex,
     kFunctionConstantClearcoatGlossMapIndex,
+    kFunctionConstantHalfPrecisionShadingIndex,
     kNumFunctionConstantIndices
 };
 
@@ -164,6 +186,25 @@ enum QualityLevel {
     kQualityNumLevels
 };
 
+// MARK: - Camera Luminance
+
+/// The layout of the `uint32_t` buffer filled by the `camera_luminance_histogram` kernel
+enum CameraLuminanceHistogramLayout {
+    kCameraLuminanceHistogramBinCount = 64, // Bins 0..<kCameraLuminanceHistogramBinCount hold the log2 luminance histogram
+    kCameraLuminanceHistogramSampleCountIndex = 64,
+    kCameraLuminanceHistogramRedSumIndex, // Low words of the sums of the linear color channels in 1 / kCameraLuminanceColorSumScale units
+    kCameraLuminanceHistogramGreenSumIndex,
+    kCameraLuminanceHistogramBlueSumIndex,
+    kCameraLuminanceHistogramRedSumHighIndex, // High words of the color sums. Each unit is worth kCameraLuminanceColorSumWordSize units of the low word
+    kCameraLuminanceHistogramGreenSumHighIndex,
+    kCameraLuminanceHistogramBlueSumHighIndex,
+    kCameraLuminanceHistogramLength
+};
+
+// Colors are summed with 16 bits of fraction per sample. A threadgroup of up to 1024 samples cannot overflow its 32 bit sums, and splitting them into low and high words when they are added to the buffer keeps the totals from overflowing for any grid size.
+#define kCameraLuminanceColorSumScale 65535.0
+#define kCameraLuminanceColorSumWordSize 65536
+
 // MARK: - HeadingType
 
 enum HeadingType {
@@ -209,11 +250,12 @@ struct EnvironmentUniforms {
 struct AnchorInstanceUniforms {
     int hasGeometry;
     int hasHeading;
-    matrix_float4x4 headingTransform;
+    vector_float4 headingRotation; // The heading as a quaternion (x, y, z, w)
     int headingType;
     
     matrix_float4x4 locationTransform;
     matrix_float4x4 worldTransform; // A transform matrix for the anchor model in world space.
+    vector_float4 boundingSphere; // The model space bounds of the mesh (center, radius). A radius of 0 means the bounds are unknown and the mesh is never culled.
     
     // Used for LOD calculations to seamlessly transition from one LOD to another
     // The lengh of the array should match the number of properties in MaterialUniforms
@@ -228,6 +270,87 @@ struct AnchorEffectsUniforms {
     matrix_float4x4 scale;
 };
 
+/// The indirect arguments of a single surface draw. Matches the layout of `MTLDrawPrimitivesIndirectArguments`.
+struct SurfaceDrawArguments {
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t vertexStart;
+    uint32_t baseInstance;
+};
+
+/// Describes a single surface in the batched surface draw. The vertices and indices of every surface are stored in shared arenas and each instance of the draw selects its own range.
+struct SurfaceInstance {
+    uint32_t vertexStart; // The first vertex of the surface in the vertex arena
+    uint32_t indexStart; // The first index of the surface in the index arena. Indices are relative to `vertexStart`
+    uint32_t indexCount;
+    uint32_t argumentBufferIndex; // The index into the precalculated arguments buffer
+    uint32_t effectsIndex; // The index into the effects uniforms buffer
+    vector_float4 boundingSphere; // Model space center (xyz) and radius (w). Used to cull the surface on the GPU
+    struct SurfaceDrawArguments drawArguments; // Written by `surface_batch_cull`. Culled surfaces draw no vertices
+};
+
+/// Values that apply to every instance of the batched surface draw
+struct SurfaceBatchUniforms {
+    float renderDistance; // Surfaces farther than this from the camera are culled
+    uint32_t instanceCount; // The number of instances in the table
+    uint32_t cullsAgainstLight; // 1 to cull against the directional light's frustum instead of the camera's
+};
+
+/// Values used to reduce the captured camera frame to luminance and color statistics
+struct CameraLuminanceUniforms {
+    vector_uint2 sampleGridSize; // The captured image is sampled on a grid of this size, one thread per sample
+    float minLogLuminance; // The log2 luminance of the lower edge of the first bin
+    float logLuminanceRange; // The log2 luminance range covered by all of the bins
+};
+
+/// Values used by the composite pass to bring the HDR scene color to the display
+struct CompositeUniforms {
+    float exposure; // Scales the linear scene color before tone mapping
+};
+
+/// Used to build level 0 of the hierarchical depth pyramid from the scene depth and the real world depth of the AR frame. See `DepthPyramid`
+struct DepthPyramidUniforms {
+    matrix_float4x4 projectionMatrix; // Projects the linear real world depth into the depth range of the scene
+    vector_float3 cameraTexCoordTransformX; // The first row of the affine transform from scene to camera texture coordinates
+    vector_float3 cameraTexCoordTransformY; // The second row of the affine transform from scene to camera texture coordinates
+    int useRealDepth; // 1 when the real world depth and alpha textures are bound
+};
+
+/// Used by the precalculation stage to test instance bounds against the hierarchical depth pyramid of the previous frame
+struct OcclusionCullingUniforms {
+    matrix_float4x4 viewProjectionMatrix; // The view projection matrix of the frame the pyramid was built from
+    vector_uint2 pyramidSize; // The size of level 0 in texels
+    uint32_t levelCount;
+    int isEnabled; // 0 until a pyramid has been built
+};
+
+/// Describes one pass of the separable gaussian blur applied to the shadow moments. See `ShadowMomentFilter`
+struct ShadowMomentUniforms {
+    vector_int2 direction; // (1, 0) for the horizontal pass and (0, 1) for the vertical pass
+    int32_t radius; // The number of taps on either side of the center texel
+    float sigma; // The standard deviation of the gaussian in texels
+};
+
+/// A square block of texels on one face of the environment capture cube map
+struct EnvironmentCaptureTile {
+    uint32_t face;
+    uint32_t x; // The first texel of the tile
+    uint32_t y;
+};
+
+/// Values used to project a captured camera frame onto the environment capture cube map
+struct EnvironmentCaptureUniforms {
+    matrix_float3x3 worldToCamera; // The rotation of the camera. Translation is ignored because the environment is treated as infinitely far away.
+    matrix_float3x3 intrinsics; // The camera intrinsics in pixels of the captured image
+    vector_float2 imageResolution;
+    float exposureScale; // Brings frames captured with different exposures to the same scale
+    float maxConfidence; // Caps the accumulated weight so the capture keeps adapting to lighting changes
+    float edgeFalloff; // The fraction of the image, measured from each edge, over which the weight of a sample falls to zero
+    uint32_t faceSize;
+    uint32_t tileSize;
+    uint32_t resolveAll; // When non zero texels that are not visible in the frame are written from the accumulation buffer as well
+};
+
 /// Structure shared between shader and C code that contains information about the material that should be used to render a model
 struct MaterialUniforms {
     vector_float4 baseColor;
@@ -303,6 +426,9 @@ struct PrecalculatedParameters {
     matrix_float4x4 modelViewProjectionMatrix; // projectionMatrix * modelViewMatrix
     matrix_float4x4 shadowMVPTransformMatrix;
     matrix_float4x4 directionalLightMVP;
+    matrix_float4x4 directionalLightModelMatrix; // directionalLightMVP * modelMatrix
+    int castsShadow; // 0 when the mesh is outside of the directional light's frustum
+    int isOccluded; // 1 when the mesh is hidden behind the depth of the previous frame. Occluded meshes still cast shadows.
     
     // Matting
     int useDepth;
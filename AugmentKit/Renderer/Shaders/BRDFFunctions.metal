@@ -32,6 +32,7 @@
 using namespace metal;
 
 #import "../Common.h"
+#import "../BRDFFunctions.h"
 
 #ifndef AK_SHADERS_BDRFFUNCTIONS
 #define AK_SHADERS_BDRFFUNCTIONS
@@ -43,90 +44,64 @@ using namespace metal;
 /// Walter et al. 2007, "Microfacet Models for Refraction through Rough Surfaces"
 /// equivalent to the Trowbridge-Reitz distribution
 float D_GGX(float roughness, float nDoth) {
-    float oneMinusNDotHSquared = 1.0 - nDoth * nDoth;
-    float a = nDoth * roughness;
-    float k = roughness / (oneMinusNDotHSquared + a * a);
-    float d = k * k * (1.0 / M_PI_F);
-    return min(d, MAXFLOAT);
+    return brdf::D_GGX(roughness, nDoth, 1.0f - nDoth * nDoth);
 }
 
 /// Burley 2012, "Physically-Based Shading at Disney"
 float D_GGX_Anisotropic(float at, float ab, float tDoth, float bDoth, float nDoth) {
-    float a2 = at * ab;
-    float3 d = float3(ab * tDoth, at * bDoth, a2 * nDoth);
-    return min(a2 * sqr(a2 / dot(d, d)) * (1.0 / M_PI_F), MAXFLOAT);
+    return brdf::D_GGX_Anisotropic(at, ab, tDoth, bDoth, nDoth);
 }
 
 /// Estevez and Kulla 2017, "Production Friendly Microfacet Sheen BRDF". Used for Cloth.
 float D_Charlie(float roughness, float nDoth) {
-    float invAlpha  = 1.0 / roughness;
-    float cos2h = nDoth * nDoth;
-    float sin2h = max(1.0 - cos2h, 0.0078125); // 2^(-14/2), so sin2h^2 > 0 in fp16
-    return (2.0 + invAlpha) * pow(sin2h, invAlpha * 0.5) / (2.0 * M_PI_F);
+    return brdf::D_Charlie(roughness, nDoth);
 }
 
 /// Heitz 2014, "Understanding the Masking-Shadowing Function in Microfacet-Based BRDFs"
 /// Full Smith-GGX
 float V_SmithG_GGX(float roughness, float nDotv, float nDotl) {
-    float a² = sqr(roughness);
-    float nDotl² = sqr(nDotl);
-    float nDotv² = sqr(nDotv);
-    float GsL = 1.0 / (nDotl + sqrt(a² + (1.0 - a²) * nDotl²));
-    float GsV = 1.0 / (nDotv + sqrt(a² + (1.0 - a²) * nDotv²));
-    return GsL * GsV;
+    return brdf::V_SmithG_GGX(roughness, nDotv, nDotl);
 }
 
 /// Heitz 2014, "Understanding the Masking-Shadowing Function in Microfacet-Based BRDFs"
 /// The following, noted by Heitz, takes the height of the microfacets into account to correlate masking and shadowing.
 /// Even though this is suppose to lead to more accurate results, I found it much too 'shiney' to looks realistic.
+/// a2=0 => v = 1 / 4*nDotl*nDotv   => min=1/4, max=+inf
+/// a2=1 => v = 1 / 2*(nDotl+nDotv) => min=1/4, max=+inf
+/// The result is clamped to the maximum value representable
 float V_SmithGGXCorrelated(float roughness, float nDotv, float nDotl) {
-    float a² = sqr(roughness);
-    float nDotl² = sqr(nDotl);
-    float nDotv² = sqr(nDotv);
     // TODO: lambdaV can be pre-computed for all the lights, it should be moved out of this function
-    float lambdaV = nDotl * sqrt(nDotv² * (1.0 - a²) + a²);
-    float lambdaL = nDotv * sqrt(nDotl² * (1.0 - a²) + a²);
-    float v = 0.5 / (lambdaV + lambdaL);
-    // a2=0 => v = 1 / 4*nDotl*nDotv   => min=1/4, max=+inf
-    // a2=1 => v = 1 / 2*(nDotl+nDotv) => min=1/4, max=+inf
-    // clamp to the maximum value representable
-    return min(v, MAXFLOAT);
+    return brdf::V_SmithGGXCorrelated(roughness, nDotv, nDotl);
 }
 
 /// Optimized version of the above
 float V_SmithGGXCorrelated_Fast(float roughness, float nDotv, float nDotl) {
-    float v = 0.5 / mix(2.0 * nDotl * nDotv, nDotl + nDotv, roughness);
-    return min(v, MAXFLOAT);
+    return brdf::V_SmithGGXCorrelated_Fast(roughness, nDotv, nDotl);
 }
 
 /// Heitz 2014, "Understanding the Masking-Shadowing Function in Microfacet-Based BRDFs"
 /// TODO: lambdaV can be pre-computed for all the lights, it should be moved out of this function
 float V_SmithGGXCorrelated_Anisotropic(float at, float ab, float tDotv, float bDotv, float tDotl, float bDotl, float nDotv, float nDotl) {
-    float lambdaV = nDotl * length(float3(at * tDotv, ab * bDotv, nDotv));
-    float lambdaL = nDotv * length(float3(at * tDotl, ab * bDotl, nDotl));
-    float v = 0.5 / (lambdaV + lambdaL);
-    return min(v, MAXFLOAT);
+    return brdf::V_SmithGGXCorrelated_Anisotropic(at, ab, tDotv, bDotv, tDotl, bDotl, nDotv, nDotl);
 }
 
 /// Kelemen 2001, "A Microfacet Based Coupled Specular-Matte BRDF Model with Importance Sampling"
 float V_Kelemen(float lDoth) {
-    return min(0.25 / (lDoth * lDoth), MAXFLOAT);
+    return brdf::V_Kelemen(lDoth);
 }
 
 /// Neubelt and Pettineo 2013, "Crafting a Next-gen Material Pipeline for The Order: 1886". Used for Cloth.
 float V_Neubelt(float roughness, float nDotv, float nDotl) {
-    return min(1.0 / (4.0 * (nDotl + nDotv - nDotl * nDotv)), MAXFLOAT);
+    return brdf::V_Neubelt(nDotv, nDotl);
 }
 
 /// Schlick 1994, "An Inexpensive BRDF Model for Physically-Based Rendering"
 float3 F_Schlick3(float3 f0, float f90, float vDoth) {
-//    float f = pow(clamp(1.0 - vDoth, 0.0, 1.0), 5.0);
-//    return f + f0 * (f90 - f);
-    return f0 + (f90 - f0) * pow(clamp(1.0 - vDoth, 0.0, 1.0), 5.0);
+    return brdf::F_Schlick3(f0, f90, vDoth);
 }
 
 float F_Schlick(float f0, float f90, float vDoth) {
-    return f0 + (1.0 - f0) * pow(clamp(1.0 - vDoth, 0.0, 1.0), 5.0);
+    return brdf::F_Schlick(f0, f90, vDoth);
 }
 
 //------------------------------------------------------------------------------
@@ -143,8 +118,7 @@ float F_Schlick(float f0, float f90, float vDoth) {
 // F90 can be approximated by 1.0 because Fresnel goes to 1 as the angle of incidence goes to 90º
 //
 float3 fresnel(float3 f0, float vDoth) {
-    float f90 = saturate(dot(f0, float3(50.0 * 0.33)));
-    return F_Schlick3(f0, f90, vDoth);
+    return brdf::fresnel(f0, vDoth);
 }
 
 float distribution(float roughness, float nDoth) {
@@ -190,20 +164,17 @@ float visibilityCloth(float roughness, float nDotv, float nDotl) {
 //------------------------------------------------------------------------------
 
 float Fd_Lambert() {
-    return 1.0 / M_PI_F;
+    return brdf::Fd_Lambert<float>();
 }
 
 /// Burley 2012, "Physically-Based Shading at Disney"
 float Fd_Burley(float roughness, float nDotv, float nDotl, float lDoth) {
-    float f90 = 0.5 + 2.0 * roughness * lDoth * lDoth;
-    float lightScatter = F_Schlick(1.0, f90, nDotl);
-    float viewScatter  = F_Schlick(1.0, f90, nDotv);
-    return lightScatter * viewScatter * (1.0 / M_PI_F);
+    return brdf::Fd_Burley(roughness, nDotv, nDotl, lDoth);
 }
 
 /// Energy conserving wrap diffuse term, does *not* include the divide by pi. Used for Cloth.
 float Fd_Wrap(float nDotl, float w) {
-    return saturate((nDotl + w) / sqr(1.0 + w));
+    return brdf::Fd_Wrap(nDotl, w);
 }
 
 //------------------------------------------------------------------------------
@@ -28,6 +28,8 @@
 #include <metal_stdlib>
 using namespace metal;
 
+#include "../ColorConversion.h"
+
 #ifndef AK_SHADERS_COMMON
 #define AK_SHADERS_COMMON
 
@@ -35,14 +37,22 @@ float sqr(float a) {
     return a * a;
 }
 
+// Exact piecewise sRGB transfer functions (IEC 61966-2-1). See ColorConversion.h. Alpha is passed through unchanged.
 float4 srgbToLinear(float4 c) {
-    float4 gamma = float4(1.0/2.2);
-    return pow(c, gamma);
+    return float4(srgbToLinearExact(c.r), srgbToLinearExact(c.g), srgbToLinearExact(c.b), c.a);
 }
 
 float4 linearToSrgba(float4 c) {
-    float4 gamma = float4(2.2);
-    return pow(c, gamma);
+    return float4(linearToSrgbExact(c.r), linearToSrgbExact(c.g), linearToSrgbExact(c.b), c.a);
+}
+
+// Polynomial approximations of the sRGB transfer functions. Accurate to well under one 8 bit step. See ColorConversion.h
+float4 srgbToLinearApproximate(float4 c) {
+    return float4(srgbToLinearFast(c.r), srgbToLinearFast(c.g), srgbToLinearFast(c.b), c.a);
+}
+
+float4 linearToSrgbaApproximate(float4 c) {
+    return float4(linearToSrgbFast(c.r), linearToSrgbFast(c.g), linearToSrgbFast(c.b), c.a);
 }
 
 float invert(float m) {
@@ -83,6 +93,240 @@ float3x3 convert3(float4x4 m) {
     return float3x3(float3(a00, a01, a02), float3(a10, a11, a12), float3(a20, a21, a22));
 }
 
+// Converts a unit quaternion (x, y, z, w) to a rotation matrix
+float3x3 quaternionToMatrix3(float4 q) {
+    float x2 = q.x + q.x;
+    float y2 = q.y + q.y;
+    float z2 = q.z + q.z;
+    float xx = q.x * x2, xy = q.x * y2, xz = q.x * z2;
+    float yy = q.y * y2, yz = q.y * z2, zz = q.z * z2;
+    float wx = q.w * x2, wy = q.w * y2, wz = q.w * z2;
+    return float3x3(float3(1.0 - (yy + zz), xy + wz, xz - wy),
+                    float3(xy - wz, 1.0 - (xx + zz), yz + wx),
+                    float3(xz + wy, yz - wx, 1.0 - (xx + yy)));
+}
+
+// Frobenius norm of a 3x3 matrix
+float frobeniusNorm3(float3x3 m) {
+    return sqrt(length_squared(m[0]) + length_squared(m[1]) + length_squared(m[2]));
+}
+
+// Polar decomposition, m = R * S, where R is a proper rotation and S is symmetric (scale on the diagonal, shear off the diagonal). A mirrored m keeps the reflection in S. Near singular matrices fall back to orthonormalizing the columns.
+// This matches `AffineDecomposition` on the CPU.
+float3x3 polarDecomposition(float3x3 m, thread float3x3 &stretch) {
+    
+    float det = determinant(m);
+    float3x3 rotation = det < 0 ? m * -1.0 : m;
+    
+    // The determinant is compared relative to the cube of the norm so that uniformly scaling m does not change which path is taken
+    float norm = frobeniusNorm3(m);
+    if (abs(det) < 1.0e-6 * norm * norm * norm) {
+        // Gram-Schmidt with fallbacks for collapsed or parallel columns
+        float3 x = length_squared(rotation[0]) < 1.0e-12 ? float3(1, 0, 0) : rotation[0];
+        x = normalize(x);
+        float3 y = rotation[1] - dot(rotation[1], x) * x;
+        if (length_squared(y) < 1.0e-12) {
+            float3 axis = abs(x.y) < 0.9 ? float3(0, 1, 0) : float3(0, 0, 1);
+            y = axis - dot(axis, x) * x;
+        }
+        y = normalize(y);
+        rotation = float3x3(x, y, cross(x, y));
+    } else {
+        // Scaled Newton iteration: R = (γR + R⁻ᵀ/γ) / 2
+        for (int i = 0; i < 10; i++) {
+            float3x3 inverseTranspose = transpose(invert3(rotation));
+            float gamma = sqrt(frobeniusNorm3(inverseTranspose) / frobeniusNorm3(rotation));
+            float3x3 next = (rotation * gamma + inverseTranspose * (1.0 / gamma)) * 0.5;
+            float difference = frobeniusNorm3(next - rotation);
+            rotation = next;
+            if (difference < 1.0e-6) {
+                break;
+            }
+        }
+    }
+    
+    stretch = transpose(rotation) * m;
+    return rotation;
+    
+}
+
+// Combines a location with a heading.
+// - Relative headings (headingType = 1) rotate the location's own orientation: R' = R_location * R_heading
+// - Absolute headings (headingType = 0) replace only the rotational part of the location, keeping its scale, shear and reflection: R' = R_heading * S_location where location = R_location * S_location is the polar decomposition
+// In both cases the translation of the location is kept. Rigid locations (orthonormal with a positive determinant) take a fast path that skips the decomposition.
+float4x4 composeLocationAndHeading(float4x4 locationTransform, float4 headingRotation, int headingType) {
+    
+    float3x3 heading = quaternionToMatrix3(headingRotation);
+    float3x3 location = convert3(locationTransform);
+    float3x3 upperLeft;
+    
+    if (headingType != 0) {
+        upperLeft = location * heading;
+    } else {
+        float3 lengthsSquared = float3(length_squared(location[0]), length_squared(location[1]), length_squared(location[2]));
+        float3 dots = float3(dot(location[0], location[1]), dot(location[0], location[2]), dot(location[1], location[2]));
+        bool isRigid = all(abs(lengthsSquared - 1.0) < 1.0e-4) && all(abs(dots) < 1.0e-4) && determinant(location) > 0;
+        if (isRigid) {
+            // Rigid: the rotation is simply replaced
+            upperLeft = heading;
+        } else {
+            float3x3 stretch;
+            polarDecomposition(location, stretch);
+            upperLeft = heading * stretch;
+        }
+    }
+    
+    return float4x4(float4(upperLeft[0], 0),
+                    float4(upperLeft[1], 0),
+                    float4(upperLeft[2], 0),
+                    float4(locationTransform[3].xyz, 1));
+    
+}
+
+// Returns false when a sphere lies completely outside of the frustum of `modelViewProjectionMatrix`. The frustum planes are extracted from the rows of the model view projection matrix so the test is done in model space.
+bool isSphereInFrustum(float4x4 modelViewProjectionMatrix, float4 sphere) {
+    
+    float4 row0 = float4(modelViewProjectionMatrix[0][0], modelViewProjectionMatrix[1][0], modelViewProjectionMatrix[2][0], modelViewProjectionMatrix[3][0]);
+    float4 row1 = float4(modelViewProjectionMatrix[0][1], modelViewProjectionMatrix[1][1], modelViewProjectionMatrix[2][1], modelViewProjectionMatrix[3][1]);
+    float4 row2 = float4(modelViewProjectionMatrix[0][2], modelViewProjectionMatrix[1][2], modelViewProjectionMatrix[2][2], modelViewProjectionMatrix[3][2]);
+    float4 row3 = float4(modelViewProjectionMatrix[0][3], modelViewProjectionMatrix[1][3], modelViewProjectionMatrix[2][3], modelViewProjectionMatrix[3][3]);
+    
+    // Left, right, bottom, top, near (clip space z starts at 0), far
+    float4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2 };
+    for (int i = 0; i < 6; i++) {
+        float planeDistance = dot(planes[i].xyz, sphere.xyz) + planes[i].w;
+        if (planeDistance < -sphere.w * length(planes[i].xyz)) {
+            return false;
+        }
+    }
+    return true;
+    
+}
+
+// Returns true when a sphere, in model space, is hidden behind the depth stored in a hierarchical depth pyramid. Every texel of the pyramid holds the farthest depth of the texels it covers so the test is conservative: the sphere is only occluded when the nearest point of the box enclosing it is further away than everything in the pyramid texels that the box covers on screen. Spheres that cross the near plane or are completely off screen are never occluded. Mirrored by `OcclusionCulling.isSphereOccluded` on the host.
+bool isSphereOccluded(float4x4 modelViewProjectionMatrix, float4 sphere, texture2d<float, access::sample> depthPyramid, uint2 pyramidSize, uint levelCount) {
+    
+    if (sphere.w <= 0 || levelCount == 0) {
+        return false;
+    }
+    
+    // Project the corners of the box that encloses the sphere. Texture coordinates run from top to bottom.
+    float2 minTexCoord = float2(1.0);
+    float2 maxTexCoord = float2(0.0);
+    float nearestDepth = 1.0;
+    for (int i = 0; i < 8; i++) {
+        float3 corner = sphere.xyz + sphere.w * float3((i & 1) ? 1.0 : -1.0, (i & 2) ? 1.0 : -1.0, (i & 4) ? 1.0 : -1.0);
+        float4 clipPosition = modelViewProjectionMatrix * float4(corner, 1.0);
+        if (clipPosition.w <= 1.0e-5) {
+            return false;
+        }
+        float3 ndc = clipPosition.xyz / clipPosition.w;
+        float2 texCoord = float2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5);
+        minTexCoord = min(minTexCoord, texCoord);
+        maxTexCoord = max(maxTexCoord, texCoord);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+    
+    if (any(maxTexCoord < 0.0) || any(minTexCoord > 1.0)) {
+        return false;
+    }
+    
+    // Choose the level where the box covers at most two texels in each direction
+    float2 minTexel = saturate(minTexCoord) * float2(pyramidSize);
+    float2 maxTexel = min(saturate(maxTexCoord) * float2(pyramidSize), float2(pyramidSize) - 1.0);
+    float2 extent = maxTexel - minTexel;
+    uint level = uint(clamp(ceil(log2(max(max(extent.x, extent.y), 1.0))), 0.0, float(levelCount - 1)));
+    
+    // A texel at `level` covers 2^level texels of level 0. The last row and column of a level also cover the remainder of odd sizes.
+    uint2 levelSize = max(pyramidSize >> level, uint2(1));
+    uint2 first = min(uint2(minTexel) >> level, levelSize - 1);
+    uint2 last = min(uint2(maxTexel) >> level, levelSize - 1);
+    
+    constexpr sampler pointSampler(coord::normalized, address::clamp_to_edge, filter::nearest, mip_filter::nearest);
+    float farthestDepth = 0.0;
+    for (uint y = first.y; y <= last.y; y++) {
+        for (uint x = first.x; x <= last.x; x++) {
+            float2 texCoord = (float2(x, y) + 0.5) / float2(levelSize);
+            farthestDepth = max(farthestDepth, depthPyramid.sample(pointSampler, texCoord, level(float(level))).r);
+        }
+    }
+    
+    return nearestDepth > farthestDepth;
+    
+}
+
+// MARK: - Moment Shadow Maps
+
+// The optimized quantization of Peters and Klein, "Moment Shadow Mapping" (2015). Rotating the four power moments of depth into this basis spreads them over the full [0, 1] range so that they survive storage in 16 bit unorm textures. The transform is affine so filtering the quantized moments is the same as filtering the moments. Mirrored by `ShadowMoments` on the host.
+constant float shadowMomentQuantizationOffset = 0.035955884801;
+constant float4x4 shadowMomentQuantization = float4x4(float4(-2.07224649, 13.7948857237, 0.105877704, 9.7924062118),
+                                                      float4(32.23703778, -59.4683975703, -1.9077466311, -33.7652110555),
+                                                      float4(-68.571074599, 82.0359750338, 9.3496555107, 47.9456096605),
+                                                      float4(39.3703274134, -35.364903257, -6.6543490743, -23.9728048165));
+constant float4x4 shadowMomentDequantization = float4x4(float4(0.2227744146, 0.1549679261, 0.1451988946, 0.163127443),
+                                                        float4(0.0771972861, 0.1394629426, 0.2120202157, 0.2591432266),
+                                                        float4(0.7926986636, 0.7963415838, 0.7258694464, 0.6539092497),
+                                                        float4(0.0319417555, -0.1722823173, -0.2758014811, -0.3376131734));
+// Pulls the moments towards those of a uniform distribution, which keeps the reconstruction stable after quantization
+constant float shadowMomentBias = 6.0e-5;
+// Offsets the depth of the receiver to avoid self shadowing
+constant float shadowMomentDepthBias = 5.0e-4;
+// Visibilities below this amount are treated as fully shadowed to hide light bleeding where occluders overlap
+constant float shadowLightBleedingReduction = 0.2;
+
+// Returns the quantized moments of a single depth from the shadow map
+float4 quantizeShadowMoments(float depth) {
+    float depthSquared = depth * depth;
+    float4 moments = float4(depth, depthSquared, depthSquared * depth, depthSquared * depthSquared);
+    float4 quantizedMoments = shadowMomentQuantization * moments;
+    quantizedMoments.x += shadowMomentQuantizationOffset;
+    return quantizedMoments;
+}
+
+// Returns the moments from (possibly filtered) quantized moments
+float4 dequantizeShadowMoments(float4 quantizedMoments) {
+    quantizedMoments.x -= shadowMomentQuantizationOffset;
+    return shadowMomentDequantization * quantizedMoments;
+}
+
+// Returns the fraction of light reaching a fragment at `fragmentDepth` in the light's depth range from the filtered moments of the shadow map around it. Uses the Hamburger 4 moment reconstruction which gives the lower bound on the fraction of occluders in front of the fragment that is consistent with the moments, then applies light bleeding reduction. Mirrored by `ShadowMoments.visibility(quantizedMoments:fragmentDepth:)` on the host.
+float shadowVisibilityFromMoments(float4 quantizedMoments, float fragmentDepth) {
+    
+    float4 b = mix(dequantizeShadowMoments(quantizedMoments), float4(0.5), shadowMomentBias);
+    float z0 = fragmentDepth - shadowMomentDepthBias;
+    
+    // Cholesky decomposition of the Hankel matrix of the moments
+    float L32D22 = fma(-b.x, b.y, b.z);
+    float D22 = fma(-b.x, b.x, b.y);
+    float squaredDepthVariance = fma(-b.y, b.y, b.w);
+    float D33D22 = dot(float2(squaredDepthVariance, -L32D22), float2(D22, L32D22));
+    float InvD22 = 1.0 / D22;
+    float L32 = L32D22 * InvD22;
+    
+    // Solve for the coefficients of the quadratic whose roots are the other two support points
+    float3 c = float3(1.0, z0, z0 * z0);
+    c.y -= b.x;
+    c.z -= b.y + L32 * c.y;
+    c.y *= InvD22;
+    c.z *= D22 / D33D22;
+    c.y -= L32 * c.z;
+    c.x -= dot(c.yz, b.xy);
+    
+    float p = c.y / c.z;
+    float q = c.x / c.z;
+    float r = sqrt(max((p * p) / 4.0 - q, 0.0));
+    float z1 = -p / 2.0 - r;
+    float z2 = -p / 2.0 + r;
+    
+    // Pick the weights of the support points that are in front of the fragment
+    float4 switchValue = (z2 < z0) ? float4(z1, z0, 1.0, 1.0) : ((z1 < z0) ? float4(z0, z1, 0.0, 1.0) : float4(0.0));
+    float quotient = (switchValue.x * z2 - b.x * (switchValue.x + z2) + b.y) / ((z2 - switchValue.y) * (z0 - z1));
+    float shadowIntensity = saturate(switchValue.z + switchValue.w * quotient);
+    
+    return saturate((1.0 - shadowIntensity - shadowLightBleedingReduction) / (1.0 - shadowLightBleedingReduction));
+    
+}
+
 float4x4 invert4(float4x4 m) {
     float a00 = m[0][0], a01 = m[0][1], a02 = m[0][2], a03 = m[0][3];
     float a10 = m[1][0], a11 = m[1][1], a12 = m[1][2], a13 = m[1][3];
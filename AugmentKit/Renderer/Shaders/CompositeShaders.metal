@@ -73,8 +73,29 @@ vertex CompositeColorInOut compositeImageVertexTransform(constant SharedUniforms
     return out;
 }
 
+// ACES filmic tone curve as fitted by Stephen Hill. Maps exposed, linear scene color to linear display color in [0, 1]. Mirrored in `ToneMapping.acesFitted(_:)`
+float3 acesFittedToneMap(float3 color) {
+    
+    // sRGB => XYZ => D65_2_D60 => AP1 => RRT_SAT
+    const float3x3 inputMatrix = float3x3(float3(0.59719, 0.07600, 0.02840),
+                                          float3(0.35458, 0.90834, 0.13383),
+                                          float3(0.04823, 0.01566, 0.83777));
+    // ODT_SAT => XYZ => D60_2_D65 => sRGB
+    const float3x3 outputMatrix = float3x3(float3(1.60475, -0.10208, -0.00327),
+                                           float3(-0.53108, 1.10813, -0.07276),
+                                           float3(-0.07367, -0.00605, 1.07602));
+    
+    // RRT and ODT fit
+    float3 v = inputMatrix * color;
+    float3 a = v * (v + 0.0245786) - 0.000090537;
+    float3 b = v * (0.983729 * v + 0.4329510) + 0.238081;
+    return saturate(outputMatrix * (a / b));
+    
+}
+
 // Composite the image fragment function.
 fragment half4 compositeImageFragmentShader(CompositeColorInOut in [[ stage_in ]],
+                                            constant CompositeUniforms &compositeUniforms [[ buffer(kBufferIndexCompositeUniforms) ]],
                                             texture2d<float, access::sample> capturedImageTextureY [[ texture( kTextureIndexY ) ]],
                                             texture2d<float, access::sample> capturedImageTextureCbCr [[ texture( kTextureIndexCbCr ) ]],
                                             texture2d<float, access::sample> sceneColorTexture [[ texture( kTextureIndexSceneColor ) ]],
@@ -91,11 +112,17 @@ fragment half4 compositeImageFragmentShader(CompositeColorInOut in [[ stage_in ]
     float2 cameraTexCoord = in.texCoordCamera;
     float2 sceneTexCoord = in.texCoordScene;
     
-    // Sample Y and CbCr textures to get the YCbCr color at the given texture coordinate.
+    // Sample Y and CbCr textures to get the YCbCr color at the given texture coordinate. The camera image is already display referred so it is not tone mapped.
     float4 rgb = ycbcrToRGBTransform(capturedImageTextureY.sample(colorSampler, cameraTexCoord), capturedImageTextureCbCr.sample(colorSampler, cameraTexCoord));
     
+    // The scene is linear HDR color premultiplied by coverage. Exposure, tone mapping and the sRGB encode happen once here instead of in every material.
+    float4 sceneSample = sceneColorTexture.sample(colorSampler, sceneTexCoord);
+    float coverage = saturate(sceneSample.a);
+    float3 sceneLinear = coverage > 0.0 ? sceneSample.rgb / sceneSample.a : float3(0.0);
+    float3 sceneDisplay = linearToSrgbaApproximate(float4(acesFittedToneMap(sceneLinear * compositeUniforms.exposure), 1.0)).rgb;
+    
     // Perform composition with the matting.
-    half4 sceneColor = half4(sceneColorTexture.sample(colorSampler, sceneTexCoord));
+    half4 sceneColor = half4(float4(mix(saturate(rgb.rgb), sceneDisplay, coverage), 1.0));
     float sceneDepth = sceneDepthTexture.sample(colorSampler, sceneTexCoord);
     
     half4 cameraColor = half4(rgb);
@@ -118,3 +145,145 @@ fragment half4 compositeImageFragmentShader(CompositeColorInOut in [[ stage_in ]
     return mattingResult;
     
 }
+
+// MARK: - Camera Luminance
+
+// Decodes the captured image to linear color. Mirrored in `CameraLuminanceHistogram.linearColor(y:cb:cr:)`
+float3 cameraLinearColor(float4 y, float4 CbCr) {
+    float3 rgb = saturate(ycbcrToRGBTransform(y, CbCr).rgb);
+    return srgbToLinear(float4(rgb, 1.0)).rgb;
+}
+
+// Builds a log2 luminance histogram and the sums of the linear color channels of the captured image. Each threadgroup reduces into threadgroup memory first so that only one atomic per bin per threadgroup touches device memory. The color sums of each threadgroup are split into a low and a high word on the way out. The output buffer must be cleared before dispatch.
+kernel void camera_luminance_histogram(texture2d<float, access::sample> capturedImageTextureY [[ texture(kTextureIndexY) ]],
+                                       texture2d<float, access::sample> capturedImageTextureCbCr [[ texture(kTextureIndexCbCr) ]],
+                                       device atomic_uint *histogram [[ buffer(kBufferIndexCameraLuminanceHistogram) ]],
+                                       constant CameraLuminanceUniforms &uniforms [[ buffer(kBufferIndexCameraLuminanceUniforms) ]],
+                                       uint2 tpig [[ thread_position_in_grid ]],
+                                       uint tiitg [[ thread_index_in_threadgroup ]],
+                                       uint2 tptg [[ threads_per_threadgroup ]]
+                                       ) {
+    
+    constexpr sampler luminanceSampler(coord::normalized, address::clamp_to_edge, filter::linear);
+    threadgroup atomic_uint localHistogram[kCameraLuminanceHistogramLength];
+    
+    uint threadCount = tptg.x * tptg.y;
+    for (uint index = tiitg; index < kCameraLuminanceHistogramLength; index += threadCount) {
+        atomic_store_explicit(&localHistogram[index], 0, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    
+    if (tpig.x < uniforms.sampleGridSize.x && tpig.y < uniforms.sampleGridSize.y) {
+        
+        float2 uv = (float2(tpig) + 0.5) / float2(uniforms.sampleGridSize);
+        float3 color = cameraLinearColor(capturedImageTextureY.sample(luminanceSampler, uv), capturedImageTextureCbCr.sample(luminanceSampler, uv));
+        float luminance = dot(color, float3(0.2126, 0.7152, 0.0722));
+        
+        // Black pixels land in the first bin
+        float logLuminance = luminance > 0 ? log2(luminance) : uniforms.minLogLuminance;
+        float normalized = saturate((logLuminance - uniforms.minLogLuminance) / uniforms.logLuminanceRange);
+        uint bin = min(uint(normalized * kCameraLuminanceHistogramBinCount), uint(kCameraLuminanceHistogramBinCount - 1));
+        
+        uint3 colorSum = uint3(round(color * kCameraLuminanceColorSumScale));
+        atomic_fetch_add_explicit(&localHistogram[bin], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&localHistogram[kCameraLuminanceHistogramSampleCountIndex], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&localHistogram[kCameraLuminanceHistogramRedSumIndex], colorSum.r, memory_order_relaxed);
+        atomic_fetch_add_explicit(&localHistogram[kCameraLuminanceHistogramGreenSumIndex], colorSum.g, memory_order_relaxed);
+        atomic_fetch_add_explicit(&localHistogram[kCameraLuminanceHistogramBlueSumIndex], colorSum.b, memory_order_relaxed);
+        
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    
+    for (uint index = tiitg; index < kCameraLuminanceHistogramRedSumHighIndex; index += threadCount) {
+        uint value = atomic_load_explicit(&localHistogram[index], memory_order_relaxed);
+        if (index >= kCameraLuminanceHistogramRedSumIndex) {
+            uint highWord = value / kCameraLuminanceColorSumWordSize;
+            value -= highWord * kCameraLuminanceColorSumWordSize;
+            if (highWord > 0) {
+                atomic_fetch_add_explicit(&histogram[index + kCameraLuminanceHistogramRedSumHighIndex - kCameraLuminanceHistogramRedSumIndex], highWord, memory_order_relaxed);
+            }
+        }
+        if (value > 0) {
+            atomic_fetch_add_explicit(&histogram[index], value, memory_order_relaxed);
+        }
+    }
+    
+}
+
+// MARK: - Depth Pyramid
+
+// Projects linear real world depth into the depth range of the scene. Returns the far plane where there is no depth.
+float realWorldSceneDepth(float linearDepth, float4x4 projectionMatrix) {
+    if (linearDepth <= 0.0) {
+        return 1.0;
+    }
+    return clamp((projectionMatrix[2][2] * -linearDepth + projectionMatrix[3][2]) / (projectionMatrix[2][3] * -linearDepth + projectionMatrix[3][3]), 0.0, 1.0);
+}
+
+// Builds level 0 of the hierarchical depth pyramid at half the resolution of the scene depth. Each texel keeps the farthest depth of the scene texels it covers. Where a person completely covers the camera image their real world depth is used when it is nearer than the virtual content. Mirrored by `OcclusionCulling.seedLevel` on the host.
+kernel void depth_pyramid_seed(depth2d<float, access::read> sceneDepthTexture [[ texture(kTextureIndexSceneDepth) ]],
+                               texture2d<float, access::sample> alphaTexture [[ texture(kTextureIndexAlpha) ]],
+                               texture2d<float, access::sample> dilatedDepthTexture [[ texture(kTextureIndexDialatedDepth) ]],
+                               texture2d<float, access::write> destination [[ texture(kTextureIndexDepthPyramidDestination) ]],
+                               constant DepthPyramidUniforms &uniforms [[ buffer(kBufferIndexDepthPyramidUniforms) ]],
+                               uint2 tpig [[ thread_position_in_grid ]]
+                               ) {
+    
+    uint2 destinationSize = uint2(destination.get_width(), destination.get_height());
+    if (tpig.x >= destinationSize.x || tpig.y >= destinationSize.y) {
+        return;
+    }
+    
+    // Nearest filtering so that the soft edges of the matte never pull the real world depth towards the camera
+    constexpr sampler matteSampler(coord::normalized, address::clamp_to_edge, filter::nearest);
+    
+    // The last row and column also cover the remainder of odd sizes
+    uint2 sourceSize = uint2(sceneDepthTexture.get_width(), sceneDepthTexture.get_height());
+    uint2 first = tpig * 2;
+    uint2 last = select(min(first + 1, sourceSize - 1), sourceSize - 1, tpig == destinationSize - 1);
+    
+    float farthestDepth = 0.0;
+    for (uint y = first.y; y <= last.y; y++) {
+        for (uint x = first.x; x <= last.x; x++) {
+            float depth = sceneDepthTexture.read(uint2(x, y));
+            if (uniforms.useRealDepth) {
+                float3 sceneTexCoord = float3((float2(x, y) + 0.5) / float2(sourceSize), 1.0);
+                float2 cameraTexCoord = float2(dot(uniforms.cameraTexCoordTransformX, sceneTexCoord), dot(uniforms.cameraTexCoordTransformY, sceneTexCoord));
+                if (alphaTexture.sample(matteSampler, cameraTexCoord).r >= 0.99) {
+                    depth = min(depth, realWorldSceneDepth(dilatedDepthTexture.sample(matteSampler, cameraTexCoord).r, uniforms.projectionMatrix));
+                }
+            }
+            farthestDepth = max(farthestDepth, depth);
+        }
+    }
+    
+    destination.write(float4(farthestDepth), tpig);
+    
+}
+
+// Reduces one level of the depth pyramid into the next, keeping the farthest depth. Mirrored by `OcclusionCulling.downsample` on the host.
+kernel void depth_pyramid_downsample(texture2d<float, access::read> source [[ texture(kTextureIndexDepthPyramidSource) ]],
+                                     texture2d<float, access::write> destination [[ texture(kTextureIndexDepthPyramidDestination) ]],
+                                     uint2 tpig [[ thread_position_in_grid ]]
+                                     ) {
+    
+    uint2 destinationSize = uint2(destination.get_width(), destination.get_height());
+    if (tpig.x >= destinationSize.x || tpig.y >= destinationSize.y) {
+        return;
+    }
+    
+    // The last row and column also cover the remainder of odd sizes
+    uint2 sourceSize = uint2(source.get_width(), source.get_height());
+    uint2 first = tpig * 2;
+    uint2 last = select(min(first + 1, sourceSize - 1), sourceSize - 1, tpig == destinationSize - 1);
+    
+    float farthestDepth = 0.0;
+    for (uint y = first.y; y <= last.y; y++) {
+        for (uint x = first.x; x <= last.x; x++) {
+            farthestDepth = max(farthestDepth, source.read(uint2(x, y)).r);
+        }
+    }
+    
+    destination.write(float4(farthestDepth), tpig);
+    
+}
@@ -167,7 +167,7 @@ float3 importanceSamplingNdfDggx(float2 u, float3 n, float roughness) {
     float cosTheta2 = (1.0 - u.y) / (1.0 + (a2 - 1.0) * u.y);
     float cosTheta = sqrt(cosTheta2);
     float sinTheta = sqrt(1.0 - cosTheta2);
-    float3 h = (cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+    float3 h = float3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
     
     float3 up = fabs(n.z) < 0.999 ? float3(0, 0, 1) : float3(1, 0, 0);
     float3x3 tangentToWorld;
@@ -218,6 +218,12 @@ float prefilteredImportanceSampling(float ipdf, float2 iblMaxMipLevel) {
     return mipLevel;
 }
 
+// The level of the prefiltered specular cube map to sample for a perceptual roughness. Must match `RoughnessMapping.filament` which is used to generate the levels on the host.
+float perceptualRoughnessToIBLLod(float perceptualRoughness, float maxLod) {
+    float roughness = saturate(perceptualRoughness);
+    return maxLod * roughness * (2.0 - roughness);
+}
+
 //float3 isEvaluateIBL(LightingParameters parameters, float3 n, float3 v, float nDotv) {
 //    // TODO: for a true anisotropic BRDF, we need a real tangent space;
 //
@@ -201,13 +201,91 @@ kernel void compute_prefiltered_specular(
                                          constant float &roughness [[buffer(kBufferIndexLODRoughness)]],
                                          uint3 tpig [[thread_position_in_grid]]
                                          ) {
-    float cubeSize = specularMap.get_width();
-    float2 cubeUV = ((float2(tpig.xy) / cubeSize) * 2 - 1);
+    // `specularMap` is a view of a single level and the grid is sized to that level on the host. Guard anyway in case the grid was rounded up to whole threadgroups.
+    uint cubeSize = specularMap.get_width();
+    if (tpig.x >= cubeSize || tpig.y >= cubeSize) {
+        return;
+    }
+    // Sample through the texel center
+    float2 cubeUV = (((float2(tpig.xy) + 0.5) / float(cubeSize)) * 2 - 1);
     int face = tpig.z;
     float3 dir = cubeDirectionFromUVAndFace(cubeUV, face);
     dir *= float3(-1, -1, 1);
-    float3 irrad = prefilterEnvMap(roughness, dir, environmentCubemap);
+    // A perfectly smooth surface only reflects the mirror direction so level 0 is a copy of the environment
+    float3 irrad = roughness == 0.0 ? float3(environmentCubemap.sample(cubeSampler, dir, level(0)).rgb) : prefilterEnvMap(roughness, dir, environmentCubemap);
     uint2 coords = tpig.xy;
     float4 color = float4(irrad, 1.0);
     specularMap.write(color, coords, face);
 }
+
+//
+// Environment capture
+//
+
+// Defined in CompositeShaders.metal
+float4 ycbcrToRGBTransform(float4 y, float4 CbCr);
+
+constexpr sampler captureSampler(coord::normalized, address::clamp_to_edge, filter::linear);
+
+// The direction through a texel of a cube map face using the Metal cube map convention. `uv` is in [-1, 1] with v pointing down the face. Mirrored in `EnvironmentCaptureProjection.direction(face:uv:)`
+static float3 cubeTexelDirection(float2 uv, uint face) {
+    switch (face) {
+        case 0: return normalize(float3( 1, -uv.y, -uv.x)); // +X
+        case 1: return normalize(float3(-1, -uv.y,  uv.x)); // -X
+        case 2: return normalize(float3( uv.x,  1,  uv.y)); // +Y
+        case 3: return normalize(float3( uv.x, -1, -uv.y)); // -Y
+        case 4: return normalize(float3( uv.x, -uv.y,  1)); // +Z
+        default: return normalize(float3(-uv.x, -uv.y, -1)); // -Z
+    }
+}
+
+// Projects every texel of the visible tiles into the captured camera frame and blends the result into the accumulated radiance, weighted by how close to the center of the frame the sample is. Mirrored in `EnvironmentCaptureProjection`
+kernel void capture_environment(
+                                texture2d<float, access::sample> capturedImageTextureY [[ texture(kTextureIndexY) ]],
+                                texture2d<float, access::sample> capturedImageTextureCbCr [[ texture(kTextureIndexCbCr) ]],
+                                texturecube<float, access::write> environmentCubemap [[ texture(kTextureIndexEnvironmentMap) ]],
+                                device half4 *accumulation [[ buffer(kBufferIndexEnvironmentCaptureAccumulation) ]],
+                                constant EnvironmentCaptureTile *tiles [[ buffer(kBufferIndexEnvironmentCaptureTiles) ]],
+                                constant EnvironmentCaptureUniforms &uniforms [[ buffer(kBufferIndexEnvironmentCaptureUniforms) ]],
+                                uint3 tpig [[thread_position_in_grid]]
+                                ) {
+    
+    EnvironmentCaptureTile tile = tiles[tpig.z];
+    uint2 texel = uint2(tile.x, tile.y) + tpig.xy;
+    if (tpig.x >= uniforms.tileSize || tpig.y >= uniforms.tileSize || texel.x >= uniforms.faceSize || texel.y >= uniforms.faceSize) {
+        return;
+    }
+    
+    uint index = (tile.face * uniforms.faceSize + texel.y) * uniforms.faceSize + texel.x;
+    float4 accumulated = float4(accumulation[index]);
+    
+    float2 uv = ((float2(texel) + 0.5) / float(uniforms.faceSize)) * 2 - 1;
+    float3 direction = cubeTexelDirection(uv, tile.face);
+    
+    // ARKit cameras look down -z with y up. The captured image has y down.
+    float3 cameraDirection = uniforms.worldToCamera * direction;
+    float weight = 0;
+    float2 imageUV = float2(-1);
+    if (cameraDirection.z < 0) {
+        float3 projected = uniforms.intrinsics * float3(cameraDirection.x, -cameraDirection.y, -cameraDirection.z);
+        imageUV = (projected.xy / projected.z) / uniforms.imageResolution;
+        float edgeDistance = min(min(imageUV.x, 1 - imageUV.x), min(imageUV.y, 1 - imageUV.y));
+        weight = smoothstep(0.0, uniforms.edgeFalloff, edgeDistance) * saturate(-cameraDirection.z);
+    }
+    
+    if (weight <= 0) {
+        if (uniforms.resolveAll != 0) {
+            environmentCubemap.write(float4(accumulated.rgb, 1.0), texel, tile.face);
+        }
+        return;
+    }
+    
+    float4 rgb = ycbcrToRGBTransform(capturedImageTextureY.sample(captureSampler, imageUV), capturedImageTextureCbCr.sample(captureSampler, imageUV));
+    float3 radiance = srgbToLinear(float4(saturate(rgb.rgb), 1.0)).rgb * uniforms.exposureScale;
+    
+    float totalWeight = accumulated.a + weight;
+    float3 color = (accumulated.rgb * accumulated.a + radiance * weight) / totalWeight;
+    accumulation[index] = half4(half3(color), half(min(totalWeight, uniforms.maxConfidence)));
+    environmentCubemap.write(float4(color, 1.0), texel, tile.face);
+    
+}
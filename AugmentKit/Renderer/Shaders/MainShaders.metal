@@ -86,6 +86,9 @@ constant bool has_sheenTint_map [[ function_constant(kFunctionConstantSheenTintM
 constant bool has_clearcoat_map [[ function_constant(kFunctionConstantClearcoatMapIndex) ]];
 constant bool has_clearcoatGloss_map [[ function_constant(kFunctionConstantClearcoatGlossMapIndex) ]];
 constant bool has_any_map = has_base_color_map || has_normal_map || has_metallic_map || has_roughness_map || has_ambient_occlusion_map || has_emission_map || has_subsurface_map || has_specular_map || has_specularTint_map || has_anisotropic_map || has_sheen_map || has_sheenTint_map || has_clearcoat_map || has_clearcoatGloss_map;
+// Set for the lower quality levels. See `RenderUtilities.getFuncConstants(forDrawData:qualityLevel:)`
+constant bool has_half_precision_shading [[ function_constant(kFunctionConstantHalfPrecisionShadingIndex) ]];
+constant bool use_half_precision_shading = is_function_constant_defined(has_half_precision_shading) && has_half_precision_shading;
 
 // See: https://google.github.io/filament/Filament.html#materialsystem/standardmodelsummary
 // Material         Reflectance     IOR             Linear value
@@ -151,6 +154,25 @@ struct ColorInOut {
     float clearcoatMapWeightGlossMapWeight; // Used in LOD calculations
 };
 
+// MARK: Shading Inputs
+// The subset of `LightingParameters` used by `illuminate`, stored at the precision of the shading tier.
+// Directions and dot products are computed at full precision by `calculateParameters` and converted once.
+template <typename T>
+struct ShadingInputs {
+    vec<T, 4> baseColor;
+    vec<T, 4> emissionColor;
+    vec<T, 3> ambientOcclusion;
+    vec<T, 3> reflectedColor;
+    vec<T, 3> f0;
+    T metalness;
+    T roughness;
+    T nDoth;
+    T oneMinusNDotHSquared;
+    T nDotv;
+    T nDotl;
+    T lDoth;
+};
+
 // MARK: - Pipeline Functions
 
 constexpr sampler linearSampler (address::repeat, min_filter::linear, mag_filter::linear, mip_filter::linear);
@@ -167,8 +189,9 @@ float3 computeF0(float4 baseColor, float metallic, float reflectance) {
     return baseColor.rgb * metallic + (reflectance * (1.0 - metallic));
 }
 
-float3 computeDiffuseColor(float4 baseColor, float metallic) {
-    return baseColor.rgb * (1.0 - metallic);
+template <typename T>
+vec<T, 3> computeDiffuseColor(vec<T, 4> baseColor, T metallic) {
+    return baseColor.rgb * (T(1.0) - metallic);
 }
 
 float3 computeNormalMap(ColorInOut in, texture2d<float> normalMapTexture) {
@@ -179,31 +202,35 @@ float3 computeNormalMap(ColorInOut in, texture2d<float> normalMapTexture) {
 
 /// The Cook-Torrance approximation of the microfacet model integration
 /// Fr(v, l) = D(h, α) * G(v, l, α) * F(v, h, f0) / 4 * (n⋅v) * (n⋅l)
-float3 computeIsotropicSpecular(LightingParameters parameters) {
+template <typename T>
+vec<T, 3> computeIsotropicSpecular(ShadingInputs<T> parameters) {
     
     // Normal Distribution Function (D):
     // The NDF, also known as the specular distribution, describes the distribution of microfacets for the surface.
     // Determines the size and shape of the highlight.
-    float D = distribution(parameters.roughness, parameters.nDoth);
+    T D = brdf::distribution(parameters.roughness, parameters.nDoth, parameters.oneMinusNDotHSquared);
     
     // Geometric Shadowing. Specular G divided by 4 * nDotv * nDotl which we are calling visibility (V):
     // The geometric shadowing term describes the shadowing from the microfacets.
     // This means ideally it should depend on roughness and the microfacet distribution.
     // The following geometric shadowing models use Smith's method for their respective NDF.
     // Smith breaks G into two components: light and view, and uses the same equation for both.
-    float V = visibility(parameters.roughness, parameters.nDotv, parameters.nDotl);
+    T V = brdf::visibility(parameters.roughness, parameters.nDotv, parameters.nDotl);
     
     // Fresnel Reflectance (F):
     // The fraction of incoming light that is reflected as opposed to refracted from a flat surface at a given lighting angle.
     // Fresnel Reflectance goes to 1 as the angle of incidence goes to 90º. The value of Fresnel Reflectance at 0º
     // is the specular reflectance color.
-    float3 F = fresnel(parameters.f0, parameters.lDoth);
+    vec<T, 3> F = brdf::fresnel(parameters.f0, parameters.lDoth);
+    
+    // D and V both peak at grazing angles. Clamping their product keeps the `half` tier from overflowing.
+    T DV = min(D * V, brdf::maxValue<T>());
 
     // This is the return value for the standard model but it doesn't include any contribution from the environment map towards the specular reflections. Fully implementing IBL would solve for this.
 //    return D * V * F;
     
     // In the mean time, this is an approximation of how the environment map would contribute to the specular reflections. All the other terms asside from D, V, and F are just a way of encorporating the environment into the specular reflection but the better way to do this would be to fullt implement IBL.
-    return (D * V * F * parameters.reflectedColor) * (1.0 + parameters.metalness * parameters.baseColor.rgb) + parameters.reflectedColor * parameters.metalness * parameters.baseColor.rgb;
+    return (DV * F * parameters.reflectedColor) * (T(1.0) + parameters.metalness * parameters.baseColor.rgb) + parameters.reflectedColor * parameters.metalness * parameters.baseColor.rgb;
 }
 
 /// From Filament implementation
@@ -238,16 +265,17 @@ float3 computeIsotropicSpecular(LightingParameters parameters) {
 //    return (D * V) * F;
 //}
 
-float3 computeDiffuse(LightingParameters parameters) {
+template <typename T>
+vec<T, 3> computeDiffuse(ShadingInputs<T> parameters) {
     
     // Filament implementation
     
     // For Cloth or Clearcoat Gloss use the following
-//    float3 diffuseColor = parameters.baseColor.rgb;
+//    vec<T, 3> diffuseColor = parameters.baseColor.rgb;
     
     // For standard model diffuse color use the following
-    float3 diffuseColor = computeDiffuseColor(parameters.baseColor, parameters.metalness);
-    diffuseColor = diffuseColor * diffuse(parameters.roughness, parameters.nDotv, parameters.nDotl, parameters.lDoth);
+    vec<T, 3> diffuseColor = computeDiffuseColor(parameters.baseColor, parameters.metalness);
+    diffuseColor = diffuseColor * brdf::diffuse(parameters.roughness, parameters.nDotv, parameters.nDotl, parameters.lDoth);
     return diffuseColor;
     
 }
@@ -262,7 +290,8 @@ float3 computeIBLDiffuse(LightingParameters parameters, texturecube<float> diffu
     return iblContribution;
 }
 
-float3 computeSpecular(LightingParameters parameters) {
+template <typename T>
+vec<T, 3> computeSpecular(ShadingInputs<T> parameters) {
     
     // Filament implementation
     
@@ -338,13 +367,14 @@ float3 computeSheen(LightingParameters parameters) {
 }
 
 // all input colors must be linear, not SRGB.
-float4 illuminate(LightingParameters parameters) {
+template <typename T>
+vec<T, 4> illuminate(ShadingInputs<T> parameters) {
     
     // DIFFUSE
-    float3 diffuseOut = computeDiffuse(parameters);
+    vec<T, 3> diffuseOut = computeDiffuse(parameters);
     
     // SPECULAR
-    float3 specularOut = computeSpecular(parameters);
+    vec<T, 3> specularOut = computeSpecular(parameters);
     
 //    float3 color;
 //    if clearcoat {
@@ -376,8 +406,38 @@ float4 illuminate(LightingParameters parameters) {
 //    }
 //    return (color * parameters.colorIntensity.rgb) * (parameters.colorIntensity.w * parameters.attenuation * parameters.nDotl * parameters.ambientOcclusion);
 
-    return float4(parameters.ambientOcclusion, 1) * float4(diffuseOut + specularOut + parameters.emissionColor.xyz, 1) * float4(1.0, 1.0, 1.0, parameters.baseColor.w);
+    return vec<T, 4>(parameters.ambientOcclusion, T(1.0)) * vec<T, 4>(diffuseOut + specularOut + parameters.emissionColor.xyz, T(1.0)) * vec<T, 4>(T(1.0), T(1.0), T(1.0), parameters.baseColor.w);
+
+}
 
+template <typename T>
+ShadingInputs<T> shadingInputs(LightingParameters parameters) {
+    
+    ShadingInputs<T> inputs;
+    inputs.baseColor = vec<T, 4>(parameters.baseColor);
+    inputs.emissionColor = vec<T, 4>(parameters.emissionColor);
+    inputs.ambientOcclusion = vec<T, 3>(parameters.ambientOcclusion);
+    inputs.reflectedColor = vec<T, 3>(parameters.reflectedColor);
+    inputs.f0 = vec<T, 3>(parameters.f0);
+    inputs.metalness = T(parameters.metalness);
+    inputs.roughness = max(T(parameters.roughness), brdf::minRoughness<T>());
+    inputs.nDoth = T(parameters.nDoth);
+    // Computed before the conversion because it cancels catastrophically at the peak of the highlight
+    inputs.oneMinusNDotHSquared = T(1.0 - parameters.nDoth * parameters.nDoth);
+    inputs.nDotv = T(parameters.nDotv);
+    inputs.nDotl = T(parameters.nDotl);
+    inputs.lDoth = T(parameters.lDoth);
+    return inputs;
+    
+}
+
+// Shades in `half` when the pipeline was built for one of the lower quality levels and in `float` otherwise.
+float4 illuminate(LightingParameters parameters) {
+    if (use_half_precision_shading) {
+        return float4(illuminate(shadingInputs<half>(parameters)));
+    } else {
+        return illuminate(shadingInputs<float>(parameters));
+    }
 }
 
 LightingParameters calculateParameters(ColorInOut in,
@@ -695,6 +755,12 @@ vertex ColorInOut anchorGeometryVertexTransform(Vertex in [[stage_in]],
     float3 tangent = in.tangent;
     int argumentBufferIndex = drawCallIndex;
     
+    // Collapse instances that were found to be occluded during precalculation
+    if (arguments[argumentBufferIndex].isOccluded != 0) {
+        out.position = float4(0.0, 0.0, 0.0, 1.0);
+        return out;
+    }
+    
     float3x3 normalMatrix = arguments[argumentBufferIndex].normalMatrix;
     float4x4 modelViewMatrix = arguments[argumentBufferIndex].modelViewMatrix;
     float4x4 modelViewProjectionMatrix = arguments[argumentBufferIndex].modelViewProjectionMatrix;
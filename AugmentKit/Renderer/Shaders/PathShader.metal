@@ -60,6 +60,12 @@ vertex PathFragmentInOut pathVertexShader(PathVertexIn in [[stage_in]],
     float4 position = in.position;
     int argumentBufferIndex = drawCallIndex;
     
+    // Collapse instances that were found to be occluded during precalculation
+    if (arguments[argumentBufferIndex].isOccluded != 0) {
+        out.position = float4(0.0, 0.0, 0.0, 1.0);
+        return out;
+    }
+    
     float4x4 modelViewProjectionMatrix = arguments[argumentBufferIndex].modelViewProjectionMatrix;
     
     out.position = modelViewProjectionMatrix * position;
@@ -20,6 +20,8 @@ kernel void precalculationComputeShader(constant SharedUniforms &sharedUniforms
                                         constant EnvironmentUniforms &environmentUniforms [[ buffer(kBufferIndexEnvironmentUniforms) ]],
                                         device PrecalculatedParameters *out [[ buffer(kBufferIndexPrecalculationOutputBuffer) ]],
                                         constant uint &instanceCount [[buffer(kBufferIndexInstanceCount)]],
+                                        constant OcclusionCullingUniforms &occlusionCullingUniforms [[ buffer(kBufferIndexOcclusionCullingUniforms) ]],
+                                        texture2d<float, access::sample> depthPyramid [[ texture(kTextureIndexDepthPyramid) ]],
                                         uint2 gid [[thread_position_in_grid]],
                                         uint2 tid [[thread_position_in_threadgroup]],
                                         uint2 size [[threads_per_grid]]
@@ -50,16 +52,12 @@ kernel void precalculationComputeShader(constant SharedUniforms &sharedUniforms
     
     float4x4 locationTransform = anchorInstanceUniforms[index].locationTransform;
 
-    // Update Heading
-    float4x4 headingTransform = anchorInstanceUniforms[index].headingTransform;
-    float headingType = float(anchorInstanceUniforms[index].headingType);
-    // FIXME: This transformcalculation is incorrect when headingType = 0 i.e. absolute heading. It is naive to assume that locationTransform[0][0], locationTransform[1][1], and locationTransform[2][2] have no rotational components
-    locationTransform =  float4x4(float4(locationTransform[0][0], headingType * locationTransform[0][1], headingType * locationTransform[0][2], headingType * locationTransform[0][3]),
-                                        float4(headingType * locationTransform[1][0], locationTransform[1][1], headingType * locationTransform[1][2], headingType * locationTransform[1][3]),
-                                        float4(headingType * locationTransform[2][0], headingType * locationTransform[2][1], locationTransform[2][2], headingType * locationTransform[2][3]),
-                                        float4(locationTransform[3][0], locationTransform[3][1], locationTransform[3][2], 1)
-                                        ) * headingTransform;
-
+    // Update Heading. Entities without a heading (targets, trackers) keep the orientation of their location.
+    if (hasHeading != 0) {
+        float4 headingRotation = anchorInstanceUniforms[index].headingRotation;
+        int headingType = anchorInstanceUniforms[index].headingType;
+        locationTransform = composeLocationAndHeading(locationTransform, headingRotation, headingType);
+    }
     
     float4x4 modelMatrix = locationTransform * coordinateSpaceTransform;
     
@@ -73,12 +71,24 @@ kernel void precalculationComputeShader(constant SharedUniforms &sharedUniforms
     
     float4x4 shadowMVPTransformMatrix = environmentUniforms.shadowMVPTransformMatrix;
     float4x4 directionalLightMVP = environmentUniforms.directionalLightMVP;
+    float4x4 directionalLightModelMatrix = directionalLightMVP * modelMatrix;
+    
+    // Instances whose bounds fall outside of the light's frustum are skipped by the shadow pass. A radius of 0 means the bounds are unknown.
+    float4 boundingSphere = anchorInstanceUniforms[index].boundingSphere;
+    int castsShadow = hasGeometry != 0 && (boundingSphere.w <= 0 || isSphereInFrustum(directionalLightModelMatrix, boundingSphere)) ? 1 : 0;
+    
+    // Instances hidden behind the depth of the previous frame are skipped by the main pass. The pyramid is a frame old so the bounds are projected with the previous view projection.
+    int isOccluded = 0;
+    if (hasGeometry != 0 && occlusionCullingUniforms.isEnabled != 0) {
+        float4x4 previousModelViewProjectionMatrix = occlusionCullingUniforms.viewProjectionMatrix * modelMatrix;
+        isOccluded = isSphereOccluded(previousModelViewProjectionMatrix, boundingSphere, depthPyramid, occlusionCullingUniforms.pyramidSize, occlusionCullingUniforms.levelCount) ? 1 : 0;
+    }
     
     out[index].hasGeometry = hasGeometry;
     out[index].worldTransform = worldTransform;
     out[index].hasHeading = hasHeading;
     out[index].headingTransform = headingTransform;
-    out[index].headingType = int(headingType);
+    out[index].headingType = headingType;
     out[index].coordinateSpaceTransform = coordinateSpaceTransform;
     out[index].locationTransform = locationTransform;
     out[index].modelMatrix = modelMatrix;
@@ -88,6 +98,9 @@ kernel void precalculationComputeShader(constant SharedUniforms &sharedUniforms
     out[index].modelViewProjectionMatrix = modelViewProjectionMatrix;
     out[index].shadowMVPTransformMatrix = shadowMVPTransformMatrix;
     out[index].directionalLightMVP = directionalLightMVP;
+    out[index].directionalLightModelMatrix = directionalLightModelMatrix;
+    out[index].castsShadow = castsShadow;
+    out[index].isOccluded = isOccluded;
     out[index].useDepth = sharedUniforms.useDepth;
     out[index].mapWeights[0] = anchorInstanceUniforms[index].mapWeights[0];
     out[index].mapWeights[1] = anchorInstanceUniforms[index].mapWeights[1];
@@ -30,6 +30,7 @@ using namespace metal;
 
 // Include header shared between this Metal shader code and C code executing Metal API commands
 #import "../ShaderTypes.h"
+#import "../Common.h"
 
 struct ShadowVertex {
     float3 position [[attribute(kVertexAttributePosition)]];
@@ -43,24 +44,111 @@ vertex ShadowOutput shadowVertexShader( ShadowVertex in [[stage_in]],
                                        device PrecalculatedParameters *arguments [[ buffer(kBufferIndexPrecalculationOutputBuffer) ]],
                                        constant int &drawCallIndex [[ buffer(kBufferIndexDrawCallIndex) ]],
                                        constant int &drawCallGroupIndex [[ buffer(kBufferIndexDrawCallGroupIndex) ]],
+                                       constant uint *casterInstances [[ buffer(kBufferIndexShadowCasterInstances) ]],
                                        uint vid [[ vertex_id ]],
-                                       ushort iid [[instance_id]]
+                                       uint iid [[instance_id]]
                                        ){
     
     ShadowOutput out;
     
+    // Every instance of a shadow caster draw maps to its own draw call in the argument buffer. See DrawCallInstanceTable.
+    uint argumentBufferIndex = casterInstances[iid];
+    
+    // Collapse instances that were culled against the light's frustum during precalculation
+    if (arguments[argumentBufferIndex].castsShadow == 0) {
+        out.position = float4(0.0, 0.0, 0.0, 1.0);
+        return out;
+    }
+    
     // Make position a float4 to perform 4x4 matrix math on it
     float4 position = float4(in.position, 1.0);
-    int argumentBufferIndex = drawCallIndex;
     
-    float4x4 modelMatrix = arguments[argumentBufferIndex].modelMatrix;
+    // Calculate the position of our vertex in clip space and output for clipping and rasterization. The light and model matrices are combined once per instance during precalculation.
+    out.position = arguments[argumentBufferIndex].directionalLightModelMatrix * position;
+    
+    return out;
+}
+
+// Draws one surface of the batched surface draw into the shadow map. The surfaces are read from the shared arenas like `rawSurfaceBatchVertexTransform` does and have already been culled against the light's frustum by `surface_batch_cull`.
+vertex ShadowOutput surfaceBatchShadowVertexShader(device RawVertexBuffer *vertexData [[ buffer(kBufferIndexRawVertexData) ]],
+                                                   device ushort *indexData [[ buffer(kBufferIndexSurfaceIndices) ]],
+                                                   device SurfaceInstance *surfaceInstances [[ buffer(kBufferIndexSurfaceInstances) ]],
+                                                   device PrecalculatedParameters *arguments [[ buffer(kBufferIndexPrecalculationOutputBuffer) ]],
+                                                   uint vid [[ vertex_id ]],
+                                                   uint iid [[ instance_id ]]
+                                                   ){
     
-    float4x4 directionalLightMVP = arguments[argumentBufferIndex].directionalLightMVP;
+    ShadowOutput out;
     
-    // Calculate the position of our vertex in clip space and output for clipping and rasterization
-    position =  directionalLightMVP * modelMatrix * position;
+    SurfaceInstance surfaceInstance = surfaceInstances[iid];
+    float3 position = vertexData[surfaceInstance.vertexStart + indexData[surfaceInstance.indexStart + vid]].position;
     
-    out.position = position;
+    out.position = arguments[surfaceInstance.argumentBufferIndex].directionalLightModelMatrix * float4(position, 1.0);
     
     return out;
 }
+
+// MARK: - Shadow Moments
+
+// The unnormalized weight of a tap `offset` texels from the center of the gaussian blur
+static float shadowMomentBlurWeight(int offset, float sigma) {
+    return exp(-float(offset * offset) / (2.0 * sigma * sigma));
+}
+
+// Converts the shadow map into quantized moments at half of its resolution and blurs them along `uniforms.direction`. Each moment texel averages the 2x2 block of shadow map texels it covers. Mirrored by `ShadowMoments.filterReference` on the host.
+kernel void shadow_moments_generate(depth2d<float, access::read> shadowMap [[ texture(kTextureIndexShadowMap) ]],
+                                    texture2d<float, access::write> destination [[ texture(kTextureIndexShadowMomentsDestination) ]],
+                                    constant ShadowMomentUniforms &uniforms [[ buffer(kBufferIndexShadowMomentUniforms) ]],
+                                    uint2 tpig [[ thread_position_in_grid ]]
+                                    ) {
+    
+    int2 destinationSize = int2(destination.get_width(), destination.get_height());
+    if (int(tpig.x) >= destinationSize.x || int(tpig.y) >= destinationSize.y) {
+        return;
+    }
+    
+    uint2 sourceSize = uint2(shadowMap.get_width(), shadowMap.get_height());
+    
+    float4 filteredMoments = float4(0.0);
+    float totalWeight = 0.0;
+    for (int i = -uniforms.radius; i <= uniforms.radius; i++) {
+        uint2 texel = uint2(clamp(int2(tpig) + i * uniforms.direction, int2(0), destinationSize - 1));
+        uint2 first = texel * 2;
+        uint2 last = min(first + 1, sourceSize - 1);
+        float4 moments = quantizeShadowMoments(shadowMap.read(first));
+        moments += quantizeShadowMoments(shadowMap.read(uint2(last.x, first.y)));
+        moments += quantizeShadowMoments(shadowMap.read(uint2(first.x, last.y)));
+        moments += quantizeShadowMoments(shadowMap.read(last));
+        float weight = shadowMomentBlurWeight(i, uniforms.sigma);
+        filteredMoments += weight * 0.25 * moments;
+        totalWeight += weight;
+    }
+    
+    destination.write(filteredMoments / totalWeight, tpig);
+    
+}
+
+// Blurs quantized moments along `uniforms.direction`. Mirrored by `ShadowMoments.filterReference` on the host.
+kernel void shadow_moments_blur(texture2d<float, access::read> source [[ texture(kTextureIndexShadowMomentsSource) ]],
+                                texture2d<float, access::write> destination [[ texture(kTextureIndexShadowMomentsDestination) ]],
+                                constant ShadowMomentUniforms &uniforms [[ buffer(kBufferIndexShadowMomentUniforms) ]],
+                                uint2 tpig [[ thread_position_in_grid ]]
+                                ) {
+    
+    int2 destinationSize = int2(destination.get_width(), destination.get_height());
+    if (int(tpig.x) >= destinationSize.x || int(tpig.y) >= destinationSize.y) {
+        return;
+    }
+    
+    float4 filteredMoments = float4(0.0);
+    float totalWeight = 0.0;
+    for (int i = -uniforms.radius; i <= uniforms.radius; i++) {
+        uint2 texel = uint2(clamp(int2(tpig) + i * uniforms.direction, int2(0), destinationSize - 1));
+        float weight = shadowMomentBlurWeight(i, uniforms.sigma);
+        filteredMoments += weight * source.read(texel);
+        totalWeight += weight;
+    }
+    
+    destination.write(filteredMoments / totalWeight, tpig);
+    
+}
@@ -35,6 +35,7 @@ using namespace metal;
 constant bool has_base_color_map [[ function_constant(kFunctionConstantBaseColorMapIndex) ]];
 constexpr sampler linearSampler (address::repeat, min_filter::linear, mag_filter::linear, mip_filter::linear);
 constexpr sampler shadowSampler(coord::normalized, filter::linear, mip_filter::none, address::clamp_to_edge, compare_func::less);
+constexpr sampler shadowMomentSampler(coord::normalized, filter::linear, mip_filter::none, address::clamp_to_edge);
 
 struct SurfaceVertex {
     float3 position      [[attribute(kVertexAttributePosition)]];
@@ -83,8 +84,8 @@ vertex SurfaceVertexOutput surfaceGeometryVertexTransform(SurfaceVertex in [[sta
     }
     
     // Shadow Coord
-    float4x4 directionalLightMVP = arguments[argumentBufferIndex].directionalLightMVP;
-    out.shadowCoord = (arguments[argumentBufferIndex].shadowMVPTransformMatrix * directionalLightMVP * modelMatrix * position).xyz;
+    float4x4 directionalLightModelMatrix = arguments[argumentBufferIndex].directionalLightModelMatrix;
+    out.shadowCoord = (arguments[argumentBufferIndex].shadowMVPTransformMatrix * directionalLightModelMatrix * position).xyz;
     
     out.iid = iid;
     
@@ -122,14 +123,85 @@ vertex SurfaceVertexOutput rawSurfaceGeometryVertexTransform(SurfaceVertex in [[
     }
     
     // Shadow Coord
-    float4x4 directionalLightMVP = arguments[argumentBufferIndex].directionalLightMVP;
-    out.shadowCoord = (arguments[argumentBufferIndex].shadowMVPTransformMatrix * directionalLightMVP * modelMatrix * position).xyz;
+    float4x4 directionalLightModelMatrix = arguments[argumentBufferIndex].directionalLightModelMatrix;
+    out.shadowCoord = (arguments[argumentBufferIndex].shadowMVPTransformMatrix * directionalLightModelMatrix * position).xyz;
     
     out.iid = iid;
     
     return out;
 }
 
+// Culls every surface in the batch once and writes the indirect draw arguments of its instance. Visible surfaces draw their own `indexCount` vertices and culled surfaces draw none. The camera passes cull against the view frustum and the render distance, the shadow pass against the directional light's frustum.
+kernel void surface_batch_cull(device SurfaceInstance *surfaceInstances [[ buffer(kBufferIndexSurfaceInstances) ]],
+                               constant SurfaceBatchUniforms &batchUniforms [[ buffer(kBufferIndexSurfaceBatchUniforms) ]],
+                               device PrecalculatedParameters *arguments [[ buffer(kBufferIndexPrecalculationOutputBuffer) ]],
+                               uint iid [[ thread_position_in_grid ]]) {
+    
+    // The grid is rounded up to whole threadgroups
+    if (iid >= batchUniforms.instanceCount) {
+        return;
+    }
+    
+    SurfaceInstance surfaceInstance = surfaceInstances[iid];
+    int argumentBufferIndex = surfaceInstance.argumentBufferIndex;
+    
+    bool isVisible;
+    if (batchUniforms.cullsAgainstLight != 0) {
+        isVisible = arguments[argumentBufferIndex].castsShadow != 0 && isSphereInFrustum(arguments[argumentBufferIndex].directionalLightModelMatrix, surfaceInstance.boundingSphere);
+    } else {
+        float3 viewCenter = (arguments[argumentBufferIndex].modelViewMatrix * float4(surfaceInstance.boundingSphere.xyz, 1.0)).xyz;
+        isVisible = length(viewCenter) - surfaceInstance.boundingSphere.w < batchUniforms.renderDistance && isSphereInFrustum(arguments[argumentBufferIndex].modelViewProjectionMatrix, surfaceInstance.boundingSphere);
+    }
+    
+    // The base instance is included in the `instance_id` of the vertex functions so each draw reads its own entry in the table
+    surfaceInstances[iid].drawArguments.vertexCount = isVisible ? surfaceInstance.indexCount : 0;
+    surfaceInstances[iid].drawArguments.instanceCount = isVisible ? 1 : 0;
+    surfaceInstances[iid].drawArguments.vertexStart = 0;
+    surfaceInstances[iid].drawArguments.baseInstance = iid;
+    
+}
+
+// Draws one surface of the batch. Every surface is drawn indirectly with the arguments written by `surface_batch_cull` so each vertex invocation fetches one of the surface's indices and the vertex it refers to from the shared arenas.
+vertex SurfaceVertexOutput rawSurfaceBatchVertexTransform(device RawVertexBuffer *vertexData [[ buffer(kBufferIndexRawVertexData) ]],
+                                                          device ushort *indexData [[ buffer(kBufferIndexSurfaceIndices) ]],
+                                                          device SurfaceInstance *surfaceInstances [[ buffer(kBufferIndexSurfaceInstances) ]],
+                                                          device PrecalculatedParameters *arguments [[ buffer(kBufferIndexPrecalculationOutputBuffer) ]],
+                                                          uint vid [[vertex_id]],
+                                                          uint iid [[instance_id]]) {
+    SurfaceVertexOutput out;
+    
+    SurfaceInstance surfaceInstance = surfaceInstances[iid];
+    int argumentBufferIndex = surfaceInstance.argumentBufferIndex;
+    
+    RawVertexBuffer vertex = vertexData[surfaceInstance.vertexStart + indexData[surfaceInstance.indexStart + vid]];
+    
+    // Make position a float4 to perform 4x4 matrix math on it
+    float4 position = float4(vertex.position, 1.0);
+    
+    float3x3 normalMatrix = arguments[argumentBufferIndex].normalMatrix;
+    float4x4 modelViewProjectionMatrix = arguments[argumentBufferIndex].modelViewProjectionMatrix;
+    
+    out.position = modelViewProjectionMatrix * position;
+    
+    // Rotate our normals to world coordinates
+    out.normal = normalMatrix * vertex.normal;
+    out.tangent = normalMatrix * vertex.tangent;
+    
+    // Texture Coord
+    if (has_base_color_map) {
+        out.texCoord = float2(vertex.texCoord.x, 1.0f - vertex.texCoord.y);
+    }
+    
+    // Shadow Coord
+    float4x4 directionalLightModelMatrix = arguments[argumentBufferIndex].directionalLightModelMatrix;
+    out.shadowCoord = (arguments[argumentBufferIndex].shadowMVPTransformMatrix * directionalLightModelMatrix * position).xyz;
+    
+    // The effects uniforms are indexed by surface rather than by instance id
+    out.iid = surfaceInstance.effectsIndex;
+    
+    return out;
+}
+
 // MARK: A simple fragment shader that uses the base color only
 fragment float4 surfaceFragmentLightingSimple(SurfaceVertexOutput in [[stage_in]],
                                                      constant MaterialUniforms &materialUniforms [[ buffer(kBufferIndexMaterialUniforms) ]],
@@ -137,7 +209,8 @@ fragment float4 surfaceFragmentLightingSimple(SurfaceVertexOutput in [[stage_in]
                                                      constant AnchorEffectsUniforms *anchorEffectsUniforms [[ buffer(kBufferIndexAnchorEffectsUniforms) ]],
                                                      texture2d<float> baseColorMap [[ texture(kTextureIndexColor), function_constant(has_base_color_map) ]],
                                                      texturecube<float> environmentCubemap [[  texture(kTextureIndexEnvironmentMap) ]],
-                                                     depth2d<float> shadowMap [[ texture(kTextureIndexShadowMap) ]]
+                                                     depth2d<float> shadowMap [[ texture(kTextureIndexShadowMap) ]],
+                                                     texture2d<float> shadowMoments [[ texture(kTextureIndexShadowMoments) ]]
                                                      ) {
     
     float4 final_color = float4(0);
@@ -148,7 +221,13 @@ fragment float4 surfaceFragmentLightingSimple(SurfaceVertexOutput in [[stage_in]
     // Draw shadows
     // Compare the depth value in the shadow map to the depth value of the fragment in the sun's.
     // frame of reference.  If the sample is occluded, it will be zero.
-    float shadowSample = shadowMap.sample_compare(shadowSampler, in.shadowCoord.xy, in.shadowCoord.z);
+    // When the prefiltered moments of the shadow map are available a single filtered fetch gives soft edges. See ShadowMomentFilter.
+    float shadowSample;
+    if (!is_null_texture(shadowMoments)) {
+        shadowSample = shadowVisibilityFromMoments(shadowMoments.sample(shadowMomentSampler, in.shadowCoord.xy), in.shadowCoord.z);
+    } else {
+        shadowSample = shadowMap.sample_compare(shadowSampler, in.shadowCoord.xy, in.shadowCoord.z);
+    }
     // Lighten shadow to account for ambient light
     float shadowContribution = shadowSample + 0.4;
     // Clamp shadow values to 1;
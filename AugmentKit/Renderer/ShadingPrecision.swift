@@ -0,0 +1,150 @@
+//
+//  ShadingPrecision.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+
+// MARK: - ShadingPrecision
+
+/// Host side implementation of the BRDF terms in BRDFFunctions.h, generic over the scalar type like the `brdf` templates, so the error of the `half` shading tier can be measured against a `Double` reference on the CPU.
+///
+/// Pipelines for `kQualityLevelHigh` shade in `float`. The lower quality levels shade in `half`. See `RenderUtilities.getFuncConstants(forDrawData:qualityLevel:)`
+enum ShadingPrecision {
+    
+    /// Mirrors `brdf::minRoughness<float>()`
+    static let minimumFullPrecisionRoughness: Double = 0.002025
+    /// Mirrors `brdf::minRoughness<half>()`. Smoother surfaces are shaded with this roughness by the `half` tier.
+    static let minimumHalfPrecisionRoughness: Double = 0.007921
+    
+    /// The largest relative error of each term over a sweep of the parameter space
+    struct ErrorReport {
+        var distribution: Double = 0
+        var visibility: Double = 0
+        var fresnel: Double = 0
+        var specular: Double = 0
+    }
+    
+    // MARK: BRDF
+    
+    /// `brdf::D_GGX`
+    static func distribution<T: BinaryFloatingPoint>(roughness: T, nDoth: T, oneMinusNDotHSquared: T) -> T {
+        let a = nDoth * roughness
+        let k = roughness / (oneMinusNDotHSquared + a * a)
+        return min(k * k / T.pi, T.greatestFiniteMagnitude)
+    }
+    
+    /// `brdf::V_SmithG_GGX`
+    static func visibility<T: BinaryFloatingPoint>(roughness: T, nDotv: T, nDotl: T) -> T {
+        let a2 = roughness * roughness
+        let GsL = 1 / (nDotl + (a2 + (1 - a2) * nDotl * nDotl).squareRoot())
+        let GsV = 1 / (nDotv + (a2 + (1 - a2) * nDotv * nDotv).squareRoot())
+        return min(GsL * GsV, T.greatestFiniteMagnitude)
+    }
+    
+    /// `brdf::fresnel` for a single channel
+    static func fresnel<T: BinaryFloatingPoint>(f0: T, lDoth: T) -> T {
+        let f90 = saturate(f0 * 3 * T(50.0 * 0.33))
+        let x = saturate(1 - lDoth)
+        let x2 = x * x
+        return f0 + (f90 - f0) * x2 * x2 * x
+    }
+    
+    /// The D * V * F product as it is computed in `computeIsotropicSpecular`
+    static func specular<T: BinaryFloatingPoint>(roughness: T, nDoth: T, oneMinusNDotHSquared: T, nDotv: T, nDotl: T, lDoth: T, f0: T) -> T {
+        let D = distribution(roughness: roughness, nDoth: nDoth, oneMinusNDotHSquared: oneMinusNDotHSquared)
+        let V = visibility(roughness: roughness, nDotv: nDotv, nDotl: nDotl)
+        return min(D * V, T.greatestFiniteMagnitude) * fresnel(f0: f0, lDoth: lDoth)
+    }
+    
+    // MARK: Error
+    
+    /**
+     Measures the relative error of the `half` tier against a `Double` reference. Perceptual roughness is swept from the `half` limit to 1 and every dot product from 0.001 (the clamp used by `calculateParameters`) to 1, with extra samples of nDoth close to 1 where the highlight peaks. As in `shadingInputs` in MainShaders.metal, 1 - nDoth² is computed before the conversion.
+     
+     Samples where the reference D * V is not representable in `half` are skipped. Errors are relative to `max(reference, 1.0e-3)` so that terms which are almost black do not dominate.
+     - Parameters:
+        - steps: The number of samples along each dimension
+     */
+    @available(iOS 14.0, *)
+    static func halfPrecisionError(steps: Int = 10) -> ErrorReport {
+        
+        let steps = max(steps, 2)
+        let minimumPerceptualRoughness = minimumHalfPrecisionRoughness.squareRoot()
+        let perceptualRoughnesses = (0..<steps).map { minimumPerceptualRoughness + (1 - minimumPerceptualRoughness) * Double($0) / Double(steps - 1) }
+        let dots = (0..<steps).map { 0.001 + 0.999 * Double($0) / Double(steps - 1) }
+        let peakDots = (0..<steps).map { 1 - pow(10, -6 + 4 * Double($0) / Double(steps - 1)) }
+        let f0s: [Double] = [0.04, 0.5, 1.0]
+        
+        var report = ErrorReport()
+        
+        func relativeError(_ value: Float16, _ reference: Double) -> Double {
+            return abs(Double(value) - reference) / max(reference, 1.0e-3)
+        }
+        
+        for perceptualRoughness in perceptualRoughnesses {
+            let roughness = perceptualRoughness * perceptualRoughness
+            for nDoth in dots + peakDots {
+                let oneMinusNDotHSquared = 1 - nDoth * nDoth
+                let referenceD = distribution(roughness: roughness, nDoth: nDoth, oneMinusNDotHSquared: oneMinusNDotHSquared)
+                let halfD = distribution(roughness: Float16(roughness), nDoth: Float16(nDoth), oneMinusNDotHSquared: Float16(oneMinusNDotHSquared))
+                report.distribution = max(report.distribution, relativeError(halfD, referenceD))
+                for nDotv in dots {
+                    for nDotl in dots {
+                        let referenceV = visibility(roughness: roughness, nDotv: nDotv, nDotl: nDotl)
+                        let halfV = visibility(roughness: Float16(roughness), nDotv: Float16(nDotv), nDotl: Float16(nDotl))
+                        report.visibility = max(report.visibility, relativeError(halfV, referenceV))
+                        guard referenceD * referenceV < Double(Float16.greatestFiniteMagnitude) else {
+                            continue
+                        }
+                        for lDoth in dots {
+                            for f0 in f0s {
+                                let reference = specular(roughness: roughness, nDoth: nDoth, oneMinusNDotHSquared: oneMinusNDotHSquared, nDotv: nDotv, nDotl: nDotl, lDoth: lDoth, f0: f0)
+                                let value = specular(roughness: Float16(roughness), nDoth: Float16(nDoth), oneMinusNDotHSquared: Float16(oneMinusNDotHSquared), nDotv: Float16(nDotv), nDotl: Float16(nDotl), lDoth: Float16(lDoth), f0: Float16(f0))
+                                report.specular = max(report.specular, relativeError(value, reference))
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        
+        for lDoth in dots {
+            for f0 in f0s {
+                report.fresnel = max(report.fresnel, relativeError(fresnel(f0: Float16(f0), lDoth: Float16(lDoth)), fresnel(f0: f0, lDoth: lDoth)))
+            }
+        }
+        
+        return report
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate static func saturate<T: BinaryFloatingPoint>(_ value: T) -> T {
+        return min(max(value, 0), 1)
+    }
+
+}
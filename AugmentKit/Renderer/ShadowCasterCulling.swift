@@ -0,0 +1,87 @@
+//
+//  ShadowCasterCulling.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - ShadowCasterCulling
+
+/// Host side implementation of the shadow caster culling done by `precalculationComputeShader`. Used to validate the shader and to reason about which casters reach the shadow pass.
+///
+/// - The light and model matrices are combined once per instance: `directionalLightModelMatrix = directionalLightMVP * modelMatrix`
+/// - An instance casts a shadow when it has geometry and its model space bounding sphere intersects the frustum of `directionalLightModelMatrix`
+/// - Instances with unknown bounds (a radius of 0) always cast a shadow
+enum ShadowCasterCulling {
+    
+    /// Returns the matrix that takes a position from model space to the light's clip space
+    static func directionalLightModelMatrix(directionalLightMVP: float4x4, modelMatrix: float4x4) -> float4x4 {
+        return directionalLightMVP * modelMatrix
+    }
+    
+    /// Host side implementation of `isSphereInFrustum` in Common.metal. Returns `false` when `sphere` lies completely outside of the frustum of `modelViewProjectionMatrix`. The center of the sphere is in `xyz` and the radius in `w`.
+    static func isSphereInFrustum(modelViewProjectionMatrix: float4x4, sphere: SIMD4<Float>) -> Bool {
+        
+        let transposed = modelViewProjectionMatrix.transpose
+        let row0 = transposed.columns.0
+        let row1 = transposed.columns.1
+        let row2 = transposed.columns.2
+        let row3 = transposed.columns.3
+        
+        // Left, right, bottom, top, near (clip space z starts at 0), far
+        let planes = [row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2]
+        for plane in planes {
+            let normal = SIMD3<Float>(plane.x, plane.y, plane.z)
+            let planeDistance = dot(normal, SIMD3<Float>(sphere.x, sphere.y, sphere.z)) + plane.w
+            if planeDistance < -sphere.w * length(normal) {
+                return false
+            }
+        }
+        return true
+        
+    }
+    
+    /// Returns `true` if the instance should be drawn by the shadow pass
+    static func castsShadow(hasGeometry: Bool, directionalLightModelMatrix: float4x4, boundingSphere: SIMD4<Float>) -> Bool {
+        guard hasGeometry else {
+            return false
+        }
+        return boundingSphere.w <= 0 || isSphereInFrustum(modelViewProjectionMatrix: directionalLightModelMatrix, sphere: boundingSphere)
+    }
+    
+    /// The largest absolute difference between the position produced by the combined matrix and the position produced by applying `directionalLightMVP` and `modelMatrix` one after the other. Used to measure the error introduced by combining the matrices.
+    static func maximumError(directionalLightMVP: float4x4, modelMatrix: float4x4, positions: [SIMD3<Float>]) -> Float {
+        let combined = directionalLightModelMatrix(directionalLightMVP: directionalLightMVP, modelMatrix: modelMatrix)
+        var maximum: Float = 0
+        for position in positions {
+            let homogeneous = SIMD4<Float>(position, 1)
+            let difference = combined * homogeneous - directionalLightMVP * (modelMatrix * homogeneous)
+            maximum = max(maximum, simd_reduce_max(abs(difference)))
+        }
+        return maximum
+    }
+
+}
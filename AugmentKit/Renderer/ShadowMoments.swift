@@ -0,0 +1,338 @@
+//
+//  ShadowMoments.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import Metal
+import simd
+import AugmentKitShader
+
+// MARK: - ShadowMoments
+
+/**
+ Host side implementation of the moment shadow mapping performed by `ShadowMomentFilter` and `shadowVisibilityFromMoments` in Common.metal. Used to validate the shaders.
+ 
+ Instead of comparing a single depth, the shadow map is converted into the first four power moments of depth, `(z, z², z³, z⁴)`, which can be blurred like any other texture. The fraction of light reaching a receiver is then reconstructed from the filtered moments with the Hamburger 4 moment algorithm (Peters and Klein, "Moment Shadow Mapping", 2015). The moments are stored with an optimized quantization that keeps them accurate in 16 bit unorm textures, which, unlike 32 bit float textures, can be filtered on every iOS GPU.
+ 
+ `percentageCloserReference(depths:width:height:x:y:fragmentDepth:radius:sigma:)` performs the comparison against every shadow map texel under the same blur kernel and can be used to measure the error of the reconstruction.
+ */
+enum ShadowMoments {
+    
+    /// Added to the first quantized moment so that every depth in [0, 1] quantizes into [0, 1]
+    static let quantizationOffset: Float = 0.035955884801
+    /// Rotates the moments into the quantized basis
+    static let quantization = float4x4(
+        SIMD4<Float>(-2.07224649, 13.7948857237, 0.105877704, 9.7924062118),
+        SIMD4<Float>(32.23703778, -59.4683975703, -1.9077466311, -33.7652110555),
+        SIMD4<Float>(-68.571074599, 82.0359750338, 9.3496555107, 47.9456096605),
+        SIMD4<Float>(39.3703274134, -35.364903257, -6.6543490743, -23.9728048165)
+    )
+    /// The inverse of `quantization`
+    static let dequantization = float4x4(
+        SIMD4<Float>(0.2227744146, 0.1549679261, 0.1451988946, 0.163127443),
+        SIMD4<Float>(0.0771972861, 0.1394629426, 0.2120202157, 0.2591432266),
+        SIMD4<Float>(0.7926986636, 0.7963415838, 0.7258694464, 0.6539092497),
+        SIMD4<Float>(0.0319417555, -0.1722823173, -0.2758014811, -0.3376131734)
+    )
+    /// Pulls the moments towards those of a uniform distribution, which keeps the reconstruction stable after quantization
+    static let momentBias: Float = 6.0e-5
+    /// Offsets the depth of the receiver to avoid self shadowing
+    static let depthBias: Float = 5.0e-4
+    /// Visibilities below this amount are treated as fully shadowed to hide light bleeding where occluders overlap
+    static let lightBleedingReduction: Float = 0.2
+    
+    /// Returns the quantized moments of a single depth from the shadow map
+    static func quantize(depth: Float) -> SIMD4<Float> {
+        let depthSquared = depth * depth
+        var quantizedMoments = quantization * SIMD4<Float>(depth, depthSquared, depthSquared * depth, depthSquared * depthSquared)
+        quantizedMoments.x += quantizationOffset
+        return quantizedMoments
+    }
+    
+    /// Returns the moments from (possibly filtered) quantized moments
+    static func dequantize(_ quantizedMoments: SIMD4<Float>) -> SIMD4<Float> {
+        var moments = quantizedMoments
+        moments.x -= quantizationOffset
+        return dequantization * moments
+    }
+    
+    /// Returns the fraction of the filtered shadow map in front of a receiver at `fragmentDepth` using the Hamburger 4 moment reconstruction. 0 is fully lit and 1 is fully shadowed.
+    static func shadowIntensity(quantizedMoments: SIMD4<Float>, fragmentDepth: Float) -> Float {
+        
+        let b = simd_mix(dequantize(quantizedMoments), SIMD4<Float>(repeating: 0.5), SIMD4<Float>(repeating: momentBias))
+        let z0 = fragmentDepth - depthBias
+        
+        // Cholesky decomposition of the Hankel matrix of the moments
+        let L32D22 = -b.x * b.y + b.z
+        let D22 = -b.x * b.x + b.y
+        let squaredDepthVariance = -b.y * b.y + b.w
+        let D33D22 = squaredDepthVariance * D22 - L32D22 * L32D22
+        let InvD22 = 1 / D22
+        let L32 = L32D22 * InvD22
+        
+        // Solve for the coefficients of the quadratic whose roots are the other two support points
+        var c = SIMD3<Float>(1, z0, z0 * z0)
+        c.y -= b.x
+        c.z -= b.y + L32 * c.y
+        c.y *= InvD22
+        c.z *= D22 / D33D22
+        c.y -= L32 * c.z
+        c.x -= c.y * b.x + c.z * b.y
+        
+        let p = c.y / c.z
+        let q = c.x / c.z
+        let r = max(p * p / 4 - q, 0).squareRoot()
+        let z1 = -p / 2 - r
+        let z2 = -p / 2 + r
+        
+        // Pick the weights of the support points that are in front of the receiver
+        let switchValue: SIMD4<Float> = {
+            if z2 < z0 {
+                return SIMD4<Float>(z1, z0, 1, 1)
+            } else if z1 < z0 {
+                return SIMD4<Float>(z0, z1, 0, 1)
+            } else {
+                return SIMD4<Float>(repeating: 0)
+            }
+        }()
+        let quotient = (switchValue.x * z2 - b.x * (switchValue.x + z2) + b.y) / ((z2 - switchValue.y) * (z0 - z1))
+        return min(max(switchValue.z + switchValue.w * quotient, 0), 1)
+        
+    }
+    
+    /// Returns the fraction of light reaching a receiver at `fragmentDepth` after light bleeding reduction. This is what the surface shaders use to darken shadowed fragments.
+    static func visibility(quantizedMoments: SIMD4<Float>, fragmentDepth: Float) -> Float {
+        let visibility = 1 - shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: fragmentDepth)
+        return min(max((visibility - lightBleedingReduction) / (1 - lightBleedingReduction), 0), 1)
+    }
+    
+    /// The unnormalized weight of a tap `offset` texels from the center of the gaussian blur
+    static func blurWeight(offset: Int, sigma: Float) -> Float {
+        return exp(-Float(offset * offset) / (2 * sigma * sigma))
+    }
+    
+    /**
+     Performs the same filtering as `ShadowMomentFilter`. The shadow map is converted into quantized moments at half its resolution, where each moment texel averages the 2x2 block of shadow map texels it covers, and then blurred horizontally and vertically.
+     - Parameters:
+        - depths: `width * height` shadow map depths stored row by row starting at the top
+        - width: The width of the shadow map in texels
+        - height: The height of the shadow map in texels
+        - radius: The number of taps on either side of the center texel
+        - sigma: The standard deviation of the gaussian in moment texels
+     - Returns: The size of the moment map and its quantized moments, stored row by row starting at the top
+     */
+    static func filterReference(depths: [Float], width: Int, height: Int, radius: Int, sigma: Float) -> (width: Int, height: Int, moments: [SIMD4<Float>]) {
+        
+        let momentWidth = MipChain.size(of: width, atLod: 1)
+        let momentHeight = MipChain.size(of: height, atLod: 1)
+        guard width > 0, height > 0, depths.count >= width * height else {
+            return (width: 0, height: 0, moments: [])
+        }
+        
+        var downsampled = [SIMD4<Float>](repeating: SIMD4<Float>(repeating: 0), count: momentWidth * momentHeight)
+        for y in 0..<momentHeight {
+            for x in 0..<momentWidth {
+                let firstX = x * 2
+                let firstY = y * 2
+                let lastX = min(firstX + 1, width - 1)
+                let lastY = min(firstY + 1, height - 1)
+                var moments = quantize(depth: depths[firstY * width + firstX])
+                moments += quantize(depth: depths[firstY * width + lastX])
+                moments += quantize(depth: depths[lastY * width + firstX])
+                moments += quantize(depth: depths[lastY * width + lastX])
+                downsampled[y * momentWidth + x] = moments * 0.25
+            }
+        }
+        
+        let horizontal = blur(downsampled, width: momentWidth, height: momentHeight, direction: (x: 1, y: 0), radius: radius, sigma: sigma)
+        let vertical = blur(horizontal, width: momentWidth, height: momentHeight, direction: (x: 0, y: 1), radius: radius, sigma: sigma)
+        return (width: momentWidth, height: momentHeight, moments: vertical)
+        
+    }
+    
+    /// The visibility that filtering the shadow map comparison itself would give at moment texel `x`, `y`. Every shadow map texel under the blur kernel is compared against `fragmentDepth` and weighted like `filterReference(depths:width:height:radius:sigma:)` weights its moments. Intended as a reference when measuring the error of the moment reconstruction, which does not include light bleeding reduction.
+    static func percentageCloserReference(depths: [Float], width: Int, height: Int, x: Int, y: Int, fragmentDepth: Float, radius: Int, sigma: Float) -> Float {
+        
+        let momentWidth = MipChain.size(of: width, atLod: 1)
+        let momentHeight = MipChain.size(of: height, atLod: 1)
+        guard width > 0, height > 0, depths.count >= width * height else {
+            return 1
+        }
+        
+        var lit: Float = 0
+        var totalWeight: Float = 0
+        for j in -radius...radius {
+            let texelY = min(max(y + j, 0), momentHeight - 1)
+            for i in -radius...radius {
+                let texelX = min(max(x + i, 0), momentWidth - 1)
+                let weight = blurWeight(offset: i, sigma: sigma) * blurWeight(offset: j, sigma: sigma)
+                let firstX = texelX * 2
+                let firstY = texelY * 2
+                for sourceY in [firstY, min(firstY + 1, height - 1)] {
+                    for sourceX in [firstX, min(firstX + 1, width - 1)] {
+                        lit += fragmentDepth - depthBias <= depths[sourceY * width + sourceX] ? weight * 0.25 : 0
+                    }
+                }
+                totalWeight += weight
+            }
+        }
+        return lit / totalWeight
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate static func blur(_ moments: [SIMD4<Float>], width: Int, height: Int, direction: (x: Int, y: Int), radius: Int, sigma: Float) -> [SIMD4<Float>] {
+        var blurred = moments
+        for y in 0..<height {
+            for x in 0..<width {
+                var filteredMoments = SIMD4<Float>(repeating: 0)
+                var totalWeight: Float = 0
+                for i in -radius...radius {
+                    let texelX = min(max(x + i * direction.x, 0), width - 1)
+                    let texelY = min(max(y + i * direction.y, 0), height - 1)
+                    let weight = blurWeight(offset: i, sigma: sigma)
+                    filteredMoments += weight * moments[texelY * width + texelX]
+                    totalWeight += weight
+                }
+                blurred[y * width + x] = filteredMoments / totalWeight
+            }
+        }
+        return blurred
+    }
+    
+}
+
+// MARK: - ShadowMomentFilter
+
+/**
+ Prefilters the shadow map so that surfaces can render soft shadows with a single filtered texture fetch. The shadow map is converted into quantized moments at half of its resolution and blurred with a separable gaussian into `texture`. See `ShadowMoments`.
+ 
+ Must be encoded after the shadow pass and before any pass that samples `texture`.
+ */
+final class ShadowMomentFilter {
+    
+    /// The default number of taps on either side of the center texel
+    static let defaultBlurRadius = 3
+    /// The default standard deviation of the blur in moment texels
+    static let defaultBlurSigma: Float = 1.5
+    
+    /// The filtered, quantized moments. Sample with linear filtering and pass the result to `shadowVisibilityFromMoments`.
+    let texture: MTLTexture
+    /// The intermediate result of the horizontal blur
+    let intermediateTexture: MTLTexture
+    /// The number of taps on either side of the center texel. Larger values give softer shadows.
+    var blurRadius = ShadowMomentFilter.defaultBlurRadius
+    /// The standard deviation of the blur in moment texels
+    var blurSigma = ShadowMomentFilter.defaultBlurSigma
+    
+    init?(device: MTLDevice, metalLibrary: MTLLibrary, shadowMapWidth: Int, shadowMapHeight: Int) {
+        
+        guard let generateFunction = metalLibrary.makeFunction(name: "shadow_moments_generate"), let blurFunction = metalLibrary.makeFunction(name: "shadow_moments_blur") else {
+            print("Warning (ShadowMomentFilter) - Failed to create the shadow moment functions.")
+            return nil
+        }
+        
+        do {
+            generatePipelineState = try device.makeComputePipelineState(function: generateFunction)
+            blurPipelineState = try device.makeComputePipelineState(function: blurFunction)
+        } catch let error {
+            print("Warning (ShadowMomentFilter) - Failed to create the compute pipeline states. ERROR: \(error)")
+            return nil
+        }
+        
+        let width = MipChain.size(of: shadowMapWidth, atLod: 1)
+        let height = MipChain.size(of: shadowMapHeight, atLod: 1)
+        let descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .rgba16Unorm, width: width, height: height, mipmapped: false)
+        descriptor.usage = [.shaderRead, .shaderWrite]
+        descriptor.storageMode = .private
+        guard let momentsTexture = device.makeTexture(descriptor: descriptor), let blurTexture = device.makeTexture(descriptor: descriptor) else {
+            print("Warning (ShadowMomentFilter) - Failed to create the shadow moment textures.")
+            return nil
+        }
+        momentsTexture.label = "Shadow Moments"
+        blurTexture.label = "Shadow Moments Intermediate"
+        texture = momentsTexture
+        intermediateTexture = blurTexture
+        
+        let threadExecutionWidth = min(generatePipelineState.threadExecutionWidth, blurPipelineState.threadExecutionWidth)
+        let maxTotalThreadsPerThreadgroup = min(generatePipelineState.maxTotalThreadsPerThreadgroup, blurPipelineState.maxTotalThreadsPerThreadgroup)
+        mipChain = MipChain(width: width, height: height, levelCount: 1, threadExecutionWidth: threadExecutionWidth, maxTotalThreadsPerThreadgroup: maxTotalThreadsPerThreadgroup)
+        
+    }
+    
+    /**
+     Encodes the filter into `commandBuffer`
+     - Parameters:
+        - shadowMap: The depth of the shadow pass
+        - commandBuffer: The command buffer to encode into
+     */
+    func encode(shadowMap: MTLTexture, commandBuffer: MTLCommandBuffer) {
+        
+        guard let level = mipChain.level(at: 0) else {
+            return
+        }
+        
+        guard let computeEncoder = commandBuffer.makeComputeCommandEncoder() else {
+            return
+        }
+        
+        computeEncoder.label = "Shadow Moments"
+        
+        let radius = Int32(max(blurRadius, 0))
+        let sigma = max(blurSigma, 1.0e-3)
+        let threadgroupsPerGrid = MTLSize(width: level.threadgroupsPerGrid.width, height: level.threadgroupsPerGrid.height, depth: 1)
+        let threadsPerThreadgroup = MTLSize(width: level.threadsPerThreadgroup.width, height: level.threadsPerThreadgroup.height, depth: 1)
+        
+        computeEncoder.pushDebugGroup("Generate Moments and Blur Horizontally")
+        var horizontalUniforms = ShadowMomentUniforms(direction: SIMD2<Int32>(1, 0), radius: radius, sigma: sigma)
+        computeEncoder.setComputePipelineState(generatePipelineState)
+        computeEncoder.setTexture(shadowMap, index: Int(kTextureIndexShadowMap.rawValue))
+        computeEncoder.setTexture(intermediateTexture, index: Int(kTextureIndexShadowMomentsDestination.rawValue))
+        computeEncoder.setBytes(&horizontalUniforms, length: MemoryLayout<ShadowMomentUniforms>.stride, index: Int(kBufferIndexShadowMomentUniforms.rawValue))
+        computeEncoder.dispatchThreadgroups(threadgroupsPerGrid, threadsPerThreadgroup: threadsPerThreadgroup)
+        computeEncoder.popDebugGroup()
+        
+        computeEncoder.pushDebugGroup("Blur Vertically")
+        var verticalUniforms = ShadowMomentUniforms(direction: SIMD2<Int32>(0, 1), radius: radius, sigma: sigma)
+        computeEncoder.setComputePipelineState(blurPipelineState)
+        computeEncoder.setTexture(intermediateTexture, index: Int(kTextureIndexShadowMomentsSource.rawValue))
+        computeEncoder.setTexture(texture, index: Int(kTextureIndexShadowMomentsDestination.rawValue))
+        computeEncoder.setBytes(&verticalUniforms, length: MemoryLayout<ShadowMomentUniforms>.stride, index: Int(kBufferIndexShadowMomentUniforms.rawValue))
+        computeEncoder.dispatchThreadgroups(threadgroupsPerGrid, threadsPerThreadgroup: threadsPerThreadgroup)
+        computeEncoder.popDebugGroup()
+        
+        computeEncoder.endEncoding()
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let generatePipelineState: MTLComputePipelineState
+    fileprivate let blurPipelineState: MTLComputePipelineState
+    fileprivate let mipChain: MipChain
+    
+}
@@ -0,0 +1,177 @@
+//
+//  SkeletonRetargeting.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - SkeletonRetargeter
+
+/**
+ Poses a model's skeleton from the joints of a tracked body.
+ 
+ The joint mapping is resolved once, when the retargeter is created, by matching the names of the model's joints with the names of the tracked joints. Every frame, the rotation of each tracked joint away from its neutral pose is applied to the bind pose of the matching model joint. Model joints without a match inherit the rotation of their parent. Bone lengths always come from the model's bind pose, so a tracked body can drive a rig with different proportions.
+ 
+ Both skeletons are expected to share the same up and forward axes in their model space, which is the case for ARKit's skeleton and for rigs authored facing +z with y up.
+ 
+ `evaluate(jointTransforms:referenceJointTransforms:into:)` does not allocate. Create a new retargeter whenever either skeleton definition changes.
+ */
+final class SkeletonRetargeter {
+    
+    /// The names of the tracked joints the mapping was resolved from
+    let sourceJointNames: [String]
+    /// The number of joints in the model's skeleton
+    let jointCount: Int
+    /// For each model joint, the index of the tracked joint that drives it or `nil` if it follows its parent
+    let jointMap: [Int?]
+    /// The number of model joints that are driven by a tracked joint
+    var mappedJointCount: Int {
+        return jointMap.reduce(0) { $0 + ($1 == nil ? 0 : 1) }
+    }
+    
+    init(sourceJointNames: [String], skeleton: SkeletonData) {
+        
+        self.sourceJointNames = sourceJointNames
+        jointCount = skeleton.jointCount
+        
+        // Exact names first, then names with the common prefixes and suffixes removed
+        var sourceIndexByName = [String: Int]()
+        var sourceIndexByNormalizedName = [String: Int]()
+        for (index, name) in sourceJointNames.enumerated() {
+            sourceIndexByName[name] = sourceIndexByName[name] ?? index
+            let normalizedName = SkeletonRetargeter.normalizedJointName(name)
+            sourceIndexByNormalizedName[normalizedName] = sourceIndexByNormalizedName[normalizedName] ?? index
+        }
+        jointMap = skeleton.jointNames.map { name in
+            return sourceIndexByName[name] ?? sourceIndexByNormalizedName[SkeletonRetargeter.normalizedJointName(name)]
+        }
+        
+        parentIndices = (0..<jointCount).map { index in
+            guard index < skeleton.parentIndices.count, let parentIndex = skeleton.parentIndices[index], parentIndex < index else {
+                return nil
+            }
+            return parentIndex
+        }
+        
+        // The bind transforms of an `MDLSkeleton` are in model space. See `ModelIOTools`
+        bindTransforms = (0..<jointCount).map { index in
+            return index < skeleton.inverseBindTransforms.count ? skeleton.inverseBindTransforms[index].inverse : matrix_identity_float4x4
+        }
+        inverseBindTransforms = (0..<jointCount).map { index in
+            return index < skeleton.inverseBindTransforms.count ? skeleton.inverseBindTransforms[index] : matrix_identity_float4x4
+        }
+        
+        poseRotations = Array(repeating: matrix_identity_float3x3, count: jointCount)
+        posePositions = Array(repeating: SIMD3<Float>(repeating: 0), count: jointCount)
+        
+    }
+    
+    /**
+     Writes the skinning transform of every model joint into `palette`.
+     - Parameters:
+        - jointTransforms: The model space transform of each tracked joint. Indexed the same as `sourceJointNames`
+        - referenceJointTransforms: The model space transform of each tracked joint in the neutral pose. When empty, the tracked transforms are treated as absolute rotations.
+        - palette: The destination. Joints past the end of `palette` are not written.
+     */
+    func evaluate(jointTransforms: [matrix_float4x4], referenceJointTransforms: [matrix_float4x4], into palette: UnsafeMutableBufferPointer<matrix_float4x4>) {
+        
+        let count = min(jointCount, palette.count)
+        
+        for index in 0..<count {
+            
+            let parentIndex = parentIndices[index]
+            let bindTransform = bindTransforms[index]
+            let bindPosition = SIMD3<Float>(bindTransform.columns.3.x, bindTransform.columns.3.y, bindTransform.columns.3.z)
+            
+            // The change in rotation from the neutral pose, in model space
+            let rotation: float3x3 = {
+                if let sourceIndex = jointMap[index], sourceIndex < jointTransforms.count {
+                    let trackedRotation = AffineDecomposition(jointTransforms[sourceIndex]).rotationMatrix
+                    guard sourceIndex < referenceJointTransforms.count else {
+                        return trackedRotation
+                    }
+                    let referenceRotation = AffineDecomposition(referenceJointTransforms[sourceIndex]).rotationMatrix
+                    return trackedRotation * referenceRotation.transpose
+                } else if let parentIndex = parentIndex {
+                    return poseRotations[parentIndex]
+                } else {
+                    return matrix_identity_float3x3
+                }
+            }()
+            
+            // Bones keep the model's length and rotate with the parent
+            let position: SIMD3<Float> = {
+                if let parentIndex = parentIndex {
+                    let parentBindTransform = bindTransforms[parentIndex]
+                    let parentBindPosition = SIMD3<Float>(parentBindTransform.columns.3.x, parentBindTransform.columns.3.y, parentBindTransform.columns.3.z)
+                    return posePositions[parentIndex] + poseRotations[parentIndex] * (bindPosition - parentBindPosition)
+                } else if let sourceIndex = jointMap[index], sourceIndex < jointTransforms.count, sourceIndex < referenceJointTransforms.count {
+                    let offset = jointTransforms[sourceIndex].columns.3 - referenceJointTransforms[sourceIndex].columns.3
+                    return bindPosition + SIMD3<Float>(offset.x, offset.y, offset.z)
+                } else {
+                    return bindPosition
+                }
+            }()
+            
+            poseRotations[index] = rotation
+            posePositions[index] = position
+            
+            let bindUpperLeft = float3x3(SIMD3<Float>(bindTransform.columns.0.x, bindTransform.columns.0.y, bindTransform.columns.0.z), SIMD3<Float>(bindTransform.columns.1.x, bindTransform.columns.1.y, bindTransform.columns.1.z), SIMD3<Float>(bindTransform.columns.2.x, bindTransform.columns.2.y, bindTransform.columns.2.z))
+            let poseUpperLeft = rotation * bindUpperLeft
+            let poseTransform = float4x4(
+                SIMD4<Float>(poseUpperLeft.columns.0, 0),
+                SIMD4<Float>(poseUpperLeft.columns.1, 0),
+                SIMD4<Float>(poseUpperLeft.columns.2, 0),
+                SIMD4<Float>(position, 1)
+            )
+            palette[index] = poseTransform * inverseBindTransforms[index]
+            
+        }
+        
+    }
+    
+    /// Lowercases `name` and removes namespace prefixes (`mixamorig:`), path components and the `_joint` suffix used by ARKit
+    static func normalizedJointName(_ name: String) -> String {
+        var normalizedName = name.lowercased()
+        if let separatorIndex = normalizedName.lastIndex(where: { $0 == ":" || $0 == "/" }) {
+            normalizedName = String(normalizedName[normalizedName.index(after: separatorIndex)...])
+        }
+        if normalizedName.hasSuffix("_joint") {
+            normalizedName = String(normalizedName.dropLast("_joint".count))
+        }
+        return normalizedName.replacingOccurrences(of: "_", with: "")
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let parentIndices: [Int?]
+    fileprivate let bindTransforms: [matrix_float4x4]
+    fileprivate let inverseBindTransforms: [matrix_float4x4]
+    // Scratch storage for the posed skeleton. Parents are always evaluated before their children.
+    fileprivate var poseRotations: [float3x3]
+    fileprivate var posePositions: [SIMD3<Float>]
+    
+}
@@ -0,0 +1,74 @@
+//
+//  ToneMapping.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import simd
+import AugmentKitShader
+
+// MARK: - ToneMapping
+
+/**
+ Host implementation of the color pipeline of the composite pass in CompositeShaders.metal. The scene is rendered as linear HDR color, then exposed, tone mapped with a fit of the ACES filmic curve, and encoded to sRGB before it is composited over the camera image.
+ 
+ Used to validate the shaders and to produce reference images on the CPU.
+ */
+enum ToneMapping {
+    
+    /// ACES filmic tone curve as fitted by Stephen Hill. Maps exposed, linear scene color to linear display color in [0, 1]. Mirrors `acesFittedToneMap` in CompositeShaders.metal
+    static func acesFitted(_ color: SIMD3<Float>) -> SIMD3<Float> {
+        let v = inputMatrix * color
+        let a = v * (v + 0.0245786) - 0.000090537
+        let b = v * (0.983729 * v + 0.4329510) + 0.238081
+        return simd_clamp(outputMatrix * (a / b), SIMD3<Float>(repeating: 0), SIMD3<Float>(repeating: 1))
+    }
+    
+    /**
+     Composites one scene texel over one camera texel the way `compositeImageFragmentShader` does, ignoring the person segmentation matte.
+     - Parameters:
+        - sceneColor: Linear HDR scene color premultiplied by the coverage in `w`
+        - cameraColor: The display referred camera color
+        - exposure: Scales the linear scene color before tone mapping
+     - Returns: The display referred color
+     */
+    static func composite(sceneColor: SIMD4<Float>, over cameraColor: SIMD3<Float>, exposure: Float) -> SIMD3<Float> {
+        let coverage = min(max(sceneColor.w, 0), 1)
+        let sceneLinear = coverage > 0 ? SIMD3<Float>(sceneColor.x, sceneColor.y, sceneColor.z) / sceneColor.w : SIMD3<Float>(repeating: 0)
+        let toneMapped = acesFitted(sceneLinear * exposure)
+        let sceneDisplay = SIMD3<Float>(linearToSrgbFast(toneMapped.x), linearToSrgbFast(toneMapped.y), linearToSrgbFast(toneMapped.z))
+        let camera = simd_clamp(cameraColor, SIMD3<Float>(repeating: 0), SIMD3<Float>(repeating: 1))
+        return simd_mix(camera, sceneDisplay, SIMD3<Float>(repeating: coverage))
+    }
+    
+    // MARK: - Private
+    
+    // sRGB => XYZ => D65_2_D60 => AP1 => RRT_SAT
+    fileprivate static let inputMatrix = float3x3(SIMD3<Float>(0.59719, 0.07600, 0.02840), SIMD3<Float>(0.35458, 0.90834, 0.13383), SIMD3<Float>(0.04823, 0.01566, 0.83777))
+    // ODT_SAT => XYZ => D60_2_D65 => sRGB
+    fileprivate static let outputMatrix = float3x3(SIMD3<Float>(1.60475, -0.10208, -0.00327), SIMD3<Float>(-0.53108, 1.10813, -0.07276), SIMD3<Float>(-0.07367, -0.00605, 1.07602))
+    
+}
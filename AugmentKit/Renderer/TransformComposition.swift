@@ -0,0 +1,154 @@
+//
+//  TransformComposition.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - TransformClass
+
+/// Describes the kind of location transform being composed with a heading so that `TransformComposition.compose(location:heading:headingType:as:)` can be specialized for it.
+protocol TransformClass {
+    /// Returns the upper left 3x3 of the result of applying an absolute `heading` to `location`
+    static func absoluteUpperLeft(location: float4x4, heading: float3x3) -> float3x3
+}
+
+/// A location made up of only a rotation and a translation. Absolute headings simply replace the rotation.
+enum RigidTransformClass: TransformClass {
+    static func absoluteUpperLeft(location: float4x4, heading: float3x3) -> float3x3 {
+        return heading
+    }
+}
+
+/// A location that also contains scale, shear or a reflection. Absolute headings replace only the rotational part of the polar decomposition and keep the rest.
+enum ScaledTransformClass: TransformClass {
+    static func absoluteUpperLeft(location: float4x4, heading: float3x3) -> float3x3 {
+        return heading * AffineDecomposition(location).stretch
+    }
+}
+
+// MARK: - TransformComposition
+
+/// Host side implementation of `composeLocationAndHeading` in Common.metal. Used to validate the shader and to compose transforms on the CPU.
+///
+/// - Relative headings rotate the location's own orientation: `R' = R_location * R_heading`
+/// - Absolute headings replace only the rotational part of the location, keeping its scale, shear and reflection: `R' = R_heading * S_location` where `S_location` comes from the polar decomposition of the location (see `AffineDecomposition`)
+///
+/// The translation of the location is kept in both cases.
+enum TransformComposition {
+    
+    /// The tolerance used when deciding if a location has unit scale
+    static let rigidTolerance: Float = 1.0e-4
+    
+    /// Returns `true` if `location` contains only a rotation and a translation
+    static func isRigid(_ location: float4x4) -> Bool {
+        let x = location.columns.0.xyz
+        let y = location.columns.1.xyz
+        let z = location.columns.2.xyz
+        let lengthsSquared = SIMD3<Float>(length_squared(x), length_squared(y), length_squared(z))
+        let dots = SIMD3<Float>(dot(x, y), dot(x, z), dot(y, z))
+        let tolerance = SIMD3<Float>(repeating: rigidTolerance)
+        return all(abs(lengthsSquared - SIMD3<Float>(repeating: 1)) .< tolerance) && all(abs(dots) .< tolerance) && float3x3(x, y, z).determinant > 0
+    }
+    
+    /// Composes `location` with `heading`, choosing the rigid or scaled path
+    static func compose(location: float4x4, heading: simd_quatf, headingType: HeadingType) -> float4x4 {
+        if isRigid(location) {
+            return compose(location: location, heading: heading, headingType: headingType, as: RigidTransformClass.self)
+        } else {
+            return compose(location: location, heading: heading, headingType: headingType, as: ScaledTransformClass.self)
+        }
+    }
+    
+    /// Composes `location` with `heading` only when the entity has a heading, the same way the precalculation kernel gates `composeLocationAndHeading` on `hasHeading`. Locations without a heading are returned unchanged so they keep their own rotation.
+    static func compose(location: float4x4, hasHeading: Bool, heading: simd_quatf, headingType: HeadingType) -> float4x4 {
+        guard hasHeading else {
+            return location
+        }
+        return compose(location: location, heading: heading, headingType: headingType)
+    }
+    
+    /// Composes `location` with `heading` using the path for the provided `TransformClass`. The caller is responsible for making sure `location` belongs to that class.
+    static func compose<Class: TransformClass>(location: float4x4, heading: simd_quatf, headingType: HeadingType, as transformClass: Class.Type) -> float4x4 {
+        
+        let headingMatrix = float3x3(heading.normalized)
+        let upperLeft: float3x3 = {
+            switch headingType {
+            case .relative:
+                return float3x3(location.columns.0.xyz, location.columns.1.xyz, location.columns.2.xyz) * headingMatrix
+            case .absolute:
+                return Class.absoluteUpperLeft(location: location, heading: headingMatrix)
+            }
+        }()
+        
+        return float4x4(
+            SIMD4<Float>(upperLeft.columns.0, 0),
+            SIMD4<Float>(upperLeft.columns.1, 0),
+            SIMD4<Float>(upperLeft.columns.2, 0),
+            SIMD4<Float>(location.columns.3.xyz, 1)
+        )
+    
+    }
+    
+    /// A double precision reference used to measure the error of the single precision paths
+    static func composeReference(location: double4x4, heading: simd_quatd, headingType: HeadingType) -> double4x4 {
+        
+        let headingMatrix = double3x3(heading.normalized)
+        let locationUpperLeft = double3x3(
+            SIMD3<Double>(location.columns.0.x, location.columns.0.y, location.columns.0.z),
+            SIMD3<Double>(location.columns.1.x, location.columns.1.y, location.columns.1.z),
+            SIMD3<Double>(location.columns.2.x, location.columns.2.y, location.columns.2.z)
+        )
+        let upperLeft: double3x3 = {
+            switch headingType {
+            case .relative:
+                return locationUpperLeft * headingMatrix
+            case .absolute:
+                return headingMatrix * AffineDecomposition.polarDecompositionReference(locationUpperLeft).stretch
+            }
+        }()
+        
+        return double4x4(
+            SIMD4<Double>(upperLeft.columns.0, 0),
+            SIMD4<Double>(upperLeft.columns.1, 0),
+            SIMD4<Double>(upperLeft.columns.2, 0),
+            SIMD4<Double>(location.columns.3.x, location.columns.3.y, location.columns.3.z, 1)
+        )
+    
+    }
+    
+    /// The largest absolute difference between any element of `transform` and `reference`
+    static func maximumError(of transform: float4x4, comparedTo reference: double4x4) -> Double {
+        var maximum: Double = 0
+        for column in 0..<4 {
+            for row in 0..<4 {
+                maximum = max(maximum, abs(Double(transform[column][row]) - reference[column][row]))
+            }
+        }
+        return maximum
+    }
+
+}
@@ -0,0 +1,215 @@
+//
+//  VirtualContentIndex.swift
+//  AugmentKit
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import Foundation
+import simd
+
+// MARK: - VirtualContentHit
+
+/**
+ The result of hit testing virtual content. Unlike an `ARHitTestResult`, which only knows about real world surfaces, this is the closest triangle of the augmented geometry that was rendered.
+ */
+public struct VirtualContentHit {
+    /**
+     The identifier of the entity that was hit
+     */
+    public var identifier: UUID
+    /**
+     The distance, in meters, from the origin of the ray to the hit
+     */
+    public var distance: Float
+    /**
+     The position of the hit in world space
+     */
+    public var position: SIMD3<Float>
+    /**
+     The normal of the triangle that was hit, in world space. Always faces the origin of the ray.
+     */
+    public var normal: SIMD3<Float>
+    /**
+     A transform located at `position` with its y axis along `normal`
+     */
+    public var worldTransform: matrix_float4x4
+}
+
+// MARK: - VirtualContentIndex
+
+/// Keeps an `InstanceBVH` over every mesh drawn by the modules that render virtual content so ray, sphere and frustum queries can be answered without iterating anchors. Each `DrawData` owns the `TriangleBVH` of its mesh, built when the mesh is imported, and every draw call becomes one instance placed with the same model matrix the precalculation shader computes.
+///
+/// `update(drawCallGroups:entityStates:frameNumber:gazeTargetIdentifiers:)` is called on the render thread once per frame. It only refits the instance hierarchy when entities move and rebuilds it when meshes are added or removed. The queries are safe to call from any thread.
+final class VirtualContentIndex {
+    
+    /// The render modules whose draw call groups are indexed
+    static let moduleIdentifiers: Set<String> = [AnchorsRenderModule.identifier, UnanchoredRenderModule.identifier, PathsRenderModule.identifier]
+    
+    /// Converts from the coordinate space of imported models to the ARKit coordinate space. Matches `precalculationComputeShader`.
+    static let coordinateSpaceTransform = float4x4(SIMD4<Float>(-1, 0, 0, 0), SIMD4<Float>(0, 1, 0, 0), SIMD4<Float>(0, 0, -1, 0), SIMD4<Float>(0, 0, 0, 1))
+    
+    /// The number of mesh instances in the index
+    var instanceCount: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return instanceHierarchy.instances.count
+    }
+    
+    /// Places an instance for every draw call in `drawCallGroups` that belongs to one of `moduleIdentifiers` and has an entry in `entityStates`
+    func update(drawCallGroups: [DrawCallGroup], entityStates: EntityStateSnapshot, frameNumber: UInt, gazeTargetIdentifiers: Set<UUID>) {
+        
+        placements.removeAll(keepingCapacity: true)
+        
+        for drawCallGroup in drawCallGroups {
+            
+            guard let moduleIdentifier = drawCallGroup.moduleIdentifier, VirtualContentIndex.moduleIdentifiers.contains(moduleIdentifier), let entityState = entityStates.state(forIdentifier: drawCallGroup.uuid) else {
+                continue
+            }
+            
+            // The heading is composed with the location the same way as the precalculation kernel
+            let locationTransform = TransformComposition.compose(location: entityState.locationTransform, hasHeading: entityState.hasHeading, heading: entityState.headingRotation, headingType: entityState.headingType)
+            let scaleTransform = matrix_identity_float4x4.scale(x: entityState.scale, y: entityState.scale, z: entityState.scale)
+            
+            for drawCall in drawCallGroup.drawCalls {
+                
+                guard let drawData = drawCall.drawData, let mesh = drawData.triangleBVH else {
+                    continue
+                }
+                
+                let worldTransform: matrix_float4x4 = {
+                    if entityState.hasWorldTransformOverride {
+                        return entityState.worldTransformOverride
+                    } else if drawData.worldTransformAnimations.count > 0 {
+                        return drawData.worldTransformAnimations[Int(frameNumber % UInt(drawData.worldTransformAnimations.count))]
+                    } else {
+                        return drawData.worldTransform
+                    }
+                }()
+                
+                let modelMatrix = locationTransform * VirtualContentIndex.coordinateSpaceTransform * scaleTransform * worldTransform
+                placements.append(BVHInstance(identifier: drawCallGroup.uuid, mesh: mesh, transform: modelMatrix))
+                
+            }
+            
+        }
+        
+        lock.lock()
+        defer { lock.unlock() }
+        
+        self.gazeTargetIdentifiers = gazeTargetIdentifiers
+        
+        // The same meshes in the same order only need to be moved
+        let existingInstances = instanceHierarchy.instances
+        let hasSameInstances = existingInstances.count == placements.count && zip(existingInstances, placements).allSatisfy { $0.identifier == $1.identifier && $0.mesh === $1.mesh }
+        guard hasSameInstances else {
+            instanceHierarchy.rebuild(with: placements)
+            return
+        }
+        
+        for (index, placement) in placements.enumerated() where existingInstances[index].transform != placement.transform {
+            instanceHierarchy.setTransform(placement.transform, forInstanceAt: index)
+        }
+        instanceHierarchy.refit()
+        
+    }
+    
+    /// Returns the closest virtual content hit by the ray from `origin` along `direction` within `maxDistance` meters. Entities in `excludedIdentifiers`, and gaze targets when `excludesGazeTargets` is `true`, are ignored.
+    func hitTest(origin: SIMD3<Float>, direction: SIMD3<Float>, maxDistance: Float = Float.greatestFiniteMagnitude, excluding excludedIdentifiers: Set<UUID> = [], excludesGazeTargets: Bool = true) -> VirtualContentHit? {
+        
+        guard length_squared(direction) > 0 else {
+            return nil
+        }
+        
+        // With a unit direction, distances along the ray are in meters
+        let ray = BVHRay(origin: origin, direction: normalize(direction))
+        
+        lock.lock()
+        defer { lock.unlock() }
+        
+        let ignoredIdentifiers = excludesGazeTargets ? excludedIdentifiers.union(gazeTargetIdentifiers) : excludedIdentifiers
+        guard let result = instanceHierarchy.intersect(ray, maxDistance: maxDistance, where: { !ignoredIdentifiers.contains($0.identifier) }) else {
+            return nil
+        }
+        
+        let instance = instanceHierarchy.instances[result.instanceIndex]
+        let position = ray.origin + ray.direction * result.hit.distance
+        
+        // Normals transform by the inverse transpose of the model matrix
+        let upperLeft = float3x3(instance.transform.columns.0.xyz, instance.transform.columns.1.xyz, instance.transform.columns.2.xyz)
+        var normal = upperLeft.inverse.transpose * result.hit.normal
+        normal = length_squared(normal) > 0 ? normalize(normal) : -ray.direction
+        if dot(normal, ray.direction) > 0 {
+            normal = -normal
+        }
+        
+        return VirtualContentHit(identifier: instance.identifier, distance: result.hit.distance, position: position, normal: normal, worldTransform: VirtualContentIndex.transform(at: position, upAxis: normal))
+        
+    }
+    
+    /// Returns the identifiers of the entities with any triangle within `radius` meters of `center`
+    func identifiers(intersectingSphereWithCenter center: SIMD3<Float>, radius: Float) -> [UUID] {
+        lock.lock()
+        defer { lock.unlock() }
+        let instanceIndices = instanceHierarchy.instances(intersectingSphereWithCenter: center, radius: radius)
+        return uniqueIdentifiers(forInstanceIndices: instanceIndices)
+    }
+    
+    /// Returns the identifiers of the entities whose bounds intersect the frustum of `viewProjectionMatrix`
+    func identifiers(inFrustumOf viewProjectionMatrix: float4x4) -> [UUID] {
+        lock.lock()
+        defer { lock.unlock() }
+        let instanceIndices = instanceHierarchy.instances(in: ViewFrustum(viewProjectionMatrix: viewProjectionMatrix))
+        return uniqueIdentifiers(forInstanceIndices: instanceIndices)
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let lock = NSLock()
+    fileprivate let instanceHierarchy = InstanceBVH()
+    fileprivate var gazeTargetIdentifiers = Set<UUID>()
+    // Reused every frame to avoid allocating
+    fileprivate var placements = [BVHInstance]()
+    
+    // Entities with several meshes have several instances
+    fileprivate func uniqueIdentifiers(forInstanceIndices instanceIndices: [Int]) -> [UUID] {
+        var seen = Set<UUID>()
+        var identifiers = [UUID]()
+        for instanceIndex in instanceIndices {
+            let identifier = instanceHierarchy.instances[instanceIndex].identifier
+            if seen.insert(identifier).inserted {
+                identifiers.append(identifier)
+            }
+        }
+        return identifiers
+    }
+    
+    // A transform at `position` with its y axis along `upAxis`
+    fileprivate static func transform(at position: SIMD3<Float>, upAxis: SIMD3<Float>) -> matrix_float4x4 {
+        let reference = abs(upAxis.y) < 0.9 ? SIMD3<Float>(0, 1, 0) : SIMD3<Float>(0, 0, 1)
+        let xAxis = normalize(cross(upAxis, reference))
+        let zAxis = cross(xAxis, upAxis)
+        return matrix_float4x4(SIMD4<Float>(xAxis, 0), SIMD4<Float>(upAxis, 0), SIMD4<Float>(zAxis, 0), SIMD4<Float>(position, 1))
+    }
+
+}
@@ -0,0 +1,141 @@
+//
+//  AKRelativePositionHierarchyTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class AKRelativePositionHierarchyTests: XCTestCase {
+    
+    func testChainMatchesRecursiveUpdate() {
+        
+        let positions = makeChain(depth: 5)
+        let referencePositions = makeChain(depth: 5)
+        
+        let hierarchy = AKRelativePositionHierarchy()
+        hierarchy.update([positions[4]])
+        referencePositions[4].updateTransforms()
+        
+        XCTAssertEqual(hierarchy.count, 5)
+        for index in 0..<5 {
+            XCTAssertEqual(positions[index].referenceTransform, referencePositions[index].referenceTransform)
+            XCTAssertFalse(positions[index].transformHasChanged)
+        }
+        
+    }
+    
+    func testSharedAncestorsAreCountedOnce() {
+        
+        let chain = makeChain(depth: 3)
+        let sibling = AKRelativePosition(withTransform: float4x4.makeTranslation(x: -1, y: 0, z: 0), relativeTo: chain[1])
+        
+        let hierarchy = AKRelativePositionHierarchy()
+        hierarchy.update([chain[2], sibling])
+        
+        XCTAssertEqual(hierarchy.count, 4)
+        XCTAssertEqual(sibling.referenceTransform, chain[2].referenceTransform)
+        
+    }
+    
+    func testParentChangedElsewhereIsResolved() {
+        
+        let positions = makeChain(depth: 3)
+        let hierarchy = AKRelativePositionHierarchy()
+        hierarchy.update([positions[2]])
+        
+        // Updating the root directly clears its flags before the hierarchy sees the change
+        positions[0].transform = float4x4.makeTranslation(x: 10, y: 0, z: 0)
+        positions[0].updateTransforms()
+        hierarchy.update([positions[2]])
+        
+        let referencePositions = makeChain(depth: 3)
+        referencePositions[0].transform = float4x4.makeTranslation(x: 10, y: 0, z: 0)
+        referencePositions[2].updateTransforms()
+        XCTAssertEqual(positions[2].referenceTransform, referencePositions[2].referenceTransform)
+        
+    }
+    
+    func testRelinkingRebuildsTheHierarchy() {
+        
+        let positions = makeChain(depth: 4)
+        let hierarchy = AKRelativePositionHierarchy()
+        hierarchy.update([positions[3]])
+        XCTAssertEqual(hierarchy.count, 4)
+        
+        positions[3].parentPosition = positions[0]
+        hierarchy.update([positions[3]])
+        
+        XCTAssertEqual(hierarchy.count, 2)
+        XCTAssertEqual(positions[3].referenceTransform, AKRelativePosition.referenceTransform(forParentReferenceTransform: positions[0].referenceTransform, parentTransform: positions[0].transform))
+        
+    }
+    
+    func testCycleIsBroken() {
+        
+        let first = AKRelativePosition(withTransform: float4x4.makeTranslation(x: 1, y: 0, z: 0))
+        let second = AKRelativePosition(withTransform: float4x4.makeTranslation(x: 0, y: 1, z: 0), relativeTo: first)
+        first.parentPosition = second
+        
+        let hierarchy = AKRelativePositionHierarchy()
+        hierarchy.update([second])
+        hierarchy.update([second])
+        
+        XCTAssertEqual(hierarchy.count, 2)
+        
+    }
+    
+    func testUpdatePerformance() {
+        
+        // 100 chains eight deep, each with ten leaves
+        var leaves = [AKRelativePosition]()
+        for _ in 0..<100 {
+            let chain = makeChain(depth: 8)
+            for index in 0..<10 {
+                leaves.append(AKRelativePosition(withTransform: float4x4.makeTranslation(x: Float(index), y: 0, z: 0), relativeTo: chain[7]))
+            }
+        }
+        let hierarchy = AKRelativePositionHierarchy()
+        measure {
+            hierarchy.update(leaves)
+        }
+        XCTAssertEqual(hierarchy.count, 1800)
+        
+    }
+    
+    // MARK: - Private
+    
+    // Each position is translated from its parent, root first
+    fileprivate func makeChain(depth: Int) -> [AKRelativePosition] {
+        var positions = [AKRelativePosition]()
+        for index in 0..<depth {
+            let transform = float4x4.makeTranslation(x: Float(index) + 0.5, y: Float(index % 2), z: -Float(index) * 0.25)
+            positions.append(AKRelativePosition(withTransform: transform, relativeTo: positions.last))
+        }
+        return positions
+    }
+    
+}
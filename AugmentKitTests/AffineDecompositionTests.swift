@@ -0,0 +1,126 @@
+//
+//  AffineDecompositionTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class AffineDecompositionTests: XCTestCase {
+    
+    func testRotationAndScale() {
+        
+        let rotation = simd_quatf(angle: 1.1, axis: normalize(SIMD3<Float>(1, -2, 0.5)))
+        var transform = float4x4(rotation) * float4x4.makeScale(x: 2, y: 0.5, z: 3)
+        transform.columns.3 = SIMD4<Float>(1, 2, 3, 1)
+        let decomposition = AffineDecomposition(transform)
+        
+        XCTAssertFalse(decomposition.isMirrored)
+        XCTAssertFalse(decomposition.isDegenerate)
+        XCTAssertFalse(decomposition.hasShear)
+        XCTAssertEqual(distance(decomposition.scale, SIMD3<Float>(2, 0.5, 3)), 0, accuracy: 1e-4)
+        XCTAssertEqual(abs(dot(decomposition.rotation.vector, rotation.vector)), 1, accuracy: 1e-4)
+        XCTAssertEqual(decomposition.translation, SIMD3<Float>(1, 2, 3))
+        assertEqual(decomposition.recomposed(), transform, accuracy: 1e-4)
+        
+    }
+    
+    func testSmallScaleIsNotDegenerate() {
+        
+        let transform = float4x4(simd_quatf(angle: 0.4, axis: SIMD3<Float>(0, 0, 1))) * float4x4.makeScale(x: 0.001, y: 0.002, z: 0.001)
+        let decomposition = AffineDecomposition(transform)
+        
+        XCTAssertFalse(decomposition.isDegenerate)
+        XCTAssertEqual(decomposition.scale.x, 0.001, accuracy: 1e-7)
+        XCTAssertEqual(decomposition.scale.y, 0.002, accuracy: 1e-7)
+        XCTAssertEqual(decomposition.scale.z, 0.001, accuracy: 1e-7)
+        XCTAssertEqual(decomposition.rotationMatrix.determinant, 1, accuracy: 1e-4)
+        assertEqual(decomposition.recomposed(), transform, accuracy: 1e-7)
+        
+    }
+    
+    func testMirroredTransformKeepsAProperRotation() {
+        
+        var transform = float4x4(simd_quatf(angle: -0.8, axis: normalize(SIMD3<Float>(0, 1, 1)))) * float4x4.makeScale(x: -1, y: 2, z: 3)
+        transform.columns.3 = SIMD4<Float>(-4, 0, 1, 1)
+        let decomposition = AffineDecomposition(transform)
+        
+        XCTAssertTrue(decomposition.isMirrored)
+        XCTAssertFalse(decomposition.isDegenerate)
+        XCTAssertEqual(decomposition.rotationMatrix.determinant, 1, accuracy: 1e-4)
+        XCTAssertLessThan(decomposition.stretch.determinant, 0)
+        XCTAssertEqual(distance(abs(decomposition.scale), SIMD3<Float>(1, 2, 3)), 0, accuracy: 1e-4)
+        assertEqual(decomposition.recomposed(), transform, accuracy: 1e-4)
+        
+        let upperLeft = double3x3(SIMD3<Double>(transform.columns.0.xyz), SIMD3<Double>(transform.columns.1.xyz), SIMD3<Double>(transform.columns.2.xyz))
+        let reference = AffineDecomposition.polarDecompositionReference(upperLeft)
+        for column in 0..<3 {
+            XCTAssertEqual(distance(SIMD3<Double>(decomposition.rotationMatrix[column]), reference.rotation[column]), 0, accuracy: 1e-4)
+            XCTAssertEqual(distance(SIMD3<Double>(decomposition.stretch[column]), reference.stretch[column]), 0, accuracy: 1e-4)
+        }
+        
+    }
+    
+    func testShearIsReported() {
+        var transform = matrix_identity_float4x4
+        transform.columns.1 = SIMD4<Float>(0.5, 1, 0, 0)
+        XCTAssertTrue(AffineDecomposition(transform).hasShear)
+        XCTAssertFalse(AffineDecomposition(matrix_identity_float4x4).hasShear)
+    }
+    
+    func testDegenerateTransformFallsBackToOrthonormalizedColumns() {
+        
+        let transform = float4x4(simd_quatf(angle: 0.6, axis: SIMD3<Float>(0, 1, 0))) * float4x4.makeScale(x: 1, y: 1, z: 0)
+        let decomposition = AffineDecomposition(transform)
+        
+        XCTAssertTrue(decomposition.isDegenerate)
+        let rotation = decomposition.rotationMatrix
+        XCTAssertEqual(rotation.determinant, 1, accuracy: 1e-4)
+        for column in 0..<3 {
+            XCTAssertFalse(rotation[column].x.isNaN || rotation[column].y.isNaN || rotation[column].z.isNaN)
+            XCTAssertEqual(length(rotation[column]), 1, accuracy: 1e-4)
+        }
+        assertEqual(decomposition.recomposed(), transform, accuracy: 1e-4)
+        
+    }
+    
+    func testIsDegenerateIsRelativeToScale() {
+        XCTAssertFalse(AffineDecomposition.isDegenerate(float3x3(diagonal: SIMD3<Float>(repeating: 1e-4))))
+        XCTAssertFalse(AffineDecomposition.isDegenerate(float3x3(diagonal: SIMD3<Float>(repeating: 1e4))))
+        XCTAssertTrue(AffineDecomposition.isDegenerate(float3x3(diagonal: SIMD3<Float>(1000, 1000, 1e-6))))
+        XCTAssertTrue(AffineDecomposition.isDegenerate(float3x3(diagonal: SIMD3<Float>(1e-3, 1e-3, 0))))
+        XCTAssertTrue(AffineDecomposition.isDegenerate(float3x3(SIMD3<Float>(1, 2, 3), SIMD3<Float>(2, 4, 6), SIMD3<Float>(0, 0, 1))))
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func assertEqual(_ transform: float4x4, _ expected: float4x4, accuracy: Float, file: StaticString = #file, line: UInt = #line) {
+        for column in 0..<4 {
+            XCTAssertEqual(distance(transform[column], expected[column]), 0, accuracy: accuracy, file: file, line: line)
+        }
+    }
+    
+}
@@ -0,0 +1,194 @@
+//
+//  BoundingVolumeHierarchyTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class BoundingVolumeHierarchyTests: XCTestCase {
+    
+    func testBuildCoversEveryPrimitive() {
+        var generator = SplitMix64(seed: 3)
+        let primitiveBounds = (0..<300).map { _ in makeTriangleBounds(using: &generator) }
+        let hierarchy = BoundingVolumeHierarchy.build(primitiveBounds: primitiveBounds)
+        XCTAssertEqual(hierarchy.order.sorted(), Array(0..<primitiveBounds.count))
+        assertValid(nodes: hierarchy.nodes, primitiveBounds: primitiveBounds, order: hierarchy.order)
+    }
+    
+    func testRefitEnclosesMovedPrimitives() {
+        var generator = SplitMix64(seed: 4)
+        var primitiveBounds = (0..<100).map { _ in makeTriangleBounds(using: &generator) }
+        var hierarchy = BoundingVolumeHierarchy.build(primitiveBounds: primitiveBounds)
+        for index in stride(from: 0, to: primitiveBounds.count, by: 3) {
+            let offset = SIMD3<Float>(generator.nextFloat(in: -5...5), generator.nextFloat(in: -5...5), generator.nextFloat(in: -5...5))
+            primitiveBounds[index] = BoundingBox(min: primitiveBounds[index].min + offset, max: primitiveBounds[index].max + offset)
+        }
+        BoundingVolumeHierarchy.refit(nodes: &hierarchy.nodes, primitiveBounds: primitiveBounds, order: hierarchy.order)
+        assertValid(nodes: hierarchy.nodes, primitiveBounds: primitiveBounds, order: hierarchy.order)
+    }
+    
+    // The hierarchy must find the same closest triangle as testing every triangle
+    func testTriangleIntersectionMatchesReference() {
+        var generator = SplitMix64(seed: 5)
+        let mesh = makeTriangleSoup(triangleCount: 500, using: &generator)
+        guard let triangleBVH = TriangleBVH(positions: mesh.positions, indices: mesh.indices) else {
+            XCTFail("The hierarchy was not built")
+            return
+        }
+        XCTAssertEqual(triangleBVH.triangleCount, 500)
+        var hitCount = 0
+        for _ in 0..<500 {
+            let origin = SIMD3<Float>(generator.nextFloat(in: -20...20), generator.nextFloat(in: -20...20), generator.nextFloat(in: -20...20))
+            let target = SIMD3<Float>(generator.nextFloat(in: -10...10), generator.nextFloat(in: -10...10), generator.nextFloat(in: -10...10))
+            let ray = BVHRay(origin: origin, direction: target - origin)
+            let hit = triangleBVH.intersect(ray)
+            let reference = triangleBVH.intersectReference(ray)
+            XCTAssertEqual(hit?.triangleIndex, reference?.triangleIndex)
+            XCTAssertEqual(hit?.distance ?? -1, reference?.distance ?? -1, accuracy: 1e-6)
+            hitCount += reference == nil ? 0 : 1
+        }
+        XCTAssertGreaterThan(hitCount, 100)
+    }
+    
+    func testTriangleIntersectionRespectsMaxDistance() {
+        guard let triangleBVH = TriangleBVH(positions: quadPositions, indices: quadIndices) else {
+            XCTFail("The hierarchy was not built")
+            return
+        }
+        let ray = BVHRay(origin: SIMD3<Float>(0.25, 0.25, 2), direction: SIMD3<Float>(0, 0, -1))
+        XCTAssertEqual(triangleBVH.intersect(ray)?.distance ?? -1, 2, accuracy: 1e-6)
+        XCTAssertNil(triangleBVH.intersect(ray, maxDistance: 1.5))
+        XCTAssertNil(triangleBVH.intersect(BVHRay(origin: SIMD3<Float>(2, 2, 2), direction: SIMD3<Float>(0, 0, -1))))
+    }
+    
+    func testTrianglesWithMissingVerticesAreSkipped() {
+        XCTAssertNil(TriangleBVH(positions: quadPositions, indices: [0, 1, 9]))
+        XCTAssertEqual(TriangleBVH(positions: quadPositions, indices: quadIndices + [0, 1, 9])?.triangleCount, 2)
+    }
+    
+    func testSphereIntersection() {
+        guard let triangleBVH = TriangleBVH(positions: quadPositions, indices: quadIndices) else {
+            XCTFail("The hierarchy was not built")
+            return
+        }
+        XCTAssertTrue(triangleBVH.intersects(sphereWithCenter: SIMD3<Float>(0, 0, 0.5), radius: 0.6))
+        XCTAssertFalse(triangleBVH.intersects(sphereWithCenter: SIMD3<Float>(0, 0, 0.5), radius: 0.4))
+        // Scaled along z, in the space of the sphere
+        let transform = float4x4.makeScale(x: 1, y: 1, z: 4) * float4x4.makeTranslation(x: 0, y: 0, z: 0.25)
+        XCTAssertFalse(triangleBVH.intersects(sphereWithCenter: SIMD3<Float>(0, 0, 0), radius: 0.9, transform: transform))
+        XCTAssertTrue(triangleBVH.intersects(sphereWithCenter: SIMD3<Float>(0, 0, 0), radius: 1.1, transform: transform))
+    }
+    
+    func testInstanceIntersection() {
+        guard let mesh = TriangleBVH(positions: quadPositions, indices: quadIndices) else {
+            XCTFail("The hierarchy was not built")
+            return
+        }
+        let near = BVHInstance(identifier: UUID(), mesh: mesh, transform: float4x4.makeTranslation(x: 0, y: 0, z: -2))
+        let far = BVHInstance(identifier: UUID(), mesh: mesh, transform: float4x4.makeTranslation(x: 0, y: 0, z: -5) * float4x4.makeScale(x: 2, y: 2, z: 2))
+        let aside = BVHInstance(identifier: UUID(), mesh: mesh, transform: float4x4.makeTranslation(x: 10, y: 0, z: -2))
+        let instanceBVH = InstanceBVH()
+        instanceBVH.rebuild(with: [far, aside, near])
+        
+        let ray = BVHRay(origin: SIMD3<Float>(0.1, 0.1, 0), direction: SIMD3<Float>(0, 0, -1))
+        XCTAssertEqual(instanceBVH.intersect(ray)?.instanceIndex, 2)
+        XCTAssertEqual(instanceBVH.intersect(ray)?.hit.distance ?? -1, 2, accuracy: 1e-6)
+        XCTAssertEqual(instanceBVH.intersect(ray, where: { $0.identifier != near.identifier })?.instanceIndex, 0)
+        XCTAssertEqual(instanceBVH.intersect(ray, where: { $0.identifier != near.identifier })?.hit.distance ?? -1, 5, accuracy: 1e-6)
+        XCTAssertNil(instanceBVH.intersect(ray, maxDistance: 1))
+        
+        // Moving the near instance out of the way only takes a refit
+        instanceBVH.setTransform(float4x4.makeTranslation(x: -10, y: 0, z: -2), forInstanceAt: 2)
+        instanceBVH.refit()
+        XCTAssertEqual(instanceBVH.intersect(ray)?.instanceIndex, 0)
+        XCTAssertEqual(instanceBVH.instances(intersectingSphereWithCenter: SIMD3<Float>(10, 0, -1.5), radius: 1), [1])
+        XCTAssertEqual(instanceBVH.instances(intersectingSphereWithCenter: SIMD3<Float>(0, 0, 0), radius: 1), [])
+    }
+    
+    func testInstancesInFrustum() {
+        guard let mesh = TriangleBVH(positions: quadPositions, indices: quadIndices) else {
+            XCTFail("The hierarchy was not built")
+            return
+        }
+        let instanceBVH = InstanceBVH()
+        instanceBVH.rebuild(with: [
+            BVHInstance(identifier: UUID(), mesh: mesh, transform: float4x4.makeTranslation(x: 0, y: 0, z: -5)),
+            BVHInstance(identifier: UUID(), mesh: mesh, transform: float4x4.makeTranslation(x: 0, y: 0, z: 5)),
+            BVHInstance(identifier: UUID(), mesh: mesh, transform: float4x4.makeTranslation(x: 50, y: 0, z: -5)),
+        ])
+        // Looking down -z with a 0 to 1 depth range
+        let projection = float4x4(columns: (SIMD4<Float>(1, 0, 0, 0), SIMD4<Float>(0, 1, 0, 0), SIMD4<Float>(0, 0, -100.0 / 99.9, -1), SIMD4<Float>(0, 0, -10.0 / 99.9, 0)))
+        XCTAssertEqual(instanceBVH.instances(in: ViewFrustum(viewProjectionMatrix: projection)), [0])
+    }
+    
+    // MARK: - Private
+    
+    // Two triangles covering x and y from -1 to 1 at z = 0
+    fileprivate let quadPositions = [SIMD3<Float>(-1, -1, 0), SIMD3<Float>(1, -1, 0), SIMD3<Float>(1, 1, 0), SIMD3<Float>(-1, 1, 0)]
+    fileprivate let quadIndices: [UInt32] = [0, 1, 2, 0, 2, 3]
+    
+    fileprivate func makeTriangleSoup(triangleCount: Int, using generator: inout SplitMix64) -> (positions: [SIMD3<Float>], indices: [UInt32]) {
+        var positions = [SIMD3<Float>]()
+        for _ in 0..<triangleCount {
+            let center = SIMD3<Float>(generator.nextFloat(in: -10...10), generator.nextFloat(in: -10...10), generator.nextFloat(in: -10...10))
+            for _ in 0..<3 {
+                positions.append(center + SIMD3<Float>(generator.nextFloat(in: -2...2), generator.nextFloat(in: -2...2), generator.nextFloat(in: -2...2)))
+            }
+        }
+        return (positions: positions, indices: Array(0..<UInt32(positions.count)))
+    }
+    
+    fileprivate func makeTriangleBounds(using generator: inout SplitMix64) -> BoundingBox {
+        let mesh = makeTriangleSoup(triangleCount: 1, using: &generator)
+        var bounds = BoundingBox()
+        mesh.positions.forEach { bounds.formUnion($0) }
+        return bounds
+    }
+    
+    fileprivate func assertValid(nodes: [BVHNode], primitiveBounds: [BoundingBox], order: [Int], file: StaticString = #file, line: UInt = #line) {
+        var leafPrimitiveCount = 0
+        for (nodeIndex, node) in nodes.enumerated() {
+            if node.isLeaf {
+                XCTAssertLessThanOrEqual(node.count, BoundingVolumeHierarchy.maxLeafSize, file: file, line: line)
+                leafPrimitiveCount += node.count
+                for index in node.offset..<(node.offset + node.count) {
+                    assertContains(node.bounds, primitiveBounds[order[index]], file: file, line: line)
+                }
+            } else {
+                XCTAssertGreaterThan(node.offset, nodeIndex + 1, file: file, line: line)
+                assertContains(node.bounds, nodes[nodeIndex + 1].bounds, file: file, line: line)
+                assertContains(node.bounds, nodes[node.offset].bounds, file: file, line: line)
+            }
+        }
+        XCTAssertEqual(leafPrimitiveCount, primitiveBounds.count, file: file, line: line)
+    }
+    
+    fileprivate func assertContains(_ box: BoundingBox, _ other: BoundingBox, file: StaticString = #file, line: UInt = #line) {
+        XCTAssertTrue(all(box.min .<= other.min) && all(box.max .>= other.max), "\(box) does not contain \(other)", file: file, line: line)
+    }
+    
+}
@@ -0,0 +1,164 @@
+//
+//  CameraLuminanceTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+import AugmentKitShader
+@testable import AugmentKit
+
+class CameraLuminanceTests: XCTestCase {
+    
+    func testUniformFrameFallsInOneBin() {
+        
+        let frame = makeFrame(width: 64, height: 32) { _, _ in return (y: 128, cb: 128, cr: 128) }
+        let histogram = frame.histogram(sampleGridSize: SIMD2<Int>(16, 8))
+        
+        let expected = expectedColor(y: 128, cb: 128, cr: 128)
+        XCTAssertEqual(histogram.sampleCount, 128)
+        XCTAssertEqual(histogram.bins.filter { $0 > 0 }.count, 1)
+        XCTAssertEqual(histogram.bins.reduce(0, +), histogram.sampleCount)
+        XCTAssertEqual(distance(histogram.averageColor, expected), 0, accuracy: 1 / Float(kCameraLuminanceColorSumScale))
+        XCTAssertEqual(histogram.luminance(atPercentile: 0.05), histogram.luminance(atPercentile: 0.95))
+        
+    }
+    
+    func testColorSumsDoNotOverflow() {
+        
+        // 131072 white samples overflow a 32 bit sum in 1 / 65535 units, so the sums have to be carried in wider words
+        let frame = makeFrame(width: 512, height: 256) { _, _ in return (y: 255, cb: 128, cr: 128) }
+        let histogram = frame.histogram(sampleGridSize: SIMD2<Int>(512, 256))
+        
+        let expected = expectedColor(y: 255, cb: 128, cr: 128)
+        XCTAssertEqual(histogram.sampleCount, 131072)
+        XCTAssertEqual(distance(histogram.averageColor, expected), 0, accuracy: 1e-4)
+        
+    }
+    
+    func testSplitWordsRoundTrip() {
+        
+        let frame = makeFrame(width: 128, height: 128) { x, y in return (y: UInt8((x * 2 + y) % 256), cb: UInt8(100 + x % 50), cr: UInt8(140 - y % 40)) }
+        let histogram = frame.histogram(sampleGridSize: SIMD2<Int>(128, 128))
+        
+        // Write the layout of the kernel, with low words that have grown past one word the way they do when many threadgroups add to them
+        var contents = [UInt32](repeating: 0, count: Int(kCameraLuminanceHistogramLength.rawValue))
+        for (index, count) in histogram.bins.enumerated() {
+            contents[index] = count
+        }
+        contents[Int(kCameraLuminanceHistogramSampleCountIndex.rawValue)] = histogram.sampleCount
+        let units = (SIMD3<Double>(histogram.colorSum) * kCameraLuminanceColorSumScale).rounded(.toNearestOrAwayFromZero)
+        let wordSize = Double(kCameraLuminanceColorSumWordSize)
+        let highWords = simd_max((units / wordSize).rounded(.down) - 3, SIMD3<Double>(repeating: 0))
+        let lowWords = units - highWords * wordSize
+        contents[Int(kCameraLuminanceHistogramRedSumIndex.rawValue)] = UInt32(lowWords.x)
+        contents[Int(kCameraLuminanceHistogramGreenSumIndex.rawValue)] = UInt32(lowWords.y)
+        contents[Int(kCameraLuminanceHistogramBlueSumIndex.rawValue)] = UInt32(lowWords.z)
+        contents[Int(kCameraLuminanceHistogramRedSumHighIndex.rawValue)] = UInt32(highWords.x)
+        contents[Int(kCameraLuminanceHistogramGreenSumHighIndex.rawValue)] = UInt32(highWords.y)
+        contents[Int(kCameraLuminanceHistogramBlueSumHighIndex.rawValue)] = UInt32(highWords.z)
+        
+        let decoded = contents.withUnsafeBufferPointer { buffer in
+            return CameraLuminanceHistogram(contents: buffer.baseAddress!, minLogLuminance: histogram.minLogLuminance, logLuminanceRange: histogram.logLuminanceRange)
+        }
+        XCTAssertEqual(decoded.bins, histogram.bins)
+        XCTAssertEqual(decoded.sampleCount, histogram.sampleCount)
+        XCTAssertEqual(distance(decoded.averageColor, histogram.averageColor), 0, accuracy: 1e-5)
+        
+    }
+    
+    func testPercentilesAndGrayWorld() {
+        
+        // The left half is dark and the right half is bright and reddish
+        let frame = makeFrame(width: 64, height: 64) { x, _ in return x < 32 ? (y: 30, cb: 128, cr: 128) : (y: 200, cb: 110, cr: 170) }
+        let histogram = frame.histogram(sampleGridSize: SIMD2<Int>(32, 32))
+        
+        XCTAssertLessThan(histogram.luminance(atPercentile: 0.25), histogram.luminance(atPercentile: 0.95))
+        XCTAssertGreaterThan(histogram.logAverageLuminance, histogram.luminance(atPercentile: 0.25))
+        XCTAssertLessThan(histogram.logAverageLuminance, histogram.luminance(atPercentile: 0.95))
+        XCTAssertEqual(histogram.grayWorldIlluminant.x, 1, accuracy: 1e-6)
+        XCTAssertEqual(histogram.grayWorldWhiteBalance.y, 1, accuracy: 1e-6)
+        XCTAssertLessThan(histogram.grayWorldWhiteBalance.x, 1)
+        
+    }
+    
+    func testExposureAdaptsTowardTheFrame() {
+        
+        let dark = makeFrame(width: 32, height: 32) { _, _ in return (y: 40, cb: 128, cr: 128) }.histogram(sampleGridSize: SIMD2<Int>(16, 16))
+        let bright = makeFrame(width: 32, height: 32) { _, _ in return (y: 230, cb: 128, cr: 128) }.histogram(sampleGridSize: SIMD2<Int>(16, 16))
+        
+        var adaptation = CameraExposureAdaptation()
+        adaptation.update(with: dark, timestamp: 0)
+        let darkExposure = adaptation.exposure
+        adaptation.update(with: bright, timestamp: 0.1)
+        let partialExposure = adaptation.exposure
+        adaptation.update(with: bright, timestamp: 10)
+        
+        XCTAssertLessThan(partialExposure, darkExposure)
+        XCTAssertLessThan(adaptation.exposure, partialExposure)
+        XCTAssertTrue(adaptation.exposureRange.contains(adaptation.exposure))
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate struct Frame {
+        var width: Int
+        var height: Int
+        var yPlane: [UInt8]
+        var cbcrPlane: [UInt8]
+        
+        func histogram(sampleGridSize: SIMD2<Int>) -> CameraLuminanceHistogram {
+            return yPlane.withUnsafeBufferPointer { yBuffer in
+                return cbcrPlane.withUnsafeBufferPointer { cbcrBuffer in
+                    return CameraLuminanceHistogram(yPlane: yBuffer.baseAddress!, yBytesPerRow: width, cbcrPlane: cbcrBuffer.baseAddress!, cbcrBytesPerRow: width, width: width, height: height, sampleGridSize: sampleGridSize, minLogLuminance: -10, logLuminanceRange: 12)
+                }
+            }
+        }
+    }
+    
+    // Chroma is taken from the top left pixel of each 2x2 block
+    fileprivate func makeFrame(width: Int, height: Int, sample: (Int, Int) -> (y: UInt8, cb: UInt8, cr: UInt8)) -> Frame {
+        var yPlane = [UInt8](repeating: 0, count: width * height)
+        var cbcrPlane = [UInt8](repeating: 0, count: width * height / 2)
+        for y in 0..<height {
+            for x in 0..<width {
+                let value = sample(x, y)
+                yPlane[y * width + x] = value.y
+                if x % 2 == 0 && y % 2 == 0 {
+                    cbcrPlane[(y / 2) * width + x] = value.cb
+                    cbcrPlane[(y / 2) * width + x + 1] = value.cr
+                }
+            }
+        }
+        return Frame(width: width, height: height, yPlane: yPlane, cbcrPlane: cbcrPlane)
+    }
+    
+    fileprivate func expectedColor(y: UInt8, cb: UInt8, cr: UInt8) -> SIMD3<Float> {
+        let color = CameraLuminanceHistogram.linearColor(y: SIMD8<Float>(repeating: Float(y) / 255), cb: SIMD8<Float>(repeating: Float(cb) / 255), cr: SIMD8<Float>(repeating: Float(cr) / 255))
+        return SIMD3<Float>(color.red[0], color.green[0], color.blue[0])
+    }
+    
+}
@@ -0,0 +1,97 @@
+//
+//  DrawCallGroupTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+@testable import AugmentKit
+
+class DrawCallGroupTests: XCTestCase {
+    
+    func testNewGroupsAreInsertedInSortedUUIDOrder() {
+        
+        let existing = [makeGroup(2, "Anchors"), makeGroup(5, "Anchors"), makeGroup(8, "Anchors"), makeGroup(1, "Surfaces"), makeGroup(9, "Surfaces")]
+        let added = [makeGroup(9, "Anchors"), makeGroup(1, "Anchors"), makeGroup(6, "Anchors"), makeGroup(3, "Surfaces")]
+        
+        let merged = DrawCallGroup.merge(added, into: existing, currentIdentifiers: Set((1...9).map({uuid($0)})))
+        
+        XCTAssertEqual(merged.map({$0.uuid}), [1, 2, 5, 6, 8, 9, 1, 3, 9].map({uuid($0)}))
+        XCTAssertEqual(merged.map({$0.moduleIdentifier}), ["Anchors", "Anchors", "Anchors", "Anchors", "Anchors", "Anchors", "Surfaces", "Surfaces", "Surfaces"])
+        
+    }
+    
+    func testGroupsOfANewModuleStartARunAtTheEnd() {
+        
+        let existing = [makeGroup(4, "Anchors")]
+        let added = [makeGroup(7, "Unanchored"), makeGroup(2, "Unanchored")]
+        
+        let merged = DrawCallGroup.merge(added, into: existing, currentIdentifiers: Set([2, 4, 7].map({uuid($0)})))
+        
+        XCTAssertEqual(merged.map({$0.uuid}), [4, 2, 7].map({uuid($0)}))
+        
+    }
+    
+    func testGroupsOfRemovedEntitiesAreDropped() {
+        
+        let existing = [makeGroup(2, "Anchors"), makeGroup(8, "Anchors")]
+        let added = [makeGroup(3, "Anchors"), makeGroup(5, "Anchors"), makeGroup(6, "Anchors")]
+        
+        // The entity with UUID 5 was removed while its groups were loading
+        let merged = DrawCallGroup.merge(added, into: existing, currentIdentifiers: Set([2, 3, 6, 8].map({uuid($0)})))
+        
+        XCTAssertEqual(merged.map({$0.uuid}), [2, 3, 6, 8].map({uuid($0)}))
+        
+        let nothingAdded = DrawCallGroup.merge(added, into: existing, currentIdentifiers: Set([2, 8].map({uuid($0)})))
+        XCTAssertEqual(nothingAdded.map({$0.uuid}), [2, 8].map({uuid($0)}))
+        
+    }
+    
+    func testReloadedGroupReplacesTheExistingGroup() {
+        
+        let existing = [makeGroup(2, "Anchors"), makeGroup(5, "Anchors"), makeGroup(8, "Anchors")]
+        let reloaded = makeGroup(5, "Anchors")
+        
+        let merged = DrawCallGroup.merge([reloaded], into: existing, currentIdentifiers: Set([2, 5, 8].map({uuid($0)})))
+        
+        XCTAssertEqual(merged.count, 3)
+        XCTAssertTrue(merged[1] === reloaded)
+        XCTAssertTrue(merged[0] === existing[0])
+        XCTAssertTrue(merged[2] === existing[2])
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func uuid(_ value: Int) -> UUID {
+        return UUID(uuidString: String(format: "00000000-0000-0000-0000-%012d", value))!
+    }
+    
+    fileprivate func makeGroup(_ value: Int, _ moduleIdentifier: String) -> DrawCallGroup {
+        let drawCallGroup = DrawCallGroup(uuid: uuid(value))
+        drawCallGroup.moduleIdentifier = moduleIdentifier
+        return drawCallGroup
+    }
+    
+}
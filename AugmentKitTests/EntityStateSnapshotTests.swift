@@ -0,0 +1,155 @@
+//
+//  EntityStateSnapshotTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+import ModelIO
+@testable import AugmentKit
+
+class EntityStateSnapshotTests: XCTestCase {
+    
+    func testCapturesAnchorLocationHeadingAndEffects() {
+        
+        var location = float4x4(simd_quatf(angle: 0.5, axis: SIMD3<Float>(0, 1, 0)))
+        location.columns.3 = SIMD4<Float>(1, 2, 3, 1)
+        let anchor = AugmentedAnchor(withModelAsset: MDLAsset(), at: WorldLocation(transform: location))
+        anchor.identifier = UUID()
+        let headingRotation = simd_quatf(angle: -0.8, axis: SIMD3<Float>(0, 1, 0))
+        anchor.heading = Heading(withType: .relative, offsetRotation: HeadingRotation(withQuaternion: headingRotation))
+        anchor.effects = [AnyEffect<Any>(ConstantAlphaEffect(alphaValue: 0.25)), AnyEffect<Any>(ConstantGlowEffect(glowValue: 0.5)), AnyEffect<Any>(ConstantTintEffect(tintValue: SIMD3<Float>(1, 0, 0.5))), AnyEffect<Any>(ConstantScaleEffect(scaleValue: 2))]
+        
+        let state = EntityStateSnapshot.state(of: anchor, atTime: 0)
+        
+        XCTAssertEqual(state.identifier, anchor.identifier)
+        XCTAssertEqual(state.locationTransform, location)
+        XCTAssertTrue(state.hasHeading)
+        XCTAssertEqual(state.headingType, .relative)
+        XCTAssertEqual(state.headingRotation.vector, headingRotation.vector)
+        XCTAssertFalse(state.hasWorldTransformOverride)
+        XCTAssertEqual(state.alpha, 0.25)
+        XCTAssertEqual(state.glow, 0.5)
+        XCTAssertEqual(state.tint, SIMD3<Float>(1, 0, 0.5))
+        XCTAssertEqual(state.scale, 2)
+        
+    }
+    
+    func testEntityWithoutEffectsUsesTheDefaults() {
+        
+        let anchor = AugmentedAnchor(withModelAsset: MDLAsset(), at: WorldLocation())
+        anchor.identifier = UUID()
+        
+        let state = EntityStateSnapshot.state(of: anchor, atTime: 0)
+        
+        XCTAssertEqual(state.alpha, 1)
+        XCTAssertEqual(state.glow, 0)
+        XCTAssertEqual(state.tint, SIMD3<Float>(1, 1, 1))
+        XCTAssertEqual(state.scale, 1)
+        XCTAssertEqual(state.headingType, .absolute)
+        
+    }
+    
+    func testTrackerWithoutHeadingHasNoHeading() {
+        
+        let parent = AKRelativePosition(withTransform: float4x4.makeTranslation(x: 1, y: 2, z: 3))
+        let tracker = AugmentedTracker(with: MDLAsset(), relativeTransform: float4x4.makeTranslation(x: 0, y: 0, z: -2), to: parent)
+        tracker.identifier = UUID()
+        
+        let state = EntityStateSnapshot.state(of: tracker, atTime: 0)
+        
+        XCTAssertFalse(state.hasHeading)
+        XCTAssertEqual(state.locationTransform.columns.3, SIMD4<Float>(1, 2, 1, 1))
+        
+        let headingRotation = simd_quatf(angle: 0.3, axis: SIMD3<Float>(1, 0, 0))
+        tracker.position.heading = Heading(withType: .absolute, offsetRotation: HeadingRotation(withQuaternion: headingRotation))
+        
+        let headingState = EntityStateSnapshot.state(of: tracker, atTime: 0)
+        
+        XCTAssertTrue(headingState.hasHeading)
+        XCTAssertEqual(headingState.headingRotation.vector, headingRotation.vector)
+        
+    }
+    
+    func testRebuildReplacesThePreviousContents() {
+        
+        let first = makeAnchor(at: SIMD3<Float>(1, 0, 0))
+        let second = makeAnchor(at: SIMD3<Float>(0, 1, 0))
+        let third = makeAnchor(at: SIMD3<Float>(0, 0, 1))
+        
+        var snapshot = EntityStateSnapshot()
+        snapshot.rebuild(from: [first, second], frameNumber: 3, time: 0.05)
+        
+        XCTAssertEqual(snapshot.count, 2)
+        XCTAssertEqual(snapshot.frameNumber, 3)
+        XCTAssertEqual(snapshot.time, 0.05)
+        XCTAssertEqual(snapshot.index(forIdentifier: first.identifier!), 0)
+        XCTAssertEqual(snapshot.index(forIdentifier: second.identifier!), 1)
+        XCTAssertEqual(snapshot.state(forIdentifier: second.identifier!)?.locationTransform.columns.3, SIMD4<Float>(0, 1, 0, 1))
+        
+        // Changing an entity after the snapshot was built does not change the snapshot
+        first.worldLocation.transform = float4x4.makeTranslation(x: 5, y: 5, z: 5)
+        XCTAssertEqual(snapshot.state(forIdentifier: first.identifier!)?.locationTransform.columns.3, SIMD4<Float>(1, 0, 0, 1))
+        
+        snapshot.rebuild(from: [third, first], frameNumber: 4, time: 0.1)
+        
+        XCTAssertEqual(snapshot.count, 2)
+        XCTAssertEqual(snapshot.frameNumber, 4)
+        XCTAssertNil(snapshot.state(forIdentifier: second.identifier!))
+        XCTAssertEqual(snapshot.index(forIdentifier: third.identifier!), 0)
+        XCTAssertEqual(snapshot.state(forIdentifier: first.identifier!)?.locationTransform.columns.3, SIMD4<Float>(5, 5, 5, 1))
+        
+    }
+    
+    func testAppendReplacesAStateWithTheSameIdentifier() {
+        
+        let identifier = UUID()
+        var snapshot = EntityStateSnapshot()
+        var state = EntityState(identifier: identifier)
+        snapshot.append(state)
+        snapshot.append(EntityState(identifier: UUID()))
+        state.alpha = 0.5
+        snapshot.append(state)
+        
+        XCTAssertEqual(snapshot.count, 2)
+        XCTAssertEqual(snapshot.index(forIdentifier: identifier), 0)
+        XCTAssertEqual(snapshot.state(forIdentifier: identifier)?.alpha, 0.5)
+        
+        snapshot.removeAll()
+        
+        XCTAssertEqual(snapshot.count, 0)
+        XCTAssertNil(snapshot.index(forIdentifier: identifier))
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func makeAnchor(at position: SIMD3<Float>) -> AugmentedAnchor {
+        let anchor = AugmentedAnchor(withModelAsset: MDLAsset(), at: WorldLocation(transform: float4x4.makeTranslation(x: position.x, y: position.y, z: position.z)))
+        anchor.identifier = UUID()
+        return anchor
+    }
+    
+}
@@ -0,0 +1,155 @@
+//
+//  EnvironmentCaptureTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+import AugmentKitShader
+
+class EnvironmentCaptureTests: XCTestCase {
+    
+    // A 640x480 image with a 90 degree horizontal field of view
+    let intrinsics = float3x3(SIMD3<Float>(320, 0, 0), SIMD3<Float>(0, 320, 0), SIMD3<Float>(320, 240, 1))
+    let imageResolution = SIMD2<Float>(640, 480)
+    // Slightly wider, so that the edges of the image do not line up exactly with the edges of the cube map faces
+    let wideIntrinsics = float3x3(SIMD3<Float>(300, 0, 0), SIMD3<Float>(0, 300, 0), SIMD3<Float>(320, 240, 1))
+    
+    func testImageCoordinates() {
+        let projection = EnvironmentCaptureProjection(cameraTransform: matrix_identity_float4x4, intrinsics: intrinsics, imageResolution: imageResolution)
+        assertEqual(projection.imageCoordinates(of: SIMD3<Float>(0, 0, -1)), SIMD2<Float>(0.5, 0.5))
+        assertEqual(projection.imageCoordinates(of: SIMD3<Float>(0.2, 0, -1)), SIMD2<Float>(0.6, 0.5))
+        // Image y points down
+        assertEqual(projection.imageCoordinates(of: SIMD3<Float>(0, 0.2, -1)), SIMD2<Float>(0.5, 0.5 - 64.0 / 480.0))
+        XCTAssertNil(projection.imageCoordinates(of: SIMD3<Float>(0, 0, 1)))
+        XCTAssertFalse(projection.isVisible(SIMD3<Float>(0, 1, -0.5)))
+    }
+    
+    // The translation of the camera is ignored because the environment is infinitely far away
+    func testOnlyCameraRotationIsUsed() {
+        var cameraTransform = float4x4(simd_quatf(angle: Float.pi / 2, axis: SIMD3<Float>(0, 1, 0)))
+        cameraTransform.columns.3 = SIMD4<Float>(10, -3, 7, 1)
+        let projection = EnvironmentCaptureProjection(cameraTransform: cameraTransform, intrinsics: intrinsics, imageResolution: imageResolution)
+        // Turning left makes the camera look down -x
+        assertEqual(projection.imageCoordinates(of: SIMD3<Float>(-1, 0, 0)), SIMD2<Float>(0.5, 0.5))
+        XCTAssertNil(projection.imageCoordinates(of: SIMD3<Float>(0, 0, -1)))
+    }
+    
+    func testWeight() {
+        let projection = EnvironmentCaptureProjection(cameraTransform: matrix_identity_float4x4, intrinsics: intrinsics, imageResolution: imageResolution)
+        XCTAssertEqual(projection.weight(of: SIMD3<Float>(0, 0, -1)), 1, accuracy: 1e-6)
+        XCTAssertEqual(projection.weight(of: SIMD3<Float>(0, 0, 1)), 0)
+        // Falls off towards the edge of the image and is 0 outside of it
+        let nearEdge = projection.weight(of: SIMD3<Float>(0.95, 0, -1))
+        XCTAssertGreaterThan(nearEdge, 0)
+        XCTAssertLessThan(nearEdge, projection.weight(of: SIMD3<Float>(0.5, 0, -1)))
+        XCTAssertEqual(projection.weight(of: SIMD3<Float>(1.1, 0, -1)), 0)
+    }
+    
+    func testFaceAndUVRoundTrip() {
+        for face in 0..<6 {
+            for uv in [SIMD2<Float>(0, 0), SIMD2<Float>(0.5, -0.25), SIMD2<Float>(-0.9, 0.9), SIMD2<Float>(0.3, 0.7)] {
+                let direction = EnvironmentCaptureProjection.direction(face: face, uv: uv)
+                XCTAssertEqual(EnvironmentCaptureProjection.face(of: direction), face)
+                assertEqual(EnvironmentCaptureProjection.uv(of: direction, onFace: face), uv)
+            }
+        }
+        // Metal cube map convention: +x, -x, +y, -y, +z, -z
+        XCTAssertEqual(EnvironmentCaptureProjection.face(of: SIMD3<Float>(0, 0, -1)), 5)
+        XCTAssertEqual(EnvironmentCaptureProjection.face(of: SIMD3<Float>(0, 2, 1)), 2)
+    }
+    
+    func testVisibleTilesFaces() {
+        let forward = EnvironmentCaptureProjection(cameraTransform: matrix_identity_float4x4, intrinsics: wideIntrinsics, imageResolution: imageResolution)
+        XCTAssertEqual(Set(forward.visibleTiles(faceSize: 64, tileSize: 8).map { $0.face }), [0, 1, 5])
+        let turned = EnvironmentCaptureProjection(cameraTransform: float4x4(simd_quatf(angle: Float.pi / 2, axis: SIMD3<Float>(0, 1, 0))), intrinsics: wideIntrinsics, imageResolution: imageResolution)
+        XCTAssertEqual(Set(turned.visibleTiles(faceSize: 64, tileSize: 8).map { $0.face }), [1, 4, 5])
+    }
+    
+    // Every texel the kernel would accumulate must be in a dispatched tile
+    func testVisibleTilesCoverEveryVisibleTexel() {
+        let faceSize = 64
+        let tileSize = 8
+        let cameraTransforms = [
+            matrix_identity_float4x4,
+            float4x4(simd_quatf(angle: Float.pi / 2, axis: SIMD3<Float>(0, 1, 0))),
+            float4x4(simd_quatf(angle: 0.7, axis: normalize(SIMD3<Float>(1, 2, 3)))),
+        ]
+        for cameraTransform in cameraTransforms {
+            let projection = EnvironmentCaptureProjection(cameraTransform: cameraTransform, intrinsics: wideIntrinsics, imageResolution: imageResolution)
+            let tiles = projection.visibleTiles(faceSize: faceSize, tileSize: tileSize)
+            let tileKeys = Set(tiles.map { SIMD3<UInt32>($0.face, $0.x, $0.y) })
+            XCTAssertEqual(tileKeys.count, tiles.count)
+            for tile in tiles {
+                XCTAssertEqual(tile.x % UInt32(tileSize), 0)
+                XCTAssertEqual(tile.y % UInt32(tileSize), 0)
+                XCTAssertLessThan(Int(tile.x), faceSize)
+                XCTAssertLessThan(Int(tile.y), faceSize)
+            }
+            var visibleTexelCount = 0
+            for face in 0..<6 {
+                for y in 0..<faceSize {
+                    for x in 0..<faceSize {
+                        let uv = (SIMD2<Float>(Float(x), Float(y)) + 0.5) / Float(faceSize) * 2 - 1
+                        guard projection.isVisible(EnvironmentCaptureProjection.direction(face: face, uv: uv)) else {
+                            continue
+                        }
+                        visibleTexelCount += 1
+                        let key = SIMD3<UInt32>(UInt32(face), UInt32(x / tileSize * tileSize), UInt32(y / tileSize * tileSize))
+                        XCTAssertTrue(tileKeys.contains(key), "Texel \(x), \(y) of face \(face) is visible but its tile is not")
+                    }
+                }
+            }
+            XCTAssertGreaterThan(visibleTexelCount, 0)
+            // Less than the whole cube is written
+            XCTAssertLessThan(tiles.count, 6 * (faceSize / tileSize) * (faceSize / tileSize))
+        }
+    }
+    
+    // With a very narrow field of view no tile corner is visible, but the tile the camera looks into is still captured
+    func testNarrowFieldOfViewCapturesForwardTile() {
+        let forward = normalize(SIMD3<Float>(-0.125, -0.125, -1))
+        let z = -forward
+        let x = normalize(cross(SIMD3<Float>(0, 1, 0), z))
+        let y = cross(z, x)
+        let cameraTransform = float4x4(SIMD4<Float>(x, 0), SIMD4<Float>(y, 0), SIMD4<Float>(z, 0), SIMD4<Float>(0, 0, 0, 1))
+        let telephoto = float3x3(SIMD3<Float>(20000, 0, 0), SIMD3<Float>(0, 20000, 0), SIMD3<Float>(320, 240, 1))
+        let projection = EnvironmentCaptureProjection(cameraTransform: cameraTransform, intrinsics: telephoto, imageResolution: imageResolution)
+        let tiles = projection.visibleTiles(faceSize: 128, tileSize: 16)
+        XCTAssertEqual(tiles.map { SIMD3<UInt32>($0.face, $0.x, $0.y) }, [SIMD3<UInt32>(5, 64, 64)])
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func assertEqual(_ value: SIMD2<Float>?, _ expected: SIMD2<Float>, file: StaticString = #file, line: UInt = #line) {
+        guard let value = value else {
+            XCTFail("Expected \(expected)", file: file, line: line)
+            return
+        }
+        XCTAssertEqual(distance(value, expected), 0, accuracy: 1e-5, "\(value) is not \(expected)", file: file, line: line)
+    }
+    
+}
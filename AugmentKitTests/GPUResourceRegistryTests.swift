@@ -0,0 +1,164 @@
+//
+//  GPUResourceRegistryTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import Metal
+@testable import AugmentKit
+
+class GPUResourceRegistryTests: XCTestCase {
+    
+    func testSharedAssetIsCountedForEveryEntityUntilTheLastOneIsRemoved() {
+        
+        guard let device = MTLCreateSystemDefaultDevice() else {
+            return
+        }
+        
+        let registry = GPUResourceRegistry()
+        let first = UUID()
+        let second = UUID()
+        var buffer = device.makeBuffer(length: 4096, options: .storageModeShared)
+        let bytes = buffer?.allocatedSize ?? 0
+        XCTAssertGreaterThan(bytes, 0)
+        
+        registry.register(buffer, category: .mesh, owner: .asset("shared"))
+        registry.associate(entity: first, withAsset: "shared")
+        registry.associate(entity: second, withAsset: "shared")
+        
+        var snapshot = registry.snapshot(frameNumber: 1)
+        XCTAssertEqual(snapshot.resourceCount, 1)
+        XCTAssertEqual(snapshot.liveBytes, bytes)
+        XCTAssertEqual(snapshot.liveBytesByOwner[.asset("shared")], bytes)
+        XCTAssertEqual(snapshot.liveBytesByEntity[first], bytes)
+        XCTAssertEqual(snapshot.liveBytesByEntity[second], bytes)
+        
+        // Removing one entity leaves the asset live for the other
+        registry.dissociate(entities: [first])
+        snapshot = registry.snapshot(frameNumber: 2)
+        XCTAssertNil(snapshot.liveBytesByEntity[first])
+        XCTAssertEqual(snapshot.liveBytesByEntity[second], bytes)
+        XCTAssertEqual(snapshot.liveBytes, bytes)
+        
+        // Once the last reference to the resource is released it is no longer counted
+        registry.dissociate(entities: [second])
+        buffer = nil
+        snapshot = registry.snapshot(frameNumber: 3)
+        XCTAssertEqual(snapshot.resourceCount, 0)
+        XCTAssertEqual(snapshot.liveBytes, 0)
+        XCTAssertEqual(snapshot.liveBytesByCategory[.mesh], 0)
+        XCTAssertNil(snapshot.liveBytesByOwner[.asset("shared")])
+        XCTAssertTrue(snapshot.liveBytesByEntity.isEmpty)
+        XCTAssertEqual(snapshot.peakBytes, bytes)
+        XCTAssertEqual(snapshot.peakBytesByCategory[.mesh], bytes)
+        
+    }
+    
+    func testRegisteringTwiceKeepsTheOriginalRegistration() {
+        
+        guard let device = MTLCreateSystemDefaultDevice(), let buffer = device.makeBuffer(length: 4096, options: .storageModeShared) else {
+            return
+        }
+        
+        let registry = GPUResourceRegistry()
+        registry.register(buffer, category: .buffer, owner: .module("first"))
+        registry.register(buffer, category: .mesh, owner: .module("second"))
+        
+        let snapshot = registry.snapshot(frameNumber: 1)
+        XCTAssertEqual(snapshot.resourceCount, 1)
+        XCTAssertEqual(snapshot.liveBytes, buffer.allocatedSize)
+        XCTAssertEqual(snapshot.liveBytesByCategory[.buffer], buffer.allocatedSize)
+        XCTAssertNil(snapshot.liveBytesByCategory[.mesh])
+        XCTAssertEqual(snapshot.liveBytesByOwner[.module("first")], buffer.allocatedSize)
+        XCTAssertNil(snapshot.liveBytesByOwner[.module("second")])
+        
+    }
+    
+    func testUnregisterAllOwnedBy() {
+        
+        guard let device = MTLCreateSystemDefaultDevice(), let kept = device.makeBuffer(length: 4096, options: .storageModeShared), let dropped = device.makeBuffer(length: 8192, options: .storageModeShared) else {
+            return
+        }
+        
+        let registry = GPUResourceRegistry()
+        let entity = UUID()
+        registry.register(kept, category: .buffer, owner: .renderer)
+        registry.register(dropped, category: .buffer, owner: .entity(entity))
+        XCTAssertEqual(registry.snapshot(frameNumber: 1).resourceCount, 2)
+        
+        registry.unregisterAll(ownedBy: .entity(entity))
+        var snapshot = registry.snapshot(frameNumber: 2)
+        XCTAssertEqual(snapshot.resourceCount, 1)
+        XCTAssertEqual(snapshot.liveBytes, kept.allocatedSize)
+        XCTAssertNil(snapshot.liveBytesByOwner[.entity(entity)])
+        
+        // A resource that was unregistered can be registered again
+        registry.register(dropped, category: .buffer, owner: .renderer)
+        snapshot = registry.snapshot(frameNumber: 3)
+        XCTAssertEqual(snapshot.liveBytesByOwner[.renderer], kept.allocatedSize + dropped.allocatedSize)
+        
+        registry.unregisterAll(ownedBy: .renderer)
+        XCTAssertEqual(registry.snapshot(frameNumber: 4).resourceCount, 0)
+        
+    }
+    
+    func testBudgetIsReportedOnceUntilLiveBytesFallBackUnder() {
+        
+        guard let device = MTLCreateSystemDefaultDevice(), let first = device.makeBuffer(length: 4096, options: .storageModeShared), let second = device.makeBuffer(length: 4096, options: .storageModeShared), let third = device.makeBuffer(length: 4096, options: .storageModeShared) else {
+            return
+        }
+        
+        let registry = GPUResourceRegistry()
+        var violations = [GPUMemoryBudgetViolation]()
+        registry.budgetExceededHandler = { violations.append($0) }
+        registry.setBudget(first.allocatedSize, for: .shadowMap)
+        
+        registry.register(first, category: .shadowMap, owner: .renderer)
+        XCTAssertTrue(violations.isEmpty)
+        
+        registry.register(second, category: .shadowMap, owner: .renderer)
+        XCTAssertEqual(violations.count, 1)
+        XCTAssertEqual(violations.first?.category, .shadowMap)
+        XCTAssertEqual(violations.first?.budgetBytes, first.allocatedSize)
+        XCTAssertEqual(violations.first?.liveBytes, first.allocatedSize + second.allocatedSize)
+        
+        // Still over budget, so it is not reported again
+        registry.register(third, category: .shadowMap, owner: .renderer)
+        XCTAssertEqual(violations.count, 1)
+        
+        // Falling back under the budget re-arms it
+        registry.unregister(second)
+        registry.unregister(third)
+        registry.register(second, category: .shadowMap, owner: .renderer)
+        XCTAssertEqual(violations.count, 2)
+        
+        // Other categories are not limited by the shadow map budget
+        registry.unregister(second)
+        registry.register(third, category: .buffer, owner: .renderer)
+        XCTAssertEqual(violations.count, 2)
+        
+    }
+    
+}
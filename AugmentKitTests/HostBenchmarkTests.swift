@@ -0,0 +1,274 @@
+//
+//  HostBenchmarkTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+// MARK: - HostBenchmarkTests
+
+/**
+ Measures the host side implementations of the renderer's per frame work against a `SyntheticScene`. Every stage calls the same code the renderer, or the host mirror of the shader, uses so the timings follow the code as it changes.
+ 
+ | Stage | Work per item |
+ | --- | --- |
+ | Precalculation | `TransformComposition.compose`, the model view and normal matrices, frustum culling and `LevelOfDetailSelector.projectedSize` for one anchor. Mirrors the precalculation compute kernel. |
+ | Skinning | Skins one vertex with a palette produced by `SkeletonRetargeter` |
+ | Shading | One `ShadingPrecision.specular` evaluation followed by `ToneMapping.composite` |
+ | Heading | One look at rotation solved by `LookAtBatch` |
+ | Path Clipping | Clips one path segment to the render sphere with `AKSphere.intersection(with:)` |
+ | Geodetic | Converts one anchor transform to a `WorldLocation` and measures its haversine distance to the origin |
+ | SHA-256 | Hashes one byte of mesh data |
+ 
+ The scene is generated once, before any stage is measured.
+ */
+class HostBenchmarkTests: XCTestCase {
+    
+    /// The number of anchors in the measured scene
+    static let anchorCount = 1000
+    /// The number of shading samples taken per anchor
+    static let shadingSamplesPerAnchor = 16
+    
+    static let scene = SyntheticScene(anchorCount: anchorCount)
+    
+    func testSceneIsDeterministic() {
+        let first = SyntheticScene(anchorCount: 100, seed: 7)
+        let second = SyntheticScene(anchorCount: 100, seed: 7)
+        XCTAssertEqual(first.anchors.map { $0.transform.columns.3 }, second.anchors.map { $0.transform.columns.3 })
+        XCTAssertEqual(first.paths, second.paths)
+        XCTAssertEqual(precalculate(scene: first), precalculate(scene: second))
+        XCTAssertEqual(shade(scene: first), shade(scene: second))
+        XCTAssertNotEqual(first.anchors.map { $0.transform.columns.3 }, SyntheticScene(anchorCount: 100, seed: 8).anchors.map { $0.transform.columns.3 })
+    }
+    
+    func testPrecalculationPerformance() {
+        let scene = HostBenchmarkTests.scene
+        var checksum: Float = 0
+        measure {
+            checksum += precalculate(scene: scene)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testSkinningPerformance() {
+        // Skinning reuses one retargeter and palette, the same as a render module does between frames
+        let scene = HostBenchmarkTests.scene
+        let retargeter = SkeletonRetargeter(sourceJointNames: scene.skeleton.jointNames, skeleton: scene.skeleton)
+        var palette = Array(repeating: matrix_identity_float4x4, count: scene.skeleton.jointCount)
+        var checksum: Float = 0
+        measure {
+            checksum += skin(scene: scene, retargeter: retargeter, palette: &palette)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testShadingPerformance() {
+        let scene = HostBenchmarkTests.scene
+        var checksum: Float = 0
+        measure {
+            checksum += shade(scene: scene)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testHeadingPerformance() {
+        let scene = HostBenchmarkTests.scene
+        var lookAtBatch = LookAtBatch()
+        var rotations = [simd_quatf]()
+        var checksum: Float = 0
+        measure {
+            checksum += resolveHeadings(scene: scene, batch: &lookAtBatch, rotations: &rotations)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testPathClippingPerformance() {
+        let scene = HostBenchmarkTests.scene
+        var checksum: Float = 0
+        measure {
+            checksum += clipPaths(scene: scene)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testGeodeticPerformance() {
+        let scene = HostBenchmarkTests.scene
+        var checksum: Float = 0
+        measure {
+            checksum += convertLocations(scene: scene)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testSHA256Performance() {
+        let meshBytes = HostBenchmarkTests.scene.meshes.map { meshBytesToHash($0) }
+        var checksum: Float = 0
+        measure {
+            checksum += hash(meshBytes)
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func precalculate(scene: SyntheticScene) -> Float {
+        
+        let viewProjectionMatrix = scene.projectionMatrix * scene.viewMatrix
+        var result: Float = 0
+        for anchor in scene.anchors {
+            let modelMatrix = TransformComposition.compose(location: anchor.transform, heading: anchor.heading, headingType: anchor.headingType)
+            let modelViewMatrix = scene.viewMatrix * modelMatrix
+            let normalMatrix = float3x3(modelViewMatrix.columns.0.xyz, modelViewMatrix.columns.1.xyz, modelViewMatrix.columns.2.xyz).inverse.transpose
+            guard ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: viewProjectionMatrix * modelMatrix, sphere: anchor.boundingSphere) else {
+                continue
+            }
+            let worldCenter = modelMatrix * SIMD4<Float>(anchor.boundingSphere.x, anchor.boundingSphere.y, anchor.boundingSphere.z, 1)
+            let scale = AffineDecomposition(modelMatrix).scale
+            let radius = anchor.boundingSphere.w * simd_reduce_max(abs(scale))
+            let projectedSize = LevelOfDetailSelector.projectedSize(radius: radius, distance: distance(worldCenter.xyz, scene.cameraPosition), projectionMatrix: scene.projectionMatrix, viewportHeight: scene.viewportSize.y)
+            result += projectedSize + normalMatrix.columns.0.x
+        }
+        return result
+        
+    }
+    
+    fileprivate func skin(scene: SyntheticScene, retargeter: SkeletonRetargeter, palette: inout [matrix_float4x4]) -> Float {
+        
+        let skeleton = scene.skeleton
+        var result: Float = 0
+        for (anchorIndex, anchor) in scene.anchors.enumerated() {
+            
+            // Each anchor plays the animation from a different keyframe. The animated pose is expressed in model space the way a tracked body is.
+            let keyframe = skeleton.animations[anchorIndex % skeleton.animations.count]
+            var jointTransforms = [matrix_float4x4]()
+            jointTransforms.reserveCapacity(skeleton.jointCount)
+            for index in 0..<skeleton.jointCount {
+                var localTransform = float4x4(keyframe.rotations[index])
+                localTransform.columns.3 = SIMD4<Float>(keyframe.translations[index], 1)
+                if let parentIndex = skeleton.parentIndices[index] {
+                    jointTransforms.append(jointTransforms[parentIndex] * localTransform)
+                } else {
+                    jointTransforms.append(localTransform)
+                }
+            }
+            palette.withUnsafeMutableBufferPointer { buffer in
+                retargeter.evaluate(jointTransforms: jointTransforms, referenceJointTransforms: skeleton.bindTransforms, into: buffer)
+            }
+            
+            // Linear blend skinning, the same as the vertex shaders
+            let mesh = scene.meshes[anchor.meshIndex]
+            for vertexIndex in 0..<mesh.positions.count {
+                let position = SIMD4<Float>(mesh.positions[vertexIndex], 1)
+                let joints = mesh.jointIndices[vertexIndex]
+                let weights = mesh.jointWeights[vertexIndex]
+                let skinned = palette[Int(joints.x)] * position * weights.x + palette[Int(joints.y)] * position * weights.y
+                result += skinned.y
+            }
+            
+        }
+        return result
+        
+    }
+    
+    fileprivate func shade(scene: SyntheticScene) -> Float {
+        
+        let lightDirection = normalize(SIMD3<Float>(0.3, 1, 0.2))
+        var result: Float = 0
+        for (anchorIndex, anchor) in scene.anchors.enumerated() {
+            let mesh = scene.meshes[anchor.meshIndex]
+            let viewDirection = normalize(scene.cameraPosition - anchor.transform.columns.3.xyz)
+            let halfVector = normalize(viewDirection + lightDirection)
+            let roughness = 0.1 + 0.8 * Float(anchorIndex % 8) / 8
+            for sample in 0..<HostBenchmarkTests.shadingSamplesPerAnchor {
+                let normal = mesh.normals[(sample * 7919) % mesh.normals.count]
+                let nDotv = max(dot(normal, viewDirection), 0.001)
+                let nDotl = max(dot(normal, lightDirection), 0.001)
+                let nDoth = max(dot(normal, halfVector), 0)
+                let lDoth = max(dot(lightDirection, halfVector), 0)
+                let specular = ShadingPrecision.specular(roughness: roughness, nDoth: nDoth, oneMinusNDotHSquared: 1 - nDoth * nDoth, nDotv: nDotv, nDotl: nDotl, lDoth: lDoth, f0: 0.04)
+                let diffuse = nDotl / Float.pi
+                let radiance = SIMD3<Float>(repeating: (diffuse + specular) * nDotl)
+                let color = ToneMapping.composite(sceneColor: SIMD4<Float>(radiance, 1), over: SIMD3<Float>(0.5, 0.5, 0.5), exposure: 1)
+                result += color.x
+            }
+        }
+        return result
+        
+    }
+    
+    fileprivate func resolveHeadings(scene: SyntheticScene, batch: inout LookAtBatch, rotations: inout [simd_quatf]) -> Float {
+        batch.removeAll()
+        for anchor in scene.anchors {
+            batch.append(eye: anchor.transform.columns.3.xyz, target: scene.cameraPosition)
+        }
+        batch.resolve(into: &rotations)
+        return rotations.reduce(0) { $0 + $1.vector.w }
+    }
+    
+    fileprivate func clipPaths(scene: SyntheticScene) -> Float {
+        
+        let renderSphere = AKSphere(center: AKVector(scene.cameraPosition), radius: Double(scene.configuration.extent))
+        var result: Double = 0
+        for path in scene.paths where path.count > 1 {
+            for index in 1..<path.count {
+                let line = AKLine(point0: SIMD3<Double>(path[index - 1]), point1: SIMD3<Double>(path[index]))
+                let intersection = renderSphere.intersection(with: line)
+                if intersection.isInside {
+                    result += intersection.line.point1.x - intersection.line.point0.x
+                }
+            }
+        }
+        return Float(result)
+        
+    }
+    
+    fileprivate func convertLocations(scene: SyntheticScene) -> Float {
+        var result: Double = 0
+        for anchor in scene.anchors {
+            let location = WorldLocation(transform: anchor.transform, referenceLocation: scene.origin)
+            result += AKLocationUtility.haversineDinstance(latitude1: scene.origin.latitude, longitude1: scene.origin.longitude, latitude2: location.latitude, longitude2: location.longitude)
+        }
+        return Float(result)
+    }
+    
+    fileprivate func meshBytesToHash(_ mesh: SyntheticScene.Mesh) -> [UInt8] {
+        var bytes = [UInt8]()
+        mesh.positions.withUnsafeBytes { bytes.append(contentsOf: $0) }
+        mesh.indices.withUnsafeBytes { bytes.append(contentsOf: $0) }
+        return bytes
+    }
+    
+    fileprivate func hash(_ inputs: [[UInt8]]) -> Float {
+        var result: Float = 0
+        for input in inputs {
+            result += Float(SHA256(input).digest()[0])
+        }
+        return result
+    }
+    
+}
@@ -0,0 +1,143 @@
+//
+//  LevelOfDetailTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+@testable import AugmentKit
+import AugmentKitShader
+
+class LevelOfDetailTests: XCTestCase {
+    
+    let threeLevels = [LevelOfDetailCost(textureBytes: 4000), LevelOfDetailCost(textureBytes: 1000), LevelOfDetailCost(textureBytes: 0)]
+    
+    func testQualityLevelForProjectedSize() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        XCTAssertEqual(selector.qualityLevel(forProjectedSize: 1000, previousLevel: nil), 0)
+        XCTAssertEqual(selector.qualityLevel(forProjectedSize: 64, previousLevel: nil), 1)
+        XCTAssertEqual(selector.qualityLevel(forProjectedSize: 16, previousLevel: nil), 2)
+    }
+    
+    func testHysteresisKeepsPreviousLevel() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        // An error of 0.94 px is within tolerance but not below the lower edge of the band
+        XCTAssertEqual(selector.qualityLevel(forProjectedSize: 120, previousLevel: nil), 1)
+        XCTAssertEqual(selector.qualityLevel(forProjectedSize: 120, previousLevel: 0), 0)
+        XCTAssertEqual(selector.qualityLevel(forProjectedSize: 120, previousLevel: 1), 1)
+    }
+    
+    // An object is never given a level past the end of its costs
+    func testLevelIsLimitedByCosts() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        let limited = UUID()
+        let unlimited = UUID()
+        selector.beginFrame()
+        selector.request(limited, projectedSize: 16, costs: Array(threeLevels.prefix(2)))
+        selector.request(unlimited, projectedSize: 16, costs: threeLevels)
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: limited), QualityLevel(rawValue: 1))
+        XCTAssertEqual(selector.qualityLevel(for: unlimited), QualityLevel(rawValue: 2))
+    }
+    
+    func testBudgetRespectsLevelCount() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        selector.budget = LevelOfDetailBudget(maxTextureBytes: 0)
+        let singleLevel = UUID()
+        let other = UUID()
+        selector.beginFrame()
+        selector.request(singleLevel, projectedSize: 1, costs: [LevelOfDetailCost(textureBytes: 500)])
+        selector.request(other, projectedSize: 1000, costs: threeLevels)
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: singleLevel), QualityLevel(rawValue: 0))
+        XCTAssertEqual(selector.qualityLevel(for: other), QualityLevel(rawValue: 2))
+        XCTAssertEqual(selector.totalCost.textureBytes, 500)
+    }
+    
+    // Objects that are smallest on screen are lowered first, one level at a time, until the scene fits
+    func testBudgetForcesADowngrade() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        let large = UUID()
+        let small = UUID()
+        
+        selector.beginFrame()
+        selector.request(large, projectedSize: 1000, costs: threeLevels)
+        selector.request(small, projectedSize: 500, costs: threeLevels)
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: large), QualityLevel(rawValue: 0))
+        XCTAssertEqual(selector.qualityLevel(for: small), QualityLevel(rawValue: 0))
+        XCTAssertEqual(selector.totalCost.textureBytes, 8000)
+        
+        selector.budget = LevelOfDetailBudget(maxTextureBytes: 5000)
+        selector.beginFrame()
+        selector.request(large, projectedSize: 1000, costs: threeLevels)
+        selector.request(small, projectedSize: 500, costs: threeLevels)
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: large), QualityLevel(rawValue: 0))
+        XCTAssertEqual(selector.qualityLevel(for: small), QualityLevel(rawValue: 1))
+        XCTAssertEqual(selector.totalCost.textureBytes, 5000)
+        
+        selector.budget = LevelOfDetailBudget(maxTextureBytes: 1500)
+        selector.beginFrame()
+        selector.request(large, projectedSize: 1000, costs: threeLevels)
+        selector.request(small, projectedSize: 500, costs: threeLevels)
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: large), QualityLevel(rawValue: 1))
+        XCTAssertEqual(selector.qualityLevel(for: small), QualityLevel(rawValue: 2))
+        XCTAssertEqual(selector.totalCost.textureBytes, 1000)
+    }
+    
+    // Merged requests add the costs of the levels both can be drawn at and keep the larger projected size
+    func testRequestsAreMerged() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        let identifier = UUID()
+        selector.beginFrame()
+        selector.request(identifier, projectedSize: 16, costs: threeLevels)
+        selector.request(identifier, projectedSize: 64, costs: Array(threeLevels.prefix(2)))
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: identifier), QualityLevel(rawValue: 1))
+        XCTAssertEqual(selector.totalCost.textureBytes, 2000)
+        
+        // Merging in a request with no levels leaves only `kQualityLevelHigh`
+        selector.beginFrame()
+        selector.request(identifier, projectedSize: 16, costs: threeLevels)
+        selector.request(identifier, projectedSize: 16, costs: [])
+        selector.resolve()
+        XCTAssertEqual(selector.qualityLevel(for: identifier), QualityLevel(rawValue: 0))
+        XCTAssertEqual(selector.totalCost.textureBytes, 0)
+    }
+    
+    func testTransitionWeight() {
+        let selector = LevelOfDetailSelector(numQualityLevels: 3)
+        // The level 1 error is 1 px, the middle of the hysteresis band
+        XCTAssertEqual(selector.transitionWeight(forProjectedSize: 128, qualityLevel: 0), 0.5, accuracy: 1e-5)
+        XCTAssertEqual(selector.transitionWeight(forProjectedSize: 64, qualityLevel: 0), 0)
+        XCTAssertEqual(selector.transitionWeight(forProjectedSize: 256, qualityLevel: 0), 1)
+        // There is no next level to fade to
+        XCTAssertEqual(selector.transitionWeight(forProjectedSize: 128, qualityLevel: 0, levelCount: 1), 1)
+        XCTAssertEqual(selector.transitionWeight(forProjectedSize: 16, qualityLevel: 2), 1)
+        XCTAssertEqual(selector.transitionWeight(forProjectedSize: 128, qualityLevel: 0, levelCount: 5), 0.5, accuracy: 1e-5)
+    }
+    
+}
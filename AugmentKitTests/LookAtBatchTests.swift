@@ -0,0 +1,129 @@
+//
+//  LookAtBatchTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class LookAtBatchTests: XCTestCase {
+    
+    func testForwardAxisPointsAtTarget() {
+        
+        let eyes = [SIMD3<Float>(0, 0, 0), SIMD3<Float>(1, 2, 3), SIMD3<Float>(-4, 0.5, 2), SIMD3<Float>(10, -1, -10), SIMD3<Float>(0.25, 0, -0.5)]
+        let targets = [SIMD3<Float>(0, 0, 5), SIMD3<Float>(-2, 1, 0), SIMD3<Float>(3, 3, 3), SIMD3<Float>(0, 0, 0), SIMD3<Float>(0.25, 0.1, 4)]
+        var batch = LookAtBatch()
+        for (eye, target) in zip(eyes, targets) {
+            batch.append(eye: eye, target: target)
+        }
+        var rotations = [simd_quatf]()
+        batch.resolve(into: &rotations)
+        
+        XCTAssertEqual(rotations.count, eyes.count)
+        for (index, rotation) in rotations.enumerated() {
+            let direction = normalize(targets[index] - eyes[index])
+            let forward = rotation.act(SIMD3<Float>(0, 0, 1))
+            let right = rotation.act(SIMD3<Float>(1, 0, 0))
+            XCTAssertEqual(rotation.length, 1, accuracy: 1e-4)
+            XCTAssertEqual(distance(forward, direction), 0, accuracy: 1e-4, "Entry \(index) does not face its target")
+            // +y stays as close to world up as possible so +x stays horizontal
+            XCTAssertEqual(right.y, 0, accuracy: 1e-4)
+            XCTAssertGreaterThanOrEqual(rotation.act(SIMD3<Float>(0, 1, 0)).y, 0)
+        }
+        
+    }
+    
+    func testDegenerateEntriesResolveToIdentity() {
+        
+        var batch = LookAtBatch()
+        batch.append(eye: SIMD3<Float>(1, 1, 1), target: SIMD3<Float>(1, 1, 1))
+        batch.append(eye: SIMD3<Float>(0, 0, 0), target: SIMD3<Float>(0, 5, 0))
+        batch.append(eye: SIMD3<Float>(0, 0, 0), target: SIMD3<Float>(0, -5, 0))
+        var rotations = [simd_quatf]()
+        batch.resolve(into: &rotations)
+        
+        for rotation in rotations {
+            XCTAssertEqual(rotation.vector, SIMD4<Float>(0, 0, 0, 1))
+        }
+        
+    }
+    
+    func testBatchMatchesLaneSolver() {
+        
+        // Seven entries so the last group of four only fills three lanes
+        var batch = LookAtBatch()
+        var eyes = [SIMD3<Float>]()
+        var targets = [SIMD3<Float>]()
+        for index in 0..<7 {
+            let eye = SIMD3<Float>(Float(index), Float(index % 3) - 1, -Float(index) * 0.5)
+            let target = SIMD3<Float>(-Float(index), 1, Float(index) + 1)
+            eyes.append(eye)
+            targets.append(target)
+            batch.append(eye: eye, target: target)
+        }
+        var rotations = [simd_quatf]()
+        batch.resolve(into: &rotations)
+        
+        for (index, rotation) in rotations.enumerated() {
+            let lane = LookAtBatch.resolve(eyeX: SIMD4<Float>(repeating: eyes[index].x), eyeY: SIMD4<Float>(repeating: eyes[index].y), eyeZ: SIMD4<Float>(repeating: eyes[index].z), targetX: SIMD4<Float>(repeating: targets[index].x), targetY: SIMD4<Float>(repeating: targets[index].y), targetZ: SIMD4<Float>(repeating: targets[index].z))
+            XCTAssertEqual(rotation.vector, SIMD4<Float>(lane.x[0], lane.y[0], lane.z[0], lane.w[0]))
+        }
+        
+    }
+    
+    func testRemoveAllReusesTheBatch() {
+        
+        var batch = LookAtBatch()
+        batch.append(eye: SIMD3<Float>(0, 0, 0), target: SIMD3<Float>(1, 0, 0))
+        batch.append(eye: SIMD3<Float>(0, 0, 0), target: SIMD3<Float>(0, 0, 1))
+        var rotations = [simd_quatf]()
+        batch.resolve(into: &rotations)
+        
+        batch.removeAll()
+        XCTAssertEqual(batch.count, 0)
+        XCTAssertEqual(batch.append(eye: SIMD3<Float>(0, 0, 0), target: SIMD3<Float>(0, 0, -1)), 0)
+        batch.resolve(into: &rotations)
+        XCTAssertEqual(rotations.count, 1)
+        XCTAssertEqual(distance(rotations[0].act(SIMD3<Float>(0, 0, 1)), SIMD3<Float>(0, 0, -1)), 0, accuracy: 1e-4)
+        
+    }
+    
+    func testResolvePerformance() {
+        
+        var batch = LookAtBatch()
+        for index in 0..<10_000 {
+            let angle = Float(index) * 0.01
+            batch.append(eye: SIMD3<Float>(cos(angle) * 10, Float(index % 5), sin(angle) * 10), target: SIMD3<Float>(0, 1.5, 0))
+        }
+        var rotations = [simd_quatf]()
+        measure {
+            batch.resolve(into: &rotations)
+        }
+        XCTAssertEqual(rotations.count, 10_000)
+        
+    }
+    
+}
@@ -0,0 +1,201 @@
+//
+//  MaterialTableTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+import Metal
+import ModelIO
+@testable import AugmentKit
+
+class MaterialTableTests: XCTestCase {
+    
+    func testMaterialsWithTheSameContentAreInterned() {
+        
+        let table = MaterialTable()
+        
+        let first = table.intern(makeMaterial(named: "first", baseColor: SIMD3<Float>(1, 0.5, 0.25), roughness: 0.5))
+        let second = table.intern(makeMaterial(named: "second", baseColor: SIMD3<Float>(1, 0.5, 0.25), roughness: 0.5))
+        let different = table.intern(makeMaterial(named: "first", baseColor: SIMD3<Float>(1, 0.5, 0.25), roughness: 0.75))
+        
+        // The name is not part of the key
+        XCTAssertTrue(first === second)
+        XCTAssertFalse(first === different)
+        XCTAssertEqual(first.materialName, "first")
+        XCTAssertEqual(first.identifier, second.identifier)
+        XCTAssertNotEqual(first.identifier, different.identifier)
+        XCTAssertGreaterThanOrEqual(first.identifier, 0)
+        XCTAssertFalse(first.contentHash.isEmpty)
+        XCTAssertNotEqual(first.contentHash, different.contentHash)
+        
+        let statistics = table.statistics
+        XCTAssertEqual(statistics.materialCount, 2)
+        XCTAssertEqual(statistics.materialHits, 1)
+        
+        withExtendedLifetime((first, second, different)) {}
+        
+    }
+    
+    func testMaterialIsDroppedWhenTheLastReferenceIsReleased() {
+        
+        let table = MaterialTable()
+        
+        var held: MaterialProperties? = table.intern(makeMaterial(named: "held", baseColor: SIMD3<Float>(0, 1, 0), roughness: 1))
+        let firstIdentifier = held?.identifier
+        XCTAssertEqual(table.statistics.materialCount, 1)
+        
+        held = nil
+        XCTAssertEqual(table.statistics.materialCount, 0)
+        
+        // Interning the same content again creates a new entry
+        let reinterned = table.intern(makeMaterial(named: "held", baseColor: SIMD3<Float>(0, 1, 0), roughness: 1))
+        XCTAssertNotEqual(reinterned.identifier, firstIdentifier)
+        XCTAssertEqual(table.statistics.materialHits, 0)
+        
+    }
+    
+    func testTexturesAreLoadedOncePerKey() {
+        
+        guard let device = MTLCreateSystemDefaultDevice() else {
+            return
+        }
+        
+        let table = MaterialTable()
+        var loadCount = 0
+        let load: () -> MTLTexture? = {
+            loadCount += 1
+            return self.makeTexture(device: device)
+        }
+        
+        let first = table.texture(withKey: "file:a.png", load: load)
+        let second = table.texture(withKey: "file:a.png", load: load)
+        let other = table.texture(withKey: "file:b.png", load: load)
+        
+        XCTAssertEqual(loadCount, 2)
+        XCTAssertNotNil(first)
+        XCTAssertTrue(first === second)
+        XCTAssertFalse(first === other)
+        XCTAssertEqual(first.flatMap { table.key(of: $0) }, "file:a.png")
+        XCTAssertEqual(other.flatMap { table.key(of: $0) }, "file:b.png")
+        
+        let statistics = table.statistics
+        XCTAssertEqual(statistics.textureCount, 2)
+        XCTAssertEqual(statistics.textureHits, 1)
+        
+        // Textures loaded without a key are not interned
+        let unkeyed = table.texture(withKey: nil, load: load)
+        XCTAssertEqual(loadCount, 3)
+        XCTAssertNil(unkeyed.flatMap { table.key(of: $0) })
+        XCTAssertEqual(table.statistics.textureCount, 2)
+        
+        withExtendedLifetime((first, second, other)) {}
+        
+    }
+    
+    func testTexturesWithTheSameContentAreShared() {
+        
+        guard let device = MTLCreateSystemDefaultDevice() else {
+            return
+        }
+        
+        let table = MaterialTable()
+        var loadCount = 0
+        var hashCount = 0
+        let load: () -> MTLTexture? = {
+            loadCount += 1
+            return self.makeTexture(device: device)
+        }
+        let contentHash: (String) -> () -> String? = { hash in
+            return {
+                hashCount += 1
+                return hash
+            }
+        }
+        
+        let original = table.texture(withIdentity: "file:a.png", fingerprint: "file:64", contentHash: contentHash("same"), load: load)
+        // A copy of the same file at another path
+        let copy = table.texture(withIdentity: "file:copy-of-a.png", fingerprint: "file:64", contentHash: contentHash("same"), load: load)
+        // Same size, different content
+        let sameSize = table.texture(withIdentity: "file:c.png", fingerprint: "file:64", contentHash: contentHash("different"), load: load)
+        
+        XCTAssertTrue(original === copy)
+        XCTAssertFalse(original === sameSize)
+        XCTAssertEqual(loadCount, 2)
+        XCTAssertEqual(table.statistics.textureContentHashes, 2)
+        
+        // A texture with a fingerprint no live texture has is loaded without hashing anything
+        hashCount = 0
+        let otherSize = table.texture(withIdentity: "file:d.png", fingerprint: "file:128", contentHash: contentHash("same"), load: load)
+        XCTAssertEqual(hashCount, 0)
+        XCTAssertEqual(loadCount, 3)
+        XCTAssertFalse(original === otherSize)
+        
+        // Looking up an identity that is already live does neither
+        let again = table.texture(withIdentity: "file:copy-of-a.png", fingerprint: "file:64", contentHash: contentHash("same"), load: load)
+        XCTAssertTrue(original === again)
+        XCTAssertEqual(hashCount, 0)
+        XCTAssertEqual(loadCount, 3)
+        
+        withExtendedLifetime((original, copy, sameSize, otherSize, again)) {}
+        
+    }
+    
+    func testMaterialsWithTheSameTextureContentAreInterned() {
+        
+        guard let device = MTLCreateSystemDefaultDevice() else {
+            return
+        }
+        
+        let table = MaterialTable()
+        let load: () -> MTLTexture? = { self.makeTexture(device: device) }
+        let original = table.texture(withIdentity: "file:a.png", fingerprint: "file:64", contentHash: { "same" }, load: load)
+        let copy = table.texture(withIdentity: "file:copy-of-a.png", fingerprint: "file:64", contentHash: { "same" }, load: load)
+        let different = table.texture(withIdentity: "file:c.png", fingerprint: "file:64", contentHash: { "different" }, load: load)
+        
+        let first = table.intern(MaterialProperties(name: "first", properties: [.baseColor: (uniform: nil, texture: original)]))
+        let second = table.intern(MaterialProperties(name: "second", properties: [.baseColor: (uniform: nil, texture: copy)]))
+        let third = table.intern(MaterialProperties(name: "third", properties: [.baseColor: (uniform: nil, texture: different)]))
+        
+        XCTAssertTrue(first === second)
+        XCTAssertFalse(first === third)
+        XCTAssertEqual(table.statistics.materialCount, 2)
+        
+        withExtendedLifetime((original, copy, different, first, second, third)) {}
+        
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func makeMaterial(named name: String, baseColor: SIMD3<Float>, roughness: Float) -> MaterialProperties {
+        return MaterialProperties(name: name, properties: [.baseColor: (uniform: baseColor, texture: nil), .roughness: (uniform: roughness, texture: nil)])
+    }
+    
+    fileprivate func makeTexture(device: MTLDevice) -> MTLTexture? {
+        let descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .rgba8Unorm, width: 4, height: 4, mipmapped: false)
+        return device.makeTexture(descriptor: descriptor)
+    }
+    
+}
@@ -0,0 +1,165 @@
+//
+//  MipChainTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+@testable import AugmentKit
+
+class MipChainTests: XCTestCase {
+    
+    func testNonPowerOfTwoSizesReachOneByOne() {
+        
+        let chain = MipChain(width: 100, height: 37, levelCount: 20)
+        
+        XCTAssertEqual(MipChain.fullLevelCount(width: 100, height: 37), 7)
+        XCTAssertEqual(chain.count, 7)
+        XCTAssertEqual(chain.levels.map { $0.width }, [100, 50, 25, 12, 6, 3, 1])
+        XCTAssertEqual(chain.levels.map { $0.height }, [37, 18, 9, 4, 2, 1, 1])
+        XCTAssertEqual(chain.levels.map { $0.lod }, Array(0..<7))
+        
+    }
+    
+    func testSizes() {
+        
+        XCTAssertEqual(MipChain.size(of: 37, atLod: 0), 37)
+        XCTAssertEqual(MipChain.size(of: 37, atLod: 5), 1)
+        XCTAssertEqual(MipChain.size(of: 37, atLod: 6), 1)
+        XCTAssertEqual(MipChain.size(of: 37, atLod: 200), 1)
+        XCTAssertEqual(MipChain.fullLevelCount(width: 1, height: 1), 1)
+        XCTAssertEqual(MipChain.fullLevelCount(width: 512, height: 512), 10)
+        XCTAssertEqual(MipChain.fullLevelCount(width: 3, height: 513), 10)
+        XCTAssertEqual(MipChain.fullLevelCount(width: 0, height: 0), 0)
+        
+    }
+    
+    func testRequestedLevelCountIsHonoured() {
+        
+        let chain = MipChain(width: 100, height: 37, depth: 6, levelCount: 3)
+        
+        XCTAssertEqual(chain.count, 3)
+        XCTAssertEqual(chain.levels.map { $0.depth }, [6, 6, 6])
+        XCTAssertNotNil(chain.level(at: 2))
+        XCTAssertNil(chain.level(at: 3))
+        XCTAssertNil(chain.level(at: -1))
+        XCTAssertEqual(MipChain(width: 0, height: 37, levelCount: 3).count, 0)
+        XCTAssertEqual(MipChain(width: 100, height: 37, levelCount: 0).count, 0)
+        
+    }
+    
+    func testThreadgroupGridPerLevel() {
+        
+        let chain = MipChain(width: 100, height: 37, depth: 6, levelCount: 7, threadExecutionWidth: 32, maxTotalThreadsPerThreadgroup: 1024)
+        
+        let expectedThreadsPerThreadgroup = [(32, 32), (32, 18), (25, 9), (12, 4), (6, 2), (3, 1), (1, 1)]
+        let expectedThreadgroupsPerGrid = [(4, 2), (2, 1), (1, 1), (1, 1), (1, 1), (1, 1), (1, 1)]
+        
+        for level in chain.levels {
+            XCTAssertEqual(level.threadsPerThreadgroup.width, expectedThreadsPerThreadgroup[level.lod].0, "lod \(level.lod)")
+            XCTAssertEqual(level.threadsPerThreadgroup.height, expectedThreadsPerThreadgroup[level.lod].1, "lod \(level.lod)")
+            XCTAssertEqual(level.threadsPerThreadgroup.depth, 1, "lod \(level.lod)")
+            XCTAssertEqual(level.threadgroupsPerGrid.width, expectedThreadgroupsPerGrid[level.lod].0, "lod \(level.lod)")
+            XCTAssertEqual(level.threadgroupsPerGrid.height, expectedThreadgroupsPerGrid[level.lod].1, "lod \(level.lod)")
+            XCTAssertEqual(level.threadgroupsPerGrid.depth, 6, "lod \(level.lod)")
+            XCTAssertEqual(level.threadsPerGrid.width, level.width, "lod \(level.lod)")
+            XCTAssertEqual(level.threadsPerGrid.height, level.height, "lod \(level.lod)")
+            XCTAssertEqual(level.threadsPerGrid.depth, 6, "lod \(level.lod)")
+        }
+        
+    }
+    
+    func testThreadgroupsCoverEveryLevelWithoutAnExtraRowOrColumn() {
+        
+        for (executionWidth, maxThreads) in [(32, 1024), (64, 512), (16, 256), (32, 32)] {
+            let chain = MipChain(width: 1000, height: 333, levelCount: 20, threadExecutionWidth: executionWidth, maxTotalThreadsPerThreadgroup: maxThreads)
+            XCTAssertEqual(chain.count, 10)
+            for level in chain.levels {
+                let threads = level.threadsPerThreadgroup
+                let groups = level.threadgroupsPerGrid
+                XCTAssertLessThanOrEqual(threads.width * threads.height * threads.depth, maxThreads)
+                XCTAssertLessThanOrEqual(threads.width, level.width)
+                XCTAssertLessThanOrEqual(threads.height, level.height)
+                XCTAssertGreaterThanOrEqual(groups.width * threads.width, level.width)
+                XCTAssertGreaterThanOrEqual(groups.height * threads.height, level.height)
+                XCTAssertLessThan((groups.width - 1) * threads.width, level.width)
+                XCTAssertLessThan((groups.height - 1) * threads.height, level.height)
+            }
+        }
+        
+    }
+    
+    func testRoughnessAtTheEndsOfTheChain() {
+        
+        for mapping in [RoughnessMapping.linear, RoughnessMapping.filament] {
+            XCTAssertEqual(mapping.perceptualRoughness(forNormalizedLod: 0), 0)
+            XCTAssertEqual(mapping.perceptualRoughness(forNormalizedLod: 1), 1)
+            XCTAssertEqual(mapping.normalizedLod(forPerceptualRoughness: 0), 0)
+            XCTAssertEqual(mapping.normalizedLod(forPerceptualRoughness: 1), 1)
+            // Out of range values are clamped
+            XCTAssertEqual(mapping.perceptualRoughness(forNormalizedLod: -1), 0)
+            XCTAssertEqual(mapping.perceptualRoughness(forNormalizedLod: 2), 1)
+            XCTAssertEqual(mapping.normalizedLod(forPerceptualRoughness: -1), 0)
+            XCTAssertEqual(mapping.normalizedLod(forPerceptualRoughness: 2), 1)
+        }
+        
+    }
+    
+    func testIntermediateRoughness() {
+        
+        XCTAssertEqual(RoughnessMapping.linear.perceptualRoughness(forNormalizedLod: 0.3), 0.3, accuracy: 1e-6)
+        XCTAssertEqual(RoughnessMapping.linear.normalizedLod(forPerceptualRoughness: 0.3), 0.3, accuracy: 1e-6)
+        
+        // lod = r * (2 - r)
+        XCTAssertEqual(RoughnessMapping.filament.normalizedLod(forPerceptualRoughness: 0.5), 0.75, accuracy: 1e-6)
+        XCTAssertEqual(RoughnessMapping.filament.normalizedLod(forPerceptualRoughness: 0.2), 0.36, accuracy: 1e-6)
+        XCTAssertEqual(RoughnessMapping.filament.perceptualRoughness(forNormalizedLod: 0.75), 0.5, accuracy: 1e-6)
+        XCTAssertEqual(RoughnessMapping.filament.perceptualRoughness(forNormalizedLod: 0.36), 0.2, accuracy: 1e-6)
+        
+        for step in 0...20 {
+            let roughness = Float(step) / 20
+            let lod = RoughnessMapping.filament.normalizedLod(forPerceptualRoughness: roughness)
+            XCTAssertEqual(RoughnessMapping.filament.perceptualRoughness(forNormalizedLod: lod), roughness, accuracy: 1e-3)
+        }
+        
+    }
+    
+    func testLevelRoughness() {
+        
+        let chain = MipChain(width: 16, height: 16, levelCount: 5, roughnessMapping: .filament)
+        
+        let expectedPerceptualRoughness: [Float] = [0, 0.133975, 0.292893, 0.5, 1]
+        for level in chain.levels {
+            XCTAssertEqual(level.perceptualRoughness, expectedPerceptualRoughness[level.lod], accuracy: 1e-6, "lod \(level.lod)")
+        }
+        XCTAssertEqual(chain.levels[0].roughness, 0)
+        XCTAssertEqual(chain.levels[3].roughness, 0.25, accuracy: 1e-6)
+        XCTAssertEqual(chain.levels[4].roughness, 1)
+        
+        let singleLevel = MipChain(width: 16, height: 16, levelCount: 1)
+        XCTAssertEqual(singleLevel.levels.map { $0.roughness }, [0])
+        
+    }
+    
+}
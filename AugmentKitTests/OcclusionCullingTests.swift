@@ -0,0 +1,143 @@
+//
+//  OcclusionCullingTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class OcclusionCullingTests: XCTestCase {
+    
+    func testRealWorldSceneDepth() {
+        XCTAssertEqual(OcclusionCulling.realWorldSceneDepth(linearDepth: 0, projectionMatrix: projectionMatrix), 1)
+        XCTAssertEqual(OcclusionCulling.realWorldSceneDepth(linearDepth: nearZ, projectionMatrix: projectionMatrix), 0, accuracy: 1e-6)
+        XCTAssertEqual(OcclusionCulling.realWorldSceneDepth(linearDepth: farZ, projectionMatrix: projectionMatrix), 1, accuracy: 1e-6)
+        XCTAssertEqual(OcclusionCulling.realWorldSceneDepth(linearDepth: 2 * farZ, projectionMatrix: projectionMatrix), 1)
+        XCTAssertLessThan(OcclusionCulling.realWorldSceneDepth(linearDepth: 5, projectionMatrix: projectionMatrix), OcclusionCulling.realWorldSceneDepth(linearDepth: 10, projectionMatrix: projectionMatrix))
+    }
+    
+    func testDownsampleKeepsFarthestDepth() {
+        let level = DepthPyramidLevel(width: 4, height: 2, depths: [0.1, 0.2, 0.5, 0.3, 0.4, 0.3, 0.1, 0.2])
+        let downsampled = OcclusionCulling.downsample(level)
+        XCTAssertEqual(downsampled.width, 2)
+        XCTAssertEqual(downsampled.height, 1)
+        XCTAssertEqual(downsampled.depths, [0.4, 0.5])
+    }
+    
+    // The last row and column cover the remainder of odd sizes
+    func testDownsampleOddSize() {
+        let level = DepthPyramidLevel(width: 3, height: 3, depths: [0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.9])
+        let downsampled = OcclusionCulling.downsample(level)
+        XCTAssertEqual(downsampled.width, 1)
+        XCTAssertEqual(downsampled.height, 1)
+        XCTAssertEqual(downsampled.depths, [0.9])
+    }
+    
+    func testBuildPyramid() {
+        let pyramid = OcclusionCulling.buildPyramid(sceneDepth: makeWall(linearDepth: 5))
+        XCTAssertEqual(pyramid.map { $0.width }, [48, 24, 12, 6, 3, 1])
+        XCTAssertEqual(pyramid.map { $0.height }, [32, 16, 8, 4, 2, 1])
+    }
+    
+    func testSphereBehindWall() {
+        let sceneDepth = makeWall(linearDepth: 5)
+        let pyramid = OcclusionCulling.buildPyramid(sceneDepth: sceneDepth)
+        let sphere = SIMD4<Float>(0, 0, 0, 1)
+        let behind = projectionMatrix * float4x4.makeTranslation(x: 0.5, y: -0.5, z: -10)
+        let inFront = projectionMatrix * float4x4.makeTranslation(x: 0.5, y: -0.5, z: -3)
+        let straddling = projectionMatrix * float4x4.makeTranslation(x: 0, y: 0, z: -5)
+        let crossingNearPlane = projectionMatrix * float4x4.makeTranslation(x: 0, y: 0, z: -0.5)
+        XCTAssertTrue(OcclusionCulling.isSphereOccluded(modelViewProjectionMatrix: behind, sphere: sphere, pyramid: pyramid))
+        XCTAssertTrue(OcclusionCulling.isSphereOccludedReference(modelViewProjectionMatrix: behind, sphere: sphere, sceneDepth: sceneDepth))
+        for modelViewProjectionMatrix in [inFront, straddling, crossingNearPlane] {
+            XCTAssertFalse(OcclusionCulling.isSphereOccluded(modelViewProjectionMatrix: modelViewProjectionMatrix, sphere: sphere, pyramid: pyramid))
+            XCTAssertFalse(OcclusionCulling.isSphereOccludedReference(modelViewProjectionMatrix: modelViewProjectionMatrix, sphere: sphere, sceneDepth: sceneDepth))
+        }
+        // Spheres without a radius are never culled
+        XCTAssertFalse(OcclusionCulling.isSphereOccluded(modelViewProjectionMatrix: behind, sphere: SIMD4<Float>(0, 0, 0, 0), pyramid: pyramid))
+    }
+    
+    func testPersonOccludesSphere() {
+        let sceneDepth = DepthPyramidLevel(width: 96, height: 64, depths: [Float](repeating: 1, count: 96 * 64))
+        let realDepth = makeWall(linearDepth: 5)
+        let behind = projectionMatrix * float4x4.makeTranslation(x: 0, y: 0, z: -10)
+        let sphere = SIMD4<Float>(0, 0, 0, 1)
+        XCTAssertFalse(OcclusionCulling.isSphereOccluded(modelViewProjectionMatrix: behind, sphere: sphere, pyramid: OcclusionCulling.buildPyramid(sceneDepth: sceneDepth)))
+        XCTAssertTrue(OcclusionCulling.isSphereOccluded(modelViewProjectionMatrix: behind, sphere: sphere, pyramid: OcclusionCulling.buildPyramid(sceneDepth: sceneDepth, realDepth: realDepth)))
+        XCTAssertTrue(OcclusionCulling.isSphereOccludedReference(modelViewProjectionMatrix: behind, sphere: sphere, sceneDepth: sceneDepth, realDepth: realDepth))
+    }
+    
+    // The pyramid may keep spheres that the full resolution test culls, but must never cull a sphere that the full resolution test keeps
+    func testPyramidIsConservative() {
+        var generator = SplitMix64(seed: 11)
+        var sceneDepth = makeWall(linearDepth: 10)
+        for _ in 0..<12 {
+            let x0 = Int(generator.nextFloat(in: 0...95))
+            let y0 = Int(generator.nextFloat(in: 0...63))
+            let x1 = min(x0 + Int(generator.nextFloat(in: 1...40)), 96)
+            let y1 = min(y0 + Int(generator.nextFloat(in: 1...30)), 64)
+            let depth = OcclusionCulling.realWorldSceneDepth(linearDepth: generator.nextFloat(in: 1...10), projectionMatrix: projectionMatrix)
+            for y in y0..<y1 {
+                for x in x0..<x1 {
+                    sceneDepth.depths[y * 96 + x] = depth
+                }
+            }
+        }
+        let pyramid = OcclusionCulling.buildPyramid(sceneDepth: sceneDepth)
+        
+        var occludedCount = 0
+        var referenceOccludedCount = 0
+        for _ in 0..<2000 {
+            let distance = generator.nextFloat(in: 1...20)
+            let translation = float4x4.makeTranslation(x: generator.nextFloat(in: -1...1) * distance, y: generator.nextFloat(in: -1...1) * distance, z: -distance)
+            let sphere = SIMD4<Float>(0, 0, 0, generator.nextFloat(in: 0.05...2))
+            let isOccluded = OcclusionCulling.isSphereOccluded(modelViewProjectionMatrix: projectionMatrix * translation, sphere: sphere, pyramid: pyramid)
+            let isReferenceOccluded = OcclusionCulling.isSphereOccludedReference(modelViewProjectionMatrix: projectionMatrix * translation, sphere: sphere, sceneDepth: sceneDepth)
+            XCTAssertFalse(isOccluded && !isReferenceOccluded, "Sphere \(sphere) at \(translation.columns.3) was culled by the pyramid only")
+            occludedCount += isOccluded ? 1 : 0
+            referenceOccludedCount += isReferenceOccluded ? 1 : 0
+        }
+        XCTAssertGreaterThan(occludedCount, 100)
+        XCTAssertLessThanOrEqual(occludedCount, referenceOccludedCount)
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let nearZ: Float = 0.1
+    fileprivate let farZ: Float = 100
+    
+    // Looks down -z with a 90 degree field of view and a 0 to 1 depth range
+    fileprivate var projectionMatrix: float4x4 {
+        return float4x4(columns: (SIMD4<Float>(1, 0, 0, 0), SIMD4<Float>(0, 1, 0, 0), SIMD4<Float>(0, 0, farZ / (nearZ - farZ), -1), SIMD4<Float>(0, 0, nearZ * farZ / (nearZ - farZ), 0)))
+    }
+    
+    // Scene depth the size of the scene covered by a wall at `linearDepth`. The size is even so level 0 of the pyramid lines up with the full resolution texels.
+    fileprivate func makeWall(linearDepth: Float) -> DepthPyramidLevel {
+        let depth = OcclusionCulling.realWorldSceneDepth(linearDepth: linearDepth, projectionMatrix: projectionMatrix)
+        return DepthPyramidLevel(width: 96, height: 64, depths: [Float](repeating: depth, count: 96 * 64))
+    }
+    
+}
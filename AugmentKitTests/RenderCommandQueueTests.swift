@@ -0,0 +1,109 @@
+//
+//  RenderCommandQueueTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+@testable import AugmentKit
+
+class RenderCommandQueueTests: XCTestCase {
+    
+    func testDrainReturnsCommandsInFIFOOrder() {
+        
+        let queue = RenderCommandQueue<Int>()
+        XCTAssertTrue(queue.isEmpty)
+        XCTAssertEqual(queue.drain(), [])
+        
+        (0..<10).forEach { queue.enqueue($0) }
+        XCTAssertFalse(queue.isEmpty)
+        XCTAssertEqual(queue.drain(), Array(0..<10))
+        XCTAssertTrue(queue.isEmpty)
+        XCTAssertEqual(queue.drain(), [])
+        
+        // Commands enqueued after a drain are returned by the next one
+        queue.enqueue(10)
+        queue.enqueue(11)
+        XCTAssertEqual(queue.drain(), [10, 11])
+        
+    }
+    
+    func testConcurrentEnqueueWithASingleDrain() {
+        
+        let producerCount = 8
+        let commandsPerProducer = 1000
+        let queue = RenderCommandQueue<(producer: Int, sequence: Int)>()
+        
+        DispatchQueue.concurrentPerform(iterations: producerCount) { producer in
+            for sequence in 0..<commandsPerProducer {
+                queue.enqueue((producer: producer, sequence: sequence))
+            }
+        }
+        
+        let commands = queue.drain()
+        XCTAssertEqual(commands.count, producerCount * commandsPerProducer)
+        XCTAssertTrue(queue.isEmpty)
+        
+        // Every command arrives exactly once and the commands of each producer stay in the order they were enqueued
+        var nextSequenceByProducer = [Int](repeating: 0, count: producerCount)
+        for command in commands {
+            XCTAssertEqual(command.sequence, nextSequenceByProducer[command.producer])
+            nextSequenceByProducer[command.producer] += 1
+        }
+        XCTAssertEqual(nextSequenceByProducer, [Int](repeating: commandsPerProducer, count: producerCount))
+        
+    }
+    
+    func testDrainWhileProducersAreEnqueuing() {
+        
+        let producerCount = 4
+        let commandsPerProducer = 2000
+        let queue = RenderCommandQueue<(producer: Int, sequence: Int)>()
+        let producers = DispatchGroup()
+        
+        for producer in 0..<producerCount {
+            DispatchQueue.global().async(group: producers) {
+                for sequence in 0..<commandsPerProducer {
+                    queue.enqueue((producer: producer, sequence: sequence))
+                }
+            }
+        }
+        
+        // A single consumer drains repeatedly, as the render thread does once per frame
+        var nextSequenceByProducer = [Int](repeating: 0, count: producerCount)
+        var isFinished = false
+        while !isFinished {
+            isFinished = producers.wait(timeout: .now()) == .success
+            for command in queue.drain() {
+                XCTAssertEqual(command.sequence, nextSequenceByProducer[command.producer])
+                nextSequenceByProducer[command.producer] += 1
+            }
+        }
+        
+        XCTAssertEqual(nextSequenceByProducer, [Int](repeating: commandsPerProducer, count: producerCount))
+        XCTAssertTrue(queue.isEmpty)
+        
+    }
+    
+}
@@ -0,0 +1,136 @@
+//
+//  SRGBConversionTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import Metal
+import AugmentKitShader
+@testable import AugmentKit
+
+class SRGBConversionTests: XCTestCase {
+    
+    func testFastCurvesStayWithinTheirErrorBounds() {
+        
+        var decodeError: Float = 0
+        var encodeError: Float = 0
+        for step in 0...100_000 {
+            let value = Float(step) / 100_000
+            decodeError = max(decodeError, abs(srgbToLinearFast(value) - srgbToLinearExact(value)))
+            encodeError = max(encodeError, abs(linearToSrgbFast(value) - linearToSrgbExact(value)))
+        }
+        
+        // ColorConversion.h documents 9.4e-5 and 3.1e-5. The slack covers single precision evaluation.
+        XCTAssertLessThanOrEqual(decodeError, 9.5e-5)
+        XCTAssertLessThanOrEqual(encodeError, 3.2e-5)
+        
+    }
+    
+    func testCurvesAreContinuousAtTheLinearThreshold() {
+        let below = kSRGBDecodeLinearThreshold
+        let above = below.nextUp
+        XCTAssertEqual(srgbToLinearExact(below), srgbToLinearExact(above), accuracy: 1e-6)
+        XCTAssertEqual(linearToSrgbExact(kSRGBEncodeLinearThreshold), linearToSrgbExact(kSRGBEncodeLinearThreshold.nextUp), accuracy: 1e-5)
+        XCTAssertEqual(linearToSrgbExact(-1), 0)
+        XCTAssertEqual(linearToSrgbFast(-1), 0)
+    }
+    
+    func testEveryCodeRoundTrips() {
+        for code in 0...255 {
+            let value = UInt8(code)
+            XCTAssertEqual(SRGBConversion.toLinear(value), srgbToLinearExact(Float(code) / 255))
+            XCTAssertEqual(SRGBConversion.toSRGB8(SRGBConversion.toLinear(value)), value)
+        }
+    }
+    
+    func testTableEncodeMatchesRoundingTheExactEncode() {
+        
+        XCTAssertEqual(SRGBConversion.toSRGB8(-1), 0)
+        XCTAssertEqual(SRGBConversion.toSRGB8(2), 255)
+        for step in 0...65_536 {
+            let value = Float(step) / 65_536
+            let scaled = linearToSrgbExact(value) * 255
+            // Values within rounding error of a decision point may go either way
+            guard abs(scaled - scaled.rounded(.down) - 0.5) > 1e-3 else {
+                continue
+            }
+            XCTAssertEqual(SRGBConversion.toSRGB8(value), UInt8(scaled.rounded()), "\(value)")
+        }
+        
+    }
+    
+    func testBufferConversionsMatchScalarConversions() {
+        
+        let codes = (0..<1024).map { UInt8(($0 * 37) % 256) }
+        var linear = [Float](repeating: 0, count: codes.count)
+        var encoded = [UInt8](repeating: 0, count: codes.count)
+        codes.withUnsafeBufferPointer { source in
+            linear.withUnsafeMutableBufferPointer { SRGBConversion.toLinear(source, into: $0) }
+        }
+        linear.withUnsafeBufferPointer { source in
+            encoded.withUnsafeMutableBufferPointer { SRGBConversion.toSRGB8(source, into: $0) }
+        }
+        
+        XCTAssertEqual(linear, codes.map { SRGBConversion.toLinear($0) })
+        XCTAssertEqual(encoded, codes)
+        
+    }
+    
+    func testSRGBVariant() {
+        XCTAssertEqual(MTLPixelFormat.rgba8Unorm.srgbVariant, .rgba8Unorm_srgb)
+        XCTAssertEqual(MTLPixelFormat.bgra8Unorm_srgb.srgbVariant, .bgra8Unorm_srgb)
+        XCTAssertNil(MTLPixelFormat.rgba16Float.srgbVariant)
+    }
+    
+    func testExactEncodePerformance() {
+        let values = (0..<1_000_000).map { Float($0) / 1_000_000 }
+        var checksum: Float = 0
+        measure {
+            checksum += values.reduce(0) { $0 + linearToSrgbExact($1) }
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testFastEncodePerformance() {
+        let values = (0..<1_000_000).map { Float($0) / 1_000_000 }
+        var checksum: Float = 0
+        measure {
+            checksum += values.reduce(0) { $0 + linearToSrgbFast($1) }
+        }
+        XCTAssert(checksum.isFinite)
+    }
+    
+    func testTableEncodePerformance() {
+        let values = (0..<1_000_000).map { Float($0) / 1_000_000 }
+        var codes = [UInt8](repeating: 0, count: values.count)
+        measure {
+            values.withUnsafeBufferPointer { source in
+                codes.withUnsafeMutableBufferPointer { SRGBConversion.toSRGB8(source, into: $0) }
+            }
+        }
+        XCTAssertEqual(codes.last, 255)
+    }
+    
+}
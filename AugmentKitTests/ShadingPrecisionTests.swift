@@ -0,0 +1,93 @@
+//
+//  ShadingPrecisionTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+@testable import AugmentKit
+
+class ShadingPrecisionTests: XCTestCase {
+    
+    func testTermsAtNormalIncidence() {
+        
+        // With every vector along the normal, D = 1 / (π α²), V = 1 / 4 and F = f0
+        for roughness in [0.05, 0.25, 1.0] {
+            XCTAssertEqual(ShadingPrecision.distribution(roughness: roughness, nDoth: 1, oneMinusNDotHSquared: 0), 1 / (Double.pi * roughness * roughness), accuracy: 1e-9)
+            XCTAssertEqual(ShadingPrecision.visibility(roughness: roughness, nDotv: 1, nDotl: 1), 0.25, accuracy: 1e-12)
+        }
+        XCTAssertEqual(ShadingPrecision.fresnel(f0: 0.04, lDoth: 1.0), 0.04, accuracy: 1e-12)
+        
+    }
+    
+    func testFresnelReachesF90AtGrazingAngles() {
+        XCTAssertEqual(ShadingPrecision.fresnel(f0: 0.04, lDoth: 0.0), 1, accuracy: 1e-12)
+        // Very dark f0 values are treated as shadowed and never reach 1
+        XCTAssertEqual(ShadingPrecision.fresnel(f0: 0.01, lDoth: 0.0), 0.01 * 3 * 50 * 0.33, accuracy: 1e-12)
+    }
+    
+    func testFloatMatchesDouble() {
+        
+        var largestError: Double = 0
+        for roughness in stride(from: ShadingPrecision.minimumFullPrecisionRoughness, through: 1, by: 0.05) {
+            for nDoth in stride(from: 0.001, through: 1, by: 0.037) {
+                for nDotv in stride(from: 0.001, through: 1, by: 0.11) {
+                    let oneMinusNDotHSquared = 1 - nDoth * nDoth
+                    let reference = ShadingPrecision.specular(roughness: roughness, nDoth: nDoth, oneMinusNDotHSquared: oneMinusNDotHSquared, nDotv: nDotv, nDotl: 0.5, lDoth: 0.7, f0: 0.04)
+                    let value = ShadingPrecision.specular(roughness: Float(roughness), nDoth: Float(nDoth), oneMinusNDotHSquared: Float(oneMinusNDotHSquared), nDotv: Float(nDotv), nDotl: 0.5, lDoth: 0.7, f0: 0.04)
+                    largestError = max(largestError, abs(Double(value) - reference) / max(reference, 1.0e-3))
+                }
+            }
+        }
+        XCTAssertLessThan(largestError, 1.0e-4)
+        
+    }
+    
+    func testHalfPrecisionErrorIsBounded() {
+        
+        guard #available(iOS 14.0, *) else {
+            return
+        }
+        // Measured at 0.3% for D, 0.2% for V, 0.1% for F and 0.6% for the product with the default sweep
+        let report = ShadingPrecision.halfPrecisionError()
+        XCTAssertLessThan(report.distribution, 0.01)
+        XCTAssertLessThan(report.visibility, 0.01)
+        XCTAssertLessThan(report.fresnel, 0.01)
+        XCTAssertLessThan(report.specular, 0.01)
+        
+    }
+    
+    func testHalfPrecisionMinimumRoughnessKeepsTheHighlightFinite() {
+        
+        guard #available(iOS 14.0, *) else {
+            return
+        }
+        let roughness = Float16(ShadingPrecision.minimumHalfPrecisionRoughness)
+        let peak = ShadingPrecision.distribution(roughness: roughness, nDoth: 1, oneMinusNDotHSquared: 0)
+        // The peak is clamped to the largest finite half rather than overflowing, but at the minimum roughness it should not need to be
+        XCTAssertLessThan(peak, Float16.greatestFiniteMagnitude)
+        
+    }
+    
+}
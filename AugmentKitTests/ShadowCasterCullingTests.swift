@@ -0,0 +1,95 @@
+//
+//  ShadowCasterCullingTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class ShadowCasterCullingTests: XCTestCase {
+    
+    // Maps x and y in [-10, 10] and z in [0, 20] to clip space with z starting at 0, as the shadow pass expects
+    let lightMVP = float4x4(diagonal: SIMD4<Float>(0.1, 0.1, 0.05, 1))
+    
+    func testSphereInsideFrustum() {
+        XCTAssertTrue(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, 0, 10, 1)))
+        XCTAssertTrue(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(-9, 9, 1, 0.5)))
+    }
+    
+    func testSphereOutsideFrustum() {
+        XCTAssertFalse(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(15, 0, 10, 1)))
+        XCTAssertFalse(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(-15, 0, 10, 1)))
+        XCTAssertFalse(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, 15, 10, 1)))
+        XCTAssertFalse(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, -15, 10, 1)))
+        XCTAssertFalse(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, 0, 22, 1)))
+    }
+    
+    func testSphereStraddlingPlaneIsKept() {
+        XCTAssertTrue(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(10.5, 0, 10, 1)))
+        XCTAssertTrue(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, 0, 20.5, 1)))
+    }
+    
+    // The near plane sits at clip space z = 0, not z = -w
+    func testNearPlaneAtClipZero() {
+        XCTAssertTrue(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, 0, -0.5, 1)))
+        XCTAssertFalse(ShadowCasterCulling.isSphereInFrustum(modelViewProjectionMatrix: lightMVP, sphere: SIMD4<Float>(0, 0, -2, 1)))
+    }
+    
+    func testCastsShadow() {
+        let inside = SIMD4<Float>(0, 0, 10, 1)
+        let outside = SIMD4<Float>(15, 0, 10, 1)
+        XCTAssertTrue(ShadowCasterCulling.castsShadow(hasGeometry: true, directionalLightModelMatrix: lightMVP, boundingSphere: inside))
+        XCTAssertFalse(ShadowCasterCulling.castsShadow(hasGeometry: true, directionalLightModelMatrix: lightMVP, boundingSphere: outside))
+        XCTAssertFalse(ShadowCasterCulling.castsShadow(hasGeometry: false, directionalLightModelMatrix: lightMVP, boundingSphere: inside))
+        // Instances without a valid bounding sphere are never culled
+        XCTAssertTrue(ShadowCasterCulling.castsShadow(hasGeometry: true, directionalLightModelMatrix: lightMVP, boundingSphere: SIMD4<Float>(15, 0, 10, 0)))
+    }
+    
+    // The bounding sphere is in model space so culling has to use the combined matrix
+    func testCullingUsesModelMatrix() {
+        let modelMatrix = float4x4.makeTranslation(x: 20, y: 0, z: 0)
+        let combined = ShadowCasterCulling.directionalLightModelMatrix(directionalLightMVP: lightMVP, modelMatrix: modelMatrix)
+        let sphere = SIMD4<Float>(0, 0, 10, 1)
+        XCTAssertTrue(ShadowCasterCulling.castsShadow(hasGeometry: true, directionalLightModelMatrix: lightMVP, boundingSphere: sphere))
+        XCTAssertFalse(ShadowCasterCulling.castsShadow(hasGeometry: true, directionalLightModelMatrix: combined, boundingSphere: sphere))
+    }
+    
+    func testCombinedMatrixError() {
+        let directionalLightMVP = float4x4.makeOrtho(left: -5, right: 5, bottom: -5, top: 5, nearZ: 0.1, farZ: 50) * float4x4.makeRotate(radians: 0.7, x: 1, y: 0.3, z: 0) * float4x4.makeTranslation(x: 1.5, y: -3, z: -20)
+        let modelMatrix = float4x4.makeTranslation(x: 0.25, y: 0, z: -1.5) * float4x4.makeRotate(radians: 2.1, x: 0, y: 1, z: 0) * float4x4.makeScale(x: 0.5, y: 0.5, z: 0.5)
+        var positions = [SIMD3<Float>]()
+        for x in -2...2 {
+            for y in -2...2 {
+                for z in -2...2 {
+                    positions.append(SIMD3<Float>(Float(x), Float(y), Float(z)))
+                }
+            }
+        }
+        let error = ShadowCasterCulling.maximumError(directionalLightMVP: directionalLightMVP, modelMatrix: modelMatrix, positions: positions)
+        XCTAssertLessThan(error, 1e-4)
+    }
+    
+}
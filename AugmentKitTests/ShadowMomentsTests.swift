@@ -0,0 +1,114 @@
+//
+//  ShadowMomentsTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class ShadowMomentsTests: XCTestCase {
+    
+    func testQuantizationRoundTrip() {
+        for step in 0...100 {
+            let depth = Float(step) / 100
+            let quantizedMoments = ShadowMoments.quantize(depth: depth)
+            XCTAssertGreaterThanOrEqual(quantizedMoments.min(), -1e-4)
+            XCTAssertLessThanOrEqual(quantizedMoments.max(), 1 + 1e-4)
+            let moments = ShadowMoments.dequantize(quantizedMoments)
+            let expected = SIMD4<Float>(depth, depth * depth, depth * depth * depth, depth * depth * depth * depth)
+            XCTAssertLessThan(simd_reduce_max(abs(moments - expected)), 1e-5, "Depth \(depth)")
+        }
+    }
+    
+    func testSingleOccluder() {
+        let quantizedMoments = ShadowMoments.quantize(depth: 0.3)
+        XCTAssertEqual(ShadowMoments.shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: 0.8), 1, accuracy: 1e-3)
+        XCTAssertEqual(ShadowMoments.shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: 0.2), 0, accuracy: 1e-3)
+        // The depth bias keeps the occluder from shadowing itself
+        XCTAssertEqual(ShadowMoments.shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: 0.3), 0, accuracy: 1e-3)
+        XCTAssertEqual(ShadowMoments.visibility(quantizedMoments: quantizedMoments, fragmentDepth: 0.8), 0, accuracy: 1e-3)
+        XCTAssertEqual(ShadowMoments.visibility(quantizedMoments: quantizedMoments, fragmentDepth: 0.2), 1, accuracy: 1e-3)
+    }
+    
+    // Half of the filter footprint is at each of two depths
+    func testTwoOccluders() {
+        let quantizedMoments = (ShadowMoments.quantize(depth: 0.3) + ShadowMoments.quantize(depth: 0.7)) * 0.5
+        XCTAssertEqual(ShadowMoments.shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: 0.1), 0, accuracy: 1e-3)
+        XCTAssertEqual(ShadowMoments.shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: 0.5), 0.5, accuracy: 1e-2)
+        XCTAssertEqual(ShadowMoments.shadowIntensity(quantizedMoments: quantizedMoments, fragmentDepth: 0.9), 1, accuracy: 1e-3)
+        // Light bleeding reduction darkens partially lit receivers
+        XCTAssertEqual(ShadowMoments.visibility(quantizedMoments: quantizedMoments, fragmentDepth: 0.5), 0.375, accuracy: 1e-2)
+    }
+    
+    func testBlurWeight() {
+        XCTAssertEqual(ShadowMoments.blurWeight(offset: 0, sigma: 1.5), 1)
+        XCTAssertEqual(ShadowMoments.blurWeight(offset: 2, sigma: 1.5), ShadowMoments.blurWeight(offset: -2, sigma: 1.5))
+        XCTAssertEqual(ShadowMoments.blurWeight(offset: 2, sigma: 1.5), exp(-4 / 4.5), accuracy: 1e-6)
+    }
+    
+    func testFilterConstantShadowMap() {
+        let filtered = ShadowMoments.filterReference(depths: [Float](repeating: 0.4, count: 7 * 5), width: 7, height: 5, radius: ShadowMomentFilter.defaultBlurRadius, sigma: ShadowMomentFilter.defaultBlurSigma)
+        XCTAssertEqual(filtered.width, 3)
+        XCTAssertEqual(filtered.height, 2)
+        let expected = ShadowMoments.quantize(depth: 0.4)
+        for moments in filtered.moments {
+            XCTAssertLessThan(simd_reduce_max(abs(moments - expected)), 1e-5)
+        }
+    }
+    
+    // The visibility reconstructed from the filtered moments should match filtering the depth comparison itself for receivers that are not part of the shadow map
+    func testMatchesPercentageCloserReference() {
+        
+        // A square occluder over a sloped ground plane
+        let size = 32
+        var depths = [Float]()
+        for y in 0..<size {
+            for x in 0..<size {
+                depths.append((10..<22).contains(x) && (10..<22).contains(y) ? 0.3 : 0.6 + 0.2 * Float(y) / Float(size - 1))
+            }
+        }
+        let radius = ShadowMomentFilter.defaultBlurRadius
+        let sigma = ShadowMomentFilter.defaultBlurSigma
+        let filtered = ShadowMoments.filterReference(depths: depths, width: size, height: size, radius: radius, sigma: sigma)
+        XCTAssertEqual(filtered.moments.count, size * size / 4)
+        
+        var partiallyLitCount = 0
+        for fragmentDepth: Float in [0.1, 0.5, 0.95] {
+            for y in 0..<filtered.height {
+                for x in 0..<filtered.width {
+                    let visibility = 1 - ShadowMoments.shadowIntensity(quantizedMoments: filtered.moments[y * filtered.width + x], fragmentDepth: fragmentDepth)
+                    let reference = ShadowMoments.percentageCloserReference(depths: depths, width: size, height: size, x: x, y: y, fragmentDepth: fragmentDepth, radius: radius, sigma: sigma)
+                    XCTAssertEqual(visibility, reference, accuracy: 0.02, "Texel \(x), \(y) at depth \(fragmentDepth)")
+                    partiallyLitCount += reference > 0.1 && reference < 0.9 ? 1 : 0
+                }
+            }
+        }
+        // The penumbra is covered
+        XCTAssertGreaterThan(partiallyLitCount, 10)
+        
+    }
+    
+}
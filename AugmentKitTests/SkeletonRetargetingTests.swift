@@ -0,0 +1,124 @@
+//
+//  SkeletonRetargetingTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class SkeletonRetargetingTests: XCTestCase {
+    
+    let sourceJointNames = ["root", "upper_joint"]
+    // The tracked bone is longer than the model's
+    let referenceJointTransforms = [matrix_identity_float4x4, float4x4.makeTranslation(x: 0, y: 1.5, z: 0)]
+    
+    func testNormalizedJointName() {
+        XCTAssertEqual(SkeletonRetargeter.normalizedJointName("mixamorig:LeftArm"), "leftarm")
+        XCTAssertEqual(SkeletonRetargeter.normalizedJointName("left_arm_joint"), "leftarm")
+        XCTAssertEqual(SkeletonRetargeter.normalizedJointName("root/hips_joint"), "hips")
+        XCTAssertEqual(SkeletonRetargeter.normalizedJointName("Spine"), "spine")
+    }
+    
+    func testJointMap() {
+        var skeleton = SkeletonData()
+        skeleton.jointPaths = ["Root", "Root/Hips", "Root/Hips/LeftArm", "Root/Tail"]
+        skeleton.jointNames = ["Root", "mixamorig:Hips", "LeftArm", "Tail"]
+        skeleton.parentIndices = [nil, 0, 1, 0]
+        let retargeter = SkeletonRetargeter(sourceJointNames: ["root", "hips_joint", "left_arm_joint", "spine_1_joint"], skeleton: skeleton)
+        XCTAssertEqual(retargeter.jointMap, [0, 1, 2, nil])
+        XCTAssertEqual(retargeter.mappedJointCount, 3)
+    }
+    
+    func testNeutralPoseIsIdentity() {
+        let retargeter = SkeletonRetargeter(sourceJointNames: sourceJointNames, skeleton: makeChain())
+        let palette = evaluate(retargeter, jointTransforms: referenceJointTransforms)
+        for transform in palette {
+            assertEqual(transform, matrix_identity_float4x4)
+        }
+    }
+    
+    // Unmapped joints follow their parent and every bone keeps the model's length
+    func testRotationIsRetargeted() {
+        let retargeter = SkeletonRetargeter(sourceJointNames: sourceJointNames, skeleton: makeChain())
+        let jointTransforms = [matrix_identity_float4x4, float4x4.makeTranslation(x: 0, y: 1.5, z: 0) * float4x4.makeRotate(radians: Float.pi / 2, x: 0, y: 0, z: 1)]
+        let palette = evaluate(retargeter, jointTransforms: jointTransforms)
+        assertEqual((palette[1] * SIMD4<Float>(0, 1, 0, 1)).xyz, SIMD3<Float>(0, 1, 0))
+        assertEqual((palette[2] * SIMD4<Float>(0, 2, 0, 1)).xyz, SIMD3<Float>(-1, 1, 0))
+        // A vertex half way along the upper bone
+        assertEqual((palette[1] * SIMD4<Float>(0, 1.5, 0, 1)).xyz, SIMD3<Float>(-0.5, 1, 0))
+    }
+    
+    func testRootTranslationIsRetargeted() {
+        let retargeter = SkeletonRetargeter(sourceJointNames: sourceJointNames, skeleton: makeChain())
+        let jointTransforms = [float4x4.makeTranslation(x: 0, y: 0, z: 0.5), float4x4.makeTranslation(x: 0, y: 1.5, z: 0.5)]
+        let palette = evaluate(retargeter, jointTransforms: jointTransforms)
+        for transform in palette {
+            assertEqual(transform, float4x4.makeTranslation(x: 0, y: 0, z: 0.5))
+        }
+    }
+    
+    func testShortPaletteIsNotOverrun() {
+        let retargeter = SkeletonRetargeter(sourceJointNames: sourceJointNames, skeleton: makeChain())
+        var palette = [matrix_float4x4](repeating: matrix_float4x4(diagonal: SIMD4<Float>(repeating: 2)), count: 3)
+        palette.withUnsafeMutableBufferPointer { buffer in
+            retargeter.evaluate(jointTransforms: referenceJointTransforms, referenceJointTransforms: referenceJointTransforms, into: UnsafeMutableBufferPointer(rebasing: buffer[0..<2]))
+        }
+        assertEqual(palette[1], matrix_identity_float4x4)
+        assertEqual(palette[2], matrix_float4x4(diagonal: SIMD4<Float>(repeating: 2)))
+    }
+    
+    // MARK: - Private
+    
+    // A root, an upper bone one unit long and an unmapped tip one unit further up
+    fileprivate func makeChain() -> SkeletonData {
+        var skeleton = SkeletonData()
+        skeleton.jointPaths = ["Root", "Root/Upper", "Root/Upper/Tip"]
+        skeleton.jointNames = ["Root", "Upper", "Tip"]
+        skeleton.parentIndices = [nil, 0, 1]
+        skeleton.bindTransforms = [matrix_identity_float4x4, float4x4.makeTranslation(x: 0, y: 1, z: 0), float4x4.makeTranslation(x: 0, y: 2, z: 0)]
+        skeleton.inverseBindTransforms = skeleton.bindTransforms.map { $0.inverse }
+        return skeleton
+    }
+    
+    fileprivate func evaluate(_ retargeter: SkeletonRetargeter, jointTransforms: [matrix_float4x4]) -> [matrix_float4x4] {
+        var palette = [matrix_float4x4](repeating: matrix_identity_float4x4, count: retargeter.jointCount)
+        palette.withUnsafeMutableBufferPointer { buffer in
+            retargeter.evaluate(jointTransforms: jointTransforms, referenceJointTransforms: referenceJointTransforms, into: buffer)
+        }
+        return palette
+    }
+    
+    fileprivate func assertEqual(_ value: SIMD3<Float>, _ expected: SIMD3<Float>, file: StaticString = #file, line: UInt = #line) {
+        XCTAssertEqual(distance(value, expected), 0, accuracy: 1e-5, "\(value) is not \(expected)", file: file, line: line)
+    }
+    
+    fileprivate func assertEqual(_ transform: float4x4, _ expected: float4x4, file: StaticString = #file, line: UInt = #line) {
+        for column in 0..<4 {
+            XCTAssertEqual(distance(transform[column], expected[column]), 0, accuracy: 1e-5, file: file, line: line)
+        }
+    }
+    
+}
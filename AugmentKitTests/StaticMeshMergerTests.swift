@@ -0,0 +1,169 @@
+//
+//  StaticMeshMergerTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import ModelIO
+import simd
+@testable import AugmentKit
+
+class StaticMeshMergerTests: XCTestCase {
+    
+    func testIsStatic() {
+        let transform = float4x4.makeTranslation(x: 1, y: 2, z: 3)
+        XCTAssertTrue(StaticMeshMerger.isStatic([]))
+        XCTAssertTrue(StaticMeshMerger.isStatic([transform, transform, transform]))
+        XCTAssertTrue(StaticMeshMerger.isStatic([transform, transform * float4x4.makeTranslation(x: 1.0e-7, y: 0, z: 0)]))
+        XCTAssertFalse(StaticMeshMerger.isStatic([transform, transform * float4x4.makeTranslation(x: 0.01, y: 0, z: 0)]))
+    }
+    
+    // Meshes that share a material end up in one submesh with their indices rebased onto the merged vertices
+    func testMergesMeshesWithSameMaterial() {
+        let merger = StaticMeshMerger()
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: makeMaterial(color: SIMD3<Float>(1, 0, 0))), worldTransform: matrix_identity_float4x4))
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: makeMaterial(color: SIMD3<Float>(1, 0, 0))), worldTransform: float4x4.makeTranslation(x: 0, y: 0, z: -2)))
+        XCTAssertEqual(merger.sourceMeshCount, 2)
+        
+        let meshes = merger.mergedMeshes()
+        XCTAssertEqual(meshes.count, 1)
+        guard let mesh = meshes.first else {
+            return
+        }
+        XCTAssertEqual(mesh.vertexCount, 6)
+        XCTAssertEqual(indices(of: mesh), [[0, 1, 2, 3, 4, 5]])
+        assertEqual(position(of: mesh, at: 4), SIMD3<Float>(1, 0, -2))
+        assertEqual(normal(of: mesh, at: 4), SIMD3<Float>(0, 0, 1))
+        
+        // The merger is empty afterwards
+        XCTAssertEqual(merger.sourceMeshCount, 0)
+        XCTAssertTrue(merger.mergedMeshes().isEmpty)
+    }
+    
+    func testKeepsOneSubmeshPerMaterial() {
+        let merger = StaticMeshMerger()
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: makeMaterial(color: SIMD3<Float>(1, 0, 0))), worldTransform: matrix_identity_float4x4))
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: makeMaterial(color: SIMD3<Float>(0, 1, 0))), worldTransform: matrix_identity_float4x4))
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: makeMaterial(color: SIMD3<Float>(1, 0, 0))), worldTransform: matrix_identity_float4x4))
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: nil), worldTransform: matrix_identity_float4x4))
+        let meshes = merger.mergedMeshes()
+        XCTAssertEqual(meshes.count, 1)
+        XCTAssertEqual(meshes.first.map { indices(of: $0) }, [[0, 1, 2, 6, 7, 8], [3, 4, 5], [9, 10, 11]])
+    }
+    
+    // A mirrored transform flips the winding back and normals use the inverse transpose
+    func testMirroredAndNonUniformTransforms() {
+        let merger = StaticMeshMerger()
+        let mesh = makeTriangleMesh(normal: simd_normalize(SIMD3<Float>(1, 0, 1)), material: nil)
+        XCTAssertTrue(merger.add(mesh, worldTransform: float4x4.makeScale(x: -2, y: 1, z: 1)))
+        guard let merged = merger.mergedMeshes().first else {
+            XCTFail("Nothing was merged")
+            return
+        }
+        XCTAssertEqual(indices(of: merged), [[0, 2, 1]])
+        assertEqual(position(of: merged, at: 1), SIMD3<Float>(-2, 0, 0))
+        assertEqual(normal(of: merged, at: 0), simd_normalize(SIMD3<Float>(-0.5, 0, 1)))
+    }
+    
+    func testRejectsUnsupportedMeshes() {
+        let merger = StaticMeshMerger()
+        XCTAssertFalse(merger.add(makeTriangleMesh(material: nil, geometryType: .lines), worldTransform: matrix_identity_float4x4))
+        XCTAssertFalse(merger.add(makeTriangleMesh(material: nil, positionFormat: .half3), worldTransform: matrix_identity_float4x4))
+        XCTAssertEqual(merger.sourceMeshCount, 0)
+        XCTAssertTrue(merger.mergedMeshes().isEmpty)
+    }
+    
+    func testDifferentLayoutsAreNotMerged() {
+        let merger = StaticMeshMerger()
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: nil), worldTransform: matrix_identity_float4x4))
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: nil, positionFormat: .float4), worldTransform: matrix_identity_float4x4))
+        XCTAssertTrue(merger.add(makeTriangleMesh(material: nil), worldTransform: matrix_identity_float4x4))
+        XCTAssertEqual(merger.mergedMeshes().map { $0.vertexCount }, [3, 3, 3])
+    }
+    
+    // MARK: - Private
+    
+    fileprivate let allocator = MDLMeshBufferDataAllocator()
+    
+    // Position and normal interleaved with a stride of 8 floats, leaving room for a `.float4` position
+    fileprivate let vertexStride = 8 * MemoryLayout<Float>.stride
+    fileprivate let normalOffset = 4 * MemoryLayout<Float>.stride
+    
+    // A triangle in the xy plane with its vertices at the origin, +x and +y
+    fileprivate func makeTriangleMesh(normal: SIMD3<Float> = SIMD3<Float>(0, 0, 1), material: MDLMaterial?, positionFormat: MDLVertexFormat = .float3, geometryType: MDLGeometryType = .triangles) -> MDLMesh {
+        
+        let positions = [SIMD3<Float>(0, 0, 0), SIMD3<Float>(1, 0, 0), SIMD3<Float>(0, 1, 0)]
+        var vertices = [Float]()
+        for position in positions {
+            vertices += [position.x, position.y, position.z, 1, normal.x, normal.y, normal.z, 0]
+        }
+        let indices: [UInt16] = [0, 1, 2]
+        
+        let vertexDescriptor = MDLVertexDescriptor()
+        vertexDescriptor.attributes[0] = MDLVertexAttribute(name: MDLVertexAttributePosition, format: positionFormat, offset: 0, bufferIndex: 0)
+        vertexDescriptor.attributes[1] = MDLVertexAttribute(name: MDLVertexAttributeNormal, format: .float3, offset: normalOffset, bufferIndex: 0)
+        vertexDescriptor.layouts[0] = MDLVertexBufferLayout(stride: vertexStride)
+        
+        let vertexBuffer = allocator.newBuffer(with: vertices.withUnsafeBufferPointer { Data(buffer: $0) }, type: .vertex)
+        let indexBuffer = allocator.newBuffer(with: indices.withUnsafeBufferPointer { Data(buffer: $0) }, type: .index)
+        let submesh = MDLSubmesh(indexBuffer: indexBuffer, indexCount: indices.count, indexType: .uInt16, geometryType: geometryType, material: material)
+        return MDLMesh(vertexBuffer: vertexBuffer, vertexCount: positions.count, descriptor: vertexDescriptor, submeshes: [submesh])
+        
+    }
+    
+    // A new material object every time, so materials are only shared when they are equal
+    fileprivate func makeMaterial(color: SIMD3<Float>) -> MDLMaterial {
+        let material = MDLMaterial(name: "Material", scatteringFunction: MDLScatteringFunction())
+        material.setProperty(MDLMaterialProperty(name: "baseColor", semantic: .baseColor, float3: color))
+        return material
+    }
+    
+    fileprivate func indices(of mesh: MDLMesh) -> [[UInt32]] {
+        let submeshes = mesh.submeshes?.compactMap { $0 as? MDLSubmesh } ?? []
+        return submeshes.map { submesh -> [UInt32] in
+            XCTAssertEqual(submesh.indexType, .uInt32)
+            let bytes = submesh.indexBuffer.map().bytes
+            return (0..<submesh.indexCount).map { bytes.load(fromByteOffset: $0 * 4, as: UInt32.self) }
+        }
+    }
+    
+    fileprivate func position(of mesh: MDLMesh, at index: Int) -> SIMD3<Float> {
+        return vector(of: mesh, at: index * vertexStride)
+    }
+    
+    fileprivate func normal(of mesh: MDLMesh, at index: Int) -> SIMD3<Float> {
+        return vector(of: mesh, at: index * vertexStride + normalOffset)
+    }
+    
+    fileprivate func vector(of mesh: MDLMesh, at byteOffset: Int) -> SIMD3<Float> {
+        let bytes = mesh.vertexBuffers[0].map().bytes
+        return SIMD3<Float>(bytes.load(fromByteOffset: byteOffset, as: Float.self), bytes.load(fromByteOffset: byteOffset + 4, as: Float.self), bytes.load(fromByteOffset: byteOffset + 8, as: Float.self))
+    }
+    
+    fileprivate func assertEqual(_ value: SIMD3<Float>, _ expected: SIMD3<Float>, file: StaticString = #file, line: UInt = #line) {
+        XCTAssertEqual(distance(value, expected), 0, accuracy: 1e-5, "\(value) is not \(expected)", file: file, line: line)
+    }
+    
+}
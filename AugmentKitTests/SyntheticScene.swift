@@ -0,0 +1,372 @@
+//
+//  SyntheticScene.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+
+import Foundation
+import simd
+@testable import AugmentKit
+
+// MARK: - SplitMix64
+
+/// A small, fast, seedable random number generator. The same seed always produces the same sequence on every platform, which is what makes `SyntheticScene` reproducible.
+struct SplitMix64: RandomNumberGenerator {
+    
+    init(seed: UInt64) {
+        state = seed
+    }
+    
+    mutating func next() -> UInt64 {
+        state &+= 0x9E3779B97F4A7C15
+        var z = state
+        z = (z ^ (z >> 30)) &* 0xBF58476D1CE4E5B9
+        z = (z ^ (z >> 27)) &* 0x94D049BB133111EB
+        return z ^ (z >> 31)
+    }
+    
+    /// A uniformly distributed value in `range`. Built from the top 24 bits of `next()` so the result does not depend on the standard library's implementation of `Float.random(in:using:)`.
+    mutating func nextFloat(in range: ClosedRange<Float>) -> Float {
+        let unit = Float(next() >> 40) / Float(1 << 24)
+        return range.lowerBound + (range.upperBound - range.lowerBound) * unit
+    }
+    
+    // MARK: - Private
+    
+    fileprivate var state: UInt64
+    
+}
+
+// MARK: - SyntheticScene
+
+/**
+ A deterministic, procedurally generated AR scene made up of the same kinds of data the renderer consumes every frame: anchors with transforms, headings and bounds, parametric meshes, an animated skeleton, paths, environment probes and geographic locations.
+ 
+ A scene depends only on its `Configuration`, so two scenes created with the same configuration are identical. This makes it possible to measure the host side work of the renderer without a device, a camera feed or any assets. See `HostBenchmarkTests`.
+ */
+struct SyntheticScene {
+    
+    /// The parameters a scene is generated from
+    struct Configuration {
+        /// The number of anchors
+        var anchorCount: Int = 100
+        /// The seed of the random number generator
+        var seed: UInt64 = 1
+        /// The number of segments around the parametric sphere. The sphere has half as many rings.
+        var meshResolution: Int = 16
+        /// The number of joints in the skeleton. The joints form a single chain.
+        var jointCount: Int = 24
+        /// The number of keyframes in the skeleton's animation
+        var keyframeCount: Int = 30
+        /// The number of paths
+        var pathCount: Int = 8
+        /// The number of segments in each path
+        var pathSegmentCount: Int = 32
+        /// The number of environment probes
+        var probeCount: Int = 4
+        /// Anchors, paths and probes are placed within this distance, in meters, of the origin
+        var extent: Float = 20
+        /// The geographic location of the origin of the AR world
+        var originLatitude: Double = 37.3318
+        var originLongitude: Double = -122.0312
+        var originElevation: Double = 10
+        
+        init() {}
+        
+        init(anchorCount: Int, seed: UInt64 = 1) {
+            self.anchorCount = anchorCount
+            self.seed = seed
+        }
+    }
+    
+    /// A generated anchor
+    struct Anchor {
+        /// The anchor's location in world space. Includes a non uniform scale for some anchors so both of the `TransformComposition` paths are exercised.
+        var transform: float4x4
+        var heading: simd_quatf
+        var headingType: HeadingType
+        /// The model space bounding sphere of the anchor's mesh. Center in `xyz` and radius in `w`.
+        var boundingSphere: SIMD4<Float>
+        /// The index of the anchor's mesh in `meshes`
+        var meshIndex: Int
+        /// The geographic location of the anchor
+        var worldLocation: WorldLocation
+    }
+    
+    /// A generated mesh
+    struct Mesh {
+        var positions = [SIMD3<Float>]()
+        var normals = [SIMD3<Float>]()
+        var indices = [UInt32]()
+        /// For each vertex, the two joints that influence it
+        var jointIndices = [SIMD2<UInt16>]()
+        /// For each vertex, the weight of each of the two joints. The weights add up to 1.
+        var jointWeights = [SIMD2<Float>]()
+    }
+    
+    /// A generated environment probe
+    struct Probe {
+        var center: SIMD3<Float>
+        var extent: SIMD3<Float>
+    }
+    
+    let configuration: Configuration
+    let anchors: [Anchor]
+    /// A sphere and a box, both at `configuration.meshResolution`. Anchors share these the way instanced models share their `MeshGPUData`.
+    let meshes: [Mesh]
+    let skeleton: SkeletonData
+    /// Each path is a list of points. Consecutive points are the ends of a segment.
+    let paths: [[SIMD3<Float>]]
+    let probes: [Probe]
+    /// The geographic location of the origin of the AR world
+    let origin: WorldLocation
+    /// The camera is placed at the origin, looking down -z
+    let cameraPosition: SIMD3<Float>
+    let viewMatrix: float4x4
+    /// A Metal style projection with clip space z in [0, 1]
+    let projectionMatrix: float4x4
+    let viewportSize: SIMD2<Float>
+    
+    init(configuration: Configuration) {
+        
+        self.configuration = configuration
+        var generator = SplitMix64(seed: configuration.seed)
+        let extent = configuration.extent
+        
+        origin = WorldLocation(transform: matrix_identity_float4x4, latitude: configuration.originLatitude, longitude: configuration.originLongitude, elevation: configuration.originElevation)
+        
+        let jointCount = max(configuration.jointCount, 1)
+        meshes = [
+            SyntheticScene.makeSphere(segments: configuration.meshResolution, radius: 0.5, jointCount: jointCount),
+            SyntheticScene.makeBox(segments: configuration.meshResolution / 2, extent: SIMD3<Float>(0.5, 0.25, 0.75), jointCount: jointCount),
+        ]
+        let meshBounds = meshes.map { SyntheticScene.boundingSphere(of: $0.positions) }
+        
+        var anchors = [Anchor]()
+        anchors.reserveCapacity(configuration.anchorCount)
+        for index in 0..<configuration.anchorCount {
+            let position = SIMD3<Float>(generator.nextFloat(in: -extent...extent), generator.nextFloat(in: -1.5...1.5), generator.nextFloat(in: -extent...extent))
+            let angle = generator.nextFloat(in: 0...(2 * Float.pi))
+            // Every fourth anchor is scaled non uniformly
+            let scale: SIMD3<Float> = index % 4 == 3 ? SIMD3<Float>(generator.nextFloat(in: 0.5...2), generator.nextFloat(in: 0.5...2), generator.nextFloat(in: 0.5...2)) : SIMD3<Float>(repeating: 1)
+            var transform = float4x4(simd_quatf(angle: angle, axis: SIMD3<Float>(0, 1, 0))) * float4x4(diagonal: SIMD4<Float>(scale, 1))
+            transform.columns.3 = SIMD4<Float>(position, 1)
+            let heading = simd_quatf(angle: generator.nextFloat(in: 0...(2 * Float.pi)), axis: SIMD3<Float>(0, 1, 0))
+            let meshIndex = index % meshes.count
+            let worldLocation = WorldLocation(transform: transform, referenceLocation: origin)
+            anchors.append(Anchor(transform: transform, heading: heading, headingType: index % 2 == 0 ? .relative : .absolute, boundingSphere: meshBounds[meshIndex], meshIndex: meshIndex, worldLocation: worldLocation))
+        }
+        self.anchors = anchors
+        
+        skeleton = SyntheticScene.makeSkeleton(jointCount: jointCount, keyframeCount: max(configuration.keyframeCount, 1), generator: &generator)
+        
+        var paths = [[SIMD3<Float>]]()
+        for _ in 0..<configuration.pathCount {
+            var point = SIMD3<Float>(generator.nextFloat(in: -extent...extent), 0, generator.nextFloat(in: -extent...extent))
+            var points = [point]
+            for _ in 0..<configuration.pathSegmentCount {
+                point += SIMD3<Float>(generator.nextFloat(in: -4...4), generator.nextFloat(in: -0.5...0.5), generator.nextFloat(in: -4...4))
+                points.append(point)
+            }
+            paths.append(points)
+        }
+        self.paths = paths
+        
+        var probes = [Probe]()
+        for _ in 0..<configuration.probeCount {
+            let center = SIMD3<Float>(generator.nextFloat(in: -extent...extent), 0, generator.nextFloat(in: -extent...extent))
+            let probeExtent = SIMD3<Float>(generator.nextFloat(in: 2...10), generator.nextFloat(in: 2...4), generator.nextFloat(in: 2...10))
+            probes.append(Probe(center: center, extent: probeExtent))
+        }
+        self.probes = probes
+        
+        cameraPosition = SIMD3<Float>(0, 1.5, 0)
+        var cameraTransform = matrix_identity_float4x4
+        cameraTransform.columns.3 = SIMD4<Float>(cameraPosition, 1)
+        viewMatrix = cameraTransform.inverse
+        viewportSize = SIMD2<Float>(1170, 2532)
+        projectionMatrix = SyntheticScene.makeProjection(fovyRadians: Float.pi / 3, aspect: viewportSize.x / viewportSize.y, nearZ: 0.001, farZ: 100)
+        
+    }
+    
+    init(anchorCount: Int, seed: UInt64 = 1) {
+        self.init(configuration: Configuration(anchorCount: anchorCount, seed: seed))
+    }
+    
+    // MARK: - Private
+    
+    // Right handed, looking down -z, clip space z in [0, 1]
+    fileprivate static func makeProjection(fovyRadians: Float, aspect: Float, nearZ: Float, farZ: Float) -> float4x4 {
+        let yScale = 1 / tan(fovyRadians * 0.5)
+        let xScale = yScale / aspect
+        let zScale = farZ / (nearZ - farZ)
+        return float4x4(
+            SIMD4<Float>(xScale, 0, 0, 0),
+            SIMD4<Float>(0, yScale, 0, 0),
+            SIMD4<Float>(0, 0, zScale, -1),
+            SIMD4<Float>(0, 0, nearZ * zScale, 0)
+        )
+    }
+    
+    // A UV sphere with `segments` segments and `segments / 2` rings. The joint weights blend along y so the mesh bends like a limb.
+    fileprivate static func makeSphere(segments: Int, radius: Float, jointCount: Int) -> Mesh {
+        
+        let segmentCount = max(segments, 3)
+        let ringCount = max(segmentCount / 2, 2)
+        var mesh = Mesh()
+        
+        for ring in 0...ringCount {
+            let phi = Float.pi * Float(ring) / Float(ringCount)
+            for segment in 0...segmentCount {
+                let theta = 2 * Float.pi * Float(segment) / Float(segmentCount)
+                let normal = SIMD3<Float>(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta))
+                mesh.positions.append(normal * radius)
+                mesh.normals.append(normal)
+            }
+        }
+        
+        let rowLength = UInt32(segmentCount + 1)
+        for ring in 0..<UInt32(ringCount) {
+            for segment in 0..<UInt32(segmentCount) {
+                let a = ring * rowLength + segment
+                let b = a + rowLength
+                mesh.indices.append(contentsOf: [a, b, a + 1, a + 1, b, b + 1])
+            }
+        }
+        
+        assignJointWeights(to: &mesh, jointCount: jointCount)
+        return mesh
+        
+    }
+    
+    // A box with each face divided into `segments` x `segments` quads
+    fileprivate static func makeBox(segments: Int, extent: SIMD3<Float>, jointCount: Int) -> Mesh {
+        
+        let segmentCount = max(segments, 1)
+        var mesh = Mesh()
+        let faces: [(normal: SIMD3<Float>, u: SIMD3<Float>, v: SIMD3<Float>)] = [
+            (SIMD3<Float>(1, 0, 0), SIMD3<Float>(0, 0, -1), SIMD3<Float>(0, 1, 0)),
+            (SIMD3<Float>(-1, 0, 0), SIMD3<Float>(0, 0, 1), SIMD3<Float>(0, 1, 0)),
+            (SIMD3<Float>(0, 1, 0), SIMD3<Float>(1, 0, 0), SIMD3<Float>(0, 0, -1)),
+            (SIMD3<Float>(0, -1, 0), SIMD3<Float>(1, 0, 0), SIMD3<Float>(0, 0, 1)),
+            (SIMD3<Float>(0, 0, 1), SIMD3<Float>(1, 0, 0), SIMD3<Float>(0, 1, 0)),
+            (SIMD3<Float>(0, 0, -1), SIMD3<Float>(-1, 0, 0), SIMD3<Float>(0, 1, 0)),
+        ]
+        
+        for face in faces {
+            let baseIndex = UInt32(mesh.positions.count)
+            for row in 0...segmentCount {
+                let v = Float(row) / Float(segmentCount) * 2 - 1
+                for column in 0...segmentCount {
+                    let u = Float(column) / Float(segmentCount) * 2 - 1
+                    mesh.positions.append((face.normal + face.u * u + face.v * v) * extent)
+                    mesh.normals.append(face.normal)
+                }
+            }
+            let rowLength = UInt32(segmentCount + 1)
+            for row in 0..<UInt32(segmentCount) {
+                for column in 0..<UInt32(segmentCount) {
+                    let a = baseIndex + row * rowLength + column
+                    let b = a + rowLength
+                    mesh.indices.append(contentsOf: [a, a + 1, b, a + 1, b + 1, b])
+                }
+            }
+        }
+        
+        assignJointWeights(to: &mesh, jointCount: jointCount)
+        return mesh
+        
+    }
+    
+    // Maps the height of each vertex onto the joint chain and blends between the two nearest joints
+    fileprivate static func assignJointWeights(to mesh: inout Mesh, jointCount: Int) {
+        
+        let minimumY = mesh.positions.reduce(Float.greatestFiniteMagnitude) { min($0, $1.y) }
+        let maximumY = mesh.positions.reduce(-Float.greatestFiniteMagnitude) { max($0, $1.y) }
+        let height = max(maximumY - minimumY, Float.leastNormalMagnitude)
+        let lastJoint = Float(jointCount - 1)
+        
+        mesh.jointIndices = mesh.positions.map { position in
+            let joint = (position.y - minimumY) / height * lastJoint
+            let lower = min(UInt16(joint), UInt16(jointCount - 1))
+            return SIMD2<UInt16>(lower, min(lower + 1, UInt16(jointCount - 1)))
+        }
+        mesh.jointWeights = mesh.positions.map { position in
+            let joint = (position.y - minimumY) / height * lastJoint
+            let blend = joint - joint.rounded(.down)
+            return SIMD2<Float>(1 - blend, blend)
+        }
+        
+    }
+    
+    // A sphere around the center of the axis aligned bounds
+    fileprivate static func boundingSphere(of positions: [SIMD3<Float>]) -> SIMD4<Float> {
+        guard let first = positions.first else {
+            return SIMD4<Float>(repeating: 0)
+        }
+        let bounds = positions.reduce((first, first)) { (simd_min($0.0, $1), simd_max($0.1, $1)) }
+        let center = (bounds.0 + bounds.1) * 0.5
+        let radius = positions.reduce(Float(0)) { max($0, distance($1, center)) }
+        return SIMD4<Float>(center, radius)
+    }
+    
+    // A single chain of joints along +y that sways around z over the course of the animation
+    fileprivate static func makeSkeleton(jointCount: Int, keyframeCount: Int, generator: inout SplitMix64) -> SkeletonData {
+        
+        var skeleton = SkeletonData()
+        let boneLength: Float = 1 / Float(jointCount)
+        var modelTransform = matrix_identity_float4x4
+        for index in 0..<jointCount {
+            let name = "joint_\(index)"
+            skeleton.jointNames.append(name)
+            skeleton.jointPaths.append(index == 0 ? name : "\(skeleton.jointPaths[index - 1])/\(name)")
+            skeleton.parentIndices.append(index == 0 ? nil : index - 1)
+            if index > 0 {
+                modelTransform.columns.3.y += boneLength
+            }
+            skeleton.bindTransforms.append(modelTransform)
+            skeleton.inverseBindTransforms.append(modelTransform.inverse)
+            var restTransform = matrix_identity_float4x4
+            restTransform.columns.3.y = index == 0 ? 0 : boneLength
+            skeleton.restTransforms.append(restTransform)
+        }
+        
+        let phases = (0..<jointCount).map { _ in generator.nextFloat(in: 0...(2 * Float.pi)) }
+        for keyframe in 0..<keyframeCount {
+            let time = Float(keyframe) / Float(keyframeCount)
+            let rotations = (0..<jointCount).map { index in
+                return simd_quatf(angle: 0.3 * sin(2 * Float.pi * time + phases[index]), axis: SIMD3<Float>(0, 0, 1))
+            }
+            let translations = (0..<jointCount).map { index in
+                return SIMD3<Float>(0, index == 0 ? 0 : boneLength, 0)
+            }
+            skeleton.animations.append(SkeletonAnimation(keyTime: Double(time), translations: translations, rotations: rotations))
+        }
+        
+        return skeleton
+        
+    }
+    
+}
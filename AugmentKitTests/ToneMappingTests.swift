@@ -0,0 +1,72 @@
+//
+//  ToneMappingTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class ToneMappingTests: XCTestCase {
+    
+    // Reference values computed in double precision from the same curve fit
+    func testACESFittedGoldenValues() {
+        assertEqual(ToneMapping.acesFitted(SIMD3<Float>(0, 0, 0)), SIMD3<Float>(0, 0, 0))
+        assertEqual(ToneMapping.acesFitted(SIMD3<Float>(0.18, 0.18, 0.18)), SIMD3<Float>(0.105591, 0.105591, 0.105590))
+        assertEqual(ToneMapping.acesFitted(SIMD3<Float>(1, 1, 1)), SIMD3<Float>(0.619115, 0.619115, 0.619109))
+        assertEqual(ToneMapping.acesFitted(SIMD3<Float>(1, 0.5, 0.25)), SIMD3<Float>(0.634990, 0.384600, 0.203160))
+        assertEqual(ToneMapping.acesFitted(SIMD3<Float>(16, 16, 16)), SIMD3<Float>(0.989935, 0.989935, 0.989925))
+        assertEqual(ToneMapping.acesFitted(SIMD3<Float>(0.05, 0.1, 0.8)), SIMD3<Float>(0.011325, 0.044993, 0.521299))
+    }
+    
+    func testACESFittedIsMonotonicAndBounded() {
+        var previous: Float = -1
+        for step in 0...1000 {
+            let value = ToneMapping.acesFitted(SIMD3<Float>(repeating: Float(step) * 0.05)).y
+            XCTAssertGreaterThanOrEqual(value, previous)
+            XCTAssertLessThanOrEqual(value, 1)
+            previous = value
+        }
+    }
+    
+    func testCompositeGoldenValues() {
+        // Half coverage, exposed by 2
+        assertEqual(ToneMapping.composite(sceneColor: SIMD4<Float>(0.09, 0.09, 0.09, 0.5), over: SIMD3<Float>(0.2, 0.4, 0.6), exposure: 2), SIMD3<Float>(0.375973, 0.475973, 0.575971))
+        // Full coverage hides the camera
+        assertEqual(ToneMapping.composite(sceneColor: SIMD4<Float>(1, 0.5, 0.25, 1), over: SIMD3<Float>(0, 0, 0), exposure: 1), SIMD3<Float>(0.818146, 0.653490, 0.488035))
+    }
+    
+    func testCompositeWithoutCoverageShowsTheCamera() {
+        assertEqual(ToneMapping.composite(sceneColor: SIMD4<Float>(0, 0, 0, 0), over: SIMD3<Float>(0.2, 0.4, 1.5), exposure: 1), SIMD3<Float>(0.2, 0.4, 1))
+        assertEqual(ToneMapping.composite(sceneColor: SIMD4<Float>(5, 5, 5, 0), over: SIMD3<Float>(0.3, 0.3, 0.3), exposure: 4), SIMD3<Float>(0.3, 0.3, 0.3))
+    }
+    
+    // MARK: - Private
+    
+    fileprivate func assertEqual(_ value: SIMD3<Float>, _ expected: SIMD3<Float>, file: StaticString = #file, line: UInt = #line) {
+        XCTAssertLessThan(simd_reduce_max(abs(value - expected)), 1e-4, "\(value) is not \(expected)", file: file, line: line)
+    }
+    
+}
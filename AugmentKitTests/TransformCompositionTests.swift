@@ -0,0 +1,140 @@
+//
+//  TransformCompositionTests.swift
+//  AugmentKitTests
+//
+//  MIT License
+//
+//  Copyright (c) 2020 JamieScanlon
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+import XCTest
+import simd
+@testable import AugmentKit
+
+class TransformCompositionTests: XCTestCase {
+    
+    func testIsRigid() {
+        
+        var rigid = float4x4(simd_quatf(angle: 0.7, axis: normalize(SIMD3<Float>(1, 2, 3))))
+        rigid.columns.3 = SIMD4<Float>(4, 5, 6, 1)
+        XCTAssertTrue(TransformComposition.isRigid(rigid))
+        XCTAssertFalse(TransformComposition.isRigid(rigid * float4x4.makeScale(x: 2, y: 2, z: 2)))
+        XCTAssertFalse(TransformComposition.isRigid(rigid * float4x4.makeScale(x: 1, y: 1, z: -1)))
+        
+    }
+    
+    func testRigidAbsoluteHeadingReplacesTheRotation() {
+        
+        var location = float4x4(simd_quatf(angle: 1.2, axis: SIMD3<Float>(0, 1, 0)))
+        location.columns.3 = SIMD4<Float>(1, -2, 3, 1)
+        let heading = simd_quatf(angle: -0.4, axis: normalize(SIMD3<Float>(1, 0, 1)))
+        
+        let composed = TransformComposition.compose(location: location, heading: heading, headingType: .absolute, as: RigidTransformClass.self)
+        let expected = float3x3(heading)
+        for column in 0..<3 {
+            XCTAssertEqual(distance(composed[column].xyz, expected[column]), 0, accuracy: 1e-5)
+        }
+        XCTAssertEqual(composed.columns.3, location.columns.3)
+        
+    }
+    
+    func testRelativeHeadingRotatesTheLocation() {
+        
+        var location = float4x4(simd_quatf(angle: 0.3, axis: SIMD3<Float>(1, 0, 0))) * float4x4.makeScale(x: 2, y: 0.5, z: 1)
+        location.columns.3 = SIMD4<Float>(0, 1, 0, 1)
+        let heading = simd_quatf(angle: 0.9, axis: SIMD3<Float>(0, 1, 0))
+        
+        let composed = TransformComposition.compose(location: location, heading: heading, headingType: .relative)
+        let expected = location * float4x4(heading)
+        for column in 0..<4 {
+            XCTAssertEqual(distance(composed[column], expected[column]), 0, accuracy: 1e-5)
+        }
+        
+    }
+    
+    func testScaledAbsoluteHeadingKeepsTheScale() {
+        
+        var location = float4x4(simd_quatf(angle: 2.1, axis: normalize(SIMD3<Float>(0, 1, 1)))) * float4x4.makeScale(x: 3, y: 0.25, z: 1.5)
+        location.columns.3 = SIMD4<Float>(-7, 0, 2, 1)
+        let heading = simd_quatf(angle: 0.5, axis: SIMD3<Float>(0, 1, 0))
+        
+        XCTAssertFalse(TransformComposition.isRigid(location))
+        let composed = TransformComposition.compose(location: location, heading: heading, headingType: .absolute)
+        XCTAssertLessThan(TransformComposition.maximumError(of: composed, comparedTo: TransformComposition.composeReference(location: double4x4(location: location), heading: simd_quatd(vector: SIMD4<Double>(heading.vector)), headingType: .absolute)), 1e-4)
+        // The heading only rotates so the length of each axis is unchanged
+        for column in 0..<3 {
+            XCTAssertEqual(length(composed[column].xyz), length(location[column].xyz), accuracy: 1e-4)
+        }
+        XCTAssertEqual(composed.columns.3, location.columns.3)
+        
+    }
+    
+    func testMirroredAbsoluteHeadingMatchesReference() {
+        
+        var location = float4x4(simd_quatf(angle: -0.6, axis: SIMD3<Float>(0, 0, 1))) * float4x4.makeScale(x: -1, y: 2, z: 1)
+        location.columns.3 = SIMD4<Float>(0.5, 0.5, 0.5, 1)
+        let heading = simd_quatf(angle: 1.4, axis: normalize(SIMD3<Float>(1, 1, 0)))
+        
+        let composed = TransformComposition.compose(location: location, heading: heading, headingType: .absolute)
+        let reference = TransformComposition.composeReference(location: double4x4(location: location), heading: simd_quatd(vector: SIMD4<Double>(heading.vector)), headingType: .absolute)
+        XCTAssertLessThan(TransformComposition.maximumError(of: composed, comparedTo: reference), 1e-4)
+        XCTAssertLessThan(float3x3(composed[0].xyz, composed[1].xyz, composed[2].xyz).determinant, 0)
+        
+    }
+    
+    // Targets and trackers without a heading carry an identity heading with an absolute type, which must not replace their rotation
+    func testLocationWithoutHeadingKeepsItsRotation() {
+        
+        var location = float4x4(simd_quatf(angle: 0.9, axis: normalize(SIMD3<Float>(1, 1, 0))))
+        location.columns.3 = SIMD4<Float>(2, 0, -4, 1)
+        let identity = simd_quatf(vector: SIMD4<Float>(0, 0, 0, 1))
+        
+        let composed = TransformComposition.compose(location: location, hasHeading: false, heading: identity, headingType: .absolute)
+        for column in 0..<4 {
+            XCTAssertEqual(distance(composed[column], location[column]), 0, accuracy: 1e-6)
+        }
+        // With a heading the same values do replace the rotation
+        let withHeading = TransformComposition.compose(location: location, hasHeading: true, heading: identity, headingType: .absolute)
+        XCTAssertEqual(distance(withHeading[0].xyz, SIMD3<Float>(1, 0, 0)), 0, accuracy: 1e-5)
+        
+    }
+    
+    func testRigidClassMatchesScaledClassForRigidLocations() {
+        
+        var location = float4x4(simd_quatf(angle: 0.8, axis: normalize(SIMD3<Float>(-1, 1, 2))))
+        location.columns.3 = SIMD4<Float>(3, 3, -3, 1)
+        let heading = simd_quatf(angle: -1.1, axis: SIMD3<Float>(0, 1, 0))
+        
+        let rigid = TransformComposition.compose(location: location, heading: heading, headingType: .absolute, as: RigidTransformClass.self)
+        let scaled = TransformComposition.compose(location: location, heading: heading, headingType: .absolute, as: ScaledTransformClass.self)
+        for column in 0..<4 {
+            XCTAssertEqual(distance(rigid[column], scaled[column]), 0, accuracy: 1e-4)
+        }
+        
+    }
+    
+}
+
+extension double4x4 {
+    init(location: float4x4) {
+        self.init(SIMD4<Double>(location.columns.0), SIMD4<Double>(location.columns.1), SIMD4<Double>(location.columns.2), SIMD4<Double>(location.columns.3))
+    }
+}